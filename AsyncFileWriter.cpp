@@ -0,0 +1,531 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "AsyncFileWriter.h"
+
+#include "config.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef _WIN32
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#endif
+
+// =================================================================================================
+// DATA TYPES
+// =================================================================================================
+struct AsyncFileWriter::Compressor_s {
+#ifdef HAVE_ZLIB
+    z_stream zlib;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx* pZstd;
+#endif
+};
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+
+static uint32_t elapsed_us(std::chrono::steady_clock::time_point start) {
+    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    return (us > UINT32_MAX) ? UINT32_MAX : (uint32_t)us;
+}
+
+// =================================================================================================
+// PUBLIC FUNCTIONS
+// =================================================================================================
+
+AsyncFileWriter::Config_s AsyncFileWriter::defaultConfig(void) {
+    Config_s config;
+    config.bufferBytes = 1024 * 1024;
+    config.buffers = 4;
+    config.flush_ms = 1000;
+    config.sync_ms = 0;
+    config.syncBytes = 0;
+    config.text = true;
+    config.compression = COMPRESS_NONE;
+    config.level = 0;
+    return config;
+}
+
+bool AsyncFileWriter::canCompress(Compression_e compression) {
+    switch (compression) {
+        case COMPRESS_NONE:
+            return true;
+#ifdef HAVE_ZLIB
+        case COMPRESS_GZIP:
+            return true;
+#endif
+#ifdef HAVE_ZSTD
+        case COMPRESS_ZSTD:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+AsyncFileWriter::AsyncFileWriter()
+    : fd_(-1),
+      config_(defaultConfig()),
+      pCurrent_(nullptr),
+      busy_(0),
+      stopping_(false),
+      stats_(),
+      pCompressor_(nullptr) {
+}
+
+AsyncFileWriter::~AsyncFileWriter() {
+    close();
+}
+
+bool AsyncFileWriter::open(const char* path, const Config_s& config) {
+    if (isOpen() || (config.buffers < 2) || (config.bufferBytes == 0) ||
+        !canCompress(config.compression)) {
+        return false;
+    }
+    config_ = config;
+    if (!startCompressor()) {
+        return false;
+    }
+
+#ifdef _WIN32
+    // Text mode, as the log has always been written with an ofstream.
+    // Compressed data is binary, whatever it holds.
+    bool text = config.text && (config.compression == COMPRESS_NONE);
+    fd_ = _open(path,
+                _O_WRONLY | _O_CREAT | _O_TRUNC | (text ? _O_TEXT : _O_BINARY),
+                _S_IREAD | _S_IWRITE);
+#else
+    fd_ = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+#endif
+    if (fd_ < 0) {
+        stopCompressor();
+        return false;
+    }
+
+    // Allocate everything now, so nothing is allocated while logging.
+    buffers_.resize(config_.buffers);
+    free_.clear();
+    free_.reserve(config_.buffers);
+    full_.clear();
+    full_.reserve(config_.buffers);
+    for (uint32_t i = 0; i < config_.buffers; i++) {
+        buffers_[i].data.resize(config_.bufferBytes);
+        buffers_[i].used = 0;
+        free_.push_back(&buffers_[i]);
+    }
+    busy_ = 0;
+    stopping_ = false;
+
+    stats_.bytes = 0;
+    stats_.dataBytes = 0;
+    stats_.compress_us = 0;
+    stats_.writes = 0;
+    stats_.syncs = 0;
+    stats_.drops = 0;
+    stats_.droppedBytes = 0;
+    stats_.buffers = config_.buffers;
+    stats_.highWater = 0;
+    stats_.error = 0;
+    stats_.write_us.clear();
+    stats_.sync_us.clear();
+
+    pCurrent_ = takeFree();
+
+    writer_ = std::thread(&AsyncFileWriter::write, this);
+    return true;
+}
+
+void AsyncFileWriter::close(void) {
+    if (!isOpen()) {
+        return;
+    }
+
+    // The I/O thread writes everything handed to it, and syncs, before it stops.
+    handOff();
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stopping_ = true;
+        cv_.notify_one();
+    }
+    writer_.join();
+    stopCompressor();
+
+#ifdef _WIN32
+    _close(fd_);
+#else
+    ::close(fd_);
+#endif
+    fd_ = -1;
+}
+
+bool AsyncFileWriter::append(const char* pData, size_t len) {
+    if (pCurrent_ == nullptr) {
+        // Every buffer was busy last time, try again for one.
+        pCurrent_ = takeFree();
+    }
+
+    while (len > 0) {
+        if (pCurrent_ == nullptr) {
+            std::lock_guard<std::mutex> lock(mtx_);
+            stats_.drops++;
+            stats_.droppedBytes += len;
+            return false;
+        }
+
+        size_t room = pCurrent_->data.size() - pCurrent_->used;
+        if ((room < len) && (pCurrent_->used > 0)) {
+            // Doesn't fit after what's there already: start a new buffer,
+            // rather than split it.
+            handOff();
+            continue;
+        }
+
+        // Split only what's larger than a whole buffer.
+        size_t n = (len < room) ? len : room;
+        if (pCurrent_->used == 0) {
+            currentSince_ = std::chrono::steady_clock::now();
+        }
+        memcpy(&pCurrent_->data[pCurrent_->used], pData, n);
+        pCurrent_->used += n;
+        pData += n;
+        len -= n;
+
+        if (pCurrent_->used == pCurrent_->data.size()) {
+            handOff();
+        }
+    }
+
+    if ((config_.flush_ms != 0) && (pCurrent_ != nullptr) && (pCurrent_->used > 0) &&
+        (std::chrono::steady_clock::now() - currentSince_ >=
+         std::chrono::milliseconds(config_.flush_ms))) {
+        handOff();
+    }
+    return true;
+}
+
+void AsyncFileWriter::flush(void) {
+    if (isOpen()) {
+        handOff();
+    }
+}
+
+uint32_t AsyncFileWriter::flushIfDue(void) {
+    if ((config_.flush_ms == 0) || (pCurrent_ == nullptr) || (pCurrent_->used == 0)) {
+        return UINT32_MAX;
+    }
+
+    std::chrono::steady_clock::duration left = currentSince_ +
+                                               std::chrono::milliseconds(config_.flush_ms) -
+                                               std::chrono::steady_clock::now();
+    if (left <= std::chrono::steady_clock::duration::zero()) {
+        handOff();
+        return UINT32_MAX;
+    }
+    return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(left).count() + 1;
+}
+
+AsyncFileWriter::Stats_s AsyncFileWriter::getStats(void) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return stats_;
+}
+
+// =================================================================================================
+// PRIVATE FUNCTIONS
+// =================================================================================================
+
+// -------------------------------------------------------------------------------------------------
+// Appending side
+// -------------------------------------------------------------------------------------------------
+
+// A free buffer, or nullptr if all of them are waiting to be written.
+AsyncFileWriter::Buffer_s* AsyncFileWriter::takeFree(void) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (free_.empty()) {
+        return nullptr;
+    }
+    Buffer_s* pBuffer = free_.back();
+    free_.pop_back();
+    return pBuffer;
+}
+
+// Queue the current buffer, if it has anything in it, for writing and
+// carry on with a free one.
+void AsyncFileWriter::handOff(void) {
+    if ((pCurrent_ == nullptr) || (pCurrent_->used == 0)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    full_.push_back(pCurrent_);
+    busy_++;
+    if (busy_ > stats_.highWater) {
+        stats_.highWater = busy_;
+    }
+
+    pCurrent_ = nullptr;
+    if (!free_.empty()) {
+        pCurrent_ = free_.back();
+        free_.pop_back();
+    }
+    cv_.notify_one();
+}
+
+// -------------------------------------------------------------------------------------------------
+// I/O thread
+// -------------------------------------------------------------------------------------------------
+void AsyncFileWriter::write(void) {
+    uint64_t unsynced = 0;
+    std::chrono::steady_clock::time_point lastSync = std::chrono::steady_clock::now();
+
+    while (true) {
+        Buffer_s* pBuffer;
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            cv_.wait(lock, [this] { return stopping_ || !full_.empty(); });
+            if (full_.empty()) {
+                break;
+            }
+            pBuffer = full_.front();
+            full_.erase(full_.begin());
+        }
+
+        const char* pData = pBuffer->data.data();
+        size_t len = pBuffer->used;
+        int compressError = 0;
+        uint32_t compress_us = 0;
+        if (pCompressor_ != nullptr) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            compressError = compress(pBuffer, &len);
+            compress_us = elapsed_us(start);
+            pData = compressed_.data();
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        int writeError = (compressError != 0) ? compressError : writeAll(pData, len);
+        uint32_t write_us = elapsed_us(start);
+        unsynced += len;
+
+        bool synced = false;
+        int syncError = 0;
+        uint32_t sync_us = 0;
+        if (((config_.syncBytes != 0) && (unsynced >= config_.syncBytes)) ||
+            ((config_.sync_ms != 0) && (std::chrono::steady_clock::now() - lastSync >=
+                                        std::chrono::milliseconds(config_.sync_ms)))) {
+            start = std::chrono::steady_clock::now();
+            syncError = sync();
+            sync_us = elapsed_us(start);
+            synced = true;
+            unsynced = 0;
+            lastSync = std::chrono::steady_clock::now();
+        }
+
+        std::lock_guard<std::mutex> lock(mtx_);
+        stats_.compress_us += compress_us;
+        if (writeError == 0) {
+            stats_.bytes += len;
+            stats_.dataBytes += pBuffer->used;
+        } else if (stats_.error == 0) {
+            stats_.error = writeError;
+        }
+        stats_.writes++;
+        stats_.write_us.add(write_us);
+        if (synced) {
+            if (stats_.error == 0) {
+                stats_.error = syncError;
+            }
+            stats_.syncs++;
+            stats_.sync_us.add(sync_us);
+        }
+
+        pBuffer->used = 0;
+        free_.push_back(pBuffer);
+        busy_--;
+    }
+
+    // Always sync on close.
+    if (unsynced > 0) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        int syncError = sync();
+        uint32_t sync_us = elapsed_us(start);
+
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (stats_.error == 0) {
+            stats_.error = syncError;
+        }
+        stats_.syncs++;
+        stats_.sync_us.add(sync_us);
+    }
+}
+
+// Returns 0, or errno if the write failed.
+int AsyncFileWriter::writeAll(const char* pData, size_t len) {
+    const char* p = pData;
+    size_t left = len;
+    while (left > 0) {
+#ifdef _WIN32
+        int n = _write(fd_, p, (unsigned int)left);
+#else
+        ssize_t n = ::write(fd_, p, left);
+#endif
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        p += n;
+        left -= n;
+    }
+    return 0;
+}
+
+// Returns 0, or errno if the sync failed.
+int AsyncFileWriter::sync(void) {
+#ifdef _WIN32
+    int rc = _commit(fd_);
+#else
+    int rc = fsync(fd_);
+#endif
+    return (rc == 0) ? 0 : errno;
+}
+
+// -------------------------------------------------------------------------------------------------
+// Compression
+// -------------------------------------------------------------------------------------------------
+// Set up the configured compression, if any, with room to compress a
+// whole buffer.
+bool AsyncFileWriter::startCompressor(void) {
+    if (config_.compression == COMPRESS_NONE) {
+        return true;
+    }
+
+    pCompressor_ = new Compressor_s();
+    size_t bound = 0;
+    switch (config_.compression) {
+#ifdef HAVE_ZLIB
+        case COMPRESS_GZIP: {
+            // 15 + 16: largest window, with a gzip header and trailer
+            int level = (config_.level == 0) ? Z_DEFAULT_COMPRESSION : config_.level;
+            int rc = deflateInit2(
+                    &pCompressor_->zlib, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+            if (rc != Z_OK) {
+                delete pCompressor_;
+                pCompressor_ = nullptr;
+                return false;
+            }
+            bound = deflateBound(&pCompressor_->zlib, (uLong)config_.bufferBytes);
+            break;
+        }
+#endif
+#ifdef HAVE_ZSTD
+        case COMPRESS_ZSTD:
+            pCompressor_->pZstd = ZSTD_createCCtx();
+            if (pCompressor_->pZstd == nullptr) {
+                delete pCompressor_;
+                pCompressor_ = nullptr;
+                return false;
+            }
+            bound = ZSTD_compressBound(config_.bufferBytes);
+            break;
+#endif
+        default:
+            break;
+    }
+    compressed_.resize(bound);
+    return true;
+}
+
+void AsyncFileWriter::stopCompressor(void) {
+    if (pCompressor_ == nullptr) {
+        return;
+    }
+
+    switch (config_.compression) {
+#ifdef HAVE_ZLIB
+        case COMPRESS_GZIP:
+            deflateEnd(&pCompressor_->zlib);
+            break;
+#endif
+#ifdef HAVE_ZSTD
+        case COMPRESS_ZSTD:
+            ZSTD_freeCCtx(pCompressor_->pZstd);
+            break;
+#endif
+        default:
+            break;
+    }
+    delete pCompressor_;
+    pCompressor_ = nullptr;
+}
+
+// Compress a buffer, on its own, into compressed_, and set *pLen to the
+// compressed length.  Returns 0, or an errno value if it failed.
+int AsyncFileWriter::compress(Buffer_s* pBuffer, size_t* pLen) {
+    switch (config_.compression) {
+#ifdef HAVE_ZLIB
+        case COMPRESS_GZIP: {
+            z_stream* pZlib = &pCompressor_->zlib;
+            if (deflateReset(pZlib) != Z_OK) {
+                return EIO;
+            }
+            pZlib->next_in = (Bytef*)pBuffer->data.data();
+            pZlib->avail_in = (uInt)pBuffer->used;
+            pZlib->next_out = (Bytef*)compressed_.data();
+            pZlib->avail_out = (uInt)compressed_.size();
+            if (deflate(pZlib, Z_FINISH) != Z_STREAM_END) {
+                return EIO;
+            }
+            *pLen = pZlib->total_out;
+            return 0;
+        }
+#endif
+#ifdef HAVE_ZSTD
+        case COMPRESS_ZSTD: {
+            size_t len = ZSTD_compressCCtx(pCompressor_->pZstd,
+                                           compressed_.data(),
+                                           compressed_.size(),
+                                           pBuffer->data.data(),
+                                           pBuffer->used,
+                                           config_.level);
+            if (ZSTD_isError(len)) {
+                return EIO;
+            }
+            *pLen = len;
+            return 0;
+        }
+#endif
+        default:
+            return EINVAL;
+    }
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "LatencyHistogram.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * File writer that does its I/O on a dedicated thread.
+ *
+ * Data is appended to one of a set of preallocated buffers.  When that
+ * buffer fills (or has held data for flush_ms) it is handed to the I/O
+ * thread and appending carries on in a free one.  Handing a buffer over
+ * takes a lock for a few instructions; the lock is never held during
+ * file I/O, so append() never waits on the disk.
+ *
+ * If the disk stalls long enough for every buffer to be full, appended
+ * data is dropped, a whole append() at a time, and counted.
+ *
+ * The file is fsync'ed every sync_ms or syncBytes, if set, and always on
+ * close.  The time taken by each write and sync is recorded.
+ *
+ * Optionally, the I/O thread compresses each buffer before writing it, as
+ * a gzip member or zstd frame of its own.  The file is then a valid .gz or
+ * .zst file, and if it's cut short everything up to the last whole buffer
+ * can still be decompressed.
+ *
+ * append(), flush(), open() and close() must be called from one thread.
+ */
+class AsyncFileWriter {
+public:
+    enum Compression_e {
+        COMPRESS_NONE,
+        COMPRESS_GZIP, // Needs zlib
+        COMPRESS_ZSTD, // Needs libzstd
+    };
+
+    struct Config_s {
+        size_t bufferBytes; // Size of each buffer
+        uint32_t buffers;   // Number of buffers, at least 2
+        uint32_t flush_ms;  // Hand over a partly filled buffer after this long, 0 to wait until
+                            // it's full
+        uint32_t sync_ms;   // fsync at least this often while writing, 0 for no time limit
+        uint64_t syncBytes; // fsync after this many bytes written, 0 for no size limit
+        bool text;          // On Windows, write line ends as CR LF (text mode), if not compressed
+        Compression_e compression;
+        int level; // Compression level, 0 for the library's default
+    };
+
+    struct Stats_s {
+        uint64_t bytes;        // Bytes written to the file
+        uint64_t dataBytes;    // Bytes of data in them, before compression
+        uint64_t compress_us;  // Time spent compressing
+        uint64_t writes;       // Buffers written
+        uint64_t syncs;        // fsync calls
+        uint64_t drops;        // append() calls dropped because no buffer was free
+        uint64_t droppedBytes; // Bytes in them
+        uint32_t buffers;      // Number of buffers
+        uint32_t highWater;    // Most buffers waiting to be written, or being written, at once
+        int error;             // errno of the first failed write or sync, 0 if none
+        LatencyHistogram write_us;
+        LatencyHistogram sync_us;
+    };
+
+    /**
+     * 4 buffers of 1 MiB, handed over at least every second, fsync only on
+     * close, text mode.
+     */
+    static Config_s defaultConfig(void);
+
+    /**
+     * Whether this build supports a compression method.
+     */
+    static bool canCompress(Compression_e compression);
+
+    AsyncFileWriter();
+    ~AsyncFileWriter();
+
+    /**
+     * Create (or truncate) the file at path and start the I/O thread.
+     */
+    bool open(const char* path, const Config_s& config);
+
+    /**
+     * Write everything appended, fsync and close the file.
+     */
+    void close(void);
+
+    bool isOpen(void) const {
+        return fd_ >= 0;
+    }
+
+    /**
+     * Queue len bytes to be written.  Returns false if they were dropped.
+     */
+    bool append(const char* pData, size_t len);
+
+    /**
+     * Hand the data appended so far to the I/O thread now.
+     */
+    void flush(void);
+
+    /**
+     * Hand the data appended so far to the I/O thread if it has waited
+     * flush_ms, as append() would.  Returns the time until it will have,
+     * in microseconds, or UINT32_MAX if no data is waiting.
+     */
+    uint32_t flushIfDue(void);
+
+    /**
+     * May be called from any thread.
+     */
+    Stats_s getStats(void);
+
+private:
+    struct Buffer_s {
+        std::vector<char> data;
+        size_t used;
+    };
+
+    // Compression library state
+    struct Compressor_s;
+
+    Buffer_s* takeFree(void);
+    void handOff(void);
+
+    bool startCompressor(void);
+    void stopCompressor(void);
+    int compress(Buffer_s* pBuffer, size_t* pLen);
+
+    void write(void);
+    int writeAll(const char* pData, size_t len);
+    int sync(void);
+
+    int fd_;
+    Config_s config_;
+
+    std::vector<Buffer_s> buffers_;
+
+    // Buffer being appended to, owned by the appending thread
+    Buffer_s* pCurrent_;
+    std::chrono::steady_clock::time_point currentSince_;
+
+    // Buffers free and waiting to be written, oldest first
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::vector<Buffer_s*> free_;
+    std::vector<Buffer_s*> full_;
+    uint32_t busy_; // Buffers full or being written
+    bool stopping_;
+    Stats_s stats_;
+
+    // Owned by the I/O thread while it runs
+    Compressor_s* pCompressor_;
+    std::vector<char> compressed_;
+
+    std::thread writer_;
+};
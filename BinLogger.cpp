@@ -0,0 +1,919 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "BinLogger.h"
+
+#include <chrono>
+#include <string.h>
+#include <type_traits>
+
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define BIN_VERSION (1)
+#define BIN_FLAG_NED (0x01)
+
+// Record types, after the sensor ids
+#define BIN_CHANNEL (0x80)
+#define BIN_MESSAGE (0x81)
+#define BIN_RESET (0x82)
+#define BIN_PERIOD (0x83)
+#define BIN_PRODUCT_IDS (0x84)
+#define BIN_FRS_RECORD (0x85)
+#define BIN_POSIX_OFFSET (0x86)
+#define BIN_HAL_STATS (0x87)
+
+// Sequence, status, timestamp and delay
+#define SENSOR_HEADER_BYTES (1 + 1 + 8 + 8)
+
+// Sensor value member un.path, for sizeof and decltype
+#define SV_MEMBER(path) ((sh2_SensorValue_t*)0)->un.path
+
+// A field of a sensor's reports, as a binField_s
+#define BIN_FIELD(sensor, field)                                                                   \
+    {#field,                                                                                       \
+     offsetof(sh2_SensorValue_t, un.sensor.field),                                                 \
+     sizeof(SV_MEMBER(sensor.field)),                                                              \
+     binFieldKind<std::remove_reference<decltype(SV_MEMBER(sensor.field))>::type>::value}
+
+// Sensor's layout, from an array of its fields
+#define BIN_LAYOUT(fields) {fields, sizeof(fields) / sizeof(binField_s)}
+
+// Longest record other than a sensor report that will be read
+#define MAX_RECORD_BYTES (1024 * 1024)
+
+
+// =================================================================================================
+// DATA TYPES
+// =================================================================================================
+// A field of a sensor report, stored as a member of sh2_SensorValue_t
+struct binField_s {
+    char const* name;
+    size_t offset;
+    size_t size;
+    char kind; // 'f' floating point, 'i' signed or 'u' unsigned integer
+};
+
+// The fields of a sensor's report, in the order they're stored
+struct binLayout_s {
+    const binField_s* fields;
+    uint32_t count;
+};
+
+// Type letter of a field of type T
+template <typename T>
+struct binFieldKind {
+    static const char value =
+            std::is_floating_point<T>::value ? 'f' : (std::is_signed<T>::value ? 'i' : 'u');
+};
+
+
+// =================================================================================================
+// LOCAL VARIABLES
+// =================================================================================================
+// Sensor values are stored in ENU, in the order DsfLogger writes them.
+static const binField_s AccelerometerFields[] = {
+        BIN_FIELD(accelerometer, x),
+        BIN_FIELD(accelerometer, y),
+        BIN_FIELD(accelerometer, z),
+};
+static const binField_s GyroscopeFields[] = {
+        BIN_FIELD(gyroscope, x),
+        BIN_FIELD(gyroscope, y),
+        BIN_FIELD(gyroscope, z),
+};
+static const binField_s MagneticFieldFields[] = {
+        BIN_FIELD(magneticField, x),
+        BIN_FIELD(magneticField, y),
+        BIN_FIELD(magneticField, z),
+};
+static const binField_s LinearAccelerationFields[] = {
+        BIN_FIELD(linearAcceleration, x),
+        BIN_FIELD(linearAcceleration, y),
+        BIN_FIELD(linearAcceleration, z),
+};
+static const binField_s RotationVectorFields[] = {
+        BIN_FIELD(rotationVector, real),
+        BIN_FIELD(rotationVector, i),
+        BIN_FIELD(rotationVector, j),
+        BIN_FIELD(rotationVector, k),
+        BIN_FIELD(rotationVector, accuracy),
+};
+static const binField_s GravityFields[] = {
+        BIN_FIELD(gravity, x),
+        BIN_FIELD(gravity, y),
+        BIN_FIELD(gravity, z),
+};
+static const binField_s GyroscopeUncalFields[] = {
+        BIN_FIELD(gyroscopeUncal, x),
+        BIN_FIELD(gyroscopeUncal, y),
+        BIN_FIELD(gyroscopeUncal, z),
+        BIN_FIELD(gyroscopeUncal, biasX),
+        BIN_FIELD(gyroscopeUncal, biasY),
+        BIN_FIELD(gyroscopeUncal, biasZ),
+};
+static const binField_s GameRotationVectorFields[] = {
+        BIN_FIELD(gameRotationVector, real),
+        BIN_FIELD(gameRotationVector, i),
+        BIN_FIELD(gameRotationVector, j),
+        BIN_FIELD(gameRotationVector, k),
+};
+static const binField_s GeoMagRotationVectorFields[] = {
+        BIN_FIELD(geoMagRotationVector, real),
+        BIN_FIELD(geoMagRotationVector, i),
+        BIN_FIELD(geoMagRotationVector, j),
+        BIN_FIELD(geoMagRotationVector, k),
+        BIN_FIELD(geoMagRotationVector, accuracy),
+};
+static const binField_s PressureFields[] = {
+        BIN_FIELD(pressure, value),
+};
+static const binField_s AmbientLightFields[] = {
+        BIN_FIELD(ambientLight, value),
+};
+static const binField_s HumidityFields[] = {
+        BIN_FIELD(humidity, value),
+};
+static const binField_s ProximityFields[] = {
+        BIN_FIELD(proximity, value),
+};
+static const binField_s TemperatureFields[] = {
+        BIN_FIELD(temperature, value),
+};
+static const binField_s MagneticFieldUncalFields[] = {
+        BIN_FIELD(magneticFieldUncal, x),
+        BIN_FIELD(magneticFieldUncal, y),
+        BIN_FIELD(magneticFieldUncal, z),
+        BIN_FIELD(magneticFieldUncal, biasX),
+        BIN_FIELD(magneticFieldUncal, biasY),
+        BIN_FIELD(magneticFieldUncal, biasZ),
+};
+static const binField_s TapDetectorFields[] = {
+        BIN_FIELD(tapDetector, flags),
+};
+static const binField_s StepCounterFields[] = {
+        BIN_FIELD(stepCounter, steps),
+        BIN_FIELD(stepCounter, latency),
+};
+static const binField_s SigMotionFields[] = {
+        BIN_FIELD(sigMotion, motion),
+};
+static const binField_s StabilityClassifierFields[] = {
+        BIN_FIELD(stabilityClassifier, classification),
+};
+static const binField_s RawAccelerometerFields[] = {
+        BIN_FIELD(rawAccelerometer, x),
+        BIN_FIELD(rawAccelerometer, y),
+        BIN_FIELD(rawAccelerometer, z),
+        BIN_FIELD(rawAccelerometer, timestamp),
+};
+static const binField_s RawGyroscopeFields[] = {
+        BIN_FIELD(rawGyroscope, x),
+        BIN_FIELD(rawGyroscope, y),
+        BIN_FIELD(rawGyroscope, z),
+        BIN_FIELD(rawGyroscope, temperature),
+        BIN_FIELD(rawGyroscope, timestamp),
+};
+static const binField_s RawMagnetometerFields[] = {
+        BIN_FIELD(rawMagnetometer, x),
+        BIN_FIELD(rawMagnetometer, y),
+        BIN_FIELD(rawMagnetometer, z),
+        BIN_FIELD(rawMagnetometer, timestamp),
+};
+static const binField_s StepDetectorFields[] = {
+        BIN_FIELD(stepDetector, latency),
+};
+static const binField_s ShakeDetectorFields[] = {
+        BIN_FIELD(shakeDetector, shake),
+};
+static const binField_s FlipDetectorFields[] = {
+        BIN_FIELD(flipDetector, flip),
+};
+static const binField_s PickupDetectorFields[] = {
+        BIN_FIELD(pickupDetector, pickup),
+};
+static const binField_s StabilityDetectorFields[] = {
+        BIN_FIELD(stabilityDetector, stability),
+};
+static const binField_s PersonalActivityClassifierFields[] = {
+        BIN_FIELD(personalActivityClassifier, mostLikelyState),
+        BIN_FIELD(personalActivityClassifier, confidence[0]),
+        BIN_FIELD(personalActivityClassifier, confidence[1]),
+        BIN_FIELD(personalActivityClassifier, confidence[2]),
+        BIN_FIELD(personalActivityClassifier, confidence[3]),
+        BIN_FIELD(personalActivityClassifier, confidence[4]),
+        BIN_FIELD(personalActivityClassifier, confidence[5]),
+        BIN_FIELD(personalActivityClassifier, confidence[6]),
+        BIN_FIELD(personalActivityClassifier, confidence[7]),
+        BIN_FIELD(personalActivityClassifier, confidence[8]),
+        BIN_FIELD(personalActivityClassifier, confidence[9]),
+};
+static const binField_s SleepDetectorFields[] = {
+        BIN_FIELD(sleepDetector, sleepState),
+};
+static const binField_s TiltDetectorFields[] = {
+        BIN_FIELD(tiltDetector, tilt),
+};
+static const binField_s PocketDetectorFields[] = {
+        BIN_FIELD(pocketDetector, pocket),
+};
+static const binField_s CircleDetectorFields[] = {
+        BIN_FIELD(circleDetector, circle),
+};
+static const binField_s HeartRateMonitorFields[] = {
+        BIN_FIELD(heartRateMonitor, heartRate),
+};
+static const binField_s ArvrStabilizedRVFields[] = {
+        BIN_FIELD(arvrStabilizedRV, real),
+        BIN_FIELD(arvrStabilizedRV, i),
+        BIN_FIELD(arvrStabilizedRV, j),
+        BIN_FIELD(arvrStabilizedRV, k),
+        BIN_FIELD(arvrStabilizedRV, accuracy),
+};
+static const binField_s ArvrStabilizedGRVFields[] = {
+        BIN_FIELD(arvrStabilizedGRV, real),
+        BIN_FIELD(arvrStabilizedGRV, i),
+        BIN_FIELD(arvrStabilizedGRV, j),
+        BIN_FIELD(arvrStabilizedGRV, k),
+};
+static const binField_s GyroIntegratedRVFields[] = {
+        BIN_FIELD(gyroIntegratedRV, real),
+        BIN_FIELD(gyroIntegratedRV, i),
+        BIN_FIELD(gyroIntegratedRV, j),
+        BIN_FIELD(gyroIntegratedRV, k),
+        BIN_FIELD(gyroIntegratedRV, angVelX),
+        BIN_FIELD(gyroIntegratedRV, angVelY),
+        BIN_FIELD(gyroIntegratedRV, angVelZ),
+};
+static const binField_s IzroRequestFields[] = {
+        BIN_FIELD(izroRequest, intent),
+        BIN_FIELD(izroRequest, request),
+};
+static const binField_s RawOptFlowFields[] = {
+        BIN_FIELD(rawOptFlow, laserOn),
+        BIN_FIELD(rawOptFlow, dx),
+        BIN_FIELD(rawOptFlow, dy),
+        BIN_FIELD(rawOptFlow, iq),
+        BIN_FIELD(rawOptFlow, resX),
+        BIN_FIELD(rawOptFlow, resY),
+        BIN_FIELD(rawOptFlow, shutter),
+        BIN_FIELD(rawOptFlow, frameMax),
+        BIN_FIELD(rawOptFlow, frameAvg),
+        BIN_FIELD(rawOptFlow, frameMin),
+        BIN_FIELD(rawOptFlow, dt),
+        BIN_FIELD(rawOptFlow, timestamp),
+};
+static const binField_s DeadReckoningPoseFields[] = {
+        BIN_FIELD(deadReckoningPose, linPosX),
+        BIN_FIELD(deadReckoningPose, linPosY),
+        BIN_FIELD(deadReckoningPose, linPosZ),
+        BIN_FIELD(deadReckoningPose, real),
+        BIN_FIELD(deadReckoningPose, i),
+        BIN_FIELD(deadReckoningPose, j),
+        BIN_FIELD(deadReckoningPose, k),
+        BIN_FIELD(deadReckoningPose, linVelX),
+        BIN_FIELD(deadReckoningPose, linVelY),
+        BIN_FIELD(deadReckoningPose, linVelZ),
+        BIN_FIELD(deadReckoningPose, angVelX),
+        BIN_FIELD(deadReckoningPose, angVelY),
+        BIN_FIELD(deadReckoningPose, angVelZ),
+        BIN_FIELD(deadReckoningPose, timestamp),
+};
+static const binField_s WheelEncoderFields[] = {
+        BIN_FIELD(wheelEncoder, dataType),
+        BIN_FIELD(wheelEncoder, wheelIndex),
+        BIN_FIELD(wheelEncoder, data),
+        BIN_FIELD(wheelEncoder, timestamp),
+};
+
+// Sensors DsfLogger doesn't log have no fields.
+static const binLayout_s SensorBinLayout[] = {
+        {nullptr, 0},                                 // 0x00
+        BIN_LAYOUT(AccelerometerFields),              // 0x01
+        BIN_LAYOUT(GyroscopeFields),                  // 0x02
+        BIN_LAYOUT(MagneticFieldFields),              // 0x03
+        BIN_LAYOUT(LinearAccelerationFields),         // 0x04
+        BIN_LAYOUT(RotationVectorFields),             // 0x05
+        BIN_LAYOUT(GravityFields),                    // 0x06
+        BIN_LAYOUT(GyroscopeUncalFields),             // 0x07
+        BIN_LAYOUT(GameRotationVectorFields),         // 0x08
+        BIN_LAYOUT(GeoMagRotationVectorFields),       // 0x09
+        BIN_LAYOUT(PressureFields),                   // 0x0A
+        BIN_LAYOUT(AmbientLightFields),               // 0x0B
+        BIN_LAYOUT(HumidityFields),                   // 0x0C
+        BIN_LAYOUT(ProximityFields),                  // 0x0D
+        BIN_LAYOUT(TemperatureFields),                // 0x0E
+        BIN_LAYOUT(MagneticFieldUncalFields),         // 0x0F
+        BIN_LAYOUT(TapDetectorFields),                // 0x10
+        BIN_LAYOUT(StepCounterFields),                // 0x11
+        BIN_LAYOUT(SigMotionFields),                  // 0x12
+        BIN_LAYOUT(StabilityClassifierFields),        // 0x13
+        BIN_LAYOUT(RawAccelerometerFields),           // 0x14
+        BIN_LAYOUT(RawGyroscopeFields),               // 0x15
+        BIN_LAYOUT(RawMagnetometerFields),            // 0x16
+        {nullptr, 0},                                 // 0x17
+        BIN_LAYOUT(StepDetectorFields),               // 0x18
+        BIN_LAYOUT(ShakeDetectorFields),              // 0x19
+        BIN_LAYOUT(FlipDetectorFields),               // 0x1A
+        BIN_LAYOUT(PickupDetectorFields),             // 0x1B
+        BIN_LAYOUT(StabilityDetectorFields),          // 0x1C
+        {nullptr, 0},                                 // 0x1D
+        BIN_LAYOUT(PersonalActivityClassifierFields), // 0x1E
+        BIN_LAYOUT(SleepDetectorFields),              // 0x1F
+        BIN_LAYOUT(TiltDetectorFields),               // 0x20
+        BIN_LAYOUT(PocketDetectorFields),             // 0x21
+        BIN_LAYOUT(CircleDetectorFields),             // 0x22
+        BIN_LAYOUT(HeartRateMonitorFields),           // 0x23
+        {nullptr, 0},                                 // 0x24
+        {nullptr, 0},                                 // 0x25
+        {nullptr, 0},                                 // 0x26
+        {nullptr, 0},                                 // 0x27
+        BIN_LAYOUT(ArvrStabilizedRVFields),           // 0x28
+        BIN_LAYOUT(ArvrStabilizedGRVFields),          // 0x29
+        BIN_LAYOUT(GyroIntegratedRVFields),           // 0x2A
+        BIN_LAYOUT(IzroRequestFields),                // 0x2B
+        BIN_LAYOUT(RawOptFlowFields),                 // 0x2C
+        BIN_LAYOUT(DeadReckoningPoseFields),          // 0x2D
+        BIN_LAYOUT(WheelEncoderFields),               // 0x2E
+};
+
+static_assert((sizeof(SensorBinLayout) / sizeof(binLayout_s)) == (SH2_MAX_SENSOR_ID + 1),
+              "Const variable size match failed");
+
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+static bool HostIsLittleEndian() {
+    const uint16_t one = 1;
+    uint8_t first;
+    memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+// Copy a size byte value between host and little-endian byte order.
+static void SwapToLittleEndian(void* pDst, const void* pSrc, size_t size) {
+    if (HostIsLittleEndian()) {
+        memcpy(pDst, pSrc, size);
+    } else {
+        const uint8_t* pFrom = (const uint8_t*)pSrc;
+        uint8_t* pTo = (uint8_t*)pDst;
+        for (size_t i = 0; i < size; i++) {
+            pTo[i] = pFrom[size - 1 - i];
+        }
+    }
+}
+
+static void PutBytes(std::vector<uint8_t>& out, const void* pData, size_t len) {
+    size_t at = out.size();
+    out.resize(at + len);
+    memcpy(&out[at], pData, len);
+}
+
+template <typename T>
+static void Put(std::vector<uint8_t>& out, T value) {
+    size_t at = out.size();
+    out.resize(at + sizeof(T));
+    SwapToLittleEndian(&out[at], &value, sizeof(T));
+}
+
+static void PutString(std::vector<uint8_t>& out, char const* s) {
+    PutBytes(out, s, strlen(s) + 1);
+}
+
+// Start a record of type 0x80 or above.  Returns where its length goes.
+static size_t BeginRecord(std::vector<uint8_t>& out, uint8_t type) {
+    Put<uint8_t>(out, type);
+    size_t at = out.size();
+    Put<uint32_t>(out, 0);
+    return at;
+}
+
+static void EndRecord(std::vector<uint8_t>& out, size_t lengthAt) {
+    uint32_t length = (uint32_t)(out.size() - lengthAt - sizeof(uint32_t));
+    SwapToLittleEndian(&out[lengthAt], &length, sizeof(length));
+}
+
+// Read values from a record body
+template <typename T>
+static bool Get(const uint8_t*& p, const uint8_t* end, T* pValue) {
+    if ((size_t)(end - p) < sizeof(T)) {
+        return false;
+    }
+    SwapToLittleEndian(pValue, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+static bool GetString(const uint8_t*& p, const uint8_t* end, char const** pString) {
+    const uint8_t* nul = (const uint8_t*)memchr(p, 0, end - p);
+    if (nul == nullptr) {
+        return false;
+    }
+    *pString = (char const*)p;
+    p = nul + 1;
+    return true;
+}
+
+// Layout of a sensor's reports, null if it isn't logged
+static const binLayout_s* GetLayout(uint8_t sensorId) {
+    if ((sensorId > SH2_MAX_SENSOR_ID) || (SensorBinLayout[sensorId].count == 0)) {
+        return nullptr;
+    }
+    return &SensorBinLayout[sensorId];
+}
+
+static size_t FieldBytes(const binLayout_s* pLayout) {
+    size_t bytes = 0;
+    for (uint32_t f = 0; f < pLayout->count; f++) {
+        bytes += pLayout->fields[f].size;
+    }
+    return bytes;
+}
+
+// The fields as written in a channel definition, "name:type,..."
+static std::string FieldList(const binLayout_s* pLayout) {
+    std::string list;
+    for (uint32_t f = 0; f < pLayout->count; f++) {
+        const binField_s& field = pLayout->fields[f];
+        if (f > 0) {
+            list += ",";
+        }
+        list += field.name;
+        list += ":";
+        list += field.kind;
+        list += (char)('0' + field.size);
+    }
+    return list;
+}
+
+
+// =================================================================================================
+// PUBLIC FUNCTIONS
+// =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// BinLogger::init
+// -------------------------------------------------------------------------------------------------
+bool BinLogger::init(char const* filePath, bool ned) {
+    AsyncFileWriter::Config_s config = writeConfig_;
+    config.text = false;
+    if (!file_.open(filePath, config)) {
+        return false;
+    }
+    orientationNed_ = ned;
+
+    for (int i = 0; i <= SH2_MAX_SENSOR_ID; i++) {
+        defined_[i] = false;
+    }
+    posixOffsetWritten_ = false;
+
+    out_.clear();
+    PutBytes(out_, "SH2BIN", 6);
+    Put<uint8_t>(out_, BIN_VERSION);
+    Put<uint8_t>(out_, ned ? BIN_FLAG_NED : 0);
+    Write();
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+// BinLogger::finish
+// -------------------------------------------------------------------------------------------------
+void BinLogger::finish() {
+    file_.close();
+}
+
+// -------------------------------------------------------------------------------------------------
+// BinLogger::logMessage
+// -------------------------------------------------------------------------------------------------
+void BinLogger::logMessage(char const* msg) {
+    out_.clear();
+    size_t lengthAt = BeginRecord(out_, BIN_MESSAGE);
+    PutBytes(out_, msg, strlen(msg));
+    EndRecord(out_, lengthAt);
+    Write();
+}
+
+// -------------------------------------------------------------------------------------------------
+// BinLogger::logAsyncEvent
+// -------------------------------------------------------------------------------------------------
+void BinLogger::logAsyncEvent(sh2_AsyncEvent_t* pEvent, double timestamp) {
+    out_.clear();
+    switch (pEvent->eventId) {
+        case SH2_RESET: {
+            size_t lengthAt = BeginRecord(out_, BIN_RESET);
+            Put<double>(out_, timestamp);
+            EndRecord(out_, lengthAt);
+            break;
+        }
+        case SH2_GET_FEATURE_RESP: {
+            if (GetLayout(pEvent->sh2SensorConfigResp.sensorId) == nullptr) {
+                // Not a sensor that's logged, so not in the .dsf either.
+                return;
+            }
+            size_t lengthAt = BeginRecord(out_, BIN_PERIOD);
+            Put<double>(out_, timestamp);
+            Put<uint8_t>(out_, pEvent->sh2SensorConfigResp.sensorId);
+            Put<uint32_t>(out_, pEvent->sh2SensorConfigResp.sensorConfig.reportInterval_us);
+            EndRecord(out_, lengthAt);
+            break;
+        }
+        default:
+            // Nothing else appears in the .dsf.
+            return;
+    }
+    Write();
+}
+
+// -------------------------------------------------------------------------------------------------
+// BinLogger::logProductIds
+// -------------------------------------------------------------------------------------------------
+void BinLogger::logProductIds(sh2_ProductIds_t ids) {
+    uint8_t count = ids.numEntries;
+    if (count > sizeof(ids.entry) / sizeof(ids.entry[0])) {
+        count = sizeof(ids.entry) / sizeof(ids.entry[0]);
+    }
+
+    out_.clear();
+    size_t lengthAt = BeginRecord(out_, BIN_PRODUCT_IDS);
+    Put<uint8_t>(out_, count);
+    for (uint8_t i = 0; i < count; i++) {
+        Put(out_, ids.entry[i].resetCause);
+        Put(out_, ids.entry[i].swPartNumber);
+        Put(out_, ids.entry[i].swVersionMajor);
+        Put(out_, ids.entry[i].swVersionMinor);
+        Put(out_, ids.entry[i].swVersionPatch);
+        Put(out_, ids.entry[i].swBuildNumber);
+    }
+    EndRecord(out_, lengthAt);
+    Write();
+}
+
+// -------------------------------------------------------------------------------------------------
+// BinLogger::logFrsRecord
+// -------------------------------------------------------------------------------------------------
+void BinLogger::logFrsRecord(uint16_t recordId,
+                             char const* name,
+                             uint32_t* buffer,
+                             uint16_t words) {
+    out_.clear();
+    size_t lengthAt = BeginRecord(out_, BIN_FRS_RECORD);
+    Put<uint16_t>(out_, recordId);
+    Put<uint16_t>(out_, words);
+    PutString(out_, name);
+    for (uint16_t w = 0; w < words; ++w) {
+        Put<uint32_t>(out_, buffer[w]);
+    }
+    EndRecord(out_, lengthAt);
+    Write();
+}
+
+// -------------------------------------------------------------------------------------------------
+// BinLogger::logSensorValue
+// -------------------------------------------------------------------------------------------------
+void BinLogger::logSensorValue(sh2_SensorValue_t* pValue, double timestamp, int64_t delay_uS) {
+    out_.clear();
+    WriteSensorValue(pValue, timestamp, delay_uS);
+    Write();
+}
+
+// -------------------------------------------------------------------------------------------------
+// BinLogger::logSensorValues
+// -------------------------------------------------------------------------------------------------
+void BinLogger::logSensorValues(SensorSample_s* pSamples, size_t count) {
+    // Records are small enough to keep in arrival order, no need to group
+    // them by sensor.
+    out_.clear();
+    for (size_t i = 0; i < count; i++) {
+        WriteSensorValue(&pSamples[i].value, pSamples[i].timestamp, pSamples[i].delay_uS);
+    }
+    Write();
+}
+
+// -------------------------------------------------------------------------------------------------
+// BinLogger::logHalStats
+// -------------------------------------------------------------------------------------------------
+void BinLogger::logHalStats(const ftdi_hal_Stats_t* pStats, double timestamp) {
+    out_.clear();
+    size_t lengthAt = BeginRecord(out_, BIN_HAL_STATS);
+    Put<double>(out_, timestamp);
+    Put(out_, pStats->rxBytes);
+    Put(out_, pStats->rxEscapes);
+    Put(out_, pStats->rxFrames);
+    Put(out_, pStats->rxBsns);
+    Put(out_, pStats->rxTooLong);
+    Put(out_, pStats->rxTooBig);
+    Put(out_, pStats->rxClientTooSmall);
+    Put(out_, pStats->txBytes);
+    Put(out_, pStats->txWrites);
+    Put(out_, pStats->txFrames);
+    Put(out_, pStats->txBsqs);
+    Put(out_, pStats->txStalls);
+    Put(out_, pStats->txStall_us);
+    Put(out_, pStats->ttyOverruns);
+    Put(out_, pStats->ttyBufOverruns);
+    Put(out_, pStats->ttyFramingErrors);
+    Put(out_, pStats->ttyParityErrors);
+    Put(out_, pStats->ttyBreaks);
+    EndRecord(out_, lengthAt);
+    Write();
+}
+
+
+// =================================================================================================
+// PRIVATE FUNCTIONS
+// =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// BinLogger::Write
+// -------------------------------------------------------------------------------------------------
+void BinLogger::Write() {
+    file_.append((const char*)out_.data(), out_.size());
+}
+
+// -------------------------------------------------------------------------------------------------
+// BinLogger::WriteSensorValue
+// -------------------------------------------------------------------------------------------------
+void BinLogger::WriteSensorValue(sh2_SensorValue_t* pValue, double timestamp, int64_t delay_uS) {
+    uint8_t sensorId = pValue->sensorId;
+    const binLayout_s* pLayout = GetLayout(sensorId);
+    if (pLayout == nullptr) {
+        // Not a sensor that's logged.
+        return;
+    }
+
+    if (!defined_[sensorId]) {
+        defined_[sensorId] = true;
+        size_t lengthAt = BeginRecord(out_, BIN_CHANNEL);
+        Put<uint8_t>(out_, sensorId);
+        Put<uint16_t>(out_, (uint16_t)FieldBytes(pLayout));
+        PutString(out_, DsfLogger::getSensorName(sensorId));
+        PutString(out_, DsfLogger::getSensorColumns(sensorId));
+        PutString(out_, FieldList(pLayout).c_str());
+        EndRecord(out_, lengthAt);
+    }
+
+    if (!posixOffsetWritten_ && timestamp != 0) {
+        posixOffsetWritten_ = true;
+        std::chrono::duration<double> now =
+                std::chrono::system_clock::now().time_since_epoch();
+        size_t lengthAt = BeginRecord(out_, BIN_POSIX_OFFSET);
+        Put<double>(out_, now.count() - timestamp);
+        EndRecord(out_, lengthAt);
+    }
+
+    Put<uint8_t>(out_, sensorId);
+    Put<uint8_t>(out_, pValue->sequence);
+    Put<uint8_t>(out_, pValue->status);
+    Put<double>(out_, timestamp);
+    Put<int64_t>(out_, delay_uS);
+
+    const uint8_t* pValueBytes = (const uint8_t*)pValue;
+    size_t at = out_.size();
+    out_.resize(at + FieldBytes(pLayout));
+    for (uint32_t f = 0; f < pLayout->count; f++) {
+        const binField_s& field = pLayout->fields[f];
+        SwapToLittleEndian(&out_[at], pValueBytes + field.offset, field.size);
+        at += field.size;
+    }
+}
+
+
+// =================================================================================================
+// BinLogReader
+// =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// BinLogReader::open
+// -------------------------------------------------------------------------------------------------
+bool BinLogReader::open(char const* filePath) {
+    in_.open(filePath, std::ios::in | std::ios::binary);
+    records_ = 0;
+    offset_ = 0;
+
+    uint8_t header[8];
+    if (!Read(header, sizeof(header))) {
+        return false;
+    }
+    if ((memcmp(header, "SH2BIN", 6) != 0) || (header[6] != BIN_VERSION)) {
+        return false;
+    }
+    ned_ = (header[7] & BIN_FLAG_NED) != 0;
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+// BinLogReader::replay
+// -------------------------------------------------------------------------------------------------
+bool BinLogReader::replay(DsfLogger* pDsf) {
+    while (true) {
+        uint64_t start = offset_;
+        uint8_t type;
+        if (!Read(&type, 1)) {
+            // Clean end of the file, unless it couldn't be read.
+            return !in_.bad();
+        }
+
+        bool ok = (type < BIN_CHANNEL) ? ReadSensorValue(pDsf, type) : ReadRecord(pDsf, type);
+        if (!ok) {
+            offset_ = start;
+            return false;
+        }
+        records_++;
+    }
+}
+
+
+// -------------------------------------------------------------------------------------------------
+// BinLogReader::Read
+// -------------------------------------------------------------------------------------------------
+bool BinLogReader::Read(void* pData, size_t len) {
+    in_.read((char*)pData, len);
+    offset_ += in_.gcount();
+    return (size_t)in_.gcount() == len;
+}
+
+// -------------------------------------------------------------------------------------------------
+// BinLogReader::ReadRecord
+// -------------------------------------------------------------------------------------------------
+bool BinLogReader::ReadRecord(DsfLogger* pDsf, uint8_t type) {
+    uint8_t lengthBytes[4];
+    uint32_t length;
+    if (!Read(lengthBytes, sizeof(lengthBytes))) {
+        return false;
+    }
+    SwapToLittleEndian(&length, lengthBytes, sizeof(length));
+    if (length > MAX_RECORD_BYTES) {
+        return false;
+    }
+
+    // One extra NUL, so the text of a message is terminated.
+    body_.resize(length + 1);
+    if (!Read(body_.data(), length)) {
+        return false;
+    }
+    body_[length] = 0;
+    const uint8_t* p = body_.data();
+    const uint8_t* end = p + length;
+
+    switch (type) {
+        case BIN_CHANNEL: {
+            // Check it describes the reports as this reader expects them.
+            uint8_t sensorId;
+            uint16_t fieldBytes;
+            char const* name;
+            char const* columns;
+            char const* fields;
+            if (!Get(p, end, &sensorId) || !Get(p, end, &fieldBytes) ||
+                !GetString(p, end, &name) || !GetString(p, end, &columns) ||
+                !GetString(p, end, &fields)) {
+                return false;
+            }
+            const binLayout_s* pLayout = GetLayout(sensorId);
+            return (pLayout != nullptr) && (fieldBytes == FieldBytes(pLayout)) &&
+                   (FieldList(pLayout) == fields);
+        }
+        case BIN_MESSAGE:
+            pDsf->logMessage((char const*)body_.data());
+            return true;
+        case BIN_RESET:
+        case BIN_PERIOD: {
+            sh2_AsyncEvent_t event;
+            double timestamp;
+            memset(&event, 0, sizeof(event));
+            if (!Get(p, end, &timestamp)) {
+                return false;
+            }
+            if (type == BIN_RESET) {
+                event.eventId = SH2_RESET;
+            } else {
+                event.eventId = SH2_GET_FEATURE_RESP;
+                uint8_t sensorId;
+                uint32_t interval_us;
+                if (!Get(p, end, &sensorId) || !Get(p, end, &interval_us) ||
+                    (GetLayout(sensorId) == nullptr)) {
+                    return false;
+                }
+                event.sh2SensorConfigResp.sensorId = sensorId;
+                event.sh2SensorConfigResp.sensorConfig.reportInterval_us = interval_us;
+            }
+            pDsf->logAsyncEvent(&event, timestamp);
+            return true;
+        }
+        case BIN_PRODUCT_IDS: {
+            sh2_ProductIds_t ids;
+            uint8_t count;
+            memset(&ids, 0, sizeof(ids));
+            if (!Get(p, end, &count) || (count > sizeof(ids.entry) / sizeof(ids.entry[0]))) {
+                return false;
+            }
+            for (uint8_t i = 0; i < count; i++) {
+                if (!Get(p, end, &ids.entry[i].resetCause) ||
+                    !Get(p, end, &ids.entry[i].swPartNumber) ||
+                    !Get(p, end, &ids.entry[i].swVersionMajor) ||
+                    !Get(p, end, &ids.entry[i].swVersionMinor) ||
+                    !Get(p, end, &ids.entry[i].swVersionPatch) ||
+                    !Get(p, end, &ids.entry[i].swBuildNumber)) {
+                    return false;
+                }
+            }
+            ids.numEntries = count;
+            pDsf->logProductIds(ids);
+            return true;
+        }
+        case BIN_FRS_RECORD: {
+            uint16_t recordId;
+            uint16_t words;
+            char const* name;
+            if (!Get(p, end, &recordId) || !Get(p, end, &words) || !GetString(p, end, &name)) {
+                return false;
+            }
+            std::vector<uint32_t> buffer(words);
+            for (uint16_t w = 0; w < words; w++) {
+                if (!Get(p, end, &buffer[w])) {
+                    return false;
+                }
+            }
+            pDsf->logFrsRecord(recordId, name, buffer.data(), words);
+            return true;
+        }
+        case BIN_POSIX_OFFSET: {
+            double offset;
+            if (!Get(p, end, &offset)) {
+                return false;
+            }
+            pDsf->setPosixOffset(offset);
+            return true;
+        }
+        case BIN_HAL_STATS: {
+            ftdi_hal_Stats_t stats;
+            double timestamp;
+            if (!Get(p, end, &timestamp) || !Get(p, end, &stats.rxBytes) ||
+                !Get(p, end, &stats.rxEscapes) || !Get(p, end, &stats.rxFrames) ||
+                !Get(p, end, &stats.rxBsns) || !Get(p, end, &stats.rxTooLong) ||
+                !Get(p, end, &stats.rxTooBig) || !Get(p, end, &stats.rxClientTooSmall) ||
+                !Get(p, end, &stats.txBytes) || !Get(p, end, &stats.txWrites) ||
+                !Get(p, end, &stats.txFrames) || !Get(p, end, &stats.txBsqs) ||
+                !Get(p, end, &stats.txStalls) || !Get(p, end, &stats.txStall_us) ||
+                !Get(p, end, &stats.ttyOverruns) || !Get(p, end, &stats.ttyBufOverruns) ||
+                !Get(p, end, &stats.ttyFramingErrors) || !Get(p, end, &stats.ttyParityErrors) ||
+                !Get(p, end, &stats.ttyBreaks)) {
+                return false;
+            }
+            pDsf->logHalStats(&stats, timestamp);
+            return true;
+        }
+        default:
+            // From a newer version of the format: skip it.
+            return true;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// BinLogReader::ReadSensorValue
+// -------------------------------------------------------------------------------------------------
+bool BinLogReader::ReadSensorValue(DsfLogger* pDsf, uint8_t sensorId) {
+    const binLayout_s* pLayout = GetLayout(sensorId);
+    if (pLayout == nullptr) {
+        return false;
+    }
+
+    body_.resize(SENSOR_HEADER_BYTES + FieldBytes(pLayout));
+    if (!Read(body_.data(), body_.size())) {
+        return false;
+    }
+    const uint8_t* p = body_.data();
+    const uint8_t* end = p + body_.size();
+
+    sh2_SensorValue_t value;
+    double timestamp = 0;
+    int64_t delay_uS = 0;
+    memset(&value, 0, sizeof(value));
+    value.sensorId = sensorId;
+    Get(p, end, &value.sequence);
+    Get(p, end, &value.status);
+    Get(p, end, &timestamp);
+    Get(p, end, &delay_uS);
+
+    uint8_t* pValueBytes = (uint8_t*)&value;
+    for (uint32_t f = 0; f < pLayout->count; f++) {
+        const binField_s& field = pLayout->fields[f];
+        SwapToLittleEndian(pValueBytes + field.offset, p, field.size);
+        p += field.size;
+    }
+
+    pDsf->logSensorValue(&value, timestamp, delay_uS);
+    return true;
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "AsyncFileWriter.h"
+#include "DsfLogger.h"
+#include "Logger.h"
+
+#include <fstream>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * Binary log format
+ *
+ * A compact equivalent of a .dsf log: everything DsfLogger would write,
+ * with sensor values stored as they were decoded rather than as text.
+ * All values are little-endian.
+ *
+ * The file starts with an 8 byte header: "SH2BIN", a version byte (1)
+ * and a flags byte, bit 0 set if the log is in NED rather than ENU
+ * orientation.  Records follow, each starting with a type byte.
+ *
+ * Types 0x01 to 0x7F are sensor reports, the type being the sensor id:
+ *   u8 sequence, u8 status, f64 timestamp (s), i64 delay (us),
+ *   then the sensor's fields, as given by its channel definition.
+ * Sensor values are always ENU, NED is applied on conversion to DSF.
+ *
+ * Types from 0x80 are followed by a u32 length and that many bytes:
+ *   0x80 channel:      u8 sensor id, u16 field bytes, then three NUL
+ *                      terminated strings: the DSF name, the DSF columns
+ *                      and the fields, as "name:type,..." with types f4
+ *                      (float), i<n> or u<n> (n byte integer).  Comes
+ *                      before the sensor's first report.
+ *   0x81 message:      the text
+ *   0x82 reset:        f64 timestamp
+ *   0x83 period:       f64 timestamp, u8 sensor id, u32 interval (us)
+ *   0x84 product ids:  u8 count, then for each: u8 reset cause,
+ *                      u32 part number, u8 major, u8 minor, u16 patch,
+ *                      u32 build number
+ *   0x85 FRS record:   u16 record id, u16 words, NUL terminated name,
+ *                      then the words as u32
+ *   0x86 posix offset: f64 offset from timestamps to POSIX time (s)
+ *   0x87 HAL stats:    f64 timestamp, then ftdi_hal_Stats_t's members in
+ *                      order, each its own size
+ *
+ * A gyroscope report takes 31 bytes, against about 80 as DSF text.
+ */
+
+// =================================================================================================
+// CLASS DEFINITON - BinLogger
+// =================================================================================================
+class BinLogger : public Logger {
+public:
+    BinLogger()
+        : writeConfig_(AsyncFileWriter::defaultConfig()),
+          defined_(),
+          posixOffsetWritten_(false){};
+    virtual ~BinLogger(){};
+
+    /**
+     * Buffering and sync policy of the file, for the next init().
+     */
+    void setWriteConfig(const AsyncFileWriter::Config_s& config) {
+        writeConfig_ = config;
+    }
+
+    AsyncFileWriter::Stats_s getWriteStats(void) {
+        return file_.getStats();
+    }
+
+    virtual bool init(char const* filePath, bool ned);
+    virtual void finish();
+
+    virtual void logMessage(char const* msg);
+    virtual void logAsyncEvent(sh2_AsyncEvent_t* pEvent, double timestamp);
+
+    virtual void logProductIds(sh2_ProductIds_t ids);
+    virtual void
+    logFrsRecord(uint16_t recordId, char const* name, uint32_t* buffer, uint16_t words);
+    virtual void logSensorValue(sh2_SensorValue_t* pValue, double timestamp, int64_t delay_uS);
+    virtual void logSensorValues(SensorSample_s* pSamples, size_t count);
+    virtual void logHalStats(const ftdi_hal_Stats_t* pStats, double timestamp);
+    virtual uint32_t flushIfDue() {
+        return file_.flushIfDue();
+    }
+
+private:
+    // ---------------------------------------------------------------------------------------------
+    // VARIABLES
+    // ---------------------------------------------------------------------------------------------
+    // The log file, written on its own thread
+    AsyncFileWriter file_;
+    AsyncFileWriter::Config_s writeConfig_;
+
+    // Channel definition has been written, per sensor
+    bool defined_[SH2_MAX_SENSOR_ID + 1];
+    bool posixOffsetWritten_;
+
+    // Records are encoded here, then written
+    std::vector<uint8_t> out_;
+
+    // ---------------------------------------------------------------------------------------------
+    // PRIVATE METHODS
+    // ---------------------------------------------------------------------------------------------
+    void Write();
+    void WriteSensorValue(sh2_SensorValue_t* pValue, double timestamp, int64_t delay_uS);
+};
+
+
+// =================================================================================================
+// CLASS DEFINITON - BinLogReader
+// =================================================================================================
+/**
+ * Reads a BinLogger log and writes it out again with a DsfLogger, giving
+ * the .dsf that would have been logged in the first place.
+ */
+class BinLogReader {
+public:
+    BinLogReader() : ned_(false), records_(0), offset_(0){};
+
+    /**
+     * Open a log and read its header.  False if it isn't a binary log.
+     */
+    bool open(char const* filePath);
+
+    /**
+     * Orientation the log was recorded in, to init() the DsfLogger with.
+     */
+    bool isNed(void) const {
+        return ned_;
+    }
+
+    /**
+     * Pass every record to pDsf.  False if the log is damaged or cut
+     * short, in which case everything before the bad record has been
+     * passed on and getOffset() is where it starts.
+     */
+    bool replay(DsfLogger* pDsf);
+
+    // Records read, and bytes of the file read so far
+    uint64_t getRecords(void) const {
+        return records_;
+    }
+    uint64_t getOffset(void) const {
+        return offset_;
+    }
+
+private:
+    bool Read(void* pData, size_t len);
+    bool ReadRecord(DsfLogger* pDsf, uint8_t type);
+    bool ReadSensorValue(DsfLogger* pDsf, uint8_t sensorId);
+
+    std::ifstream in_;
+    bool ned_;
+    uint64_t records_;
+    uint64_t offset_;
+
+    // Body of the current record
+    std::vector<uint8_t> body_;
+};
@@ -24,6 +24,7 @@
 extern "C" {
 #include "sh2_err.h"
 #include "sh2_hal.h"
+#include "timing.h"
 }
 
 #define DFU_MAX_ATTEMPTS (5)
@@ -264,11 +265,7 @@ close_and_return:
     // If update process completed successfully, delay a bit to let
     // flash writes complete.
     if (status == SH2_OK) {
-        uint32_t now = pHal->getTimeUs(pHal);
-        uint32_t start = now;
-        while ((now - start) < DELAY_POST_DFU_US) {
-            now = pHal->getTimeUs(pHal);
-        }
+        timing_delay_us(DELAY_POST_DFU_US);
     }
 
     // close device
@@ -0,0 +1,235 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DsfFormatter.h"
+
+#include <cmath>
+#include <cstdio>
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+
+// Significant digits of the general format
+#define GENERAL_DIGITS (9)
+
+// Values scaled to an integer closer than this to halfway between two
+// integers are left to snprintf to round.
+#define HALFWAY_MARGIN (1e-6)
+
+// =================================================================================================
+// LOCAL VARIABLES
+// =================================================================================================
+
+// Powers of ten that are exact as doubles
+static const double Pow10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+#define MAX_POW10 (22)
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+
+// Round a * 10^k to the nearest integer, in *pN.  a must be positive.
+// Returns false if the result doesn't fit in 53 bits, or is too close to
+// halfway to round with certainty.
+static bool scaleRound(double a, int k, uint64_t* pN) {
+    double s = Pow10[k];
+    double p = a * s;
+    if (p >= 9007199254740992.0) {
+        return false;
+    }
+
+    // a * s is exactly p + r
+    double r = std::fma(a, s, -p);
+    double whole = std::floor(p);
+    double frac = (p - whole) + r;
+    if (std::fabs(frac - 0.5) < HALFWAY_MARGIN) {
+        return false;
+    }
+
+    *pN = (uint64_t)whole + ((frac > 0.5) ? 1 : 0);
+    return true;
+}
+
+// =================================================================================================
+// PRIVATE FUNCTIONS
+// =================================================================================================
+
+void DsfFormatter::writeUnsigned(uint64_t v) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v != 0);
+
+    char* p = room(n);
+    for (int i = 0; i < n; i++) {
+        p[i] = digits[n - 1 - i];
+    }
+    size_ += n;
+}
+
+void DsfFormatter::writeSigned(int64_t v) {
+    if (v < 0) {
+        *this << '-';
+        // Negate as unsigned so the most negative value works too.
+        writeUnsigned(0 - (uint64_t)v);
+    } else {
+        writeUnsigned((uint64_t)v);
+    }
+}
+
+// Default floating point format, as %.9g
+void DsfFormatter::writeGeneral(double v) {
+    if (v == 0) {
+        *this << (std::signbit(v) ? "-0" : "0");
+        return;
+    }
+
+    double a = std::fabs(v);
+    if (!std::isfinite(v) || (a < 1e-14) || (a >= 1e9)) {
+        writePrintf("%.*g", GENERAL_DIGITS, v);
+        return;
+    }
+
+    // Find the decimal exponent e such that a rounded to 9 significant
+    // digits is n * 10^(e - 8), with n of exactly 9 digits.  The estimate
+    // from log10 can be one out, and rounding up can add a digit.
+    int e = (int)std::floor(std::log10(a));
+    uint64_t n = 0;
+    for (int tries = 0;; tries++) {
+        int k = (GENERAL_DIGITS - 1) - e;
+        if ((tries == 3) || (k < 0) || (k > MAX_POW10) || !scaleRound(a, k, &n)) {
+            writePrintf("%.*g", GENERAL_DIGITS, v);
+            return;
+        }
+        if (n >= 1000000000) {
+            e++;
+        } else if (n < 100000000) {
+            e--;
+        } else {
+            break;
+        }
+    }
+
+    char digits[GENERAL_DIGITS];
+    for (int i = GENERAL_DIGITS - 1; i >= 0; i--) {
+        digits[i] = (char)('0' + n % 10);
+        n /= 10;
+    }
+
+    // %g drops trailing zeros after the decimal point.
+    int significant = GENERAL_DIGITS;
+    while ((significant > 1) && (digits[significant - 1] == '0')) {
+        significant--;
+    }
+
+    // Sign, up to 6 leading zeros or an exponent, the digits and a point
+    char* p = room(1 + 6 + GENERAL_DIGITS + 1);
+    char* start = p;
+    if (v < 0) {
+        *p++ = '-';
+    }
+
+    if (e >= 0) {
+        // All the integer digits, then any fraction
+        for (int i = 0; i <= e; i++) {
+            *p++ = digits[i];
+        }
+        if (significant > e + 1) {
+            *p++ = '.';
+            for (int i = e + 1; i < significant; i++) {
+                *p++ = digits[i];
+            }
+        }
+    } else if (e >= -4) {
+        *p++ = '0';
+        *p++ = '.';
+        for (int i = -1; i > e; i--) {
+            *p++ = '0';
+        }
+        for (int i = 0; i < significant; i++) {
+            *p++ = digits[i];
+        }
+    } else {
+        // e is from -14 to -5
+        *p++ = digits[0];
+        if (significant > 1) {
+            *p++ = '.';
+            for (int i = 1; i < significant; i++) {
+                *p++ = digits[i];
+            }
+        }
+        *p++ = 'e';
+        *p++ = '-';
+        *p++ = (char)('0' + (-e) / 10);
+        *p++ = (char)('0' + (-e) % 10);
+    }
+    size_ += p - start;
+}
+
+// Fixed point format, as %.<decimals>f
+void DsfFormatter::writeFixed(double v, uint32_t decimals) {
+    uint64_t n = 0;
+    if ((decimals > 9) || !std::isfinite(v) || !scaleRound(std::fabs(v), decimals, &n)) {
+        writePrintf("%.*f", decimals, v);
+        return;
+    }
+
+    if (std::signbit(v)) {
+        *this << '-';
+    }
+
+    uint64_t scale = (uint64_t)Pow10[decimals];
+    writeUnsigned(n / scale);
+    if (decimals > 0) {
+        uint64_t frac = n % scale;
+        char* p = room(1 + decimals);
+        p[0] = '.';
+        for (uint32_t i = decimals; i > 0; i--) {
+            p[i] = (char)('0' + frac % 10);
+            frac /= 10;
+        }
+        size_ += 1 + decimals;
+    }
+}
+
+// Format with snprintf, for values the fast paths don't handle.
+void DsfFormatter::writePrintf(const char* format, uint32_t precision, double v) {
+    char text[400];
+    int len = snprintf(text, sizeof(text), format, (int)precision, v);
+    if (len < 0) {
+        return;
+    }
+    if (len >= (int)sizeof(text)) {
+        len = sizeof(text) - 1;
+    }
+
+    // snprintf follows the C locale's decimal point, a stream doesn't.
+    for (int i = 0; i < len; i++) {
+        if (text[i] == ',') {
+            text[i] = '.';
+        }
+    }
+
+    memcpy(room(len), text, len);
+    size_ += len;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/**
+ * Text buffer for DSF records, a replacement for std::ostream on the
+ * sensor report path.
+ *
+ * Values are written exactly as a std::ostream in the classic locale
+ * with precision(9) would write them: integers in decimal, characters as
+ * themselves and floating point values in the default (%g style) format
+ * with 9 significant digits, which is enough for any float to read back
+ * exactly.  fixed() gives the std::fixed format with a given number of
+ * decimals.  Unlike a stream there are no locale facets or format flags,
+ * and once the buffer has grown to the size of a batch, no allocation.
+ *
+ * Most floating point values are converted with integer arithmetic.
+ * Values that can't be converted exactly that way (very large or small
+ * values, NaN, infinity, or a value within rounding error of halfway
+ * between two outputs) fall back to snprintf.
+ */
+class DsfFormatter {
+public:
+    // A value to write in fixed point format, see fixed()
+    struct Fixed_s {
+        double value;
+        uint32_t decimals;
+    };
+
+    explicit DsfFormatter(size_t capacity = 4096) : buf_(capacity), size_(0) {
+    }
+
+    /**
+     * Write value with decimals (at most 9) digits after the decimal point.
+     */
+    static Fixed_s fixed(double value, uint32_t decimals) {
+        Fixed_s f = {value, decimals};
+        return f;
+    }
+
+    void clear(void) {
+        size_ = 0;
+    }
+
+    const char* data(void) const {
+        return buf_.data();
+    }
+
+    size_t size(void) const {
+        return size_;
+    }
+
+    DsfFormatter& operator<<(const char* s) {
+        size_t len = strlen(s);
+        memcpy(room(len), s, len);
+        size_ += len;
+        return *this;
+    }
+
+    DsfFormatter& operator<<(char c) {
+        *room(1) = c;
+        size_++;
+        return *this;
+    }
+
+    // As with a stream, these are characters, not numbers.
+    DsfFormatter& operator<<(signed char c) {
+        return *this << (char)c;
+    }
+    DsfFormatter& operator<<(unsigned char c) {
+        return *this << (char)c;
+    }
+
+    DsfFormatter& operator<<(short v) {
+        writeSigned(v);
+        return *this;
+    }
+    DsfFormatter& operator<<(unsigned short v) {
+        writeUnsigned(v);
+        return *this;
+    }
+    DsfFormatter& operator<<(int v) {
+        writeSigned(v);
+        return *this;
+    }
+    DsfFormatter& operator<<(unsigned int v) {
+        writeUnsigned(v);
+        return *this;
+    }
+    DsfFormatter& operator<<(long v) {
+        writeSigned(v);
+        return *this;
+    }
+    DsfFormatter& operator<<(unsigned long v) {
+        writeUnsigned(v);
+        return *this;
+    }
+    DsfFormatter& operator<<(long long v) {
+        writeSigned(v);
+        return *this;
+    }
+    DsfFormatter& operator<<(unsigned long long v) {
+        writeUnsigned(v);
+        return *this;
+    }
+
+    DsfFormatter& operator<<(float v) {
+        writeGeneral(v);
+        return *this;
+    }
+    DsfFormatter& operator<<(double v) {
+        writeGeneral(v);
+        return *this;
+    }
+
+    DsfFormatter& operator<<(const Fixed_s& f) {
+        writeFixed(f.value, f.decimals);
+        return *this;
+    }
+
+private:
+    // Pointer to space for n more characters at the end of the buffer
+    char* room(size_t n) {
+        if (size_ + n > buf_.size()) {
+            buf_.resize(2 * (size_ + n));
+        }
+        return &buf_[size_];
+    }
+
+    void writeUnsigned(uint64_t v);
+    void writeSigned(int64_t v);
+    void writeGeneral(double v);
+    void writeFixed(double v, uint32_t decimals);
+    void writePrintf(const char* format, uint32_t precision, double v);
+
+    std::vector<char> buf_;
+    size_t size_;
+};
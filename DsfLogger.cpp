@@ -30,6 +30,25 @@
 // =================================================================================================
 // DEFINES AND MACROS
 // =================================================================================================
+// Channel of the HAL's I/O statistics, clear of the sensor ids
+#define HAL_STATS_CHANNEL (256)
+
+// Define SensorFields<sensorId>, declaring its write<Ned>(), and start the
+// definition of write<Ned>().
+#define SENSOR_FIELDS(sensorId)                                                        \
+    template <>                                                                        \
+    struct DsfLogger::SensorFields<sensorId> {                                         \
+        template <bool Ned>                                                            \
+        static void write(DsfFormatter& out, const sh2_SensorValue_t* pValue);         \
+    };                                                                                 \
+    template <bool Ned>                                                                \
+    void DsfLogger::SensorFields<sensorId>::write(DsfFormatter& out,                   \
+                                                  const sh2_SensorValue_t* pValue)
+
+// Case of GetFieldWriter() for a sensor
+#define FIELD_WRITER(sensorId)                                                         \
+    case sensorId:                                                                     \
+        return &SensorFields<sensorId>::write<Ned>
 
 
 // =================================================================================================
@@ -104,28 +123,102 @@ static const sensorDsfHeader_s SensorDsfHeader[] = {
 static_assert((sizeof(SensorDsfHeader) / sizeof(sensorDsfHeader_s)) == (SH2_MAX_SENSOR_ID + 1),
               "Const variable size match failed");
 
-static SampleIdExtender* extenders_[SH2_MAX_SENSOR_ID + 1];
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+// Current system time, seconds since the Unix epoch
+static double PosixTime() {
+#ifdef _WIN32
+    const DWORD64 UNIX_EPOCH = 0x019DB1DED53E8000; // January 1, 1970 in Windows Ticks.
+    const double TICKS_PER_SECOND = 10000000.0;    // Windows tick = 100ns.
+
+    // Get system time
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+
+    // Combine parts into LARGE_INTEGER ticks.
+    LARGE_INTEGER ticks;
+    ticks.LowPart = ft.dwLowDateTime;
+    ticks.HighPart = ft.dwHighDateTime;
+
+    // Convert to double, based on Unix epoch, units are seconds.
+    return (ticks.QuadPart - UNIX_EPOCH) / TICKS_PER_SECOND;
+#else
+    struct timespec tp;
+    clock_gettime(CLOCK_REALTIME, &tp);
+    return tp.tv_sec + tp.tv_nsec * 1e-9;
+#endif
+}
+
+// x, y, z as reported (ENU), or converted to NED
+template <bool Ned>
+static void WriteAxes(DsfFormatter& out, float x, float y, float z) {
+    if (Ned) {
+        out << y << "," << x << "," << -z;
+    } else {
+        out << x << "," << y << "," << z;
+    }
+}
+
+// Quaternion as reported (ENU), or converted to NED
+template <bool Ned>
+static void WriteQuaternion(DsfFormatter& out, float real, float i, float j, float k) {
+    if (Ned) {
+        out << real << "," << j << "," << i << "," << -k;
+    } else {
+        out << real << "," << i << "," << j << "," << k;
+    }
+}
 
 
 // =================================================================================================
 // PUBLIC FUNCTIONS
 // =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// DsfLogger::getSensorName
+// -------------------------------------------------------------------------------------------------
+char const* DsfLogger::getSensorName(uint8_t sensorId) {
+    return (sensorId <= SH2_MAX_SENSOR_ID) ? SensorDsfHeader[sensorId].name : "";
+}
+
+// -------------------------------------------------------------------------------------------------
+// DsfLogger::getSensorColumns
+// -------------------------------------------------------------------------------------------------
+char const* DsfLogger::getSensorColumns(uint8_t sensorId) {
+    return (sensorId <= SH2_MAX_SENSOR_ID) ? SensorDsfHeader[sensorId].sensorColumns : "";
+}
+
+// -------------------------------------------------------------------------------------------------
+// DsfLogger::~DsfLogger
+// -------------------------------------------------------------------------------------------------
+DsfLogger::~DsfLogger() {
+    for (int i = 0; i <= SH2_MAX_SENSOR_ID; i++) {
+        delete extenders_[i];
+    }
+}
+
 // -------------------------------------------------------------------------------------------------
 // DsfLogger::init
 // -------------------------------------------------------------------------------------------------
 bool DsfLogger::init(char const* filePath, bool ned) {
-    outFile_.open(filePath);
-
-    if (outFile_) {
+    if (file_.open(filePath, writeConfig_)) {
         orientationNed_ = ned;
 
         for (int i = 0; i <= SH2_MAX_SENSOR_ID; i++) {
+            fieldWriters_[i] = ned ? GetFieldWriter<true>(i) : GetFieldWriter<false>(i);
+            delete extenders_[i];
             if (strcmp("", SensorDsfHeader[i].sensorColumns) == 0) {
                 extenders_[i] = nullptr;
             } else {
                 extenders_[i] = new SampleIdExtender();
             }
         }
+        halStatsDefined_ = false;
+        posixOffsetWritten_ = false;
+        if (!posixOffsetGiven_) {
+            posixOffset_ = 0;
+        }
         return true;
 
     } else {
@@ -137,17 +230,15 @@ bool DsfLogger::init(char const* filePath, bool ned) {
 // DsfLogger::finish
 // -------------------------------------------------------------------------------------------------
 void DsfLogger::finish() {
-    if (outFile_) {
-        outFile_.flush();
-        outFile_.close();
-    }
+    file_.close();
 }
 
 // -------------------------------------------------------------------------------------------------
 // DsfLogger::logMessage
 // -------------------------------------------------------------------------------------------------
 void DsfLogger::logMessage(char const* msg) {
-    outFile_ << msg << std::endl;
+    text_ << msg << "\n";
+    WriteText();
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -157,10 +248,10 @@ void DsfLogger::logAsyncEvent(sh2_AsyncEvent_t* pEvent, double timestamp) {
 
     switch (pEvent->eventId) {
         case SH2_RESET:
-            outFile_ << "$ ";
-            outFile_ << std::fixed << std::setprecision(9) << timestamp << ",";
-            outFile_.unsetf(std::ios_base::floatfield);
-            outFile_ << " reset(1)\n";
+            text_ << "$ ";
+            text_ << std::fixed << std::setprecision(9) << timestamp << ",";
+            text_.unsetf(std::ios_base::floatfield);
+            text_ << " reset(1)\n";
             break;
         case SH2_GET_FEATURE_RESP: {
             // Log the sensor reporting interval
@@ -168,22 +259,25 @@ void DsfLogger::logAsyncEvent(sh2_AsyncEvent_t* pEvent, double timestamp) {
             // Ensure the Channel definition is written before the period is reported.
             if (extenders_[sensorId]) {
                 if (extenders_[sensorId]->isEmpty()) {
-                    WriteChannelDefinition(sensorId);
+                    out_.clear();
+                    WriteChannelDefinition(out_, sensorId);
+                    file_.append(out_.data(), out_.size());
                     extenders_[sensorId]->extend(0);
                 }
-                outFile_ << "$" << static_cast<int32_t>(sensorId) << " ";
-                outFile_ << std::fixed << std::setprecision(9) << timestamp << ", ";
-                outFile_.unsetf(std::ios_base::floatfield);
-                outFile_ << "period(";
-                outFile_ << (pEvent->sh2SensorConfigResp.sensorConfig.reportInterval_us /
-                             1000000.0);
-                outFile_ << ")\n";
+                text_ << "$" << static_cast<int32_t>(sensorId) << " ";
+                text_ << std::fixed << std::setprecision(9) << timestamp << ", ";
+                text_.unsetf(std::ios_base::floatfield);
+                text_ << "period(";
+                text_ << (pEvent->sh2SensorConfigResp.sensorConfig.reportInterval_us /
+                          1000000.0);
+                text_ << ")\n";
             }
             break;
         }
         default:
             break;
     }
+    WriteText();
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -196,27 +290,28 @@ void DsfLogger::logProductIds(sh2_ProductIds_t ids) {
             case 0:
                 break;
             case 1:
-                outFile_ << "!RESET_CAUSE=\"PowerOnReset\"\n";
+                text_ << "!RESET_CAUSE=\"PowerOnReset\"\n";
                 break;
             case 2:
-                outFile_ << "!RESET_CAUSE=\"InternalSystemReset\"\n";
+                text_ << "!RESET_CAUSE=\"InternalSystemReset\"\n";
                 break;
             case 3:
-                outFile_ << "!RESET_CAUSE=\"WatchdogTimeout\"\n";
+                text_ << "!RESET_CAUSE=\"WatchdogTimeout\"\n";
                 break;
             case 4:
-                outFile_ << "!RESET_CAUSE=\"ExternalReset\"\n";
+                text_ << "!RESET_CAUSE=\"ExternalReset\"\n";
                 break;
             case 5:
-                outFile_ << "!RESET_CAUSE=\"Other\"\n";
+                text_ << "!RESET_CAUSE=\"Other\"\n";
                 break;
         }
-        outFile_ << "! PN." << i << "=\"" << static_cast<uint32_t>(ids.entry[i].swPartNumber) << " "
-                 << static_cast<uint32_t>(ids.entry[i].swVersionMajor) << "."
-                 << static_cast<uint32_t>(ids.entry[i].swVersionMinor) << "."
-                 << static_cast<uint32_t>(ids.entry[i].swVersionPatch) << "."
-                 << static_cast<uint32_t>(ids.entry[i].swBuildNumber) << "\"\n";
+        text_ << "! PN." << i << "=\"" << static_cast<uint32_t>(ids.entry[i].swPartNumber) << " "
+              << static_cast<uint32_t>(ids.entry[i].swVersionMajor) << "."
+              << static_cast<uint32_t>(ids.entry[i].swVersionMinor) << "."
+              << static_cast<uint32_t>(ids.entry[i].swVersionPatch) << "."
+              << static_cast<uint32_t>(ids.entry[i].swBuildNumber) << "\"\n";
     }
+    WriteText();
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -226,472 +321,495 @@ void DsfLogger::logFrsRecord(uint16_t recordId,
                              char const* name,
                              uint32_t* buffer,
                              uint16_t words) {
-    outFile_ << "! frs_" << std::hex << std::setw(4) << std::setfill('0') << recordId << "=[";
-    outFile_ << "\"" << name << "\",";
-    outFile_ << "\"" << std::hex << std::setw(4) << std::setfill('0') << recordId << "\",";
-    outFile_ << "\"";
+    text_ << "! frs_" << std::hex << std::setw(4) << std::setfill('0') << recordId << "=[";
+    text_ << "\"" << name << "\",";
+    text_ << "\"" << std::hex << std::setw(4) << std::setfill('0') << recordId << "\",";
+    text_ << "\"";
     for (uint16_t w = 0; w < words; ++w) {
         for (uint8_t b = 0; b < 4; ++b) {
-            outFile_ << std::hex << std::setw(2) << std::setfill('0')
-                     << ((buffer[w] >> (b * 8)) & 0xFF);
+            text_ << std::hex << std::setw(2) << std::setfill('0')
+                  << ((buffer[w] >> (b * 8)) & 0xFF);
             if (w != (words - 1) || b != 3) {
-                outFile_ << ",";
+                text_ << ",";
             }
         }
     }
-    outFile_ << std::dec << "\"]\n";
+    text_ << std::dec << "\"]\n";
+    WriteText();
 }
 
 // -------------------------------------------------------------------------------------------------
 // DsfLogger::logSensorValue
 // -------------------------------------------------------------------------------------------------
 void DsfLogger::logSensorValue(sh2_SensorValue_t* pValue, double timestamp, int64_t delay_uS) {
-    uint32_t sensorId = pValue->sensorId;
+    if (pValue->sensorId > SH2_MAX_SENSOR_ID) {
+        // Unknown to this version of the logger
+        return;
+    }
+    SampleIdExtender* extender = extenders_[pValue->sensorId];
 
-    if (!extenders_[sensorId]) {
+    if (!extender) {
         // If the sensor ID is invalid, return.
         return;
     }
 
-    // Write Sensor Report Header
-    WriteSensorReportHeader(pValue, extenders_[sensorId], timestamp, delay_uS);
-
-    switch (sensorId) {
+    out_.clear();
+    WriteSensorValue(out_, pValue, extender, timestamp, delay_uS);
+    file_.append(out_.data(), out_.size());
+}
 
-        case SH2_RAW_ACCELEROMETER: {
-            outFile_ << pValue->un.rawAccelerometer.x << "," << pValue->un.rawAccelerometer.y << ","
-                     << pValue->un.rawAccelerometer.z << ","
-                     << pValue->un.rawAccelerometer.timestamp << "\n";
-            break;
-        }
-        case SH2_ACCELEROMETER: {
-            if (orientationNed_) {
-                outFile_ << pValue->un.accelerometer.y << "," // ENU -> NED
-                         << pValue->un.accelerometer.x << "," << -pValue->un.accelerometer.z
-                         << "\n";
-            } else {
-                outFile_ << pValue->un.accelerometer.x << "," << pValue->un.accelerometer.y << ","
-                         << pValue->un.accelerometer.z << "\n";
-            }
-            break;
-        }
-        case SH2_LINEAR_ACCELERATION: {
-            if (orientationNed_) {
-                outFile_ << pValue->un.linearAcceleration.y << "," // ENU -> NED
-                         << pValue->un.linearAcceleration.x << ","
-                         << -pValue->un.linearAcceleration.z << "\n";
-            } else {
-                outFile_ << pValue->un.linearAcceleration.x << ","
-                         << pValue->un.linearAcceleration.y << ","
-                         << pValue->un.linearAcceleration.z << "\n";
-            }
-            break;
-        }
-        case SH2_GRAVITY: {
-            if (orientationNed_) {
-                outFile_ << pValue->un.gravity.y << "," // ENU -> NED
-                         << pValue->un.gravity.x << "," << -pValue->un.gravity.z << "\n";
-            } else {
-                outFile_ << pValue->un.gravity.x << "," << pValue->un.gravity.y << ","
-                         << pValue->un.gravity.z << "\n";
-            }
-            break;
-        }
-        case SH2_RAW_GYROSCOPE: {
-            outFile_ << pValue->un.rawGyroscope.x << "," << pValue->un.rawGyroscope.y << ","
-                     << pValue->un.rawGyroscope.z << "," << pValue->un.rawGyroscope.temperature
-                     << "," << pValue->un.rawGyroscope.timestamp << "\n";
-            break;
-        }
-        case SH2_GYROSCOPE_CALIBRATED: {
-            if (orientationNed_) {
-                outFile_ << pValue->un.gyroscope.y << "," // ENU -> NED
-                         << pValue->un.gyroscope.x << "," << -pValue->un.gyroscope.z << "\n";
-            } else {
-                outFile_ << pValue->un.gyroscope.x << "," << pValue->un.gyroscope.y << ","
-                         << pValue->un.gyroscope.z << "\n";
-            }
-            break;
-        }
-        case SH2_GYROSCOPE_UNCALIBRATED: {
-            if (orientationNed_) {
-                outFile_ << pValue->un.gyroscopeUncal.y << "," // ENU -> NED
-                         << pValue->un.gyroscopeUncal.x << "," << -pValue->un.gyroscopeUncal.z
-                         << "," << pValue->un.gyroscopeUncal.biasY << "," // ENU -> NED
-                         << pValue->un.gyroscopeUncal.biasX << ","
-                         << -pValue->un.gyroscopeUncal.biasZ << "\n";
-            } else {
-                outFile_ << pValue->un.gyroscopeUncal.x << "," << pValue->un.gyroscopeUncal.y << ","
-                         << pValue->un.gyroscopeUncal.z << "," << pValue->un.gyroscopeUncal.biasX
-                         << "," << pValue->un.gyroscopeUncal.biasY << ","
-                         << pValue->un.gyroscopeUncal.biasZ << "\n";
-            }
-            break;
-        }
-        case SH2_RAW_MAGNETOMETER: {
-            outFile_ << pValue->un.rawMagnetometer.x << "," << pValue->un.rawMagnetometer.y << ","
-                     << pValue->un.rawMagnetometer.z << "," << pValue->un.rawMagnetometer.timestamp
-                     << "\n";
-            break;
-        }
-        case SH2_MAGNETIC_FIELD_CALIBRATED: {
-            if (orientationNed_) {
-                outFile_ << pValue->un.magneticField.y << "," // ENU -> NED
-                         << pValue->un.magneticField.x << "," << -pValue->un.magneticField.z
-                         << "\n";
-            } else {
-                outFile_ << pValue->un.magneticField.x << "," << pValue->un.magneticField.y << ","
-                         << pValue->un.magneticField.z << "\n";
-            }
-            break;
-        }
-        case SH2_MAGNETIC_FIELD_UNCALIBRATED: {
-            if (orientationNed_) {
-                outFile_ << pValue->un.magneticFieldUncal.y << "," // ENU -> NED
-                         << pValue->un.magneticFieldUncal.x << ","
-                         << -pValue->un.magneticFieldUncal.z << ","
-                         << pValue->un.magneticFieldUncal.biasY << "," // ENU -> NED
-                         << pValue->un.magneticFieldUncal.biasX << ","
-                         << -pValue->un.magneticFieldUncal.biasZ << "\n";
-            } else {
-                outFile_ << pValue->un.magneticFieldUncal.x << ","
-                         << pValue->un.magneticFieldUncal.y << ","
-                         << pValue->un.magneticFieldUncal.z << ","
-                         << pValue->un.magneticFieldUncal.biasX << ","
-                         << pValue->un.magneticFieldUncal.biasY << ","
-                         << pValue->un.magneticFieldUncal.biasZ << "\n";
-            }
-            break;
-        }
-        case SH2_ROTATION_VECTOR: {
-            if (orientationNed_) {
-                outFile_ << pValue->un.rotationVector.real << "," << pValue->un.rotationVector.j
-                         << "," // Convert ENU -> NED
-                         << pValue->un.rotationVector.i << "," << -pValue->un.rotationVector.k
-                         << ",";
-            } else {
-                outFile_ << pValue->un.rotationVector.real << "," << pValue->un.rotationVector.i
-                         << "," << pValue->un.rotationVector.j << "," << pValue->un.rotationVector.k
-                         << ",";
-            }
-            outFile_ << RadiansToDeg(pValue->un.rotationVector.accuracy) << "\n";
-            break;
-        }
-        case SH2_GAME_ROTATION_VECTOR: {
-            if (orientationNed_) {
-                outFile_ << pValue->un.gameRotationVector.real << ","
-                         << pValue->un.gameRotationVector.j << "," // Convert ENU -> NED
-                         << pValue->un.gameRotationVector.i << ","
-                         << -pValue->un.gameRotationVector.k << "\n";
-            } else {
-                outFile_ << pValue->un.gameRotationVector.real << ","
-                         << pValue->un.gameRotationVector.i << ","
-                         << pValue->un.gameRotationVector.j << ","
-                         << pValue->un.gameRotationVector.k << "\n";
-            }
-            break;
-        }
-        case SH2_GEOMAGNETIC_ROTATION_VECTOR: {
-            if (orientationNed_) {
-                outFile_ << pValue->un.geoMagRotationVector.real << ","
-                         << pValue->un.geoMagRotationVector.j << "," // Convert ENU -> NED
-                         << pValue->un.geoMagRotationVector.i << ","
-                         << -pValue->un.geoMagRotationVector.k << ",";
-            } else {
-                outFile_ << pValue->un.geoMagRotationVector.real << ","
-                         << pValue->un.geoMagRotationVector.i << ","
-                         << pValue->un.geoMagRotationVector.j << ","
-                         << pValue->un.geoMagRotationVector.k << ",";
-            }
-            outFile_ << RadiansToDeg(pValue->un.geoMagRotationVector.accuracy) << "\n";
-            break;
-        }
-        case SH2_PRESSURE: {
-            outFile_ << pValue->un.pressure.value << "\n";
-            break;
-        }
-        case SH2_AMBIENT_LIGHT: {
-            outFile_ << pValue->un.ambientLight.value << "\n";
-            break;
-        }
-        case SH2_HUMIDITY: {
-            outFile_ << pValue->un.humidity.value << "\n";
-            break;
-        }
-        case SH2_PROXIMITY: {
-            outFile_ << pValue->un.proximity.value << "\n";
-            break;
-        }
-        case SH2_TEMPERATURE: {
-            outFile_ << pValue->un.temperature.value << "\n";
-            break;
-        }
-        case SH2_TAP_DETECTOR: {
-            outFile_ << static_cast<uint32_t>(pValue->un.tapDetector.flags) << "\n";
-            break;
-        }
-        case SH2_STEP_DETECTOR: {
-            outFile_ << pValue->un.stepDetector.latency << "\n";
-            break;
-        }
-        case SH2_STEP_COUNTER: {
-            outFile_ << pValue->un.stepCounter.steps << ",";
-            outFile_ << pValue->un.stepCounter.latency << "\n";
-            break;
-        }
-        case SH2_SIGNIFICANT_MOTION: {
-            outFile_ << pValue->un.sigMotion.motion << "\n";
-            break;
-        }
-        case SH2_STABILITY_CLASSIFIER: {
-            outFile_ << static_cast<uint32_t>(pValue->un.stabilityClassifier.classification)
-                     << "\n";
-            break;
-        }
-        case SH2_SHAKE_DETECTOR: {
-            outFile_ << pValue->un.shakeDetector.shake << "\n";
-            break;
-        }
-        case SH2_FLIP_DETECTOR: {
-            outFile_ << pValue->un.flipDetector.flip << "\n";
-            break;
-        }
-        case SH2_PICKUP_DETECTOR: {
-            outFile_ << pValue->un.pickupDetector.pickup << "\n";
-            break;
-        }
-        case SH2_STABILITY_DETECTOR: {
-            outFile_ << pValue->un.stabilityDetector.stability << "\n";
-            break;
-        }
-        case SH2_PERSONAL_ACTIVITY_CLASSIFIER: {
-            outFile_ << static_cast<uint32_t>(pValue->un.personalActivityClassifier.mostLikelyState)
-                     << ",";
-            for (int i = 0; i < 10; i++) {
-                outFile_ << static_cast<uint32_t>(
-                                    pValue->un.personalActivityClassifier.confidence[i])
-                         << ",";
-            }
-            outFile_ << "\n";
-            break;
-        }
-        case SH2_SLEEP_DETECTOR: {
-            outFile_ << static_cast<uint32_t>(pValue->un.sleepDetector.sleepState) << "\n";
-            break;
-        }
-        case SH2_TILT_DETECTOR: {
-            outFile_ << pValue->un.tiltDetector.tilt << "\n";
-            break;
-        }
-        case SH2_POCKET_DETECTOR: {
-            outFile_ << pValue->un.pocketDetector.pocket << "\n";
-            break;
-        }
-        case SH2_CIRCLE_DETECTOR: {
-            outFile_ << pValue->un.circleDetector.circle << "\n";
-            break;
-        }
-        case SH2_HEART_RATE_MONITOR: {
-            outFile_ << pValue->un.heartRateMonitor.heartRate << "\n";
-            break;
-        }
-        case SH2_ARVR_STABILIZED_RV: {
-            if (orientationNed_) {
-                outFile_ << pValue->un.arvrStabilizedRV.real << "," << pValue->un.arvrStabilizedRV.j
-                         << "," // Convert ENU -> NED
-                         << pValue->un.arvrStabilizedRV.i << "," << -pValue->un.arvrStabilizedRV.k
-                         << ",";
-            } else {
-                outFile_ << pValue->un.arvrStabilizedRV.real << "," << pValue->un.arvrStabilizedRV.i
-                         << "," << pValue->un.arvrStabilizedRV.j << ","
-                         << pValue->un.arvrStabilizedRV.k << ",";
-            }
-            outFile_ << RadiansToDeg(pValue->un.arvrStabilizedRV.accuracy) << "\n";
-            break;
-        }
-        case SH2_ARVR_STABILIZED_GRV: {
-            if (orientationNed_) {
-                outFile_ << pValue->un.arvrStabilizedGRV.real << ","
-                         << pValue->un.arvrStabilizedGRV.j << "," // Convert ENU -> NED
-                         << pValue->un.arvrStabilizedGRV.i << "," << -pValue->un.arvrStabilizedGRV.k
-                         << "\n";
-            } else {
-                outFile_ << pValue->un.arvrStabilizedGRV.real << ","
-                         << pValue->un.arvrStabilizedGRV.i << "," << pValue->un.arvrStabilizedGRV.j
-                         << "," << pValue->un.arvrStabilizedGRV.k << "\n";
-            }
-            break;
-        }
-        case SH2_GYRO_INTEGRATED_RV: {
-            if (orientationNed_) {
-                outFile_ << pValue->un.gyroIntegratedRV.real << "," << pValue->un.gyroIntegratedRV.j
-                         << "," // Convert ENU -> NED
-                         << pValue->un.gyroIntegratedRV.i << "," << -pValue->un.gyroIntegratedRV.k
-                         << "," << pValue->un.gyroIntegratedRV.angVelY << ","
-                         << pValue->un.gyroIntegratedRV.angVelX << ","
-                         << -pValue->un.gyroIntegratedRV.angVelZ << "\n";
-            } else {
-                outFile_ << pValue->un.gyroIntegratedRV.real << "," << pValue->un.gyroIntegratedRV.i
-                         << "," << pValue->un.gyroIntegratedRV.j << ","
-                         << pValue->un.gyroIntegratedRV.k << ","
-                         << pValue->un.gyroIntegratedRV.angVelX << ","
-                         << pValue->un.gyroIntegratedRV.angVelY << ","
-                         << pValue->un.gyroIntegratedRV.angVelZ << "\n";
-            }
-            break;
-        }
-        case SH2_IZRO_MOTION_REQUEST: {
-            outFile_ << static_cast<uint32_t>(pValue->un.izroRequest.intent) << ","
-                     << static_cast<uint32_t>(pValue->un.izroRequest.request) << "\n";
-            break;
+// -------------------------------------------------------------------------------------------------
+// DsfLogger::logSensorValues
+// -------------------------------------------------------------------------------------------------
+void DsfLogger::logSensorValues(SensorSample_s* pSamples, size_t count) {
+    // Order the reports by sensor, in order of each sensor's first report
+    // and keeping each sensor's reports in order, with a counting sort.
+    // Reports from sensor ids unknown to this version are left out.
+    uint32_t groups = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint8_t sensorId = pSamples[i].value.sensorId;
+        if (sensorId > SH2_MAX_SENSOR_ID) {
+            continue;
+        }
+        if (batchCount_[sensorId]++ == 0) {
+            batchIds_[groups++] = sensorId;
         }
-        case SH2_RAW_OPTICAL_FLOW: {
-            outFile_ << static_cast<uint32_t>(pValue->un.rawOptFlow.dx != 0 ||
-                                              pValue->un.rawOptFlow.dy != 0)
-                     << ",";
-            outFile_ << static_cast<uint32_t>(pValue->un.rawOptFlow.laserOn) << ",";
-            outFile_ << static_cast<int16_t>(pValue->un.rawOptFlow.dx) << ",";
-            outFile_ << static_cast<int16_t>(pValue->un.rawOptFlow.dy) << ",";
-            outFile_ << static_cast<uint32_t>(pValue->un.rawOptFlow.iq) << ",";
-            outFile_ << static_cast<uint32_t>(pValue->un.rawOptFlow.resX) << ",";
-            outFile_ << static_cast<uint32_t>(pValue->un.rawOptFlow.resY) << ",";
-            outFile_ << static_cast<uint32_t>(pValue->un.rawOptFlow.shutter) << ",";
-            outFile_ << static_cast<uint32_t>(pValue->un.rawOptFlow.frameMax) << ",";
-            outFile_ << static_cast<uint32_t>(pValue->un.rawOptFlow.frameAvg) << ",";
-            outFile_ << static_cast<uint32_t>(pValue->un.rawOptFlow.frameMin) << ",";
-            outFile_ << static_cast<uint32_t>(pValue->un.rawOptFlow.dt) << ",";
-            outFile_ << static_cast<uint32_t>(pValue->un.rawOptFlow.timestamp) << "\n";
-            break;
+    }
+    uint32_t next = 0;
+    for (uint32_t g = 0; g < groups; g++) {
+        uint8_t sensorId = batchIds_[g];
+        batchNext_[sensorId] = next;
+        next += batchCount_[sensorId];
+    }
+    batchOrder_.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        uint8_t sensorId = pSamples[i].value.sensorId;
+        if (sensorId <= SH2_MAX_SENSOR_ID) {
+            batchOrder_[batchNext_[sensorId]++] = (uint32_t)i;
         }
-        case SH2_DEAD_RECKONING_POSE: {
-            // Output is ENU: rearrange if desired
-            if (orientationNed_) {
-                outFile_ << pValue->un.deadReckoningPose.linPosY << ",";
-                outFile_ << pValue->un.deadReckoningPose.linPosX << ",";
-                outFile_ << -pValue->un.deadReckoningPose.linPosZ << ",";
-
-                outFile_ << pValue->un.deadReckoningPose.real << ",";
-                outFile_ << pValue->un.deadReckoningPose.j << ",";
-                outFile_ << pValue->un.deadReckoningPose.i << ",";
-                outFile_ << -pValue->un.deadReckoningPose.k << ",";
-
-                outFile_ << pValue->un.deadReckoningPose.linVelY << ",";
-                outFile_ << pValue->un.deadReckoningPose.linVelX << ",";
-                outFile_ << -pValue->un.deadReckoningPose.linVelZ << ",";
-
-                outFile_ << pValue->un.deadReckoningPose.angVelY << ",";
-                outFile_ << pValue->un.deadReckoningPose.angVelX << ",";
-                outFile_ << -pValue->un.deadReckoningPose.angVelZ << ",";
-            } else {
-                outFile_ << pValue->un.deadReckoningPose.linPosX << ",";
-                outFile_ << pValue->un.deadReckoningPose.linPosY << ",";
-                outFile_ << pValue->un.deadReckoningPose.linPosZ << ",";
-
-                outFile_ << pValue->un.deadReckoningPose.real << ",";
-                outFile_ << pValue->un.deadReckoningPose.i << ",";
-                outFile_ << pValue->un.deadReckoningPose.j << ",";
-                outFile_ << pValue->un.deadReckoningPose.k << ",";
-
-                outFile_ << pValue->un.deadReckoningPose.linVelX << ",";
-                outFile_ << pValue->un.deadReckoningPose.linVelY << ",";
-                outFile_ << pValue->un.deadReckoningPose.linVelZ << ",";
-
-                outFile_ << pValue->un.deadReckoningPose.angVelX << ",";
-                outFile_ << pValue->un.deadReckoningPose.angVelY << ",";
-                outFile_ << pValue->un.deadReckoningPose.angVelZ << ",";
+    }
+
+    // Format each sensor's reports back to back, into one buffer.
+    out_.clear();
+    size_t idx = 0;
+    for (uint32_t g = 0; g < groups; g++) {
+        uint8_t sensorId = batchIds_[g];
+        uint32_t n = batchCount_[sensorId];
+        SampleIdExtender* extender = extenders_[sensorId];
+        batchCount_[sensorId] = 0;
+
+        if (extender) {
+            for (uint32_t k = 0; k < n; k++) {
+                SensorSample_s* pSample = &pSamples[batchOrder_[idx + k]];
+                WriteSensorValue(
+                        out_, &pSample->value, extender, pSample->timestamp, pSample->delay_uS);
             }
-            outFile_ << pValue->un.deadReckoningPose.timestamp << "\n";
-            break;
-        }
-        case SH2_WHEEL_ENCODER: {
-            outFile_ << static_cast<uint16_t>(pValue->un.wheelEncoder.dataType) << ",";
-            outFile_ << static_cast<uint16_t>(pValue->un.wheelEncoder.wheelIndex) << ",";
-            outFile_ << static_cast<uint16_t>(pValue->un.wheelEncoder.data) << ",";
-            outFile_ << static_cast<uint32_t>(pValue->un.wheelEncoder.timestamp) << "\n";
-            break;
         }
-        default:
-            break;
+        idx += n;
+    }
+
+    file_.append(out_.data(), out_.size());
+}
+
+
+// -------------------------------------------------------------------------------------------------
+// DsfLogger::logHalStats
+// -------------------------------------------------------------------------------------------------
+void DsfLogger::logHalStats(const ftdi_hal_Stats_t* pStats, double timestamp) {
+    if (!halStatsDefined_) {
+        halStatsDefined_ = true;
+        // TIME is when the host read the statistics, on the host clock.
+        // It isn't derived from the hub's timestamps like the sensors' TIME
+        // and isn't delay-corrected, so it's marked as host time.
+        text_ << "+" << HAL_STATS_CHANNEL
+              << " TIME{s},RX_BYTES[x]{bytes},RX_ESCAPES[x]{bytes},RX_FRAMES[x]{frames},"
+                 "RX_BSNS[x]{frames},RX_TOO_LONG[x]{frames},RX_TOO_BIG[x]{frames},"
+                 "RX_CLIENT_TOO_SMALL[x]{frames},TX_BYTES[x]{bytes},TX_WRITES[x]{writes},"
+                 "TX_FRAMES[x]{frames},"
+                 "TX_BSQS[x]{frames},TX_STALLS[x]{stalls},TX_STALL_TIME[x]{s},"
+                 "TTY_OVERRUNS[x]{errors},TTY_BUF_OVERRUNS[x]{errors},"
+                 "TTY_FRAMING_ERRORS[x]{errors},TTY_PARITY_ERRORS[x]{errors},"
+                 "TTY_BREAKS[x]{breaks}\n";
+        text_ << "!" << HAL_STATS_CHANNEL << " time_base=\"host\"\n";
+        text_ << "!" << HAL_STATS_CHANNEL << " name=\"HalStats\"\n";
     }
+
+    text_ << "." << HAL_STATS_CHANNEL << " ";
+    text_ << std::fixed << std::setprecision(9) << timestamp << ",";
+    text_.unsetf(std::ios_base::floatfield);
+    text_ << pStats->rxBytes << "," << pStats->rxEscapes << "," << pStats->rxFrames << ","
+          << pStats->rxBsns << "," << pStats->rxTooLong << "," << pStats->rxTooBig << ","
+          << pStats->rxClientTooSmall << "," << pStats->txBytes << "," << pStats->txWrites
+          << "," << pStats->txFrames << "," << pStats->txBsqs << "," << pStats->txStalls << ","
+          << std::setprecision(6) << std::fixed << pStats->txStall_us * 1e-6 << ",";
+    text_.unsetf(std::ios_base::floatfield);
+    text_ << pStats->ttyOverruns << "," << pStats->ttyBufOverruns << ","
+          << pStats->ttyFramingErrors << "," << pStats->ttyParityErrors << ","
+          << pStats->ttyBreaks << "\n";
+    WriteText();
 }
 
 
 // =================================================================================================
 // PRIVATE FUNCTIONS
 // =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// DsfLogger::SensorFields
+// -------------------------------------------------------------------------------------------------
+// Each sensor's fields, one specialization per sensor id, written by
+// SensorFields<sensorId>::write<Ned>() in the log's orientation.
+SENSOR_FIELDS(SH2_RAW_ACCELEROMETER) {
+    const auto& v = pValue->un.rawAccelerometer;
+    out << v.x << "," << v.y << "," << v.z << "," << v.timestamp << "\n";
+}
+
+SENSOR_FIELDS(SH2_ACCELEROMETER) {
+    const auto& v = pValue->un.accelerometer;
+    WriteAxes<Ned>(out, v.x, v.y, v.z);
+    out << "\n";
+}
+
+SENSOR_FIELDS(SH2_LINEAR_ACCELERATION) {
+    const auto& v = pValue->un.linearAcceleration;
+    WriteAxes<Ned>(out, v.x, v.y, v.z);
+    out << "\n";
+}
+
+SENSOR_FIELDS(SH2_GRAVITY) {
+    const auto& v = pValue->un.gravity;
+    WriteAxes<Ned>(out, v.x, v.y, v.z);
+    out << "\n";
+}
+
+SENSOR_FIELDS(SH2_RAW_GYROSCOPE) {
+    const auto& v = pValue->un.rawGyroscope;
+    out << v.x << "," << v.y << "," << v.z << "," << v.temperature << "," << v.timestamp << "\n";
+}
+
+SENSOR_FIELDS(SH2_GYROSCOPE_CALIBRATED) {
+    const auto& v = pValue->un.gyroscope;
+    WriteAxes<Ned>(out, v.x, v.y, v.z);
+    out << "\n";
+}
+
+SENSOR_FIELDS(SH2_GYROSCOPE_UNCALIBRATED) {
+    const auto& v = pValue->un.gyroscopeUncal;
+    WriteAxes<Ned>(out, v.x, v.y, v.z);
+    out << ",";
+    WriteAxes<Ned>(out, v.biasX, v.biasY, v.biasZ);
+    out << "\n";
+}
+
+SENSOR_FIELDS(SH2_RAW_MAGNETOMETER) {
+    const auto& v = pValue->un.rawMagnetometer;
+    out << v.x << "," << v.y << "," << v.z << "," << v.timestamp << "\n";
+}
+
+SENSOR_FIELDS(SH2_MAGNETIC_FIELD_CALIBRATED) {
+    const auto& v = pValue->un.magneticField;
+    WriteAxes<Ned>(out, v.x, v.y, v.z);
+    out << "\n";
+}
+
+SENSOR_FIELDS(SH2_MAGNETIC_FIELD_UNCALIBRATED) {
+    const auto& v = pValue->un.magneticFieldUncal;
+    WriteAxes<Ned>(out, v.x, v.y, v.z);
+    out << ",";
+    WriteAxes<Ned>(out, v.biasX, v.biasY, v.biasZ);
+    out << "\n";
+}
+
+SENSOR_FIELDS(SH2_ROTATION_VECTOR) {
+    const auto& v = pValue->un.rotationVector;
+    WriteQuaternion<Ned>(out, v.real, v.i, v.j, v.k);
+    out << "," << RadiansToDeg(v.accuracy) << "\n";
+}
+
+SENSOR_FIELDS(SH2_GAME_ROTATION_VECTOR) {
+    const auto& v = pValue->un.gameRotationVector;
+    WriteQuaternion<Ned>(out, v.real, v.i, v.j, v.k);
+    out << "\n";
+}
+
+SENSOR_FIELDS(SH2_GEOMAGNETIC_ROTATION_VECTOR) {
+    const auto& v = pValue->un.geoMagRotationVector;
+    WriteQuaternion<Ned>(out, v.real, v.i, v.j, v.k);
+    out << "," << RadiansToDeg(v.accuracy) << "\n";
+}
+
+SENSOR_FIELDS(SH2_PRESSURE) {
+    out << pValue->un.pressure.value << "\n";
+}
+
+SENSOR_FIELDS(SH2_AMBIENT_LIGHT) {
+    out << pValue->un.ambientLight.value << "\n";
+}
+
+SENSOR_FIELDS(SH2_HUMIDITY) {
+    out << pValue->un.humidity.value << "\n";
+}
+
+SENSOR_FIELDS(SH2_PROXIMITY) {
+    out << pValue->un.proximity.value << "\n";
+}
+
+SENSOR_FIELDS(SH2_TEMPERATURE) {
+    out << pValue->un.temperature.value << "\n";
+}
+
+SENSOR_FIELDS(SH2_TAP_DETECTOR) {
+    out << static_cast<uint32_t>(pValue->un.tapDetector.flags) << "\n";
+}
+
+SENSOR_FIELDS(SH2_STEP_DETECTOR) {
+    out << pValue->un.stepDetector.latency << "\n";
+}
+
+SENSOR_FIELDS(SH2_STEP_COUNTER) {
+    out << pValue->un.stepCounter.steps << "," << pValue->un.stepCounter.latency << "\n";
+}
+
+SENSOR_FIELDS(SH2_SIGNIFICANT_MOTION) {
+    out << pValue->un.sigMotion.motion << "\n";
+}
+
+SENSOR_FIELDS(SH2_STABILITY_CLASSIFIER) {
+    out << static_cast<uint32_t>(pValue->un.stabilityClassifier.classification) << "\n";
+}
+
+SENSOR_FIELDS(SH2_SHAKE_DETECTOR) {
+    out << pValue->un.shakeDetector.shake << "\n";
+}
+
+SENSOR_FIELDS(SH2_FLIP_DETECTOR) {
+    out << pValue->un.flipDetector.flip << "\n";
+}
+
+SENSOR_FIELDS(SH2_PICKUP_DETECTOR) {
+    out << pValue->un.pickupDetector.pickup << "\n";
+}
+
+SENSOR_FIELDS(SH2_STABILITY_DETECTOR) {
+    out << pValue->un.stabilityDetector.stability << "\n";
+}
+
+SENSOR_FIELDS(SH2_PERSONAL_ACTIVITY_CLASSIFIER) {
+    const auto& v = pValue->un.personalActivityClassifier;
+    out << static_cast<uint32_t>(v.mostLikelyState) << ",";
+    for (int i = 0; i < 10; i++) {
+        out << static_cast<uint32_t>(v.confidence[i]) << ",";
+    }
+    out << "\n";
+}
+
+SENSOR_FIELDS(SH2_SLEEP_DETECTOR) {
+    out << static_cast<uint32_t>(pValue->un.sleepDetector.sleepState) << "\n";
+}
+
+SENSOR_FIELDS(SH2_TILT_DETECTOR) {
+    out << pValue->un.tiltDetector.tilt << "\n";
+}
+
+SENSOR_FIELDS(SH2_POCKET_DETECTOR) {
+    out << pValue->un.pocketDetector.pocket << "\n";
+}
+
+SENSOR_FIELDS(SH2_CIRCLE_DETECTOR) {
+    out << pValue->un.circleDetector.circle << "\n";
+}
+
+SENSOR_FIELDS(SH2_HEART_RATE_MONITOR) {
+    out << pValue->un.heartRateMonitor.heartRate << "\n";
+}
+
+SENSOR_FIELDS(SH2_ARVR_STABILIZED_RV) {
+    const auto& v = pValue->un.arvrStabilizedRV;
+    WriteQuaternion<Ned>(out, v.real, v.i, v.j, v.k);
+    out << "," << RadiansToDeg(v.accuracy) << "\n";
+}
+
+SENSOR_FIELDS(SH2_ARVR_STABILIZED_GRV) {
+    const auto& v = pValue->un.arvrStabilizedGRV;
+    WriteQuaternion<Ned>(out, v.real, v.i, v.j, v.k);
+    out << "\n";
+}
+
+SENSOR_FIELDS(SH2_GYRO_INTEGRATED_RV) {
+    const auto& v = pValue->un.gyroIntegratedRV;
+    WriteQuaternion<Ned>(out, v.real, v.i, v.j, v.k);
+    out << ",";
+    WriteAxes<Ned>(out, v.angVelX, v.angVelY, v.angVelZ);
+    out << "\n";
+}
+
+SENSOR_FIELDS(SH2_IZRO_MOTION_REQUEST) {
+    out << static_cast<uint32_t>(pValue->un.izroRequest.intent) << ","
+        << static_cast<uint32_t>(pValue->un.izroRequest.request) << "\n";
+}
+
+SENSOR_FIELDS(SH2_RAW_OPTICAL_FLOW) {
+    const auto& v = pValue->un.rawOptFlow;
+    out << static_cast<uint32_t>(v.dx != 0 || v.dy != 0) << ",";
+    out << static_cast<uint32_t>(v.laserOn) << ",";
+    out << static_cast<int16_t>(v.dx) << ",";
+    out << static_cast<int16_t>(v.dy) << ",";
+    out << static_cast<uint32_t>(v.iq) << ",";
+    out << static_cast<uint32_t>(v.resX) << ",";
+    out << static_cast<uint32_t>(v.resY) << ",";
+    out << static_cast<uint32_t>(v.shutter) << ",";
+    out << static_cast<uint32_t>(v.frameMax) << ",";
+    out << static_cast<uint32_t>(v.frameAvg) << ",";
+    out << static_cast<uint32_t>(v.frameMin) << ",";
+    out << static_cast<uint32_t>(v.dt) << ",";
+    out << static_cast<uint32_t>(v.timestamp) << "\n";
+}
+
+SENSOR_FIELDS(SH2_DEAD_RECKONING_POSE) {
+    const auto& v = pValue->un.deadReckoningPose;
+    WriteAxes<Ned>(out, v.linPosX, v.linPosY, v.linPosZ);
+    out << ",";
+    WriteQuaternion<Ned>(out, v.real, v.i, v.j, v.k);
+    out << ",";
+    WriteAxes<Ned>(out, v.linVelX, v.linVelY, v.linVelZ);
+    out << ",";
+    WriteAxes<Ned>(out, v.angVelX, v.angVelY, v.angVelZ);
+    out << "," << v.timestamp << "\n";
+}
+
+SENSOR_FIELDS(SH2_WHEEL_ENCODER) {
+    const auto& v = pValue->un.wheelEncoder;
+    out << static_cast<uint16_t>(v.dataType) << ",";
+    out << static_cast<uint16_t>(v.wheelIndex) << ",";
+    out << static_cast<uint16_t>(v.data) << ",";
+    out << static_cast<uint32_t>(v.timestamp) << "\n";
+}
+
+// -------------------------------------------------------------------------------------------------
+// DsfLogger::GetFieldWriter
+// -------------------------------------------------------------------------------------------------
+template <bool Ned>
+DsfLogger::FieldWriter_t DsfLogger::GetFieldWriter(uint8_t sensorId) {
+    switch (sensorId) {
+        FIELD_WRITER(SH2_RAW_ACCELEROMETER);
+        FIELD_WRITER(SH2_ACCELEROMETER);
+        FIELD_WRITER(SH2_LINEAR_ACCELERATION);
+        FIELD_WRITER(SH2_GRAVITY);
+        FIELD_WRITER(SH2_RAW_GYROSCOPE);
+        FIELD_WRITER(SH2_GYROSCOPE_CALIBRATED);
+        FIELD_WRITER(SH2_GYROSCOPE_UNCALIBRATED);
+        FIELD_WRITER(SH2_RAW_MAGNETOMETER);
+        FIELD_WRITER(SH2_MAGNETIC_FIELD_CALIBRATED);
+        FIELD_WRITER(SH2_MAGNETIC_FIELD_UNCALIBRATED);
+        FIELD_WRITER(SH2_ROTATION_VECTOR);
+        FIELD_WRITER(SH2_GAME_ROTATION_VECTOR);
+        FIELD_WRITER(SH2_GEOMAGNETIC_ROTATION_VECTOR);
+        FIELD_WRITER(SH2_PRESSURE);
+        FIELD_WRITER(SH2_AMBIENT_LIGHT);
+        FIELD_WRITER(SH2_HUMIDITY);
+        FIELD_WRITER(SH2_PROXIMITY);
+        FIELD_WRITER(SH2_TEMPERATURE);
+        FIELD_WRITER(SH2_TAP_DETECTOR);
+        FIELD_WRITER(SH2_STEP_DETECTOR);
+        FIELD_WRITER(SH2_STEP_COUNTER);
+        FIELD_WRITER(SH2_SIGNIFICANT_MOTION);
+        FIELD_WRITER(SH2_STABILITY_CLASSIFIER);
+        FIELD_WRITER(SH2_SHAKE_DETECTOR);
+        FIELD_WRITER(SH2_FLIP_DETECTOR);
+        FIELD_WRITER(SH2_PICKUP_DETECTOR);
+        FIELD_WRITER(SH2_STABILITY_DETECTOR);
+        FIELD_WRITER(SH2_PERSONAL_ACTIVITY_CLASSIFIER);
+        FIELD_WRITER(SH2_SLEEP_DETECTOR);
+        FIELD_WRITER(SH2_TILT_DETECTOR);
+        FIELD_WRITER(SH2_POCKET_DETECTOR);
+        FIELD_WRITER(SH2_CIRCLE_DETECTOR);
+        FIELD_WRITER(SH2_HEART_RATE_MONITOR);
+        FIELD_WRITER(SH2_ARVR_STABILIZED_RV);
+        FIELD_WRITER(SH2_ARVR_STABILIZED_GRV);
+        FIELD_WRITER(SH2_GYRO_INTEGRATED_RV);
+        FIELD_WRITER(SH2_IZRO_MOTION_REQUEST);
+        FIELD_WRITER(SH2_RAW_OPTICAL_FLOW);
+        FIELD_WRITER(SH2_DEAD_RECKONING_POSE);
+        FIELD_WRITER(SH2_WHEEL_ENCODER);
+        default:
+            return nullptr;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// DsfLogger::WriteSensorValue
+// -------------------------------------------------------------------------------------------------
+void DsfLogger::WriteSensorValue(DsfFormatter& out,
+                                 sh2_SensorValue_t* pValue,
+                                 SampleIdExtender* extender,
+                                 double timestamp,
+                                 int64_t delay_uS) {
+    // Write Sensor Report Header
+    WriteSensorReportHeader(out, pValue, extender, timestamp, delay_uS);
+
+    fieldWriters_[pValue->sensorId](out, pValue);
+}
+
+// -------------------------------------------------------------------------------------------------
+// DsfLogger::WriteText
+// -------------------------------------------------------------------------------------------------
+void DsfLogger::WriteText() {
+    const std::string& text = text_.str();
+    file_.append(text.data(), text.size());
+    text_.str(std::string());
+}
+
 // -------------------------------------------------------------------------------------------------
 // DsfLogger::WriteChannelDefinition
 // -------------------------------------------------------------------------------------------------
-void DsfLogger::WriteChannelDefinition(uint8_t sensorId, bool orientation) {
+void DsfLogger::WriteChannelDefinition(DsfFormatter& out, uint8_t sensorId, bool orientation) {
     char const* fieldNames = SensorDsfHeader[sensorId].sensorColumns;
     char const* name = SensorDsfHeader[sensorId].name;
 
-    outFile_ << "+" << static_cast<int32_t>(sensorId)
-             << " TIME{s},SYSTEM_TIME{s},SAMPLE_ID[x]{samples},STATUS[x]{state}," << fieldNames
-             << "\n";
+    out << "+" << static_cast<int32_t>(sensorId)
+        << " TIME{s},SYSTEM_TIME{s},SAMPLE_ID[x]{samples},STATUS[x]{state}," << fieldNames
+        << "\n";
 
     if (orientation) {
         if (sensorId != SH2_RAW_ACCELEROMETER && sensorId != SH2_RAW_GYROSCOPE &&
             sensorId != SH2_RAW_MAGNETOMETER && sensorId != SH2_RAW_OPTICAL_FLOW &&
             sensorId != SH2_WHEEL_ENCODER) {
-            outFile_ << "!" << static_cast<int32_t>(sensorId) << " coordinate_system=";
+            out << "!" << static_cast<int32_t>(sensorId) << " coordinate_system=";
             if (orientationNed_) {
-                outFile_ << "\"NED\"\n";
+                out << "\"NED\"\n";
             } else {
-                outFile_ << "\"ENU\"\n";
+                out << "\"ENU\"\n";
             }
         }
     }
-    outFile_ << "!" << static_cast<int32_t>(sensorId) << " name=\"" << name << "\"\n";
+    out << "!" << static_cast<int32_t>(sensorId) << " name=\"" << name << "\"\n";
 }
 
 // -------------------------------------------------------------------------------------------------
 // DsfLogger::WriteSensorReportHeader
 // -------------------------------------------------------------------------------------------------
-void DsfLogger::WriteSensorReportHeader(sh2_SensorValue_t* pValue,
+void DsfLogger::WriteSensorReportHeader(DsfFormatter& out,
+                                        sh2_SensorValue_t* pValue,
                                         SampleIdExtender* extender,
                                         double timestamp,
                                         int64_t delay_uS) {
-    static double posixOffset_ = 0;
     if (extender->isEmpty()) {
-        WriteChannelDefinition(pValue->sensorId);
+        WriteChannelDefinition(out, pValue->sensorId);
     }
 
-    if (posixOffset_ == 0 && timestamp != 0) {
-#ifdef _WIN32
-        const DWORD64 UNIX_EPOCH = 0x019DB1DED53E8000; // January 1, 1970 in Windows Ticks.
-        const double TICKS_PER_SECOND = 10000000.0;    // Windows tick = 100ns.
-
-        // Get system time
-        FILETIME ft;
-        GetSystemTimeAsFileTime(&ft);
-
-        // Combine parts into LARGE_INTEGER ticks.
-        LARGE_INTEGER ticks;
-        ticks.LowPart = ft.dwLowDateTime;
-        ticks.HighPart = ft.dwHighDateTime;
-
-        // Convert to double, based on Unix epoch, units are seconds.
-        double posix_time = (ticks.QuadPart - UNIX_EPOCH) / TICKS_PER_SECOND;
-
-        // Store offset to convert timestamps to Unix times.
-        posixOffset_ = posix_time - timestamp;
-#else
-        struct timespec tp;
-        clock_gettime(CLOCK_REALTIME, &tp);
-        double posix_time = tp.tv_sec + tp.tv_nsec * 1e-9;
-        posixOffset_ = posix_time - timestamp;
-#endif
-        outFile_ << "! posix_offset=" << std::fixed << std::setprecision(9) << posixOffset_
-                 << std::endl;
+    if (!posixOffsetWritten_ && timestamp != 0) {
+        if (posixOffset_ == 0) {
+            // Store offset to convert timestamps to Unix times.
+            posixOffset_ = PosixTime() - timestamp;
+        }
+        posixOffsetWritten_ = true;
+        out << "! posix_offset=" << DsfFormatter::fixed(posixOffset_, 9) << "\n";
     }
 
-    outFile_ << "." << static_cast<uint32_t>(pValue->sensorId) << " ";
+    out << "." << static_cast<uint32_t>(pValue->sensorId) << " ";
     // First column: delay-corrected timestamp
-    outFile_ << std::fixed << std::setprecision(9) << timestamp << ",";
+    out << DsfFormatter::fixed(timestamp, 9) << ",";
     // Second column: Host arrival time (delay term removed).
-    outFile_ << std::fixed << std::setprecision(9) << (timestamp - (delay_uS * 1e-6)) << ",";
-    outFile_.unsetf(std::ios_base::floatfield);
-    outFile_ << extender->extend(pValue->sequence) << ",";
-    outFile_ << static_cast<uint32_t>(pValue->status) << ",";
+    out << DsfFormatter::fixed(timestamp - (delay_uS * 1e-6), 9) << ",";
+    out << extender->extend(pValue->sequence) << ",";
+    out << static_cast<uint32_t>(pValue->status) << ",";
 }
@@ -17,11 +17,14 @@
 
 #pragma once
 
+#include "AsyncFileWriter.h"
+#include "DsfFormatter.h"
 #include "Logger.h"
 
-#include <fstream>
+#include <sstream>
 #include <stddef.h>
 #include <stdint.h>
+#include <vector>
 
 // =================================================================================================
 // CLASS DEFINITON - SampleIdExtender
@@ -56,8 +59,45 @@ private:
 // =================================================================================================
 class DsfLogger : public Logger {
 public:
-    DsfLogger(){};
-    virtual ~DsfLogger(){};
+    DsfLogger()
+        : writeConfig_(AsyncFileWriter::defaultConfig()),
+          fieldWriters_(),
+          extenders_(),
+          posixOffset_(0),
+          posixOffsetWritten_(false),
+          posixOffsetGiven_(false),
+          halStatsDefined_(false),
+          batchCount_(),
+          batchNext_(){};
+    virtual ~DsfLogger();
+
+    /**
+     * Buffering and sync policy of the file, for the next init().
+     */
+    void setWriteConfig(const AsyncFileWriter::Config_s& config) {
+        writeConfig_ = config;
+    }
+
+    AsyncFileWriter::Stats_s getWriteStats(void) {
+        return file_.getStats();
+    }
+
+    /**
+     * Use offset as the POSIX offset, rather than reading the clock at the
+     * first sensor report, in this and later files.  For rewriting a log
+     * recorded earlier.
+     */
+    void setPosixOffset(double offset) {
+        posixOffset_ = offset;
+        posixOffsetGiven_ = true;
+    }
+
+    /**
+     * DSF channel name and column definitions of a sensor.  Sensors
+     * that aren't logged have no columns ("").
+     */
+    static char const* getSensorName(uint8_t sensorId);
+    static char const* getSensorColumns(uint8_t sensorId);
 
     virtual bool init(char const* filePath, bool ned);
     virtual void finish();
@@ -69,19 +109,72 @@ public:
     virtual void
     logFrsRecord(uint16_t recordId, char const* name, uint32_t* buffer, uint16_t words);
     virtual void logSensorValue(sh2_SensorValue_t* pValue, double timestamp, int64_t delay_uS);
+    virtual void logSensorValues(SensorSample_s* pSamples, size_t count);
+    virtual void logHalStats(const ftdi_hal_Stats_t* pStats, double timestamp);
+    virtual uint32_t flushIfDue() {
+        return file_.flushIfDue();
+    }
 
 private:
     // ---------------------------------------------------------------------------------------------
     // VARIABLES
     // ---------------------------------------------------------------------------------------------
-    std::ofstream outFile_;
+    // The log file, written on its own thread
+    AsyncFileWriter file_;
+    AsyncFileWriter::Config_s writeConfig_;
+
+    // Records other than sensor reports are formatted here, then written
+    std::ostringstream text_;
+
+    // Writes the fields of a sensor report, after its header
+    typedef void (*FieldWriter_t)(DsfFormatter& out, const sh2_SensorValue_t* pValue);
+
+    // Field writer per sensor, for the log's orientation, set by init().
+    // Null for unused sensor ids.
+    FieldWriter_t fieldWriters_[SH2_MAX_SENSOR_ID + 1];
+
+    // Sample id extender per sensor, null for unused sensor ids
+    SampleIdExtender* extenders_[SH2_MAX_SENSOR_ID + 1];
+
+    // Offset from timestamps to POSIX time, set with each file's first sensor
+    // report unless given with setPosixOffset()
+    double posixOffset_;
+    bool posixOffsetWritten_;
+    bool posixOffsetGiven_;
+
+    // HAL statistics channel definition has been written
+    bool halStatsDefined_;
+
+    // logSensorValues() working storage: reports per sensor, the sensors
+    // in order of their first report, and the order to write reports in.
+    uint32_t batchCount_[SH2_MAX_SENSOR_ID + 1];
+    uint32_t batchNext_[SH2_MAX_SENSOR_ID + 1];
+    uint8_t batchIds_[SH2_MAX_SENSOR_ID + 1];
+    std::vector<uint32_t> batchOrder_;
+
+    // Sensor reports (a batch of them from logSensorValues()) are formatted
+    // here, then written to the file at once.
+    DsfFormatter out_;
 
     // ---------------------------------------------------------------------------------------------
     // PRIVATE METHODS
     // ---------------------------------------------------------------------------------------------
-    void WriteChannelDefinition(uint8_t sensorId, bool orientation = true);
-    void WriteSensorReportHeader(sh2_SensorValue_t* pValue,
+    // Sensor report fields, specialized per sensor id and orientation
+    template <uint8_t SensorId>
+    struct SensorFields;
+    template <bool Ned>
+    static FieldWriter_t GetFieldWriter(uint8_t sensorId);
+
+    void WriteText();
+    void WriteChannelDefinition(DsfFormatter& out, uint8_t sensorId, bool orientation = true);
+    void WriteSensorReportHeader(DsfFormatter& out,
+                                 sh2_SensorValue_t* pValue,
                                  SampleIdExtender* extender,
                                  double timestamp,
                                  int64_t delay_uS);
+    void WriteSensorValue(DsfFormatter& out,
+                          sh2_SensorValue_t* pValue,
+                          SampleIdExtender* extender,
+                          double timestamp,
+                          int64_t delay_uS);
 };
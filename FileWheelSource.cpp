@@ -22,6 +22,7 @@
 #endif
 
 #include "FileWheelSource.h"
+#include <chrono>
 #include <cstring>
 #include <iostream>
 #include <string>
@@ -44,8 +45,11 @@ FileWheelSource::FileWheelSource(const char* fn)
         while (running_) {
             std::getline(*input_, tmp);
             if (tmp != "") {
-                std::lock_guard<std::mutex> lock(mtx_);
-                q_.push_back(std::move(tmp));
+                {
+                    std::lock_guard<std::mutex> lock(mtx_);
+                    q_.push_back(std::move(tmp));
+                }
+                notify();
             }
             if (input_->eof()) {
                 // At EOF, clear status and sleep briefly so as not to
@@ -67,12 +71,18 @@ FileWheelSource::~FileWheelSource(void) {
 
 void FileWheelSource::service(void) {
     std::string line("");
+    bool more = false;
     {
         std::lock_guard<std::mutex> lock(mtx_);
         if (!q_.empty()) {
             line = q_.front();
             q_.pop_front();
         }
+        more = !q_.empty();
+    }
+    if (more) {
+        // Lines remain queued: make sure a waiting main loop comes back for them.
+        notify();
     }
     if (line != "") {
         int wheelIndex = -1;
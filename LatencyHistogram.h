@@ -0,0 +1,113 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Distribution of latencies, in microseconds.
+ *
+ * Latencies are counted in 1 us buckets up to FineLimit_us, then in
+ * CoarseWidth_us buckets up to Limit_us.  Anything longer is counted as
+ * Limit_us.  Percentiles are reported as the upper edge of the bucket
+ * they fall in, so they are never understated.
+ */
+class LatencyHistogram {
+public:
+    static const uint32_t FineLimit_us = 2000;
+    static const uint32_t CoarseWidth_us = 100;
+    static const uint32_t Limit_us = 100000;
+
+    LatencyHistogram()
+        : buckets_(FineLimit_us + (Limit_us - FineLimit_us) / CoarseWidth_us + 1, 0),
+          count_(0),
+          total_us_(0),
+          max_us_(0) {
+    }
+
+    void add(uint32_t latency_us) {
+        if (latency_us > max_us_) {
+            max_us_ = latency_us;
+        }
+        total_us_ += latency_us;
+        count_++;
+
+        if (latency_us > Limit_us) {
+            latency_us = Limit_us;
+        }
+        if (latency_us < FineLimit_us) {
+            buckets_[latency_us]++;
+        } else {
+            buckets_[FineLimit_us + (latency_us - FineLimit_us) / CoarseWidth_us]++;
+        }
+    }
+
+    void clear(void) {
+        for (size_t i = 0; i < buckets_.size(); i++) {
+            buckets_[i] = 0;
+        }
+        count_ = 0;
+        total_us_ = 0;
+        max_us_ = 0;
+    }
+
+    uint64_t count(void) const {
+        return count_;
+    }
+
+    uint32_t mean_us(void) const {
+        return (count_ > 0) ? (uint32_t)(total_us_ / count_) : 0;
+    }
+
+    uint32_t max_us(void) const {
+        return max_us_;
+    }
+
+    /**
+     * Latency that fraction (0 to 1) of the samples didn't exceed.
+     */
+    uint32_t percentile_us(double fraction) const {
+        uint64_t target = (uint64_t)(fraction * count_ + 0.5);
+        if (target == 0) {
+            target = 1;
+        }
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < buckets_.size(); i++) {
+            seen += buckets_[i];
+            if (seen >= target) {
+                uint32_t edge_us;
+                if (i < FineLimit_us) {
+                    edge_us = (uint32_t)i;
+                } else {
+                    edge_us = FineLimit_us + (uint32_t)(i - FineLimit_us + 1) * CoarseWidth_us - 1;
+                }
+                return (edge_us < max_us_) ? edge_us : max_us_;
+            }
+        }
+        return max_us_;
+    }
+
+private:
+    std::vector<uint64_t> buckets_;
+    uint64_t count_;
+    uint64_t total_us_;
+    uint32_t max_us_;
+};
@@ -20,6 +20,7 @@
 extern "C" {
 #include "sh2.h"
 #include "sh2_SensorValue.h"
+#include "ftdi_hal.h"
 }
 
 #include <fstream>
@@ -31,6 +32,13 @@ extern "C" {
 // =================================================================================================
 class Logger {
 public:
+    // A sensor report with its timestamps, as passed to logSensorValue()
+    struct SensorSample_s {
+        sh2_SensorValue_t value;
+        double timestamp;
+        int64_t delay_uS;
+    };
+
     Logger(){};
     virtual ~Logger(){};
 
@@ -45,6 +53,24 @@ public:
     logFrsRecord(uint16_t recordId, char const* name, uint32_t* buffer, uint16_t words) = 0;
     virtual void logSensorValue(sh2_SensorValue_t* pValue, double timestamp, int64_t delay_uS) = 0;
 
+    // Log count sensor reports.  Each sensor's reports are written in
+    // order, but reports of different sensors may be grouped by sensor.
+    virtual void logSensorValues(SensorSample_s* pSamples, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            logSensorValue(&pSamples[i].value, pSamples[i].timestamp, pSamples[i].delay_uS);
+        }
+    }
+    // Log the link statistics.  timestamp is host time, timing_now_us() in
+    // seconds when the statistics were read, not a sensor hub timestamp.
+    virtual void logHalStats(const ftdi_hal_Stats_t* pStats, double timestamp) = 0;
+
+    // Hand data held in memory to the file once it's waited the flush
+    // interval, for when nothing is being logged to push it out.  Returns
+    // the time until this is next needed, in us, UINT32_MAX if nothing is held.
+    virtual uint32_t flushIfDue() {
+        return UINT32_MAX;
+    }
+
 protected:
     // ---------------------------------------------------------------------------------------------
     // VARIABLES
@@ -54,7 +80,7 @@ protected:
     // ---------------------------------------------------------------------------------------------
     // PROTECTED METHODS
     // ---------------------------------------------------------------------------------------------
-    double RadiansToDeg(float value) {
+    static double RadiansToDeg(float value) {
         double const PI = 3.1415926535897932384626433832795;
         return (value * 180.0) / PI;
     }
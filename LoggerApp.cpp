@@ -19,6 +19,7 @@ extern "C" {
 #include "sh2_SensorValue.h"
 #include "sh2_err.h"
 #include "sh2_hal.h"
+#include "timing.h"
 }
 
 #include "Logger.h"
@@ -27,6 +28,7 @@ extern "C" {
 
 #include "math.h"
 #include <chrono>
+#include <ctime>
 #include <iomanip>
 #include <iostream>
 #include <string.h>
@@ -36,13 +38,6 @@ extern "C" {
 // =================================================================================================
 // DEFINES AND MACROS
 // =================================================================================================
-enum class State_e {
-    Idle,    // Initial state
-    Reset,   // Target device has been reset. Waiting for the startup response from the system.
-    Startup, // Target device started up successfully. Ready to be configured.
-    Run,     // Configurations complete. Start collecting sensor data.
-};
-
 #ifdef _WIN32
 #define RESET_TIMEOUT_ 1000000
 #else
@@ -51,43 +46,82 @@ enum class State_e {
 
 #define FLUSH_TIMEOUT 0.1f
 
+#define REPORT_INTERVAL_US 1000000
+
 // =================================================================================================
 // DATA TYPES
 // =================================================================================================
+// Start of a timed phase of LoggerApp::init
+struct PhaseTimer_s {
+    std::chrono::steady_clock::time_point wall;
+    std::clock_t cpu;
+};
 
 // =================================================================================================
 // LOCAL VARIABLES
 // =================================================================================================
-static Logger* logger_;
+// The sh2 driver supports one open session per process: the LoggerApp using it.
+static LoggerApp* sh2Owner_ = nullptr;
 
-static WheelSource* wheelSource_;
 
-static State_e state_ = State_e::Idle;
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// startPhase
+// -------------------------------------------------------------------------------------------------
+static void startPhase(PhaseTimer_s* pTimer) {
+    pTimer->wall = std::chrono::steady_clock::now();
+    pTimer->cpu = std::clock();
+}
 
-// Sensor Sample Timestamp
-static double firstSampleTime_us_ = 0;
-static double currSampleTime_us_ = 0;
-static double lastSampleTime_us_ = 0;
+// -------------------------------------------------------------------------------------------------
+// reportPhase
+// -------------------------------------------------------------------------------------------------
+// Report elapsed and CPU time of a phase that issued the given number of
+// commands to the sensor hub.  Since the commands are issued one after
+// another, elapsed time per command approximates the command round-trip time.
+static void reportPhase(PhaseTimer_s* pTimer, char const* name, int commands) {
+    std::chrono::duration<double, std::milli> wall_ms =
+            std::chrono::steady_clock::now() - pTimer->wall;
+    double cpu_ms = 1000.0 * (std::clock() - pTimer->cpu) / CLOCKS_PER_SEC;
+
+    std::ios_base::fmtflags flags = std::cout.flags();
+    std::streamsize precision = std::cout.precision();
+
+    std::cout << "INFO: " << name << ": " << commands << " commands in " << std::fixed
+              << std::setprecision(1) << wall_ms.count() << " ms";
+    if (commands > 0) {
+        std::cout << " (" << wall_ms.count() / commands << " ms each)";
+    }
+    std::cout << ", CPU " << cpu_ms << " ms" << std::endl;
 
-static uint64_t sensorEventsReceived_ = 0;
-static uint64_t lastSensorEventsReceived_ = 0;
+    std::cout.flags(flags);
+    std::cout.precision(precision);
+}
 
-static uint64_t shtpErrors_ = 0;
 
 // =================================================================================================
-// CONST LOCAL VARIABLES
+// PRIVATE FUNCTIONS
 // =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// LoggerApp::EventCallback
+// -------------------------------------------------------------------------------------------------
+void LoggerApp::EventCallback(void* cookie, sh2_AsyncEvent_t* pEvent) {
+    static_cast<LoggerApp*>(cookie)->HandleEvent(pEvent);
+}
 
-static sh2_Hal_t* sh2Hal_ = 0;
-
+// -------------------------------------------------------------------------------------------------
+// LoggerApp::SensorCallback
+// -------------------------------------------------------------------------------------------------
+void LoggerApp::SensorCallback(void* cookie, sh2_SensorEvent_t* pEvent) {
+    static_cast<LoggerApp*>(cookie)->HandleSensorEvent(pEvent);
+}
 
-// =================================================================================================
-// LOCAL FUNCTIONS
-// =================================================================================================
 // -------------------------------------------------------------------------------------------------
-// myEventCallback
+// LoggerApp::HandleEvent
 // -------------------------------------------------------------------------------------------------
-void myEventCallback(void* cookie, sh2_AsyncEvent_t* pEvent) {
+void LoggerApp::HandleEvent(sh2_AsyncEvent_t* pEvent) {
 
     switch (state_) {
         case State_e::Reset:
@@ -116,21 +150,28 @@ void myEventCallback(void* cookie, sh2_AsyncEvent_t* pEvent) {
 }
 
 // -------------------------------------------------------------------------------------------------
-// mySensorCallback
+// LoggerApp::HandleSensorEvent
 // -------------------------------------------------------------------------------------------------
-void mySensorCallback(void* cookie, sh2_SensorEvent_t* pEvent) {
-    static std::chrono::time_point<std::chrono::steady_clock> t0 = std::chrono::steady_clock::now();
-    static bool ready = false;
+void LoggerApp::HandleSensorEvent(sh2_SensorEvent_t* pEvent) {
     sh2_SensorValue_t value;
     int rc = SH2_OK;
 
+    // The report's timestamp less its delay is when its frame started arriving.
+    // Both are on the HAL's 32-bit clock, which wraps cleanly.
+    uint32_t arrival_us = (uint32_t)(pEvent->timestamp_uS - pEvent->delay_uS);
+    latency_.add((uint32_t)timing_now_us() - arrival_us);
+
     rc = sh2_decodeSensorEvent(&value, pEvent);
-    if (!ready) {
-        std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+    if (flushing_) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (flushStart_ == std::chrono::steady_clock::time_point()) {
+            flushStart_ = now;
+        }
+        std::chrono::duration<double> dt = now - flushStart_;
         if (dt.count() > FLUSH_TIMEOUT) {
             // Initial raw data samples may arrive out-of-order which
             // can result in invalid timestamps assignment.
-            ready = true;
+            flushing_ = false;
         } else {
             return;
         }
@@ -156,7 +197,6 @@ void mySensorCallback(void* cookie, sh2_SensorEvent_t* pEvent) {
     logger_->logSensorValue(&value, currSampleTime_us_, pEvent->delay_uS);
 }
 
-
 // =================================================================================================
 // PUBLIC FUNCTIONS
 // =================================================================================================
@@ -169,6 +209,11 @@ int LoggerApp::init(appConfig_s* appConfig,
                     WheelSource* wheelSource) {
     int status;
 
+    if (sh2Owner_ != nullptr) {
+        std::cout << "ERROR: A SensorHub session is already open in this process\n";
+        return -1;
+    }
+
     logger_ = logger;
     wheelSource_ = wheelSource;
     sh2Hal_ = pHal;
@@ -178,21 +223,29 @@ int LoggerApp::init(appConfig_s* appConfig,
     // ---------------------------------------------------------------------------------------------
     state_ = State_e::Reset; // Enter 'Reset' state
     shtpErrors_ = 0;
+    flushing_ = true;
+    flushStart_ = std::chrono::steady_clock::time_point();
+
+    // Time the whole startup, as well as its phases.
+    PhaseTimer_s initTimer;
+    startPhase(&initTimer);
+    int commands = 0;
 
     std::cout << "INFO: Open a session with a SensorHub \n";
-    status = sh2_open(sh2Hal_, myEventCallback, NULL);
+    status = sh2_open(sh2Hal_, EventCallback, this);
     if (status != SH2_OK) {
         std::cout << "ERROR: Failed to open a SensorHub session : " << status << "\n";
         return -1;
     }
+    sh2Owner_ = this;
 
     // ---------------------------------------------------------------------------------------------
     // Set callback for Sensor Data
     // ---------------------------------------------------------------------------------------------
-    status = sh2_setSensorCallback(mySensorCallback, NULL);
+    status = sh2_setSensorCallback(SensorCallback, this);
     if (status != SH2_OK) {
         std::cout << "ERROR: Failed to set Sensor callback\n";
-        return -1;
+        return CloseAfterInitError();
     }
 
     // ---------------------------------------------------------------------------------------------
@@ -224,6 +277,7 @@ int LoggerApp::init(appConfig_s* appConfig,
         } else {
             sh2_reinitialize();
         }
+        commands += appConfig->clearOfCal + appConfig->clearDcd + 1;
     }
 
     // ---------------------------------------------------------------------------------------------
@@ -234,9 +288,10 @@ int LoggerApp::init(appConfig_s* appConfig,
     status = sh2_getProdIds(&productIds);
     if (status != SH2_OK) {
         std::cout << "ERROR: Failed to get product IDs\n";
-        return -1;
+        return CloseAfterInitError();
     }
     logger_->logProductIds(productIds);
+    commands++;
 
     // ---------------------------------------------------------------------------------------------
     // Set DCD Auto Save
@@ -245,8 +300,9 @@ int LoggerApp::init(appConfig_s* appConfig,
     status = sh2_setDcdAutoSave(appConfig->dcdAutoSave);
     if (status != SH2_OK) {
         std::cout << "ERROR: Failed to set DCD Auto Save\n";
-        return -1;
+        return CloseAfterInitError();
     }
+    commands++;
 
     // ---------------------------------------------------------------------------------------------
     // Set Calibration Configuration
@@ -255,14 +311,19 @@ int LoggerApp::init(appConfig_s* appConfig,
     status = sh2_setCalConfig(appConfig->calEnableMask);
     if (status != SH2_OK) {
         std::cout << "ERROR: Failed to set calibration configuration\n";
-        return -1;
+        return CloseAfterInitError();
     }
+    commands++;
 
     // ---------------------------------------------------------------------------------------------
     // Get Device FRS records
     // ---------------------------------------------------------------------------------------------
     std::cout << "INFO: Get FRS Records\n";
-    LogAllFrsRecords();
+    PhaseTimer_s timer;
+    startPhase(&timer);
+    int frsReads = LogAllFrsRecords();
+    reportPhase(&timer, "FRS records", frsReads);
+    commands += frsReads;
 
     // ---------------------------------------------------------------------------------------------
     // Enable Sensors
@@ -271,11 +332,12 @@ int LoggerApp::init(appConfig_s* appConfig,
     pSensorsToEnable_ = appConfig->pSensorsToEnable;
     if (pSensorsToEnable_ == 0 || pSensorsToEnable_->empty()) {
         std::cout << "ERROR: NO Sensor list is specified.\n";
-        return -1;
+        return CloseAfterInitError();
     }
 
     // Enable Sensors
     std::cout << "\nINFO: Enable Sensors\n";
+    startPhase(&timer);
     sh2_SensorConfig_t config;
     for (sensorList_t::iterator it = pSensorsToEnable_->begin(); it != pSensorsToEnable_->end();
          ++it) {
@@ -286,6 +348,9 @@ int LoggerApp::init(appConfig_s* appConfig,
 
         sh2_setSensorConfig(it->sensorId, &config);
     }
+    reportPhase(&timer, "Sensor configuration", (int)pSensorsToEnable_->size());
+    commands += (int)pSensorsToEnable_->size();
+    reportPhase(&initTimer, "Startup", commands);
 
     // Initialization Process complete
     // Transition to RUN state and observe sensor data
@@ -308,9 +373,36 @@ int LoggerApp::service() {
 
     sh2_service();
 
+    flushTimeout_us_ = logger_->flushIfDue();
+    flushChecked_us_ = timing_now_us();
+
     return 1;
 }
 
+// -------------------------------------------------------------------------------------------------
+// LoggerApp::getServiceTimeout_us
+// -------------------------------------------------------------------------------------------------
+uint32_t LoggerApp::getServiceTimeout_us() {
+    uint64_t currSysTime_us = timing_now_us();
+    uint64_t elapsed_us = currSysTime_us - lastReportTime_us_;
+
+    if (elapsed_us >= REPORT_INTERVAL_US) {
+        return 0;
+    }
+    uint32_t timeout_us = static_cast<uint32_t>(REPORT_INTERVAL_US - elapsed_us);
+
+    if (flushTimeout_us_ != UINT32_MAX) {
+        elapsed_us = currSysTime_us - flushChecked_us_;
+        if (elapsed_us >= flushTimeout_us_) {
+            return 0;
+        }
+        if (flushTimeout_us_ - elapsed_us < timeout_us) {
+            timeout_us = static_cast<uint32_t>(flushTimeout_us_ - elapsed_us);
+        }
+    }
+    return timeout_us;
+}
+
 // -------------------------------------------------------------------------------------------------
 // LoggerApp::finish
 // -------------------------------------------------------------------------------------------------
@@ -334,13 +426,26 @@ int LoggerApp::finish() {
     std::cout << "  Done." << std::endl;
 
     std::cout << "INFO: Closing the SensorHub session" << std::endl;
-    sh2_close();       // Close SH2 driver
+    sh2_close(); // Close SH2 driver
+    sh2Owner_ = nullptr;
     logger_->finish(); // Close (DSF) Logger instance
 
     std::cout << "INFO: Shutdown complete" << std::endl;
     return 1;
 }
 
+// -------------------------------------------------------------------------------------------------
+// LoggerApp::CloseAfterInitError
+// -------------------------------------------------------------------------------------------------
+int LoggerApp::CloseAfterInitError() {
+    // Don't leave the sh2 driver holding a HAL the caller is about to free,
+    // and let a later init() open a new session.
+    sh2_close();
+    sh2Owner_ = nullptr;
+    state_ = State_e::Idle;
+    return -1;
+}
+
 // -------------------------------------------------------------------------------------------------
 // LoggerApp::GetSensorConfiguration
 // -------------------------------------------------------------------------------------------------
@@ -355,9 +460,9 @@ void LoggerApp::GetSensorConfiguration(sh2_SensorId_t sensorId, sh2_SensorConfig
 void LoggerApp::ReportProgress() {
     uint64_t currSysTime_us;
 
-    currSysTime_us = sh2Hal_->getTimeUs(sh2Hal_);
+    currSysTime_us = timing_now_us();
 
-    if (currSysTime_us - lastReportTime_us_ >= 1000000) {
+    if (currSysTime_us - lastReportTime_us_ >= REPORT_INTERVAL_US) {
 
         double deltaT = currSampleTime_us_ - firstSampleTime_us_;
         int32_t h = static_cast<int32_t>(floor(deltaT / 60.0 / 60.0));
@@ -401,15 +506,21 @@ int LoggerApp::LogFrsRecord(uint16_t recordId, char const* name) {
 // -------------------------------------------------------------------------------------------------
 // LoggerApp::LogAllFrsRecords
 // -------------------------------------------------------------------------------------------------
-void LoggerApp::LogAllFrsRecords() {
+int LoggerApp::LogAllFrsRecords() {
+    int reads = 1;
     if (LogFrsRecord(STATIC_CALIBRATION_AGM, "scd") == 0) {
         logger_->logMessage("# No SCD present, logging nominal calibration as 'scd'.");
         LogFrsRecord(NOMINAL_CALIBRATION, "scd");
+        reads++;
     }
 
     const LoggerUtil::frsIdMap_s* pFrs;
     for (int i = 0; i < LoggerUtil::NumSh2FrsRecords; i++) {
         pFrs = &LoggerUtil::Sh2FrsRecords[i];
         LogFrsRecord(pFrs->recordId, pFrs->name);
+        reads++;
     }
+
+    // Number of FRS reads performed
+    return reads;
 }
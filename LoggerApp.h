@@ -17,6 +17,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <list>
 #include <stdint.h>
 extern "C" {
@@ -31,15 +32,31 @@ extern "C" {
 // =================================================================================================
 // DATA TYPES
 // =================================================================================================
+#include "LatencyHistogram.h"
 #include "Logger.h"
 #include "WheelSource.h"
 
 // =================================================================================================
 // CLASS DEFINITON - LoggerApp
 // =================================================================================================
+// Each instance logs one sensor hub, through its own HAL and Logger.
 class LoggerApp {
 public:
-    LoggerApp(){};
+    LoggerApp()
+        : logger_(nullptr),
+          wheelSource_(nullptr),
+          sh2Hal_(nullptr),
+          state_(State_e::Idle),
+          firstSampleTime_us_(0),
+          currSampleTime_us_(0),
+          sensorEventsReceived_(0),
+          lastSensorEventsReceived_(0),
+          shtpErrors_(0),
+          flushing_(true),
+          pSensorsToEnable_(nullptr),
+          lastReportTime_us_(0),
+          flushTimeout_us_(UINT32_MAX),
+          flushChecked_us_(0){};
 
     // ---------------------------------------------------------------------------------------------
     // DATA TYPES
@@ -84,21 +101,77 @@ public:
 
     int service();
 
+    // Time until service() next has periodic work to do (progress report,
+    // flushing the log file).  A main loop that sleeps while waiting for
+    // data must not sleep longer than this.
+    uint32_t getServiceTimeout_us();
+
     int finish();
 
+    // Time from each sensor report's arrival on the serial port to its
+    // sensor callback.
+    const LatencyHistogram& getLatency() const {
+        return latency_;
+    }
+
 private:
+    // ---------------------------------------------------------------------------------------------
+    // DATA TYPES
+    // ---------------------------------------------------------------------------------------------
+    enum class State_e {
+        Idle,    // Initial state
+        Reset,   // Target device has been reset. Waiting for the startup response from the system.
+        Startup, // Target device started up successfully. Ready to be configured.
+        Run,     // Configurations complete. Start collecting sensor data.
+    };
+
     // ---------------------------------------------------------------------------------------------
     // VARIABLES
     // ---------------------------------------------------------------------------------------------
+    Logger* logger_;
+    WheelSource* wheelSource_;
+    sh2_Hal_t* sh2Hal_;
+
+    State_e state_;
+
+    // Sensor Sample Timestamp
+    double firstSampleTime_us_;
+    double currSampleTime_us_;
+
+    uint64_t sensorEventsReceived_;
+    uint64_t lastSensorEventsReceived_;
+
+    uint64_t shtpErrors_;
+
+    LatencyHistogram latency_;
+
+    // Initial samples are discarded until FLUSH_TIMEOUT after the first one.
+    bool flushing_;
+    std::chrono::steady_clock::time_point flushStart_;
+
     sensorList_t* pSensorsToEnable_;
     uint64_t lastReportTime_us_;
 
+    // Time until the Logger next needs flushIfDue(), as of flushChecked_us_
+    uint32_t flushTimeout_us_;
+    uint64_t flushChecked_us_;
+
     // ---------------------------------------------------------------------------------------------
     // PRIVATE METHODS
     // ---------------------------------------------------------------------------------------------
+    // sh2 callbacks.  The cookie is the LoggerApp.
+    static void EventCallback(void* cookie, sh2_AsyncEvent_t* pEvent);
+    static void SensorCallback(void* cookie, sh2_SensorEvent_t* pEvent);
+
+    void HandleEvent(sh2_AsyncEvent_t* pEvent);
+    void HandleSensorEvent(sh2_SensorEvent_t* pEvent);
+
+    // Close the session init() opened, after a later step failed.  Returns -1.
+    int CloseAfterInitError();
+
     void GetSensorConfiguration(sh2_SensorId_t sensorId, sh2_SensorConfig_t* pConfig);
     void ReportProgress();
 
     int LogFrsRecord(uint16_t recordId, char const* name);
-    void LogAllFrsRecords();
+    int LogAllFrsRecords();
 };
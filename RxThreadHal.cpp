@@ -0,0 +1,306 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "RxThreadHal.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+extern "C" {
+#include "sh2_err.h"
+}
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+
+// Longest the acquisition thread sleeps in the wrapped HAL's wait function.
+// Bounds how long close() takes to stop the thread.
+#define RX_WAIT_US (10000)
+
+// Poll interval if the wrapped HAL has no wait function.
+#define RX_POLL_US (100)
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+
+// Restrict thread to run on cpu only.  Returns false if that isn't possible.
+static bool pinThread(std::thread& thread, int cpu) {
+#ifdef _WIN32
+    return SetThreadAffinityMask(thread.native_handle(), (DWORD_PTR)1 << cpu) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+    (void)thread;
+    (void)cpu;
+    return false;
+#endif
+}
+
+// =================================================================================================
+// PUBLIC FUNCTIONS
+// =================================================================================================
+
+RxThreadHal::RxThreadHal(sh2_Hal_t* pInner, WaitFn_t waitFn, uint32_t capacity)
+    : pInner_(pInner),
+      waitFn_(waitFn),
+      queue_(capacity),
+      overflows_(0),
+      running_(false),
+      cpu_(-1),
+      spin_us_(0),
+      consumerWaiting_(false),
+      woken_(false) {
+    shim_.hal.open = open_;
+    shim_.hal.close = close_;
+    shim_.hal.read = read_;
+    shim_.hal.write = write_;
+    shim_.hal.getTimeUs = getTimeUs_;
+    shim_.self = this;
+}
+
+RxThreadHal::~RxThreadHal() {
+    if (running_) {
+        close();
+    }
+}
+
+void RxThreadHal::setCpu(int cpu) {
+    cpu_ = cpu;
+}
+
+void RxThreadHal::setSpinUs(uint32_t spin_us) {
+    spin_us_ = spin_us;
+}
+
+sh2_Hal_t* RxThreadHal::getHal(void) {
+    return &shim_.hal;
+}
+
+int RxThreadHal::wait(uint32_t timeout_us) {
+    if (spin_us_ > 0) {
+        // Frames tend to follow shortly after frames, so busy-poll for a
+        // while rather than pay the wake-up latency of a blocking wait.
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point deadline =
+                now + std::chrono::microseconds(timeout_us);
+        std::chrono::steady_clock::time_point spinEnd =
+                lastRead_ + std::chrono::microseconds(spin_us_);
+        if (spinEnd > deadline) {
+            spinEnd = deadline;
+        }
+        while (now < spinEnd) {
+            if (!queue_.empty()) {
+                return 1;
+            }
+            // Let the acquisition thread run if it shares our CPU.
+            std::this_thread::yield();
+            now = std::chrono::steady_clock::now();
+        }
+        if (now >= deadline) {
+            return 0;
+        }
+        timeout_us = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(deadline - now)
+                             .count();
+    }
+
+    std::unique_lock<std::mutex> lock(waitMtx_);
+
+    // Announce we are waiting before checking the ring.  The acquisition
+    // thread checks consumerWaiting_ after pushing, so one of us sees the other.
+    consumerWaiting_ = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    bool ready = waitCv_.wait_for(lock, std::chrono::microseconds(timeout_us), [this] {
+        return woken_ || !queue_.empty();
+    });
+
+    consumerWaiting_ = false;
+    woken_ = false;
+
+    return ready ? 1 : 0;
+}
+
+void RxThreadHal::wake(void) {
+    std::lock_guard<std::mutex> lock(waitMtx_);
+    woken_ = true;
+    waitCv_.notify_one();
+}
+
+RxThreadHal::Stats_s RxThreadHal::getStats(void) {
+    Stats_s stats;
+
+    stats.capacity = (uint32_t)queue_.capacity();
+    stats.highWater = (uint32_t)queue_.highWater();
+    stats.overflows = overflows_;
+
+    return stats;
+}
+
+void RxThreadHal::withInner(const std::function<void(sh2_Hal_t*)>& fn) {
+    std::lock_guard<std::mutex> lock(innerMtx_);
+    fn(pInner_);
+}
+
+// =================================================================================================
+// PRIVATE FUNCTIONS
+// =================================================================================================
+
+// -------------------------------------------------------------------------------------------------
+// sh2_Hal_t entry points
+// -------------------------------------------------------------------------------------------------
+int RxThreadHal::open_(sh2_Hal_t* self) {
+    return ((Shim_s*)self)->self->open();
+}
+
+void RxThreadHal::close_(sh2_Hal_t* self) {
+    ((Shim_s*)self)->self->close();
+}
+
+int RxThreadHal::read_(sh2_Hal_t* self, uint8_t* pBuffer, unsigned len, uint32_t* t_us) {
+    return ((Shim_s*)self)->self->read(pBuffer, len, t_us);
+}
+
+int RxThreadHal::write_(sh2_Hal_t* self, uint8_t* pBuffer, unsigned len) {
+    return ((Shim_s*)self)->self->write(pBuffer, len);
+}
+
+uint32_t RxThreadHal::getTimeUs_(sh2_Hal_t* self) {
+    sh2_Hal_t* pInner = ((Shim_s*)self)->self->pInner_;
+    return pInner->getTimeUs(pInner);
+}
+
+// -------------------------------------------------------------------------------------------------
+// Consumer side
+// -------------------------------------------------------------------------------------------------
+int RxThreadHal::open(void) {
+    if (running_) {
+        return SH2_ERR;
+    }
+
+    queue_.clear();
+    overflows_ = 0;
+    woken_ = false;
+
+    int status = pInner_->open(pInner_);
+    if (status != SH2_OK) {
+        return status;
+    }
+
+    running_ = true;
+    acquirer_ = std::thread(&RxThreadHal::acquire, this);
+    if ((cpu_ >= 0) && !pinThread(acquirer_, cpu_)) {
+        std::cerr << "WARNING: Unable to pin the RX thread to CPU " << cpu_ << std::endl;
+    }
+
+    return SH2_OK;
+}
+
+void RxThreadHal::close(void) {
+    running_ = false;
+    if (acquirer_.joinable()) {
+        acquirer_.join();
+    }
+
+    pInner_->close(pInner_);
+}
+
+int RxThreadHal::read(uint8_t* pBuffer, unsigned len, uint32_t* t_us) {
+    Frame_s* pFrame = queue_.readSlot();
+    if (pFrame == nullptr) {
+        return 0;
+    }
+
+    int retval = 0;
+    if (pFrame->len <= len) {
+        memcpy(pBuffer, pFrame->data, pFrame->len);
+        *t_us = pFrame->t_us;
+        retval = pFrame->len;
+    }
+    queue_.pop();
+
+    if (spin_us_ > 0) {
+        lastRead_ = std::chrono::steady_clock::now();
+    }
+
+    return retval;
+}
+
+int RxThreadHal::write(uint8_t* pBuffer, unsigned len) {
+    std::lock_guard<std::mutex> lock(innerMtx_);
+    return pInner_->write(pInner_, pBuffer, len);
+}
+
+// -------------------------------------------------------------------------------------------------
+// Acquisition thread
+// -------------------------------------------------------------------------------------------------
+void RxThreadHal::acquire(void) {
+    std::chrono::steady_clock::time_point lastFrame = std::chrono::steady_clock::now();
+
+    while (running_) {
+        Frame_s* pFrame = queue_.writeSlot();
+        Frame_s* pDest = (pFrame != nullptr) ? pFrame : &discard_;
+
+        int len;
+        {
+            std::lock_guard<std::mutex> lock(innerMtx_);
+            len = pInner_->read(pInner_, pDest->data, sizeof(pDest->data), &pDest->t_us);
+        }
+
+        if (len > 0) {
+            if (spin_us_ > 0) {
+                lastFrame = std::chrono::steady_clock::now();
+            }
+            if (pFrame == nullptr) {
+                overflows_++;
+                continue;
+            }
+
+            pFrame->len = len;
+            queue_.push();
+
+            // Pairs with the fence in wait()
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (consumerWaiting_) {
+                std::lock_guard<std::mutex> lock(waitMtx_);
+                waitCv_.notify_one();
+            }
+        } else if ((spin_us_ > 0) && (std::chrono::steady_clock::now() - lastFrame <
+                                      std::chrono::microseconds(spin_us_))) {
+            // Frames tend to follow shortly after frames, so keep reading
+            // rather than sleep.  Reading here, under innerMtx_, rather than
+            // spinning in waitFn_ keeps the port serialized with write().
+            std::this_thread::yield();
+        } else if (waitFn_ != nullptr) {
+            waitFn_(pInner_, RX_WAIT_US);
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(RX_POLL_US));
+        }
+    }
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+extern "C" {
+#include "sh2_hal.h"
+}
+
+#include "SpscQueue.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/**
+ * HAL wrapper that receives on a dedicated acquisition thread.
+ *
+ * While open, the acquisition thread does nothing but read frames from
+ * the wrapped HAL and queue them, with their timestamps, in a lock-free
+ * ring.  The sh2 library consumes them through the sh2_Hal_t returned
+ * by getHal(), so slow processing on the consumer side (log formatting,
+ * file writes) doesn't hold off draining the serial port.
+ *
+ * If the ring is full, newly received frames are dropped and counted
+ * as overflows.
+ */
+class RxThreadHal {
+public:
+    // Wait function of the wrapped HAL, e.g. ftdi_hal_wait.  It's called on
+    // the acquisition thread without the lock that serializes read() with
+    // write() and withInner(), so it may only touch receive state that
+    // read() alone changes, and must not read the port itself: with
+    // ftdi_hal_wait, leave ftdi_hal_setRxSpinUs() at 0 and use setSpinUs().
+    typedef int (*WaitFn_t)(sh2_Hal_t* self, uint32_t timeout_us);
+
+    struct Stats_s {
+        uint32_t capacity;  // Ring size in frames
+        uint32_t highWater; // Most frames queued at once
+        uint32_t overflows; // Frames dropped because the ring was full
+    };
+
+    /**
+     * Wrap pInner.  If waitFn is provided, the acquisition thread
+     * sleeps in it between reads, otherwise it polls.
+     */
+    RxThreadHal(sh2_Hal_t* pInner, WaitFn_t waitFn = nullptr, uint32_t capacity = 256);
+    ~RxThreadHal();
+
+    /**
+     * Pin the acquisition thread to a CPU (e.g. an isolated core) from
+     * the next open().  -1, the default, leaves it to the scheduler.
+     */
+    void setCpu(int cpu);
+
+    /**
+     * Make wait() busy-poll for up to spin_us after the last frame was
+     * read, before falling back to a blocking wait, and the acquisition
+     * thread keep reading the wrapped HAL for as long after a frame
+     * arrives before sleeping in its wait function.  0, the default,
+     * always blocks.
+     */
+    void setSpinUs(uint32_t spin_us);
+
+    /**
+     * The HAL to hand to sh2_open().
+     */
+    sh2_Hal_t* getHal(void);
+
+    /**
+     * Block until a frame is queued, wake() is called or timeout_us
+     * elapses.  Returns 1 if a frame is available (or woken), 0 on timeout.
+     */
+    int wait(uint32_t timeout_us);
+
+    /**
+     * Cause a pending (or the next) wait() to return immediately.
+     * May be called from any thread.
+     */
+    void wake(void);
+
+    Stats_s getStats(void);
+
+    /**
+     * Run fn on the wrapped HAL, holding off the acquisition thread, e.g.
+     * to read its statistics.
+     */
+    void withInner(const std::function<void(sh2_Hal_t*)>& fn);
+
+private:
+    struct Frame_s {
+        uint32_t t_us;
+        uint32_t len;
+        uint8_t data[SH2_HAL_MAX_PAYLOAD_IN];
+    };
+
+    // sh2_Hal_t must be first so the library's pointer leads back to us.
+    struct Shim_s {
+        sh2_Hal_t hal;
+        RxThreadHal* self;
+    };
+
+    static int open_(sh2_Hal_t* self);
+    static void close_(sh2_Hal_t* self);
+    static int read_(sh2_Hal_t* self, uint8_t* pBuffer, unsigned len, uint32_t* t_us);
+    static int write_(sh2_Hal_t* self, uint8_t* pBuffer, unsigned len);
+    static uint32_t getTimeUs_(sh2_Hal_t* self);
+
+    int open(void);
+    void close(void);
+    int read(uint8_t* pBuffer, unsigned len, uint32_t* t_us);
+    int write(uint8_t* pBuffer, unsigned len);
+
+    void acquire(void);
+
+    Shim_s shim_;
+    sh2_Hal_t* pInner_;
+    WaitFn_t waitFn_;
+
+    SpscQueue<Frame_s> queue_;
+    Frame_s discard_; // Frames received while the ring is full are read into here and dropped
+    std::atomic<uint32_t> overflows_;
+
+    // Serializes calls into the wrapped HAL between the acquisition
+    // thread (read) and the sh2 thread (write).
+    std::mutex innerMtx_;
+
+    std::thread acquirer_;
+    std::atomic<bool> running_;
+    int cpu_;
+
+    // Consumer side busy-polling
+    uint32_t spin_us_;
+    std::chrono::steady_clock::time_point lastRead_;
+
+    // Used to put the consumer to sleep in wait().
+    std::mutex waitMtx_;
+    std::condition_variable waitCv_;
+    std::atomic<bool> consumerWaiting_;
+    bool woken_;
+};
@@ -0,0 +1,955 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Sh2Emulator.h"
+
+extern "C" {
+#include "soft_link.h"
+#include "timing.h"
+}
+
+#include <algorithm>
+#include <errno.h>
+#include <iostream>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define PROTOCOL_CONTROL (0)
+#define PROTOCOL_SHTP (1)
+
+#define SHTP_HDR_LEN (4)
+
+// SHTP channels
+#define CHAN_EXECUTABLE (1)
+#define CHAN_CONTROL (2)
+#define CHAN_INPUT_NORMAL (3)
+#define CHAN_INPUT_WAKE (4)
+#define CHAN_INPUT_GIRV (5)
+
+// Executable channel
+#define EXECUTABLE_RESET (1)
+#define EXECUTABLE_RESET_COMPLETE (1)
+
+// Sensor hub report ids
+#define GET_FEATURE_REQ (0xFE)
+#define SET_FEATURE_CMD (0xFD)
+#define GET_FEATURE_RESP (0xFC)
+#define BASE_TIMESTAMP_REF (0xFB)
+#define PROD_ID_REQ (0xF9)
+#define PROD_ID_RESP (0xF8)
+#define FRS_WRITE_REQ (0xF7)
+#define FRS_WRITE_DATA_REQ (0xF6)
+#define FRS_WRITE_RESP (0xF5)
+#define FRS_READ_REQ (0xF4)
+#define FRS_READ_RESP (0xF3)
+#define COMMAND_REQ (0xF2)
+#define COMMAND_RESP (0xF1)
+#define FORCE_FLUSH (0xF0)
+#define FLUSH_COMPLETED (0xEF)
+
+// Command request ids
+#define CMD_INITIALIZE (0x04)
+#define CMD_SAVE_DCD (0x06)
+#define CMD_ME_CAL (0x07)
+#define CMD_DCD_PERIOD_SAVE (0x09)
+#define CMD_CLEAR_DCD_RESET (0x0B)
+
+// FRS read status
+#define FRS_READ_NO_ERROR (0)
+#define FRS_READ_COMPLETE (3)
+#define FRS_READ_OFFSET_OUT_OF_RANGE (4)
+#define FRS_READ_RECORD_EMPTY (5)
+#define FRS_READ_BLOCK_COMPLETE (6)
+#define FRS_READ_BLOCK_AND_RECORD_COMPLETE (7)
+
+// FRS write status
+#define FRS_WRITE_WORD_RECEIVED (0)
+#define FRS_WRITE_COMPLETE (3)
+#define FRS_WRITE_READY (4)
+#define FRS_WRITE_NOT_IN_WRITE_MODE (6)
+
+// Receive buffer space advertised in buffer status notifications
+#define HUB_RX_BUF_LEN (1024)
+
+// Fastest report interval accepted
+#define MIN_INTERVAL_US (10)
+
+// Report delays are 14 bits of 100us, so a batch can't span more than this
+#define MAX_BATCH_US (1000000)
+
+// Drop packets rather than queue more than this many bytes for the host
+#define TX_BACKLOG_MAX (65536)
+
+// If the emulator falls further behind than this, skip the missed samples
+#define MAX_CATCHUP_US (100000)
+
+// Longest getServiceTimeout_us() returns with nothing scheduled
+#define IDLE_TIMEOUT_US (100000)
+
+// Rotation rate about the vertical axis of the simulated device
+#define YAW_RATE_RADPS (0.5)
+
+#define GRAVITY_MPS2 (9.80665)
+
+// =================================================================================================
+// CONST LOCAL VARIABLES
+// =================================================================================================
+// Length of each sensor's input report, 0 for reserved ids.  Must agree with the sh2 library.
+static const uint8_t ReportLen[SH2_MAX_SENSOR_ID + 1] = {
+        0,  // 0x00 Reserved
+        10, // 0x01 Accelerometer
+        10, // 0x02 Gyroscope
+        10, // 0x03 Magnetic Field
+        10, // 0x04 Linear Acceleration
+        14, // 0x05 Rotation Vector
+        10, // 0x06 Gravity
+        16, // 0x07 Uncalibrated Gyroscope
+        12, // 0x08 Game Rotation Vector
+        14, // 0x09 Geomagnetic Rotation Vector
+        8,  // 0x0A Pressure
+        8,  // 0x0B Ambient Light
+        6,  // 0x0C Humidity
+        6,  // 0x0D Proximity
+        6,  // 0x0E Temperature
+        16, // 0x0F Uncalibrated MagneticField
+        5,  // 0x10 Tap Detector
+        12, // 0x11 Step Counter
+        6,  // 0x12 Significant Motion
+        6,  // 0x13 Stability Classifier
+        16, // 0x14 Raw Accelerometer
+        16, // 0x15 Raw Gyroscope
+        16, // 0x16 Raw Magnetometer
+        0,  // 0x17 Reserved
+        8,  // 0x18 Step Detector
+        6,  // 0x19 Shake Detector
+        6,  // 0x1A Flip Detector
+        6,  // 0x1B Pickup Detector
+        6,  // 0x1C Stability Detector
+        0,  // 0x1D Reserved
+        16, // 0x1E Personal Activity Classifier
+        6,  // 0x1F Sleep Detector
+        6,  // 0x20 Tilt Detector
+        6,  // 0x21 Pocket Detector
+        6,  // 0x22 Circle Detector
+        6,  // 0x23 Heart Rate Monitor
+        0,  // 0x24 Reserved
+        0,  // 0x25 Reserved
+        0,  // 0x26 Reserved
+        0,  // 0x27 Reserved
+        14, // 0x28 ARVR Stabilized Rotation Vector
+        12, // 0x29 ARVR Stabilized GameRotation Vector
+        14, // 0x2A Gyro Rotation Vector (channel 5, no report header)
+        6,  // 0x2B IZRO Motion Request
+        24, // 0x2C Raw Optical Flow
+        60, // 0x2D Dead Reckoning Pose
+        12, // 0x2E Wheel Encoder
+};
+
+struct ProdId_s {
+    uint8_t versionMajor;
+    uint8_t versionMinor;
+    uint32_t partNumber;
+    uint32_t buildNumber;
+    uint16_t versionPatch;
+};
+
+static const ProdId_s ProdIds[] = {
+        {3, 9, 10003606, 400, 9},
+        {4, 2, 10003171, 12, 0},
+        {1, 0, 10003251, 230, 2},
+        {1, 0, 10003254, 102, 0},
+};
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+static void put16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint16_t get16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+// Fixed point value with q fractional bits
+static int16_t fix16(double v, int q) {
+    return (int16_t)lround(v * (1 << q));
+}
+
+static void putVec(uint8_t* p, double x, double y, double z, int q) {
+    put16(p, (uint16_t)fix16(x, q));
+    put16(p + 2, (uint16_t)fix16(y, q));
+    put16(p + 4, (uint16_t)fix16(z, q));
+}
+
+// Quaternion of a rotation by yaw about the vertical axis, Q14
+static void putQuat(uint8_t* p, double yaw) {
+    putVec(p, 0.0, 0.0, sin(yaw / 2), 14);
+    put16(p + 6, (uint16_t)fix16(cos(yaw / 2), 14));
+}
+
+// Fill in the data fields of a sensor report (everything after the
+// 4 byte report header) for a device turning steadily about the vertical.
+static void fillReport(uint8_t sensorId, uint8_t* p, uint64_t sample_us) {
+    double t = sample_us * 1e-6;
+    double yaw = YAW_RATE_RADPS * t;
+
+    switch (sensorId) {
+        case SH2_ACCELEROMETER:
+        case SH2_GRAVITY:
+            putVec(p, 0.0, 0.0, GRAVITY_MPS2, 8);
+            break;
+        case SH2_LINEAR_ACCELERATION:
+            putVec(p, 0.5 * sin(2 * M_PI * t), 0.0, 0.0, 8);
+            break;
+        case SH2_GYROSCOPE_CALIBRATED:
+            putVec(p, 0.0, 0.0, YAW_RATE_RADPS, 9);
+            break;
+        case SH2_GYROSCOPE_UNCALIBRATED:
+            putVec(p, 0.01, 0.01, YAW_RATE_RADPS + 0.01, 9);
+            putVec(p + 6, 0.01, 0.01, 0.01, 9);
+            break;
+        case SH2_MAGNETIC_FIELD_CALIBRATED:
+            putVec(p, 25.0 * cos(yaw), -25.0 * sin(yaw), -40.0, 4);
+            break;
+        case SH2_MAGNETIC_FIELD_UNCALIBRATED:
+            putVec(p, 25.0 * cos(yaw) + 5.0, -25.0 * sin(yaw) + 5.0, -35.0, 4);
+            putVec(p + 6, 5.0, 5.0, 5.0, 4);
+            break;
+        case SH2_ROTATION_VECTOR:
+        case SH2_GEOMAGNETIC_ROTATION_VECTOR:
+        case SH2_ARVR_STABILIZED_RV:
+            putQuat(p, yaw);
+            put16(p + 8, (uint16_t)fix16(0.05, 12)); // accuracy estimate, radians
+            break;
+        case SH2_GAME_ROTATION_VECTOR:
+        case SH2_ARVR_STABILIZED_GRV:
+            putQuat(p, yaw);
+            break;
+        case SH2_RAW_ACCELEROMETER:
+        case SH2_RAW_GYROSCOPE:
+        case SH2_RAW_MAGNETOMETER:
+            // ADC counts, temperature (or reserved) and sample time
+            putVec(p, 0.0, 0.0, 4096.0, 0);
+            put16(p + 6, 0);
+            put32(p + 8, (uint32_t)sample_us);
+            break;
+        case SH2_PRESSURE:
+            put32(p, (uint32_t)(1013.25 * (1 << 20))); // hPa
+            break;
+        case SH2_AMBIENT_LIGHT:
+            put32(p, 300 << 8); // lux
+            break;
+        case SH2_HUMIDITY:
+            put16(p, 45 << 8); // %
+            break;
+        case SH2_PROXIMITY:
+            put16(p, 5 << 4); // cm
+            break;
+        case SH2_TEMPERATURE:
+            put16(p, 25 << 7); // degrees C
+            break;
+        default:
+            break;
+    }
+}
+
+// =================================================================================================
+// PUBLIC FUNCTIONS
+// =================================================================================================
+Sh2Emulator::Sh2Emulator(uint32_t maxCargo, uint32_t batch_us, bool bsnAfterFrame)
+    : fd_(-1),
+      connected_(false),
+      resetN_(true),
+      bootN_(true),
+      running_(false),
+      maxCargo_(maxCargo),
+      batch_us_(std::min(batch_us, (uint32_t)MAX_BATCH_US)),
+      bsnAfterFrame_(bsnAfterFrame),
+      txIdx_(0),
+      cmdRespSeq_(0),
+      calConfig_(0),
+      frsWriting_(false),
+      frsWriteType_(0) {
+    rfc1662_decoderInit(&decoder_, rxFrame_, sizeof(rxFrame_));
+
+    normal_.channel = CHAN_INPUT_NORMAL;
+    wake_.channel = CHAN_INPUT_WAKE;
+
+    memset(&stats_, 0, sizeof(stats_));
+
+    // A few records so FRS reads have something to return.  The rest read as empty.
+    frs_[SERIAL_NUMBER] = {12345};
+    frs_[SYSTEM_ORIENTATION] = {0, 0, 0, 0x40000000}; // identity, Q30
+    frs_[NOMINAL_CALIBRATION] = std::vector<uint32_t>(32, 0);
+
+    reset();
+}
+
+void Sh2Emulator::connect(int fd) {
+    fd_ = fd;
+    connected_ = true;
+    resetN_ = true;
+    bootN_ = true;
+    rfc1662_decoderReset(&decoder_);
+    reset();
+}
+
+void Sh2Emulator::disconnect(void) {
+    reset();
+    connected_ = false;
+    fd_ = -1;
+}
+
+bool Sh2Emulator::service(void) {
+    if (!connected_) {
+        return false;
+    }
+
+    // Receive
+    uint8_t buf[4096];
+    while (true) {
+        ssize_t got = read(fd_, buf, sizeof(buf));
+        if (got == 0) {
+            // Host hung up
+            return false;
+        }
+        if (got < 0) {
+            if ((errno == EAGAIN) || (errno == EINTR)) {
+                break;
+            }
+            return false;
+        }
+
+        uint32_t idx = 0;
+        while (idx < (uint32_t)got) {
+            idx += rfc1662_decode(&decoder_, buf + idx, (uint32_t)got - idx);
+            if (decoder_.frameReady) {
+                if (decoder_.frameLen <= sizeof(rxFrame_)) {
+                    rxFrame(rxFrame_, decoder_.frameLen);
+                }
+                rfc1662_decoderReset(&decoder_);
+            }
+        }
+    }
+
+    // Generate
+    if (running_) {
+        generate(timing_now_us());
+    }
+
+    // Transmit
+    return flushTx();
+}
+
+uint32_t Sh2Emulator::getServiceTimeout_us(void) {
+    uint64_t now = timing_now_us();
+    uint64_t next = now + IDLE_TIMEOUT_US;
+
+    if (running_) {
+        for (uint8_t id : enabled_) {
+            next = std::min(next, sensors_[id].nextSample_us);
+        }
+        if (normal_.reports > 0) {
+            next = std::min(next, normal_.base_us + batch_us_);
+        }
+        if (wake_.reports > 0) {
+            next = std::min(next, wake_.base_us + batch_us_);
+        }
+    }
+
+    return (next > now) ? (uint32_t)(next - now) : 0;
+}
+
+bool Sh2Emulator::txPending(void) {
+    return txIdx_ < tx_.size();
+}
+
+Sh2Emulator::Stats_s Sh2Emulator::getStats(void) {
+    return stats_;
+}
+
+// =================================================================================================
+// PRIVATE FUNCTIONS
+// =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// Reset and boot
+// -------------------------------------------------------------------------------------------------
+void Sh2Emulator::reset(void) {
+    running_ = false;
+
+    for (int id = 0; id <= SH2_MAX_SENSOR_ID; id++) {
+        memset(&sensors_[id], 0, sizeof(sensors_[id]));
+    }
+    enabled_.clear();
+
+    normal_.cargo.clear();
+    normal_.reports = 0;
+    wake_.cargo.clear();
+    wake_.reports = 0;
+
+    // Anything not yet sent is lost with the reset
+    tx_.clear();
+    txIdx_ = 0;
+
+    memset(txSeq_, 0, sizeof(txSeq_));
+    cmdRespSeq_ = 0;
+    frsWriting_ = false;
+}
+
+void Sh2Emulator::bootComplete(void) {
+    running_ = true;
+
+    uint8_t resp = EXECUTABLE_RESET_COMPLETE;
+    sendShtp(CHAN_EXECUTABLE, &resp, sizeof(resp));
+}
+
+// -------------------------------------------------------------------------------------------------
+// Receive
+// -------------------------------------------------------------------------------------------------
+void Sh2Emulator::rxFrame(const uint8_t* pFrame, uint32_t len) {
+    uint8_t protocol = pFrame[0];
+
+    if (protocol == PROTOCOL_CONTROL) {
+        // A frame with no data is a buffer status query
+        if (len == 1) {
+            sendBsn();
+        }
+        return;
+    }
+
+    if (protocol == SOFT_LINK_PROTOCOL_LINE) {
+        if (len >= 3) {
+            rxLine(pFrame[1], pFrame[2]);
+        }
+        return;
+    }
+
+    if ((protocol != PROTOCOL_SHTP) || !running_ || (len < 1 + SHTP_HDR_LEN)) {
+        return;
+    }
+
+    const uint8_t* pPacket = pFrame + 1;
+    uint32_t packetLen = get16(pPacket) & 0x7FFF;
+    if (packetLen > len - 1) {
+        packetLen = len - 1;
+    }
+    uint8_t channel = pPacket[2];
+    const uint8_t* pCargo = pPacket + SHTP_HDR_LEN;
+    uint32_t cargoLen = (packetLen > SHTP_HDR_LEN) ? packetLen - SHTP_HDR_LEN : 0;
+
+    if ((channel == CHAN_CONTROL) && (cargoLen > 0)) {
+        rxControl(pCargo, cargoLen);
+    } else if ((channel == CHAN_EXECUTABLE) && (cargoLen > 0) && (pCargo[0] == EXECUTABLE_RESET)) {
+        reset();
+        bootComplete();
+    }
+
+    // Ready for the next transfer
+    if (bsnAfterFrame_) {
+        sendBsn();
+    }
+}
+
+void Sh2Emulator::rxLine(uint8_t line, uint8_t level) {
+    if (line == SOFT_LINK_BOOTN) {
+        bootN_ = (level != 0);
+        return;
+    }
+    if (line != SOFT_LINK_RESETN) {
+        return;
+    }
+
+    bool wasReset = !resetN_;
+    resetN_ = (level != 0);
+
+    if (!resetN_) {
+        reset();
+    } else if (wasReset) {
+        if (bootN_) {
+            bootComplete();
+        } else {
+            std::cerr << "INFO: Bootloader mode requested, not emulated." << std::endl;
+        }
+    }
+}
+
+void Sh2Emulator::rxControl(const uint8_t* pCargo, uint32_t len) {
+    switch (pCargo[0]) {
+        case PROD_ID_REQ:
+            for (const ProdId_s& id : ProdIds) {
+                uint8_t resp[16] = {0};
+                resp[0] = PROD_ID_RESP;
+                resp[1] = 4; // reset cause: external reset
+                resp[2] = id.versionMajor;
+                resp[3] = id.versionMinor;
+                put32(resp + 4, id.partNumber);
+                put32(resp + 8, id.buildNumber);
+                put16(resp + 12, id.versionPatch);
+                sendShtp(CHAN_CONTROL, resp, sizeof(resp));
+            }
+            break;
+        case GET_FEATURE_REQ:
+            if ((len >= 2) && (pCargo[1] <= SH2_MAX_SENSOR_ID)) {
+                sendFeature(pCargo[1]);
+            }
+            break;
+        case SET_FEATURE_CMD:
+            rxSetFeature(pCargo, len);
+            break;
+        case FRS_READ_REQ:
+            rxFrsRead(pCargo, len);
+            break;
+        case FRS_WRITE_REQ:
+            rxFrsWrite(pCargo, len);
+            break;
+        case FRS_WRITE_DATA_REQ:
+            rxFrsWriteData(pCargo, len);
+            break;
+        case COMMAND_REQ:
+            rxCommand(pCargo, len);
+            break;
+        case FORCE_FLUSH:
+            if (len >= 2) {
+                uint64_t now = timing_now_us();
+                flushBatch(&normal_, now);
+                flushBatch(&wake_, now);
+
+                uint8_t resp[2] = {FLUSH_COMPLETED, pCargo[1]};
+                sendShtp(CHAN_CONTROL, resp, sizeof(resp));
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void Sh2Emulator::rxCommand(const uint8_t* pReq, uint32_t len) {
+    if (len < 12) {
+        return;
+    }
+
+    uint8_t cmdSeq = pReq[1];
+    uint8_t command = pReq[2];
+    const uint8_t* pParams = pReq + 3;
+    uint8_t result[11] = {0};
+
+    switch (command) {
+        case CMD_ME_CAL:
+            // p0..p2: accel, gyro, mag enable, p3: subcommand (0: configure), p4: planar accel
+            if (pParams[3] == 0) {
+                calConfig_ = (pParams[0] ? 0x01 : 0) | (pParams[1] ? 0x02 : 0) |
+                             (pParams[2] ? 0x04 : 0) | (pParams[4] ? 0x08 : 0);
+            }
+            result[0] = 0; // success
+            result[1] = (calConfig_ & 0x01) ? 1 : 0;
+            result[2] = (calConfig_ & 0x02) ? 1 : 0;
+            result[3] = (calConfig_ & 0x04) ? 1 : 0;
+            result[4] = (calConfig_ & 0x08) ? 1 : 0;
+            sendCommandResp(command, cmdSeq, result, sizeof(result));
+            break;
+        case CMD_DCD_PERIOD_SAVE:
+            // No response
+            break;
+        case CMD_CLEAR_DCD_RESET:
+            frs_.erase(DYNAMIC_CALIBRATION);
+            reset();
+            bootComplete();
+            break;
+        case CMD_INITIALIZE:
+        case CMD_SAVE_DCD:
+        default:
+            // Report success
+            sendCommandResp(command, cmdSeq, result, sizeof(result));
+            break;
+    }
+}
+
+void Sh2Emulator::rxSetFeature(const uint8_t* pReq, uint32_t len) {
+    if (len < 17) {
+        return;
+    }
+
+    uint8_t id = pReq[1];
+    if (id > SH2_MAX_SENSOR_ID) {
+        return;
+    }
+
+    Sensor_s* pSensor = &sensors_[id];
+    uint8_t flags = pReq[2];
+    pSensor->config.changeSensitivityRelative = (flags & 0x01) != 0;
+    pSensor->config.changeSensitivityEnabled = (flags & 0x02) != 0;
+    pSensor->config.wakeupEnabled = (flags & 0x04) != 0;
+    pSensor->config.alwaysOnEnabled = (flags & 0x08) != 0;
+    pSensor->config.sniffEnabled = (flags & 0x10) != 0;
+    pSensor->config.changeSensitivity = get16(pReq + 3);
+    pSensor->config.batchInterval_us = get32(pReq + 9);
+    pSensor->config.sensorSpecific = get32(pReq + 13);
+
+    uint32_t interval = get32(pReq + 5);
+    if (ReportLen[id] == 0) {
+        // Reserved id, never reports
+        interval = 0;
+    } else if ((interval > 0) && (interval < MIN_INTERVAL_US)) {
+        interval = MIN_INTERVAL_US;
+    }
+    pSensor->config.reportInterval_us = interval;
+
+    bool enable = (interval > 0);
+    if (enable && !pSensor->enabled) {
+        pSensor->nextSample_us = timing_now_us() + interval;
+        enabled_.push_back(id);
+    } else if (!enable && pSensor->enabled) {
+        enabled_.erase(std::remove(enabled_.begin(), enabled_.end(), id), enabled_.end());
+    }
+    pSensor->enabled = enable;
+
+    // Report the configuration actually applied
+    sendFeature(id);
+}
+
+void Sh2Emulator::rxFrsRead(const uint8_t* pReq, uint32_t len) {
+    if (len < 8) {
+        return;
+    }
+
+    uint16_t offset = get16(pReq + 2);
+    uint16_t type = get16(pReq + 4);
+    uint16_t blockSize = get16(pReq + 6);
+
+    uint8_t resp[16] = {0};
+    resp[0] = FRS_READ_RESP;
+    put16(resp + 12, type);
+
+    std::map<uint16_t, std::vector<uint32_t>>::const_iterator it = frs_.find(type);
+    if ((it == frs_.end()) || it->second.empty()) {
+        resp[1] = FRS_READ_RECORD_EMPTY;
+        sendShtp(CHAN_CONTROL, resp, sizeof(resp));
+        return;
+    }
+
+    const std::vector<uint32_t>& record = it->second;
+    if (offset >= record.size()) {
+        resp[1] = FRS_READ_OFFSET_OUT_OF_RANGE;
+        sendShtp(CHAN_CONTROL, resp, sizeof(resp));
+        return;
+    }
+
+    size_t end = record.size();
+    if ((blockSize > 0) && (offset + blockSize < end)) {
+        end = offset + blockSize;
+    }
+
+    // Two words per response
+    for (size_t w = offset; w < end; w += 2) {
+        uint8_t words = (end - w >= 2) ? 2 : 1;
+        uint8_t status = FRS_READ_NO_ERROR;
+        if (w + words >= end) {
+            if (end < record.size()) {
+                status = FRS_READ_BLOCK_COMPLETE;
+            } else {
+                status = (blockSize > 0) ? FRS_READ_BLOCK_AND_RECORD_COMPLETE : FRS_READ_COMPLETE;
+            }
+        }
+
+        resp[1] = (uint8_t)((words << 4) | status);
+        put16(resp + 2, (uint16_t)w);
+        put32(resp + 4, record[w]);
+        put32(resp + 8, (words == 2) ? record[w + 1] : 0);
+        sendShtp(CHAN_CONTROL, resp, sizeof(resp));
+    }
+}
+
+void Sh2Emulator::rxFrsWrite(const uint8_t* pReq, uint32_t len) {
+    if (len < 6) {
+        return;
+    }
+
+    uint16_t length = get16(pReq + 2);
+    uint16_t type = get16(pReq + 4);
+
+    if (length == 0) {
+        // Erase the record
+        frs_.erase(type);
+        frsWriting_ = false;
+        sendFrsWriteResp(FRS_WRITE_COMPLETE, 0);
+        return;
+    }
+
+    frsWriting_ = true;
+    frsWriteType_ = type;
+    frsWriteData_.assign(length, 0);
+    sendFrsWriteResp(FRS_WRITE_READY, 0);
+}
+
+void Sh2Emulator::rxFrsWriteData(const uint8_t* pReq, uint32_t len) {
+    if (len < 12) {
+        return;
+    }
+
+    uint16_t offset = get16(pReq + 2);
+    if (!frsWriting_) {
+        sendFrsWriteResp(FRS_WRITE_NOT_IN_WRITE_MODE, offset);
+        return;
+    }
+
+    if (offset < frsWriteData_.size()) {
+        frsWriteData_[offset] = get32(pReq + 4);
+    }
+    if (offset + 1u < frsWriteData_.size()) {
+        frsWriteData_[offset + 1] = get32(pReq + 8);
+    }
+    sendFrsWriteResp(FRS_WRITE_WORD_RECEIVED, offset);
+
+    if (offset + 2u >= frsWriteData_.size()) {
+        frs_[frsWriteType_] = frsWriteData_;
+        frsWriting_ = false;
+        sendFrsWriteResp(FRS_WRITE_COMPLETE, offset);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// Transmit
+// -------------------------------------------------------------------------------------------------
+void Sh2Emulator::sendFeature(uint8_t sensorId) {
+    const sh2_SensorConfig_t* pConfig = &sensors_[sensorId].config;
+    uint8_t resp[17];
+
+    resp[0] = GET_FEATURE_RESP;
+    resp[1] = sensorId;
+    resp[2] = (pConfig->changeSensitivityRelative ? 0x01 : 0) |
+              (pConfig->changeSensitivityEnabled ? 0x02 : 0) |
+              (pConfig->wakeupEnabled ? 0x04 : 0) | (pConfig->alwaysOnEnabled ? 0x08 : 0) |
+              (pConfig->sniffEnabled ? 0x10 : 0);
+    put16(resp + 3, pConfig->changeSensitivity);
+    put32(resp + 5, pConfig->reportInterval_us);
+    put32(resp + 9, pConfig->batchInterval_us);
+    put32(resp + 13, pConfig->sensorSpecific);
+
+    sendShtp(CHAN_CONTROL, resp, sizeof(resp));
+}
+
+void Sh2Emulator::sendCommandResp(uint8_t command,
+                                  uint8_t cmdSeq,
+                                  const uint8_t* pResult,
+                                  uint32_t len) {
+    uint8_t resp[16] = {0};
+
+    resp[0] = COMMAND_RESP;
+    resp[1] = cmdRespSeq_++;
+    resp[2] = command;
+    resp[3] = cmdSeq;
+    resp[4] = 0; // response sequence, only one response per command here
+    memcpy(resp + 5, pResult, std::min(len, (uint32_t)11));
+
+    sendShtp(CHAN_CONTROL, resp, sizeof(resp));
+}
+
+void Sh2Emulator::sendFrsWriteResp(uint8_t status, uint16_t offset) {
+    uint8_t resp[4];
+
+    resp[0] = FRS_WRITE_RESP;
+    resp[1] = status;
+    put16(resp + 2, offset);
+
+    sendShtp(CHAN_CONTROL, resp, sizeof(resp));
+}
+
+void Sh2Emulator::sendBsn(void) {
+    uint8_t bsn[2];
+    put16(bsn, HUB_RX_BUF_LEN);
+    sendFrame(PROTOCOL_CONTROL, bsn, sizeof(bsn));
+}
+
+void Sh2Emulator::sendShtp(uint8_t channel, const uint8_t* pCargo, uint32_t len) {
+    uint8_t packet[SHTP_HDR_LEN + 1024];
+    uint32_t packetLen = SHTP_HDR_LEN + len;
+    if (packetLen > sizeof(packet)) {
+        return;
+    }
+
+    put16(packet, (uint16_t)packetLen);
+    packet[2] = channel;
+    packet[3] = txSeq_[channel]++;
+    memcpy(packet + SHTP_HDR_LEN, pCargo, len);
+
+    sendFrame(PROTOCOL_SHTP, packet, packetLen);
+    stats_.packets++;
+}
+
+void Sh2Emulator::sendFrame(uint8_t protocol, const uint8_t* pData, uint32_t len) {
+    // Worst case every byte is escaped, plus flags and protocol id
+    size_t start = tx_.size();
+    uint32_t encodedLen = 2 * (len + 1) + 2;
+    tx_.resize(start + encodedLen);
+
+    rfc1662_encode(&tx_[start], &encodedLen, protocol, pData, len);
+    tx_.resize(start + encodedLen);
+}
+
+bool Sh2Emulator::flushTx(void) {
+    while (txIdx_ < tx_.size()) {
+        ssize_t sent = write(fd_, &tx_[txIdx_], tx_.size() - txIdx_);
+        if (sent > 0) {
+            txIdx_ += sent;
+            stats_.bytes += sent;
+        } else if ((sent < 0) && (errno == EINTR)) {
+            continue;
+        } else if ((sent < 0) && (errno == EAGAIN)) {
+            break;
+        } else {
+            return false;
+        }
+    }
+
+    if (txIdx_ == tx_.size()) {
+        tx_.clear();
+        txIdx_ = 0;
+    } else if (txIdx_ > TX_BACKLOG_MAX) {
+        tx_.erase(tx_.begin(), tx_.begin() + txIdx_);
+        txIdx_ = 0;
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+// Sensor reports
+// -------------------------------------------------------------------------------------------------
+void Sh2Emulator::generate(uint64_t now_us) {
+    while (true) {
+        // Next sample due, over all sensors, so reports go out in time order
+        Sensor_s* pNext = nullptr;
+        uint8_t nextId = 0;
+        for (uint8_t id : enabled_) {
+            Sensor_s* pSensor = &sensors_[id];
+            if ((pSensor->nextSample_us <= now_us) &&
+                ((pNext == nullptr) || (pSensor->nextSample_us < pNext->nextSample_us))) {
+                pNext = pSensor;
+                nextId = id;
+            }
+        }
+        if (pNext == nullptr) {
+            break;
+        }
+
+        uint32_t interval = pNext->config.reportInterval_us;
+        if (now_us - pNext->nextSample_us > MAX_CATCHUP_US) {
+            // Fell too far behind (e.g. the emulator was descheduled), skip ahead
+            uint64_t missed = (now_us - pNext->nextSample_us) / interval;
+            stats_.reports += missed;
+            stats_.dropped += missed;
+            pNext->nextSample_us += missed * interval;
+        }
+
+        addReport(nextId, pNext->nextSample_us, now_us);
+        pNext->nextSample_us += interval;
+    }
+
+    if ((normal_.reports > 0) && (now_us - normal_.base_us >= batch_us_)) {
+        flushBatch(&normal_, now_us);
+    }
+    if ((wake_.reports > 0) && (now_us - wake_.base_us >= batch_us_)) {
+        flushBatch(&wake_, now_us);
+    }
+}
+
+void Sh2Emulator::addReport(uint8_t sensorId, uint64_t sample_us, uint64_t now_us) {
+    Sensor_s* pSensor = &sensors_[sensorId];
+    uint8_t len = ReportLen[sensorId];
+    stats_.reports++;
+
+    if (sensorId == SH2_GYRO_INTEGRATED_RV) {
+        // Sent alone on its own channel, without report header or timestamp
+        uint8_t report[14];
+        putQuat(report, YAW_RATE_RADPS * sample_us * 1e-6);
+        putVec(report + 8, 0.0, 0.0, YAW_RATE_RADPS, 10);
+        if (tx_.size() - txIdx_ > TX_BACKLOG_MAX) {
+            stats_.dropped++;
+        } else {
+            sendShtp(CHAN_INPUT_GIRV, report, sizeof(report));
+        }
+        return;
+    }
+
+    Batch_s* pBatch = pSensor->config.wakeupEnabled ? &wake_ : &normal_;
+
+    // Send what we have if this report won't fit, or its delay can't be expressed
+    if ((pBatch->reports > 0) &&
+        ((SHTP_HDR_LEN + pBatch->cargo.size() + len > maxCargo_) ||
+         (sample_us - pBatch->base_us > MAX_BATCH_US))) {
+        flushBatch(pBatch, now_us);
+    }
+
+    if (pBatch->reports == 0) {
+        // Base timestamp reference, filled in when the packet is sent
+        pBatch->cargo.assign(5, 0);
+        pBatch->cargo[0] = BASE_TIMESTAMP_REF;
+        pBatch->base_us = sample_us;
+    }
+
+    // Report header: id, sequence number, status (accuracy and upper delay bits), delay
+    uint32_t delay = (uint32_t)((sample_us - pBatch->base_us) / 100);
+    size_t pos = pBatch->cargo.size();
+    pBatch->cargo.resize(pos + len, 0);
+    uint8_t* p = &pBatch->cargo[pos];
+    p[0] = sensorId;
+    p[1] = pSensor->seq++;
+    p[2] = (uint8_t)(3 | ((delay >> 8) << 2)); // accuracy: high
+    p[3] = (uint8_t)delay;
+    fillReport(sensorId, p + 4, sample_us);
+    pBatch->reports++;
+
+    if (batch_us_ == 0) {
+        flushBatch(pBatch, now_us);
+    }
+}
+
+void Sh2Emulator::flushBatch(Batch_s* pBatch, uint64_t now_us) {
+    if (pBatch->reports == 0) {
+        return;
+    }
+
+    if (tx_.size() - txIdx_ > TX_BACKLOG_MAX) {
+        // Host isn't keeping up, the hub's queue overflows
+        stats_.dropped += pBatch->reports;
+    } else {
+        // Time from the base timestamp to now, in 100us units
+        put32(&pBatch->cargo[1], (uint32_t)((now_us - pBatch->base_us) / 100));
+        sendShtp(pBatch->channel, pBatch->cargo.data(), (uint32_t)pBatch->cargo.size());
+    }
+
+    pBatch->cargo.clear();
+    pBatch->reports = 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+extern "C" {
+#include "rfc1662.h"
+#include "sh2.h"
+}
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+/**
+ * Software model of an SH-2 sensor hub on the UART interface.
+ *
+ * Speaks RFC1662/SHTP over a file descriptor (socket or pty, see
+ * hal/soft_link.h) and answers what sh2_logger asks of a real hub:
+ * reset, product ids, FRS reads and writes, command requests and sensor
+ * configuration.  Enabled sensors report synthetic data at their
+ * configured intervals, with as many reports batched into each SHTP
+ * packet as fit in the configured cargo size or arrive within the batch
+ * window.
+ *
+ * If the host doesn't read fast enough, packets are dropped once the
+ * transmit backlog is full, as a real hub's output queue would overflow.
+ */
+class Sh2Emulator {
+public:
+    struct Stats_s {
+        uint64_t reports; // Sensor reports generated
+        uint64_t dropped; // Reports dropped because the host wasn't keeping up
+        uint64_t packets; // SHTP packets sent
+        uint64_t bytes;   // Bytes written to the transport
+    };
+
+    /**
+     * maxCargo is the largest SHTP packet sent, header included.  Reports
+     * are held for at most batch_us before being sent, 0 sends each one
+     * as soon as it is generated.  If bsnAfterFrame is set, a buffer
+     * status notification follows every received frame, otherwise one is
+     * only sent in answer to a query.
+     */
+    Sh2Emulator(uint32_t maxCargo, uint32_t batch_us, bool bsnAfterFrame = true);
+
+    /**
+     * Serve a host on fd, which must be non-blocking.  The hub stays
+     * quiet until the host resets it.
+     */
+    void connect(int fd);
+
+    /**
+     * Stop serving the current host.  Does not close the descriptor.
+     */
+    void disconnect(void);
+
+    /**
+     * Process received data, generate reports that are due and send
+     * whatever the transport will take.  Returns false if the transport
+     * failed or the host hung up.
+     */
+    bool service(void);
+
+    /**
+     * Time until service() next has work to do, other than received data.
+     */
+    uint32_t getServiceTimeout_us(void);
+
+    /**
+     * True if data is waiting to be sent.
+     */
+    bool txPending(void);
+
+    Stats_s getStats(void);
+
+private:
+    struct Sensor_s {
+        bool enabled;
+        sh2_SensorConfig_t config;
+        uint64_t nextSample_us;
+        uint8_t seq;
+    };
+
+    // Reports accumulating for one SHTP packet
+    struct Batch_s {
+        uint8_t channel;
+        std::vector<uint8_t> cargo;
+        uint64_t base_us; // Time of the first report, the packet's base timestamp
+        uint32_t reports;
+    };
+
+    void reset(void);
+    void bootComplete(void);
+
+    void rxFrame(const uint8_t* pFrame, uint32_t len);
+    void rxLine(uint8_t line, uint8_t level);
+    void rxControl(const uint8_t* pCargo, uint32_t len);
+    void rxCommand(const uint8_t* pReq, uint32_t len);
+    void rxSetFeature(const uint8_t* pReq, uint32_t len);
+    void rxFrsRead(const uint8_t* pReq, uint32_t len);
+    void rxFrsWrite(const uint8_t* pReq, uint32_t len);
+    void rxFrsWriteData(const uint8_t* pReq, uint32_t len);
+
+    void sendFeature(uint8_t sensorId);
+    void sendCommandResp(uint8_t command, uint8_t cmdSeq, const uint8_t* pResult, uint32_t len);
+    void sendFrsWriteResp(uint8_t status, uint16_t offset);
+    void sendBsn(void);
+    void sendShtp(uint8_t channel, const uint8_t* pCargo, uint32_t len);
+    void sendFrame(uint8_t protocol, const uint8_t* pData, uint32_t len);
+    bool flushTx(void);
+
+    void generate(uint64_t now_us);
+    void addReport(uint8_t sensorId, uint64_t sample_us, uint64_t now_us);
+    void flushBatch(Batch_s* pBatch, uint64_t now_us);
+
+    int fd_;
+    bool connected_;
+    bool resetN_;  // Level of RESETN line
+    bool bootN_;   // Level of BOOTN line
+    bool running_; // Out of reset and booted into the sensor hub application
+
+    uint32_t maxCargo_;
+    uint32_t batch_us_;
+    bool bsnAfterFrame_;
+
+    // Receive deframing
+    uint8_t rxFrame_[1024];
+    rfc1662_Decoder_t decoder_;
+
+    // Encoded frames waiting to be written
+    std::vector<uint8_t> tx_;
+    size_t txIdx_;
+
+    uint8_t txSeq_[8]; // SHTP sequence number per channel
+    uint8_t cmdRespSeq_;
+
+    Sensor_s sensors_[SH2_MAX_SENSOR_ID + 1];
+    std::vector<uint8_t> enabled_; // Ids of enabled sensors
+    Batch_s normal_;
+    Batch_s wake_;
+
+    uint8_t calConfig_;
+
+    std::map<uint16_t, std::vector<uint32_t>> frs_;
+
+    // FRS write in progress
+    bool frsWriting_;
+    uint16_t frsWriteType_;
+    std::vector<uint32_t> frsWriteData_;
+
+    Stats_s stats_;
+};
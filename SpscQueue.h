@@ -0,0 +1,138 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Bounded single-producer/single-consumer lock-free ring.
+ *
+ * Elements are filled and consumed in place: the producer calls
+ * writeSlot(), fills the element and calls push(); the consumer calls
+ * readSlot(), uses the element and calls pop().  Exactly one thread
+ * may act as producer and one as consumer.
+ *
+ * The ring records its high-water mark (greatest number of elements
+ * queued at once).  Overflow accounting is left to the producer since
+ * only it knows whether an element was actually lost.
+ */
+template <typename T>
+class SpscQueue {
+public:
+    /**
+     * Create a ring holding up to capacity elements.  Capacity is
+     * rounded up to a power of two.
+     */
+    explicit SpscQueue(size_t capacity) : head_(0), tail_(0), highWater_(0) {
+        size_t n = 1;
+        while (n < capacity) {
+            n <<= 1;
+        }
+        slots_.resize(n);
+        mask_ = n - 1;
+    }
+
+    size_t capacity(void) const {
+        return slots_.size();
+    }
+
+    /**
+     * Producer: next free element, or nullptr if the ring is full.
+     */
+    T* writeSlot(void) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) >= slots_.size()) {
+            return nullptr;
+        }
+        return &slots_[tail & mask_];
+    }
+
+    /**
+     * Producer: publish the element obtained from writeSlot().
+     */
+    void push(void) {
+        size_t tail = tail_.load(std::memory_order_relaxed) + 1;
+        tail_.store(tail, std::memory_order_release);
+
+        size_t used = tail - head_.load(std::memory_order_acquire);
+        if (used > highWater_.load(std::memory_order_relaxed)) {
+            highWater_.store(used, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Consumer: oldest queued element, or nullptr if the ring is empty.
+     */
+    T* readSlot(void) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &slots_[head & mask_];
+    }
+
+    /**
+     * Consumer: release the element obtained from readSlot().
+     */
+    void pop(void) {
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * Number of queued elements.  May be called from either side.
+     */
+    size_t size(void) const {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+
+    bool empty(void) const {
+        return size() == 0;
+    }
+
+    /**
+     * Greatest number of elements queued at once.
+     */
+    size_t highWater(void) const {
+        return highWater_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Discard all queued elements and clear the high-water mark.
+     * Neither producer nor consumer may be active.
+     */
+    void clear(void) {
+        head_.store(0);
+        tail_.store(0);
+        highWater_.store(0);
+    }
+
+private:
+    std::vector<T> slots_;
+    size_t mask_;
+
+    // head_ is written only by the consumer, tail_ only by the producer.
+    // Pad so they don't share a cache line.  (alignas would need C++17
+    // aligned new for heap-allocated queues.)
+    std::atomic<size_t> head_;
+    char pad_[64];
+    std::atomic<size_t> tail_;
+    std::atomic<size_t> highWater_;
+};
@@ -0,0 +1,340 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ThreadedLogger.h"
+
+#include <cstring>
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+
+// Longest the writer thread sleeps with nothing to do.  Bounds how long
+// finish() takes to stop the thread.
+#define WRITER_WAIT_US (10000)
+
+// Most sensor values passed to the wrapped Logger in one call
+#define WRITE_BATCH (256)
+
+// =================================================================================================
+// PUBLIC FUNCTIONS
+// =================================================================================================
+
+ThreadedLogger::ThreadedLogger(Logger* pInner, uint32_t capacity)
+    : pInner_(pInner),
+      queue_(capacity),
+      drops_(0),
+      enqueue_(),
+      queued_(),
+      format_(),
+      samples_(WRITE_BATCH),
+      running_(false),
+      writerWaiting_(false) {
+}
+
+ThreadedLogger::~ThreadedLogger() {
+    if (running_) {
+        finish();
+    }
+}
+
+bool ThreadedLogger::init(char const* filePath, bool ned) {
+    if (running_ || !pInner_->init(filePath, ned)) {
+        return false;
+    }
+
+    queue_.clear();
+    drops_ = 0;
+
+    running_ = true;
+    writer_ = std::thread(&ThreadedLogger::write, this);
+    return true;
+}
+
+void ThreadedLogger::finish() {
+    // The writer drains the ring before it stops.
+    running_ = false;
+    {
+        std::lock_guard<std::mutex> lock(waitMtx_);
+        waitCv_.notify_one();
+    }
+    if (writer_.joinable()) {
+        writer_.join();
+    }
+
+    pInner_->finish();
+}
+
+void ThreadedLogger::logMessage(char const* msg) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Record_s* pRecord = claim(true);
+    if (pRecord == nullptr) {
+        return;
+    }
+    pRecord->type = Type_e::Message;
+    pRecord->text = msg;
+    publish(pRecord, start);
+}
+
+void ThreadedLogger::logAsyncEvent(sh2_AsyncEvent_t* pEvent, double timestamp) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Record_s* pRecord = claim(true);
+    if (pRecord == nullptr) {
+        return;
+    }
+    pRecord->type = Type_e::AsyncEvent;
+    pRecord->event = *pEvent;
+    pRecord->timestamp = timestamp;
+    publish(pRecord, start);
+}
+
+void ThreadedLogger::logProductIds(sh2_ProductIds_t ids) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Record_s* pRecord = claim(true);
+    if (pRecord == nullptr) {
+        return;
+    }
+    pRecord->type = Type_e::ProductIds;
+    pRecord->productIds = ids;
+    publish(pRecord, start);
+}
+
+void ThreadedLogger::logFrsRecord(uint16_t recordId,
+                                  char const* name,
+                                  uint32_t* buffer,
+                                  uint16_t words) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Record_s* pRecord = claim(true);
+    if (pRecord == nullptr) {
+        return;
+    }
+    pRecord->type = Type_e::FrsRecord;
+    pRecord->recordId = recordId;
+    pRecord->text = name;
+    pRecord->words.assign(buffer, buffer + words);
+    publish(pRecord, start);
+}
+
+void ThreadedLogger::logSensorValue(sh2_SensorValue_t* pValue,
+                                    double timestamp,
+                                    int64_t delay_uS) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Record_s* pRecord = claim(false);
+    if (pRecord == nullptr) {
+        return;
+    }
+    pRecord->type = Type_e::SensorValue;
+    pRecord->value = *pValue;
+    pRecord->timestamp = timestamp;
+    pRecord->delay_uS = delay_uS;
+    publish(pRecord, start);
+}
+
+void ThreadedLogger::logHalStats(const ftdi_hal_Stats_t* pStats, double timestamp) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Record_s* pRecord = claim(false);
+    if (pRecord == nullptr) {
+        return;
+    }
+    pRecord->type = Type_e::HalStats;
+    pRecord->halStats = *pStats;
+    pRecord->timestamp = timestamp;
+    publish(pRecord, start);
+}
+
+ThreadedLogger::Stats_s ThreadedLogger::getStats(void) {
+    Stats_s stats;
+
+    stats.capacity = (uint32_t)queue_.capacity();
+    stats.depth = (uint32_t)queue_.size();
+    stats.highWater = (uint32_t)queue_.highWater();
+    stats.drops = drops_;
+    stats.enqueue = enqueue_;
+    {
+        std::lock_guard<std::mutex> lock(statsMtx_);
+        stats.queued = queued_;
+        stats.format = format_;
+    }
+
+    return stats;
+}
+
+// =================================================================================================
+// PRIVATE FUNCTIONS
+// =================================================================================================
+
+// -------------------------------------------------------------------------------------------------
+// Caller side
+// -------------------------------------------------------------------------------------------------
+
+// Next free record.  If the ring is full, waits for room (while the writer
+// runs) if wait is set, otherwise counts a drop and returns nullptr.
+ThreadedLogger::Record_s* ThreadedLogger::claim(bool wait) {
+    Record_s* pRecord = queue_.writeSlot();
+    while ((pRecord == nullptr) && wait && running_) {
+        std::this_thread::yield();
+        pRecord = queue_.writeSlot();
+    }
+    if (pRecord == nullptr) {
+        drops_++;
+    }
+    return pRecord;
+}
+
+void ThreadedLogger::publish(Record_s* pRecord, std::chrono::steady_clock::time_point start) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    pRecord->queuedAt = now;
+    queue_.push();
+    addTime(&enqueue_, std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count());
+
+    // Pairs with the fence in write()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (writerWaiting_) {
+        std::lock_guard<std::mutex> lock(waitMtx_);
+        waitCv_.notify_one();
+    }
+}
+
+void ThreadedLogger::addTime(StageTime_s* pStage, uint64_t ns) {
+    pStage->records++;
+    pStage->total_ns += ns;
+    if (ns > pStage->max_ns) {
+        pStage->max_ns = ns;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// Writer thread
+// -------------------------------------------------------------------------------------------------
+void ThreadedLogger::write(void) {
+    while (true) {
+        Record_s* pRecord = queue_.readSlot();
+        if (pRecord == nullptr) {
+            if (!running_) {
+                // Stopped.  Anything queued before that is visible now.
+                if (queue_.empty()) {
+                    break;
+                }
+                continue;
+            }
+
+            // Nothing to write.  Don't leave what's been written so far
+            // sitting in the wrapped Logger's buffers meanwhile.
+            pInner_->flushIfDue();
+
+            std::unique_lock<std::mutex> lock(waitMtx_);
+            writerWaiting_ = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            waitCv_.wait_for(lock, std::chrono::microseconds(WRITER_WAIT_US), [this] {
+                return !running_ || !queue_.empty();
+            });
+            writerWaiting_ = false;
+            continue;
+        }
+
+        if (pRecord->type == Type_e::SensorValue) {
+            writeSensorValues();
+            continue;
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        uint64_t queued_ns =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(start - pRecord->queuedAt)
+                        .count();
+
+        replay(pRecord);
+        queue_.pop();
+
+        uint64_t format_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now() - start)
+                                     .count();
+
+        std::lock_guard<std::mutex> lock(statsMtx_);
+        addTime(&queued_, queued_ns);
+        addTime(&format_, format_ns);
+    }
+}
+
+// Pass the run of sensor values at the head of the ring, up to a batch of
+// them, to the wrapped Logger in one call.
+void ThreadedLogger::writeSensorValues(void) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    StageTime_s queued = {};
+    size_t count = 0;
+
+    Record_s* pRecord = queue_.readSlot();
+    while ((pRecord != nullptr) && (pRecord->type == Type_e::SensorValue) &&
+           (count < samples_.size())) {
+        addTime(&queued,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(start - pRecord->queuedAt)
+                        .count());
+
+        samples_[count].value = pRecord->value;
+        samples_[count].timestamp = pRecord->timestamp;
+        samples_[count].delay_uS = pRecord->delay_uS;
+        count++;
+
+        queue_.pop();
+        pRecord = queue_.readSlot();
+    }
+
+    pInner_->logSensorValues(samples_.data(), count);
+
+    uint64_t format_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+
+    std::lock_guard<std::mutex> lock(statsMtx_);
+    queued_.records += queued.records;
+    queued_.total_ns += queued.total_ns;
+    if (queued.max_ns > queued_.max_ns) {
+        queued_.max_ns = queued.max_ns;
+    }
+    // Records in a batch share its time equally.
+    format_.records += count;
+    format_.total_ns += format_ns;
+    if (format_ns / count > format_.max_ns) {
+        format_.max_ns = format_ns / count;
+    }
+}
+
+// Make the call recorded in pRecord on the wrapped Logger.
+void ThreadedLogger::replay(Record_s* pRecord) {
+    switch (pRecord->type) {
+        case Type_e::Message:
+            pInner_->logMessage(pRecord->text.c_str());
+            break;
+        case Type_e::AsyncEvent:
+            pInner_->logAsyncEvent(&pRecord->event, pRecord->timestamp);
+            break;
+        case Type_e::ProductIds:
+            pInner_->logProductIds(pRecord->productIds);
+            break;
+        case Type_e::FrsRecord:
+            pInner_->logFrsRecord(pRecord->recordId,
+                                  pRecord->text.c_str(),
+                                  pRecord->words.data(),
+                                  (uint16_t)pRecord->words.size());
+            break;
+        case Type_e::SensorValue:
+            pInner_->logSensorValue(&pRecord->value, pRecord->timestamp, pRecord->delay_uS);
+            break;
+        case Type_e::HalStats:
+            pInner_->logHalStats(&pRecord->halStats, pRecord->timestamp);
+            break;
+    }
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Logger.h"
+#include "SpscQueue.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Logger wrapper that formats and writes on a dedicated thread.
+ *
+ * Each call is copied, with its arguments, into a preallocated
+ * lock-free ring and returns.  The writer thread replays the calls, in
+ * order, on the wrapped Logger, which only it touches between init()
+ * and finish().  So the thread draining the sensor hub (sh2 callbacks)
+ * never waits on text formatting or file writes.
+ *
+ * If the ring is full, sensor values and HAL statistics are dropped and
+ * counted.  The other calls are rare (startup, configuration changes)
+ * and needed to make sense of the log, so they wait for room instead.
+ *
+ * Runs of queued sensor values are passed to the wrapped Logger's
+ * logSensorValues() together.
+ */
+class ThreadedLogger : public Logger {
+public:
+    // Time spent per record in one stage of the pipeline
+    struct StageTime_s {
+        uint64_t records;
+        uint64_t total_ns;
+        uint64_t max_ns;
+    };
+
+    struct Stats_s {
+        uint32_t capacity;   // Ring size in records
+        uint32_t depth;      // Records queued now
+        uint32_t highWater;  // Most records queued at once
+        uint64_t drops;      // Records dropped because the ring was full
+        StageTime_s enqueue; // Copying a call into the ring, on the caller's thread
+        StageTime_s queued;  // Waiting in the ring
+        StageTime_s format;  // Formatting and writing by the wrapped Logger.  Sensor
+                             // values are written in batches, each record taking an
+                             // equal share of its batch's time.
+    };
+
+    /**
+     * Wrap pInner, queueing up to capacity calls.
+     */
+    ThreadedLogger(Logger* pInner, uint32_t capacity = 4096);
+    virtual ~ThreadedLogger();
+
+    /**
+     * Initialize the wrapped Logger and start the writer thread.
+     */
+    virtual bool init(char const* filePath, bool ned);
+
+    /**
+     * Write everything queued, stop the writer thread and finish the
+     * wrapped Logger.
+     */
+    virtual void finish();
+
+    virtual void logMessage(char const* msg);
+    virtual void logAsyncEvent(sh2_AsyncEvent_t* pEvent, double timestamp);
+
+    virtual void logProductIds(sh2_ProductIds_t ids);
+    virtual void
+    logFrsRecord(uint16_t recordId, char const* name, uint32_t* buffer, uint16_t words);
+    virtual void logSensorValue(sh2_SensorValue_t* pValue, double timestamp, int64_t delay_uS);
+    virtual void logHalStats(const ftdi_hal_Stats_t* pStats, double timestamp);
+
+    /**
+     * May be called from the thread making the log calls.
+     */
+    Stats_s getStats(void);
+
+private:
+    enum class Type_e {
+        Message,
+        AsyncEvent,
+        ProductIds,
+        FrsRecord,
+        SensorValue,
+        HalStats,
+    };
+
+    struct Record_s {
+        Type_e type;
+        double timestamp;
+        int64_t delay_uS;
+        std::chrono::steady_clock::time_point queuedAt;
+        union {
+            sh2_SensorValue_t value;
+            sh2_AsyncEvent_t event;
+            sh2_ProductIds_t productIds;
+            ftdi_hal_Stats_t halStats;
+            uint16_t recordId;
+        };
+        // Messages and FRS records only.  Their storage is kept with the
+        // slot, so sensor values never allocate.
+        std::string text;
+        std::vector<uint32_t> words;
+    };
+
+    Record_s* claim(bool wait);
+    void publish(Record_s* pRecord, std::chrono::steady_clock::time_point start);
+
+    void write(void);
+    void writeSensorValues(void);
+    void replay(Record_s* pRecord);
+
+    static void addTime(StageTime_s* pStage, uint64_t ns);
+
+    Logger* pInner_;
+
+    SpscQueue<Record_s> queue_;
+    uint64_t drops_;
+    StageTime_s enqueue_;
+
+    // Updated by the writer thread, read by getStats()
+    std::mutex statsMtx_;
+    StageTime_s queued_;
+    StageTime_s format_;
+
+    // Sensor values being passed to the wrapped Logger
+    std::vector<SensorSample_s> samples_;
+
+    std::thread writer_;
+    std::atomic<bool> running_;
+
+    // Used to put the writer thread to sleep while the ring is empty.
+    std::mutex waitMtx_;
+    std::condition_variable waitCv_;
+    std::atomic<bool> writerWaiting_;
+};
@@ -16,12 +16,15 @@
  */
 
 #include "WheelSource.h"
-using namespace std::chrono;
+
+extern "C" {
+#include "timing.h"
+}
 
 #include <iostream>
 
 WheelSource::WheelSource() : lastHub_(0), ready_(false) {
-    lastHost_ = steady_clock::now();
+    lastHost_us_ = timing_now_us();
 }
 
 void WheelSource::reportModuleTime(const sh2_SensorValue_t* value, const sh2_SensorEvent_t* event) {
@@ -32,22 +35,22 @@ void WheelSource::reportModuleTime(const sh2_SensorValue_t* value, const sh2_Sen
         case SH2_RAW_ACCELEROMETER:
             ready_ = true;
             lastHub_ = value->un.rawAccelerometer.timestamp;
-            lastHost_ = steady_clock::now();
+            lastHost_us_ = timing_now_us();
             break;
         case SH2_RAW_GYROSCOPE:
             ready_ = true;
             lastHub_ = value->un.rawGyroscope.timestamp;
-            lastHost_ = steady_clock::now();
+            lastHost_us_ = timing_now_us();
             break;
         case SH2_RAW_MAGNETOMETER:
             ready_ = true;
             lastHub_ = value->un.rawMagnetometer.timestamp;
-            lastHost_ = steady_clock::now();
+            lastHost_us_ = timing_now_us();
             break;
         case SH2_RAW_OPTICAL_FLOW:
             ready_ = true;
             lastHub_ = value->un.rawOptFlow.timestamp;
-            lastHost_ = steady_clock::now();
+            lastHost_us_ = timing_now_us();
             break;
         default:
             // No raw timestamp to update
@@ -55,18 +58,26 @@ void WheelSource::reportModuleTime(const sh2_SensorValue_t* value, const sh2_Sen
     }
 }
 
+void WheelSource::setNotify(std::function<void()> notify) {
+    std::lock_guard<std::mutex> lock(notifyMtx_);
+    notify_ = notify;
+}
+
+void WheelSource::notify(void) {
+    std::lock_guard<std::mutex> lock(notifyMtx_);
+    if (notify_) {
+        notify_();
+    }
+}
+
 bool WheelSource::ready(void) {
     return ready_;
 }
 
-uint32_t WheelSource::estimateHubTime(const steady_clock::time_point* t) {
-    steady_clock::time_point now;
-    if (t == nullptr) {
-        now = steady_clock::now();
-        t = &now;
-    }
-    duration<double> elapsed = duration_cast<duration<double> >(*t - lastHost_);
+uint32_t WheelSource::estimateHubTime(const uint64_t* pHostTime_us) {
+    uint64_t hostTime_us = (pHostTime_us != nullptr) ? *pHostTime_us : timing_now_us();
 
-    int32_t elapsed_us = static_cast<int32_t>(elapsed.count() * 1e6);
+    // Hub time is 32 bits and wraps, so only the low bits of the elapsed time matter.
+    uint32_t elapsed_us = static_cast<uint32_t>(hostTime_us - lastHost_us_);
     return lastHub_ + elapsed_us;
 }
@@ -22,7 +22,8 @@ extern "C" {
 #include "sh2_SensorValue.h"
 }
 
-#include <chrono>
+#include <functional>
+#include <mutex>
 
 /**
  * A WheelSource is responsible for reporting wheel encoder position
@@ -32,8 +33,8 @@ extern "C" {
  * time and the recipient's internal time.
  *
  * This base class provides a simple mechanism for obtaining this
- * mapping (between "raw" sensor data and a local clock provided by
- * std::chrono::steady_clock).
+ * mapping (between "raw" sensor data and the local 64-bit timebase
+ * provided by timing_now_us()).
  *
  * Implementations should override the `service` method.
  *
@@ -42,6 +43,8 @@ extern "C" {
 class WheelSource {
 public:
     WheelSource();
+    virtual ~WheelSource() {
+    }
 
     /**
      * Report a sensor sample, which WheelSource may use to establish
@@ -58,12 +61,25 @@ public:
      */
     virtual void service(void) = 0;
 
+    /**
+     * Register a function to be called when new wheel data becomes
+     * available.  The main loop uses this to wake up early when it is
+     * sleeping while waiting for serial data.
+     */
+    void setNotify(std::function<void()> notify);
+
 protected:
+    /**
+     * Invoke the registered notify function, if any. May be called
+     * from any thread.
+     */
+    void notify(void);
+
     /**
      * Obtain an estimate of the module (hub) time for a given local
-     * (host) time_point.
+     * (host) time in microseconds, or for now if pHostTime_us is null.
      */
-    uint32_t estimateHubTime(const std::chrono::steady_clock::time_point* t = nullptr);
+    uint32_t estimateHubTime(const uint64_t* pHostTime_us = nullptr);
 
     /**
      * Return true if sufficient data has been read from the module to
@@ -74,5 +90,8 @@ protected:
 private:
     bool ready_;
     uint32_t lastHub_;
-    std::chrono::steady_clock::time_point lastHost_;
+    uint64_t lastHost_us_;
+
+    std::function<void()> notify_;
+    std::mutex notifyMtx_;
 };
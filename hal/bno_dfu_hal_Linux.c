@@ -16,6 +16,8 @@
  */
 
 #include "bno_dfu_hal.h"
+#include "soft_link.h"
+#include "timing.h"
 
 #include <errno.h>
 #include <fcntl.h>
@@ -44,16 +46,22 @@ struct bno_dfu_hal_s {
 
     bool is_open;
     int fd;
+    bool softLink; // Software transport (socket or pty), see soft_link.h
     const char* device_filename;
 };
 typedef struct bno_dfu_hal_s bno_dfu_hal_t;
 
 // Set RESETN to state.
-static void setResetN(int fd, bool state) {
+static void setResetN(bno_dfu_hal_t* pHal, bool state) {
+    if (pHal->softLink) {
+        soft_link_setLine(pHal->fd, SOFT_LINK_RESETN, state);
+        return;
+    }
+
     // RESETN connected to DTR
     int resetSignal = TIOCM_DTR;
     int status = 0;
-    ioctl(fd, TIOCMGET, &status);
+    ioctl(pHal->fd, TIOCMGET, &status);
 
     if (state) {
         // Clear the signal (logic level inverted, this outputs high.)
@@ -62,16 +70,21 @@ static void setResetN(int fd, bool state) {
         // Set the signal (logic level inverted, this outputs low.)
         status |= resetSignal;
     }
-    ioctl(fd, TIOCMSET, &status);
+    ioctl(pHal->fd, TIOCMSET, &status);
 }
 
 // Set BOOTN to state.
-static void setBootN(int fd, bool state) {
+static void setBootN(bno_dfu_hal_t* pHal, bool state) {
+    if (pHal->softLink) {
+        soft_link_setLine(pHal->fd, SOFT_LINK_BOOTN, state);
+        return;
+    }
+
     // BOOTN connected to RTS
     int bootnSignal = TIOCM_RTS;
 
     int status;
-    ioctl(fd, TIOCMGET, &status);
+    ioctl(pHal->fd, TIOCMGET, &status);
 
     if (state) {
         // Clear the signal (logic level inverted, this outputs high.)
@@ -80,7 +93,7 @@ static void setBootN(int fd, bool state) {
         // Set the signal (logic level inverted, this outputs low.)
         status |= bootnSignal;
     }
-    ioctl(fd, TIOCMSET, &status);
+    ioctl(pHal->fd, TIOCMSET, &status);
 }
 
 static void uart_errno_printf(const char* s, ...) {
@@ -92,54 +105,20 @@ static void uart_errno_printf(const char* s, ...) {
     va_end(vl);
 }
 
-static uint32_t time32_now_us() {
-    static uint64_t initialTimeUs = 0;
-    uint64_t t_us = 0;
-
-    struct timespec tp;
-    clock_gettime(CLOCK_MONOTONIC, &tp);
-    t_us = ((uint32_t)tp.tv_sec * 1000000) + ((uint32_t)tp.tv_nsec / 1000.0);
-
-    if (initialTimeUs == 0) {
-        initialTimeUs = t_us;
-    }
-    t_us -= initialTimeUs;
-
-    return (uint32_t)t_us;
-}
-
-static void delay_us(uint32_t t) {
-    uint32_t now = time32_now_us();
-    uint32_t start = now;
-    while ((now - start) <= t) {
-        now = time32_now_us();
-    }
-}
-
-static int dfu_hal_open(sh2_Hal_t* self) {
-    bno_dfu_hal_t* pHal = (bno_dfu_hal_t*)self;
+// Open and configure the serial port.
+static int open_serial(bno_dfu_hal_t* pHal) {
     struct termios tty;
     speed_t baud = B115200;
 
-    // Return error if already open
-    if (pHal->is_open) {
-        return SH2_ERR;
-    }
-
-    // Mark as open
-    pHal->is_open = true;
-
     // Open device file
     if ((pHal->fd = open(pHal->device_filename, O_RDWR | O_NOCTTY | O_NONBLOCK)) == -1) {
         uart_errno_printf("uart_connect: OPEN %s:", pHal->device_filename);
-        pHal->is_open = false;
         return SH2_ERR_IO;
     }
 
     // Get attributes
     if (tcgetattr(pHal->fd, &tty) < 0) {
         fprintf(stderr, "unable to read port attributes");
-        pHal->is_open = false;
         close(pHal->fd);
         return SH2_ERR_IO;
     }
@@ -164,7 +143,6 @@ static int dfu_hal_open(sh2_Hal_t* self) {
     // Set attributes
     if (tcsetattr(pHal->fd, TCSANOW, &tty) < 0) {
         fprintf(stderr, "unable to set port attributes");
-        pHal->is_open = false;
         close(pHal->fd);
         return SH2_ERR_IO;
     }
@@ -172,17 +150,47 @@ static int dfu_hal_open(sh2_Hal_t* self) {
     fsync(pHal->fd);
     tcflush(pHal->fd, TCIOFLUSH);
 
+    return SH2_OK;
+}
+
+static int dfu_hal_open(sh2_Hal_t* self) {
+    bno_dfu_hal_t* pHal = (bno_dfu_hal_t*)self;
+
+    // Return error if already open
+    if (pHal->is_open) {
+        return SH2_ERR;
+    }
+
+    // Mark as open
+    pHal->is_open = true;
+
+    pHal->softLink = soft_link_isSoftLink(pHal->device_filename);
+    if (pHal->softLink) {
+        // Simulated sensor hub, no serial port setup
+        if ((pHal->fd = soft_link_open(pHal->device_filename)) == -1) {
+            uart_errno_printf("uart_connect: OPEN %s:", pHal->device_filename);
+            pHal->is_open = false;
+            return SH2_ERR_IO;
+        }
+    } else {
+        int status = open_serial(pHal);
+        if (status != SH2_OK) {
+            pHal->is_open = false;
+            return status;
+        }
+    }
+
     // Reset into bootloader
-    setResetN(pHal->fd, false); // Assert reset
-    setBootN(pHal->fd, false);  // Assert BOOTN
+    setResetN(pHal, false); // Assert reset
+    setBootN(pHal, false);  // Assert BOOTN
 
     // Delay for RESET_DELAY_US to ensure reset takes effect
-    delay_us(RESET_DELAY_US);
+    timing_delay_us(RESET_DELAY_US);
 
-    setResetN(pHal->fd, true); // Deassert reset with BOOTN asserted
+    setResetN(pHal, true); // Deassert reset with BOOTN asserted
 
     // Wait until we know bootloader is up
-    delay_us(DFU_BOOT_DELAY_US);
+    timing_delay_us(DFU_BOOT_DELAY_US);
 
     return SH2_OK;
 }
@@ -191,16 +199,16 @@ static void dfu_hal_close(sh2_Hal_t* self) {
     bno_dfu_hal_t* pHal = (bno_dfu_hal_t*)self;
 
     // Reset into normal SHTP mode
-    setResetN(pHal->fd, false); // Assert reset
-    setBootN(pHal->fd, true);   // De-assert BOOTN
+    setResetN(pHal, false); // Assert reset
+    setBootN(pHal, true);   // De-assert BOOTN
 
     // Delay for RESET_DELAY_US to ensure reset takes effect
-    delay_us(RESET_DELAY_US);
+    timing_delay_us(RESET_DELAY_US);
 
-    setResetN(pHal->fd, true); // De-assert reset with BOOTN de-asserted
+    setResetN(pHal, true); // De-assert reset with BOOTN de-asserted
 
     // Delay to ensure fully booted before allowing system to continue.
-    delay_us(SH2_BOOT_DELAY_US);
+    timing_delay_us(SH2_BOOT_DELAY_US);
 
     // Mark as not open
     pHal->is_open = false;
@@ -229,7 +237,7 @@ static int dfu_hal_read(sh2_Hal_t* self, uint8_t* pBuffer, unsigned len, uint32_
     }
 
     // Grab timestamp
-    *t_us = time32_now_us();
+    *t_us = (uint32_t)timing_now_us();
 
     // Return num bytes read
     return len_read;
@@ -257,7 +265,7 @@ static int dfu_hal_write(sh2_Hal_t* self, uint8_t* pBuffer, unsigned len) {
 }
 
 static uint32_t dfu_hal_getTimeUs(sh2_Hal_t* self) {
-    return time32_now_us();
+    return (uint32_t)timing_now_us();
 }
 
 // dfu_hal instance data
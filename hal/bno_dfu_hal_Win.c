@@ -16,6 +16,7 @@
  */
 
 #include "bno_dfu_hal.h"
+#include "timing.h"
 
 #include "ftd2xx.h"
 #include <Windows.h>
@@ -62,36 +63,6 @@ static void setBootN(bno_dfu_hal_t* pHal, bool state) {
     }
 }
 
-static uint32_t time32_now_us() {
-    static uint64_t initialTimeUs = 0;
-    static uint64_t freq = 0;
-    uint64_t counterTime;
-    uint64_t t_us = 0;
-
-    QueryPerformanceCounter((LARGE_INTEGER*)&counterTime);
-
-    if (freq == 0) {
-        QueryPerformanceFrequency((LARGE_INTEGER*)&freq);
-    }
-
-    t_us = (uint64_t)(counterTime * 1000000 / freq);
-
-    if (initialTimeUs == 0) {
-        initialTimeUs = t_us;
-    }
-    t_us -= initialTimeUs;
-
-    return (uint32_t)t_us;
-}
-
-static void delay_us(uint32_t t) {
-    uint32_t now = time32_now_us();
-    uint32_t start = now;
-    while ((int32_t)(now - start) <= t) {
-        now = time32_now_us();
-    }
-}
-
 static const DWORD BAUD_RATE = 115200;
 static const UCHAR LATENCY_TIMER = 1;
 static const UCHAR LATENCY_TIMER_STARTUP = 10;
@@ -160,12 +131,12 @@ static int dfu_hal_open(sh2_Hal_t* self) {
     setBootN(pHal, false);  // Assert BOOTN
 
     // Delay for RESET_DELAY_US to ensure reset takes effect
-    delay_us(RESET_DELAY_US);
+    timing_delay_us(RESET_DELAY_US);
 
     setResetN(pHal, true); // Deassert reset with BOOTN asserted
 
     // Wait until we know bootloader is up
-    delay_us(DFU_BOOT_DELAY_US);
+    timing_delay_us(DFU_BOOT_DELAY_US);
 
     return SH2_OK;
 }
@@ -178,12 +149,12 @@ static void dfu_hal_close(sh2_Hal_t* self) {
     setBootN(pHal, true);   // De-assert BOOTN
 
     // Delay for RESET_DELAY_US to ensure reset takes effect
-    delay_us(RESET_DELAY_US);
+    timing_delay_us(RESET_DELAY_US);
 
     setResetN(pHal, true); // De-assert reset with BOOTN de-asserted
 
     // Delay to ensure fully booted before allowing system to continue.
-    delay_us(SH2_BOOT_DELAY_US);
+    timing_delay_us(SH2_BOOT_DELAY_US);
 
     // Mark as not open
     pHal->is_open = false;
@@ -220,7 +191,7 @@ static int dfu_hal_read(sh2_Hal_t* self, uint8_t* pBuffer, unsigned len, uint32_
     }
 
     // Grab timestamp
-    *t_us = time32_now_us();
+    *t_us = (uint32_t)timing_now_us();
 
     // Return num bytes read (might be zero)
     return len_read;
@@ -248,7 +219,7 @@ static int dfu_hal_write(sh2_Hal_t* self, uint8_t* pBuffer, unsigned len) {
 }
 
 static uint32_t dfu_hal_getTimeUs(sh2_Hal_t* self) {
-    return time32_now_us();
+    return (uint32_t)timing_now_us();
 }
 
 // dfu_hal instance data
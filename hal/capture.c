@@ -0,0 +1,105 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Suppress warning about fopen safety under MSVC
+#ifdef _MSC_VER
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#endif
+
+#include "capture.h"
+
+#include <string.h>
+
+#define HEADER_LEN (12)
+#define RECORD_HDR_LEN (12)
+
+static const char MAGIC[8] = "SH2CAPT";
+
+FILE* capture_create(const char* filename) {
+    FILE* f = fopen(filename, "wb");
+    if (f == NULL) {
+        return NULL;
+    }
+
+    uint8_t hdr[HEADER_LEN] = {0};
+    memcpy(hdr, MAGIC, sizeof(MAGIC));
+    hdr[8] = (uint8_t)CAPTURE_VERSION;
+    hdr[9] = (uint8_t)(CAPTURE_VERSION >> 8);
+
+    if (fwrite(hdr, 1, sizeof(hdr), f) != sizeof(hdr)) {
+        fclose(f);
+        return NULL;
+    }
+    return f;
+}
+
+bool capture_write(FILE* f, uint64_t t_us, uint8_t dir, const uint8_t* pData, uint16_t len) {
+    uint8_t hdr[RECORD_HDR_LEN];
+
+    for (int i = 0; i < 8; i++) {
+        hdr[i] = (uint8_t)(t_us >> (8 * i));
+    }
+    hdr[8] = dir;
+    hdr[9] = 0;
+    hdr[10] = (uint8_t)len;
+    hdr[11] = (uint8_t)(len >> 8);
+
+    return (fwrite(hdr, 1, sizeof(hdr), f) == sizeof(hdr)) && (fwrite(pData, 1, len, f) == len);
+}
+
+FILE* capture_open(const char* filename) {
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+
+    uint8_t hdr[HEADER_LEN];
+    if ((fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr)) || (memcmp(hdr, MAGIC, sizeof(MAGIC)) != 0) ||
+        ((hdr[8] | (hdr[9] << 8)) != CAPTURE_VERSION)) {
+        fclose(f);
+        return NULL;
+    }
+    return f;
+}
+
+bool capture_read(FILE* f, capture_Record_t* pRec, uint8_t* pData, uint16_t max) {
+    uint8_t hdr[RECORD_HDR_LEN];
+
+    if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr)) {
+        return false;
+    }
+
+    pRec->t_us = 0;
+    for (int i = 0; i < 8; i++) {
+        pRec->t_us |= (uint64_t)hdr[i] << (8 * i);
+    }
+    pRec->dir = hdr[8];
+    pRec->len = (uint16_t)(hdr[10] | (hdr[11] << 8));
+
+    uint16_t keep = (pRec->len < max) ? pRec->len : max;
+    if (fread(pData, 1, keep, f) != keep) {
+        return false;
+    }
+    if ((keep < pRec->len) && (fseek(f, pRec->len - keep, SEEK_CUR) != 0)) {
+        return false;
+    }
+    pRec->len = keep;
+
+    return true;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Raw wire capture files.
+ *
+ * A capture holds the bytes exchanged with the sensor hub exactly as they
+ * crossed the serial port, still RFC1662 framed, in the chunks the HAL
+ * read or wrote them.  All integers are little-endian.
+ *
+ *   File header (12 bytes):
+ *     magic       8 bytes  "SH2CAPT\0"
+ *     version     uint16   CAPTURE_VERSION
+ *     reserved    uint16
+ *
+ *   Then one record per chunk (12 byte header + data):
+ *     time_us     uint64   timing_now_us() when the chunk was read (RX)
+ *                          or before it was written (TX)
+ *     direction   uint8    CAPTURE_DIR_RX or CAPTURE_DIR_TX
+ *     reserved    uint8
+ *     length      uint16   number of data bytes
+ *     data        length bytes
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define CAPTURE_VERSION (1)
+
+#define CAPTURE_DIR_RX (0) // Received from the sensor hub
+#define CAPTURE_DIR_TX (1) // Sent to the sensor hub
+
+typedef struct capture_Record_s {
+    uint64_t t_us;
+    uint8_t dir;
+    uint16_t len;
+} capture_Record_t;
+
+// Create a capture file and write its header.  Returns NULL on failure.
+FILE* capture_create(const char* filename);
+
+// Append a record.  Returns false on a write error.
+bool capture_write(FILE* f, uint64_t t_us, uint8_t dir, const uint8_t* pData, uint16_t len);
+
+// Open a capture file for reading and check its header.  Returns NULL on failure.
+FILE* capture_open(const char* filename);
+
+// Read the next record.  At most max data bytes are stored in pData, the
+// rest of a longer record is skipped.  Returns false at end of file or if
+// the file is truncated.
+bool capture_read(FILE* f, capture_Record_t* pRec, uint8_t* pData, uint16_t max);
@@ -16,9 +16,13 @@
  */
 
 #include "ftdi_hal.h"
+#include "capture.h"
+#include "rfc1662.h"
+#include "timing.h"
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #ifdef _WIN32
 #include "ftd2xx.h"
@@ -26,30 +30,46 @@
 #else
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sched.h>
 #include <stdarg.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <termios.h>
-#include <time.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
+
+#include "soft_link.h"
 #endif
 
 #include "sh2_err.h"
 
+#define DEFAULT_BAUD_RATE_BPS (3000000)
+
 #ifdef _WIN32
-#define DEFAULT_BAUD_RATE (3000000)
+#define DEFAULT_BAUD_RATE (DEFAULT_BAUD_RATE_BPS)
 #else
 #define DEFAULT_BAUD_RATE (B3000000)
 #endif
 
-#define RFC1662_FLAG (0x7E)
-#define RFC1662_ESCAPE (0x7D)
 #define PROTOCOL_CONTROL (0)
 #define PROTOCOL_SHTP (1)
 
+// 8N1: start bit, 8 data bits, stop bit
+#define BITS_PER_CHAR (10)
+
+// Weight of each new sample in the RX jitter estimate is 1/JITTER_FILTER_N
+#define JITTER_FILTER_N (16)
+
 #ifdef _WIN32
 static const UCHAR LATENCY_TIMER = 1;
 static const UCHAR LATENCY_TIMER_STARTUP = 10;
+#else
+// USB-serial latency timer (ms), applied at open when the driver supports it.
+static const int LATENCY_TIMER = 1;
 #endif
 
 static const uint32_t RESET_DELAY_US = 10000;
@@ -57,11 +77,34 @@ static const uint32_t DFU_BOOT_DELAY_US = 50000;
 static const uint32_t SH2_BOOT_DELAY_US = 150000;
 static const uint32_t INTER_BSQ_DELAY_US = 10000; // 10 ms between sending BSQs
 
+// The sensor hub can't handle data too fast: nominal limit is 100 us
+// between bytes.
+#define DEFAULT_TX_GAP_US (100)
+
+// Longest the port's output buffer may stay full (e.g. the device holding
+// off flow control) before writes fail.  The time counts across calls, so
+// once it's passed each write fails after one try, until the port takes
+// data again.  Room is waited for in steps of at most TX_FULL_WAIT_US.
+#define TX_TIMEOUT_US (1000000)
+#define TX_FULL_WAIT_US (1000)
+
+// Size of the HAL-owned receive buffer.  Serial data is pulled from the
+// port in chunks of up to this many bytes, then deframed from the buffer.
+#define RX_BUF_LEN (4096)
+
+// Encoded frames accepted from the client, waiting for the sensor hub to
+// have room for them.  When the queue is full, writes return 0 and the
+// client retries.
+#define TX_QUEUE_LEN (4096)
+#define TX_QUEUE_FRAMES (32)
+
+// What the sensor hub sends buffer status notifications (BSNs) for.  Until
+// it is known, only BSNs that are fresh under either assumption are used.
 typedef enum {
-    OUTSIDE_FRAME, // Waiting for start of frame
-    INSIDE_FRAME,  // Inside frame until end of frame
-    ESCAPED,       // Inside frame, after escape char
-} RxState_t;
+    BSN_MODE_UNKNOWN,
+    BSN_MODE_QUERY, // A BSN answers each BSQ
+    BSN_MODE_FRAME, // ... and also follows every SHTP frame received
+} bsnMode_t;
 
 // Augmented HAL structure with BNO DFU on Linux specific fields.
 struct ftdi_hal_s {
@@ -70,13 +113,70 @@ struct ftdi_hal_s {
     bool dfu;
     bool is_open;
 
-    uint16_t lastBsn;
-    uint8_t rxFrame[SH2_HAL_MAX_PAYLOAD_IN];
-    uint32_t rxFrameLen;
-    bool rxFrameReady;
-    uint32_t rxFrameStartTime_us;
-    RxState_t rxState;
-    uint32_t lastBsqTime_us;
+    uint16_t lastBsn;         // Hub's free space, from a fresh BSN, or 0 once used
+    uint64_t rxFrameStartTime_us;
+    uint64_t lastBsqTime_us;  // When the last BSQ (or run of frames awaiting a BSN) was sent
+    bool bsqPending;          // BSQ or run sent, no fresh BSN received since
+
+    // BSN accounting.  BSNs arrive in the order the hub sent them, so
+    // counting what should have prompted one tells which BSN was sent after
+    // the latest run of frames.  Only such a fresh BSN grants credit: an
+    // older one doesn't allow for the run.  A BSN is fresh once
+    // stats.rxBsns reaches the due count for the hub's bsnMode.
+    bsnMode_t bsnMode;
+    uint32_t bsnsQuery;    // BSNs prompted so far, in BSN_MODE_QUERY
+    uint32_t bsnsFrame;    // BSNs prompted so far, in BSN_MODE_FRAME
+    uint32_t bsnDueQuery;  // Count of the first fresh BSN, in BSN_MODE_QUERY
+    uint32_t bsnDueFrame;  // Count of the first fresh BSN, in BSN_MODE_FRAME
+    uint16_t rxBsn;        // Last BSN received, fresh or not
+    uint64_t txStallStart_us; // When the head of the transmit queue started waiting, or 0
+
+    // Transmit queue, frames are sent in order as buffer credit allows.
+    uint8_t txQueue[TX_QUEUE_LEN];
+    uint32_t txQueueLen;                  // Bytes queued
+    uint16_t txFrameLen[TX_QUEUE_FRAMES]; // Length of each queued frame
+    uint32_t txFrames;                    // Number of frames queued
+
+    // Raw bytes read from the port.  Frames are decoded from here straight
+    // into the client's buffer once they are complete.  Bytes left over after
+    // a frame is delivered carry over to the next read.
+    uint8_t rxBuf[RX_BUF_LEN];
+    uint32_t rxBufLen;  // Number of valid bytes in rxBuf
+    uint32_t rxBufIdx;  // Start of unprocessed data (start flag, if rxInFrame)
+    uint32_t rxScanIdx; // Where to resume looking for the end flag
+    bool rxInFrame;     // Start flag found, waiting for end flag
+
+    // Receive timing.  A chunk's last byte is taken to have arrived when the
+    // read returned, earlier bytes are back-computed from the baud rate.
+    uint32_t baud_bps;       // Line rate in bits/s
+    uint64_t rxChunkTime_us; // Arrival time of the last byte in rxBuf
+    uint64_t rxIdleTime_us;  // Last time the port was known to have no more data
+    uint32_t rxJitter_us;    // Smoothed uncertainty of rxChunkTime_us
+    uint32_t rxSpin_us;      // ftdi_hal_wait() busy-polls this long after data arrives
+
+    // Transmit pacing.  Each byte is written at least txGap_us after the
+    // previous one.  The gaps actually achieved are measured.
+    uint32_t txGap_us;
+    uint32_t txMinGap_us;   // Smallest gap between bytes of a frame
+    uint64_t txGapTotal_us; // Sum of gaps, for the mean
+    uint32_t txGaps;        // Number of gaps measured
+    uint64_t txFullSince_us; // When the port stopped taking data, or 0 if it is
+
+    ftdi_hal_Stats_t stats; // Counted since open
+
+    // Raw traffic is recorded here, if not NULL.  See capture.h.
+    FILE* captureFile;
+
+    // Replay of a capture in place of the port, if replayFilename is set.
+    // Recorded RX chunks are fed to the deframer, writes are discarded.
+    const char* replayFilename;
+    FILE* replayFile;
+    bool replayFast;            // As fast as possible, rather than in real time
+    bool replayEof;             // All recorded data has been delivered
+    capture_Record_t replayRec; // RX record being delivered
+    uint8_t replayData[RX_BUF_LEN];
+    uint32_t replayIdx;         // Next byte of replayData to deliver
+    int64_t replayOffset_us;    // Recorded time to our time
 
     const char* device_filename;
 #ifdef _WIN32
@@ -88,6 +188,19 @@ struct ftdi_hal_s {
 #else
     speed_t baud;
     int fd;
+    bool softLink; // Software transport (socket or pty), see soft_link.h
+    int wakePipe[2]; // ftdi_hal_wake() writes here to interrupt ftdi_hal_wait()
+
+    // Low latency tuning, undone on close
+    char latencyPath[PATH_MAX]; // sysfs latency_timer file of the port
+    int origLatencyTimer;       // Value before open, or -1 if not changed
+    int origSerialFlags;        // serial_struct flags before open, or -1 if not changed
+
+#ifdef __linux__
+    // Serial driver error counters at open, if the driver keeps them
+    bool icountValid;
+    struct serial_icounter_struct icountBase;
+#endif
 #endif
 };
 typedef struct ftdi_hal_s ftdi_hal_t;
@@ -113,23 +226,30 @@ static void setBootN(ftdi_hal_t* pHal, bool state) {
     }
 }
 
-// Get time in microseconds as 64-bit quantity
-static uint64_t readTime_us() {
-    static uint64_t freq = 0;
-    uint64_t counterTime;
-
-    QueryPerformanceCounter((LARGE_INTEGER*)&counterTime);
-
-    if (freq == 0) {
-        QueryPerformanceFrequency((LARGE_INTEGER*)&freq);
+// Write up to len bytes.  Returns the number written, 0 if it should be
+// retried or SH2_ERR_IO.
+static int write_chunk(ftdi_hal_t* pHal, const uint8_t* pData, uint32_t len) {
+    DWORD bytes_written = 0;
+    FT_STATUS status = FT_Write(pHal->ftHandle, (void*)pData, len, &bytes_written);
+    if (status != FT_OK) {
+        // fail with I/O error
+        return SH2_ERR_IO;
     }
+    return (int)bytes_written;
+}
 
-    return (uint64_t)(counterTime * 1000000 / freq);
+// Wait up to timeout_us for room to write.  FT_Write() already waits out
+// its own timeout before writing nothing, so just back off.
+static void wait_writable(ftdi_hal_t* pHal, uint32_t timeout_us) {
+    (void)pHal;
+    timing_sleepUntil_us(timing_now_us() + timeout_us, 0);
 }
 
-static bool read_char(ftdi_hal_t* pHal, uint8_t* c) {
-    int status;
-    int bytesRead;
+// Read up to len bytes of whatever data is available, without blocking.
+// Returns number of bytes read.
+static int read_chunk(ftdi_hal_t* pHal, uint8_t* pBuf, uint32_t len) {
+    FT_STATUS status;
+    DWORD bytesRead = 0;
 
     DWORD eventDWord;
     DWORD txBytes;
@@ -137,24 +257,27 @@ static bool read_char(ftdi_hal_t* pHal, uint8_t* c) {
 
     FT_GetStatus(pHal->ftHandle, &rxBytes, &txBytes, &eventDWord);
 
-    if (rxBytes > 0) {
-        status = FT_Read(pHal->ftHandle, c, 1, &bytesRead);
-        if ((status == FT_OK) && (bytesRead > 0)) {
-            // Reset LATENCY_TIMER as soon as data is received.
-            if (!pHal->anyRx) {
-                pHal->anyRx = true;
-                if (!pHal->latencySet) {
-                    pHal->latencySet = true;
-                    FT_SetLatencyTimer(pHal->ftHandle, LATENCY_TIMER);
-                }
-            }
-            return true;
-        } else {
-            return false;
+    if (rxBytes == 0) {
+        return 0;
+    }
+    if (rxBytes > len) {
+        rxBytes = len;
+    }
+
+    status = FT_Read(pHal->ftHandle, pBuf, rxBytes, &bytesRead);
+    if ((status != FT_OK) || (bytesRead == 0)) {
+        return 0;
+    }
+
+    // Reset LATENCY_TIMER as soon as data is received.
+    if (!pHal->anyRx) {
+        pHal->anyRx = true;
+        if (!pHal->latencySet) {
+            pHal->latencySet = true;
+            FT_SetLatencyTimer(pHal->ftHandle, LATENCY_TIMER);
         }
-    } else {
-        return false;
     }
+    return (int)bytesRead;
 }
 
 #else // ifdef _WIN32
@@ -162,6 +285,11 @@ static bool read_char(ftdi_hal_t* pHal, uint8_t* c) {
 
 // Set RESETN to state.
 static void setResetN(ftdi_hal_t* pHal, bool state) {
+    if (pHal->softLink) {
+        soft_link_setLine(pHal->fd, SOFT_LINK_RESETN, state);
+        return;
+    }
+
     // RESETN connected to DTR
     int resetSignal = TIOCM_DTR;
     int status = 0;
@@ -179,6 +307,11 @@ static void setResetN(ftdi_hal_t* pHal, bool state) {
 
 // Set BOOTN to state.
 static void setBootN(ftdi_hal_t* pHal, bool state) {
+    if (pHal->softLink) {
+        soft_link_setLine(pHal->fd, SOFT_LINK_BOOTN, state);
+        return;
+    }
+
     // BOOTN connected to RTS
     int bootnSignal = TIOCM_RTS;
 
@@ -195,99 +328,549 @@ static void setBootN(ftdi_hal_t* pHal, bool state) {
     ioctl(pHal->fd, TIOCMSET, &status);
 }
 
-// Get time in microseconds as 64-bit quantity
-static uint64_t readTime_us() {
-    struct timespec tp;
-    clock_gettime(CLOCK_MONOTONIC, &tp);
-    return ((uint32_t)tp.tv_sec * 1000000) + ((uint32_t)tp.tv_nsec / 1000.0);
+// Write up to len bytes.  Returns the number written, 0 if it should be
+// retried or SH2_ERR_IO.
+static int write_chunk(ftdi_hal_t* pHal, const uint8_t* pData, uint32_t len) {
+    int status = write(pHal->fd, pData, len);
+    if (status > 0) {
+        return status;
+    }
+    if ((status < 0) && (errno != EAGAIN)) {
+        // I/O error!
+        return SH2_ERR_IO;
+    }
+    return 0;
 }
 
-static bool read_char(ftdi_hal_t* pHal, uint8_t* c) {
+// Wait up to timeout_us for room to write.
+static void wait_writable(ftdi_hal_t* pHal, uint32_t timeout_us) {
+    struct pollfd fds;
+    fds.fd = pHal->fd;
+    fds.events = POLLOUT;
+    fds.revents = 0;
+
+    // Errors and signals just end the wait early; the write is retried.
+    poll(&fds, 1, (int)((timeout_us + 999) / 1000));
+}
+
+// Read up to len bytes of whatever data is available, without blocking.
+// Returns number of bytes read.
+static int read_chunk(ftdi_hal_t* pHal, uint8_t* pBuf, uint32_t len) {
     int status;
-    status = read(pHal->fd, c, 1);
-    return status > 0;
+    status = read(pHal->fd, pBuf, len);
+    if (status < 0) {
+        // EAGAIN: no data available.  Other errors are treated the same way,
+        // the next call will try again.
+        return 0;
+    }
+    return status;
+}
+
+// Read an integer from a sysfs file.  Returns -1 on failure.
+static int read_sysfs_int(const char* path) {
+    int value = -1;
+    FILE* f = fopen(path, "r");
+    if (f != NULL) {
+        if (fscanf(f, "%d", &value) != 1) {
+            value = -1;
+        }
+        fclose(f);
+    }
+    return value;
+}
+
+// Write an integer to a sysfs file.  Returns true on success.
+static bool write_sysfs_int(const char* path, int value) {
+    FILE* f = fopen(path, "w");
+    if (f == NULL) {
+        return false;
+    }
+    bool ok = (fprintf(f, "%d", value) > 0);
+    ok = (fclose(f) == 0) && ok;
+    return ok;
+}
+
+// Have the USB-serial driver deliver received data without waiting for its
+// latency timer (ftdi_sio default 16 ms), so data doesn't arrive in bursts.
+// Sets latency_timer through sysfs if possible, otherwise ASYNC_LOW_LATENCY.
+// Ports without either (plain UARTs, ptys) are left as they are.
+static void tune_latency(ftdi_hal_t* pHal) {
+    pHal->latencyPath[0] = '\0';
+    pHal->origLatencyTimer = -1;
+    pHal->origSerialFlags = -1;
+
+#ifdef __linux__
+    // Follow symlinks such as /dev/serial/by-id/... to find the tty name.
+    char devPath[PATH_MAX];
+    if (realpath(pHal->device_filename, devPath) != NULL) {
+        const char* tty = strrchr(devPath, '/');
+        tty = (tty != NULL) ? tty + 1 : devPath;
+
+        int n = snprintf(pHal->latencyPath,
+                         sizeof(pHal->latencyPath),
+                         "/sys/bus/usb-serial/devices/%s/latency_timer",
+                         tty);
+        int orig = -1;
+        if ((n > 0) && (n < (int)sizeof(pHal->latencyPath))) {
+            orig = read_sysfs_int(pHal->latencyPath);
+        }
+        if (orig == LATENCY_TIMER) {
+            fprintf(stderr, "INFO: %s latency_timer already %d ms\n", tty, orig);
+            return;
+        }
+        if ((orig >= 0) && write_sysfs_int(pHal->latencyPath, LATENCY_TIMER)) {
+            pHal->origLatencyTimer = orig;
+            fprintf(stderr,
+                    "INFO: %s latency_timer set to %d ms (was %d)\n",
+                    tty,
+                    LATENCY_TIMER,
+                    orig);
+            return;
+        }
+        if (orig >= 0) {
+            fprintf(stderr,
+                    "INFO: %s latency_timer is %d ms, no permission to change it\n",
+                    tty,
+                    orig);
+        }
+    }
+
+    struct serial_struct serial;
+    if (ioctl(pHal->fd, TIOCGSERIAL, &serial) < 0) {
+        // Not a serial driver, e.g. a pty
+        fprintf(stderr, "INFO: No latency tuning available for %s\n", pHal->device_filename);
+        return;
+    }
+    if (serial.flags & ASYNC_LOW_LATENCY) {
+        fprintf(stderr, "INFO: %s already in low latency mode\n", pHal->device_filename);
+        return;
+    }
+    int flags = serial.flags;
+    serial.flags |= ASYNC_LOW_LATENCY;
+    if (ioctl(pHal->fd, TIOCSSERIAL, &serial) < 0) {
+        fprintf(stderr,
+                "INFO: Unable to set low latency mode on %s: %s\n",
+                pHal->device_filename,
+                strerror(errno));
+        return;
+    }
+    pHal->origSerialFlags = flags;
+    fprintf(stderr, "INFO: %s set to low latency mode\n", pHal->device_filename);
+#endif
+}
+
+// Undo tune_latency().  Called while the port is still open.
+static void restore_latency(ftdi_hal_t* pHal) {
+    if (pHal->origLatencyTimer >= 0) {
+        write_sysfs_int(pHal->latencyPath, pHal->origLatencyTimer);
+        pHal->origLatencyTimer = -1;
+    }
+
+#ifdef __linux__
+    if (pHal->origSerialFlags >= 0) {
+        struct serial_struct serial;
+        if (ioctl(pHal->fd, TIOCGSERIAL, &serial) == 0) {
+            serial.flags = pHal->origSerialFlags;
+            ioctl(pHal->fd, TIOCSSERIAL, &serial);
+        }
+        pHal->origSerialFlags = -1;
+    }
+#endif
 }
 
 #endif // ifdef _WIN32
 
-static uint32_t time32_now_us() {
-    static uint64_t initialTimeUs = 0;
-    uint64_t t_us = readTime_us();
+// Clock used during fast replay: the recorded time of the data last
+// delivered, so frames get the timestamps they had when captured.  Once the
+// recording runs out it moves on in real time, so timeouts still expire.
+// Like timing_now_us() itself, there is one per process.
+static struct {
+    uint64_t now_us;       // Time of the last data delivered
+    bool realTime;         // Recording used up, advancing in real time
+    uint64_t realStart_us; // System time when realTime was set
+} replayClock;
+
+static uint64_t replay_clock_ns(void) {
+    uint64_t t_us = replayClock.now_us;
+    if (replayClock.realTime) {
+        t_us += timing_systemNow_us() - replayClock.realStart_us;
+    }
+    return t_us * 1000;
+}
+
+// Mark the end of a replay's data.
+static void replay_eof(ftdi_hal_t* pHal) {
+    pHal->replayEof = true;
+    if (pHal->replayFast && !replayClock.realTime) {
+        replayClock.realTime = true;
+        replayClock.realStart_us = timing_systemNow_us();
+    }
+}
 
-    if (initialTimeUs == 0) {
-        initialTimeUs = t_us;
+// Load the next RX record to replay.  TX records are skipped, the host
+// produces its own writes.  Returns false at the end of the recording.
+static bool replay_next(ftdi_hal_t* pHal) {
+    while (capture_read(pHal->replayFile,
+                        &pHal->replayRec,
+                        pHal->replayData,
+                        sizeof(pHal->replayData))) {
+        if ((pHal->replayRec.dir == CAPTURE_DIR_RX) && (pHal->replayRec.len > 0)) {
+            pHal->replayIdx = 0;
+            return true;
+        }
     }
-    t_us -= initialTimeUs;
 
-    return (uint32_t)t_us;
+    replay_eof(pHal);
+    return false;
 }
 
-static void delay_us(uint32_t t) {
-    uint32_t now = time32_now_us();
-    uint32_t start = now;
-    while ((int32_t)(now - start) <= t) {
-        now = time32_now_us();
+// True if there is RX data left to deliver, loading the next record once
+// the current one has been delivered.  Done lazily, so a fast replay's
+// clock only starts running in real time after the last data was read.
+static bool replay_ready(ftdi_hal_t* pHal) {
+    if (pHal->replayEof) {
+        return false;
+    }
+    if (pHal->replayIdx < pHal->replayRec.len) {
+        return true;
     }
+    return replay_next(pHal);
 }
 
-static void rfc1662_reset(ftdi_hal_t* pHal) {
-    pHal->rxFrameLen = 0;
-    pHal->rxFrameReady = false;
-    pHal->rxState = OUTSIDE_FRAME;
+// Time at which the current RX record is due, in our timebase.
+static uint64_t replay_due_us(ftdi_hal_t* pHal) {
+    return (uint64_t)((int64_t)pHal->replayRec.t_us + pHal->replayOffset_us);
 }
 
-static void rfc1662_decode(ftdi_hal_t* pHal, uint8_t c) {
-    // Use state machine to build up chars into frames for delivery.
-    switch (pHal->rxState) {
-        case OUTSIDE_FRAME:
-            // Look for start of frame
-            if (c == RFC1662_FLAG) {
-                // Init frame in progress
-                pHal->rxFrameStartTime_us = time32_now_us();
-                pHal->rxFrameLen = 0;
-                pHal->rxFrameReady = false;
-                pHal->rxState = INSIDE_FRAME;
+// Start replaying: load the first record and line up recorded time with ours.
+static int replay_open(ftdi_hal_t* pHal) {
+    pHal->replayFile = capture_open(pHal->replayFilename);
+    if (pHal->replayFile == NULL) {
+        fprintf(stderr, "Unable to open capture file %s\n", pHal->replayFilename);
+        return SH2_ERR_IO;
+    }
+    pHal->replayEof = false;
+
+    uint64_t now = timing_now_us();
+    if (pHal->replayFast) {
+        replayClock.now_us = now;
+        replayClock.realTime = false;
+        timing_setClock(replay_clock_ns);
+    }
+
+    if (!replay_next(pHal)) {
+        pHal->replayOffset_us = 0;
+    } else if (pHal->replayFast) {
+        // Recorded timestamps are kept unless they'd take time backwards.
+        pHal->replayOffset_us =
+                (pHal->replayRec.t_us < now) ? (int64_t)(now - pHal->replayRec.t_us) : 0;
+    } else {
+        // First data is due right away, the rest at their recorded spacing.
+        pHal->replayOffset_us = (int64_t)now - (int64_t)pHal->replayRec.t_us;
+    }
+    return SH2_OK;
+}
+
+// Stop replaying.  A fast replay's clock stays in place, running in real
+// time, so time never goes backwards for the rest of the run.
+static void replay_close(ftdi_hal_t* pHal) {
+    if (!pHal->replayEof) {
+        replay_eof(pHal);
+    }
+    fclose(pHal->replayFile);
+    pHal->replayFile = NULL;
+}
+
+// Replay counterpart of read_chunk(): up to len bytes of the current
+// record, once it is due.
+static int replay_chunk(ftdi_hal_t* pHal, uint8_t* pBuf, uint32_t len) {
+    if (!replay_ready(pHal)) {
+        return 0;
+    }
+
+    uint64_t due = replay_due_us(pHal);
+    if (pHal->replayFast) {
+        if (due > replayClock.now_us) {
+            replayClock.now_us = due;
+        }
+    } else if (timing_now_us() < due) {
+        return 0;
+    }
+
+    uint32_t n = pHal->replayRec.len - pHal->replayIdx;
+    if (n > len) {
+        n = len;
+    }
+    memcpy(pBuf, pHal->replayData + pHal->replayIdx, n);
+    pHal->replayIdx += n;
+    return (int)n;
+}
+
+// Replay counterpart of the port wait in ftdi_hal_wait().
+static int replay_wait(ftdi_hal_t* pHal, uint32_t timeout_us) {
+    if (!replay_ready(pHal)) {
+        return 0;
+    }
+    if (pHal->replayFast) {
+        return 1;
+    }
+
+    uint64_t due = replay_due_us(pHal);
+    uint64_t deadline = timing_now_us() + timeout_us;
+    timing_sleepUntil_us((due < deadline) ? due : deadline, 0);
+
+    uint64_t now = timing_now_us();
+    pHal->rxIdleTime_us = now;
+    return (now >= due) ? 1 : 0;
+}
+
+// Discard any buffered, not yet deframed, receive data.
+static void rx_buf_reset(ftdi_hal_t* pHal) {
+    pHal->rxBufLen = 0;
+    pHal->rxBufIdx = 0;
+    pHal->rxScanIdx = 0;
+    pHal->rxInFrame = false;
+}
+
+// True if rxBuf holds data that has not been searched for frames yet.
+static bool rx_buf_pending(ftdi_hal_t* pHal) {
+    if (pHal->rxInFrame) {
+        return pHal->rxScanIdx < pHal->rxBufLen;
+    }
+    return pHal->rxBufIdx < pHal->rxBufLen;
+}
+
+// Keep only the frame in progress (if any) at the front of rxBuf, then
+// append whatever data is available from the port.  Returns number of bytes read.
+static int rx_buf_fill(ftdi_hal_t* pHal) {
+    if (!pHal->rxInFrame) {
+        rx_buf_reset(pHal);
+    } else if (pHal->rxBufIdx > 0) {
+        uint32_t keep = pHal->rxBufLen - pHal->rxBufIdx;
+        memmove(pHal->rxBuf, pHal->rxBuf + pHal->rxBufIdx, keep);
+        pHal->rxScanIdx -= pHal->rxBufIdx;
+        pHal->rxBufIdx = 0;
+        pHal->rxBufLen = keep;
+    } else if (pHal->rxBufLen == sizeof(pHal->rxBuf)) {
+        // frame in progress fills the whole buffer, too big for HAL, discard
+        rx_buf_reset(pHal);
+        pHal->stats.rxTooLong++;
+    }
+
+    uint32_t space = sizeof(pHal->rxBuf) - pHal->rxBufLen;
+    int got;
+    if (pHal->replayFilename != NULL) {
+        got = replay_chunk(pHal, pHal->rxBuf + pHal->rxBufLen, space);
+    } else {
+        got = read_chunk(pHal, pHal->rxBuf + pHal->rxBufLen, space);
+    }
+    uint64_t now = timing_now_us();
+    if (got > 0) {
+        if (pHal->captureFile != NULL) {
+            capture_write(pHal->captureFile,
+                          now,
+                          CAPTURE_DIR_RX,
+                          pHal->rxBuf + pHal->rxBufLen,
+                          (uint16_t)got);
+        }
+        pHal->rxBufLen += got;
+        pHal->rxChunkTime_us = now;
+        pHal->stats.rxBytes += got;
+
+        // The data arrived some time after the port was last seen idle.
+        // Track how wide that window is as the jitter estimate.
+        uint64_t window = now - pHal->rxIdleTime_us;
+        if (window > INT32_MAX) {
+            window = INT32_MAX;
+        }
+        pHal->rxJitter_us += ((int32_t)window - (int32_t)pHal->rxJitter_us) / JITTER_FILTER_N;
+    }
+    if ((uint32_t)got < space) {
+        // Read didn't fill the buffer so the port has been drained.
+        pHal->rxIdleTime_us = now;
+    }
+    return got;
+}
+
+// Estimated arrival time of the byte at rxBuf[idx], which must be part of
+// the last chunk read.
+static uint64_t rx_byte_time(ftdi_hal_t* pHal, uint32_t idx) {
+    uint64_t charsAfter = pHal->rxBufLen - 1 - idx;
+    uint64_t offset_us = (charsAfter * BITS_PER_CHAR * 1000000) / pHal->baud_bps;
+
+    return pHal->rxChunkTime_us - offset_us;
+}
+
+// Write len bytes, one at a time, at least txGap_us apart.  The thread
+// sleeps between bytes rather than spinning, and while the output buffer
+// is full.  With no gap, bytes are written in as few calls as the port
+// allows.  Returns SH2_OK, or SH2_ERR_IO if the port fails or has been full
+// for TX_TIMEOUT_US.
+static int tx_paced(ftdi_hal_t* pHal, const uint8_t* pData, uint32_t len) {
+    uint32_t written = 0;
+    uint64_t lastWrite_us = 0;
+    uint64_t next_us = 0;
+
+    while (written < len) {
+        if (written > 0) {
+            // Wait out the gap, measured from when the previous byte was written.
+            // Gaps are short and only a minimum, so sleep without spinning.
+            timing_sleepUntil_us(next_us, 0);
+        }
+
+        uint32_t chunk = (pHal->txGap_us == 0) ? (len - written) : 1;
+        int status = write_chunk(pHal, pData + written, chunk);
+        if (status < 0) {
+            return status;
+        }
+        if (status == 0) {
+            // Output buffer full, wait for room and try again.
+            uint64_t now = timing_now_us();
+            if (pHal->txFullSince_us == 0) {
+                pHal->txFullSince_us = now;
             }
-            break;
-        case INSIDE_FRAME:
-            // Look for end of frame
-            if (c == RFC1662_FLAG) {
-                if (pHal->rxFrameLen > 0) {
-                    // Frame is done
-                    pHal->rxFrameReady = true;
-                    pHal->rxState = OUTSIDE_FRAME;
-                } else {
-                    // Treat second consec flag as another start flag.
-                    pHal->rxState = INSIDE_FRAME;
-                }
-            } else if (c == RFC1662_ESCAPE) {
-                // Go to escaped state so next char can be a flag or escape
-                pHal->rxState = ESCAPED;
-            } else {
-                if (pHal->rxFrameLen < sizeof(pHal->rxFrame)) {
-                    pHal->rxFrame[pHal->rxFrameLen] = c;
-                    pHal->rxFrameLen++;
-                } else {
-                    // overflowing, don't store data beyond allocated buffer size.
-                    pHal->rxFrameLen++;
-                }
+            uint64_t deadline_us = pHal->txFullSince_us + TX_TIMEOUT_US;
+            if (now >= deadline_us) {
+                return SH2_ERR_IO;
             }
-            break;
-        case ESCAPED:
-            if (pHal->rxFrameLen < sizeof(pHal->rxFrame)) {
-                pHal->rxFrame[pHal->rxFrameLen] = c ^ 0x20;
-                pHal->rxFrameLen++;
-            } else {
-                // overflowing, don't store data beyond allocated buffer size.
-                pHal->rxFrameLen++;
+            uint64_t wait_us = deadline_us - now;
+            wait_writable(pHal, (wait_us < TX_FULL_WAIT_US) ? (uint32_t)wait_us : TX_FULL_WAIT_US);
+            continue;
+        }
+        pHal->stats.txWrites++;
+        pHal->txFullSince_us = 0;
+
+        uint64_t now = timing_now_us();
+        if (written > 0) {
+            uint32_t gap = (uint32_t)(now - lastWrite_us);
+            if (gap < pHal->txMinGap_us) {
+                pHal->txMinGap_us = gap;
+            }
+            pHal->txGapTotal_us += gap;
+            pHal->txGaps++;
+        }
+        if (status > 1) {
+            // Bytes within one write go out back to back.
+            pHal->txMinGap_us = 0;
+            pHal->txGaps += status - 1;
+        }
+        lastWrite_us = now;
+        written += status;
+        pHal->stats.txBytes += status;
+
+        next_us = now + pHal->txGap_us;
+    }
+
+    return SH2_OK;
+}
+
+static const uint8_t BSQ[] = {RFC1662_FLAG, PROTOCOL_CONTROL, RFC1662_FLAG};
+
+// Send a buffer status query.  The hub answers with a BSN.
+static int tx_bsq(ftdi_hal_t* pHal) {
+    uint64_t now = timing_now_us();
+
+    pHal->lastBsqTime_us = now;
+    pHal->bsqPending = true;
+    pHal->stats.txBsqs++;
+
+    // Its answer comes after everything sent so far, so is fresh.
+    pHal->bsnsQuery++;
+    pHal->bsnsFrame++;
+    pHal->bsnDueQuery = pHal->bsnsQuery;
+    pHal->bsnDueFrame = pHal->bsnsFrame;
+    if (tx_paced(pHal, BSQ, sizeof(BSQ)) != SH2_OK) {
+        return SH2_ERR_IO;
+    }
+    if (pHal->captureFile != NULL) {
+        capture_write(pHal->captureFile, now, CAPTURE_DIR_TX, BSQ, sizeof(BSQ));
+    }
+    return SH2_OK;
+}
+
+// Discard the frame at the head of the transmit queue.
+static void tx_dequeue(ftdi_hal_t* pHal, uint32_t frames, uint32_t len) {
+    pHal->txQueueLen -= len;
+    memmove(pHal->txQueue, pHal->txQueue + len, pHal->txQueueLen);
+    pHal->txFrames -= frames;
+    memmove(pHal->txFrameLen,
+            pHal->txFrameLen + frames,
+            pHal->txFrames * sizeof(pHal->txFrameLen[0]));
+}
+
+// Send queued frames while the hub has room for them.  Each run of frames
+// is followed straight away by a BSQ, so credit for the next one is on its
+// way back while the client is still busy.  Hubs that send a BSN after
+// every frame on their own (seen as more BSNs than BSQs) don't need it.
+// If the hub has no room and no BSN is expected, or the fresh one seems
+// lost, ask again.
+static int tx_service(ftdi_hal_t* pHal) {
+    while (pHal->txFrames > 0) {
+        // Send as many queued frames together as the hub has room for.
+        uint32_t frames = 0;
+        uint32_t runLen = 0;
+        while ((frames < pHal->txFrames) && (runLen + pHal->txFrameLen[frames] <= pHal->lastBsn)) {
+            runLen += pHal->txFrameLen[frames];
+            frames++;
+        }
+
+        if (frames == 0) {
+            uint64_t now = timing_now_us();
+            if (pHal->txStallStart_us == 0) {
+                pHal->txStallStart_us = now;
+                pHal->stats.txStalls++;
+            }
+            if (!pHal->bsqPending) {
+                return tx_bsq(pHal);
+            }
+            if ((now - pHal->lastBsqTime_us) > INTER_BSQ_DELAY_US) {
+                if ((pHal->bsnMode == BSN_MODE_UNKNOWN) &&
+                    (pHal->stats.rxBsns >= pHal->bsnDueQuery)) {
+                    // The BSQ was answered and no BSNs followed the frames:
+                    // the hub only answers BSQs, so its answer was fresh.
+                    pHal->bsnMode = BSN_MODE_QUERY;
+                    pHal->lastBsn = pHal->rxBsn;
+                    pHal->bsqPending = false;
+                    continue;
+                }
+                // The fresh BSN seems lost.  Anything older has arrived by
+                // now, so count afresh from here, and ask again.
+                pHal->bsnsQuery = pHal->stats.rxBsns;
+                pHal->bsnsFrame = pHal->stats.rxBsns;
+                return tx_bsq(pHal);
             }
-            pHal->rxState = INSIDE_FRAME;
-            break;
-        default:
-            // Bad state.  Recover by resetting to outside frame state
-            pHal->rxState = OUTSIDE_FRAME;
-            break;
+            return SH2_OK;
+        }
+
+        // Reset lastBsn.  By sending, we're invalidating prior buffer status notification.
+        pHal->lastBsn = 0;
+
+        // Write the frames as one run, paced for the sensor hub.
+        uint64_t now = timing_now_us();
+        if (pHal->txStallStart_us != 0) {
+            pHal->stats.txStall_us += now - pHal->txStallStart_us;
+            pHal->txStallStart_us = 0;
+        }
+        if (tx_paced(pHal, pHal->txQueue, runLen) != SH2_OK) {
+            return SH2_ERR_IO;
+        }
+        if (pHal->captureFile != NULL) {
+            capture_write(pHal->captureFile, now, CAPTURE_DIR_TX, pHal->txQueue, (uint16_t)runLen);
+        }
+        tx_dequeue(pHal, frames, runLen);
+        pHal->stats.txFrames += frames;
+        pHal->bsnsFrame += frames;
+
+        if (pHal->bsnMode == BSN_MODE_FRAME) {
+            // The BSN following the run's last frame is the fresh one.
+            pHal->bsnDueFrame = pHal->bsnsFrame;
+            pHal->lastBsqTime_us = now;
+            pHal->bsqPending = true;
+        } else if (tx_bsq(pHal) != SH2_OK) {
+            return SH2_ERR_IO;
+        }
     }
+    return SH2_OK;
 }
 
 #ifndef _WIN32
@@ -299,8 +882,72 @@ static void uart_errno_printf(const char* s, ...) {
     fflush(stderr);
     va_end(vl);
 }
+
+// Open and configure the serial port.
+static int open_serial(ftdi_hal_t* pHal) {
+    struct termios tty;
+
+    // Open device file
+    if ((pHal->fd = open(pHal->device_filename, O_RDWR | O_NOCTTY | O_NONBLOCK)) == -1) {
+        uart_errno_printf("uart_connect: OPEN '%s':", pHal->device_filename);
+        return SH2_ERR_IO;
+    }
+
+    // Get attributes
+    if (tcgetattr(pHal->fd, &tty) < 0) {
+        uart_errno_printf("Unable to read port attributes: %s", pHal->device_filename);
+        close(pHal->fd);
+        return SH2_ERR_IO;
+    }
+    tty.c_iflag &=
+            ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF); //| IGNPAR
+    tty.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    tty.c_oflag &= ~OPOST;
+    tty.c_cflag &= ~(CSIZE | PARENB);
+    tty.c_cflag |= CS8 | CREAD | CLOCAL;
+
+    tty.c_cflag &= ~CSTOPB;
+    tty.c_cflag &= ~CRTSCTS;
+
+    // Set speed
+    cfsetispeed(&tty, pHal->baud);
+    cfsetospeed(&tty, pHal->baud);
+
+    // VMIN and VTIME so data is returned ASAP
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 0;
+
+    // Set attributes
+    if (tcsetattr(pHal->fd, TCSANOW, &tty) < 0) {
+        uart_errno_printf("Unable to set port attributes for %s", pHal->device_filename);
+        close(pHal->fd);
+        return SH2_ERR_IO;
+    }
+
+    fsync(pHal->fd);
+    tcflush(pHal->fd, TCIOFLUSH);
+
+    return SH2_OK;
+}
 #endif
 
+// Bring the serial driver's error counts in stats up to date.  They are
+// left at -1 if the driver doesn't keep them.
+static void tty_stats(ftdi_hal_t* pHal) {
+#ifdef __linux__
+    struct serial_icounter_struct count;
+    if (pHal->is_open && pHal->icountValid && (ioctl(pHal->fd, TIOCGICOUNT, &count) == 0)) {
+        pHal->stats.ttyOverruns = count.overrun - pHal->icountBase.overrun;
+        pHal->stats.ttyBufOverruns = count.buf_overrun - pHal->icountBase.buf_overrun;
+        pHal->stats.ttyFramingErrors = count.frame - pHal->icountBase.frame;
+        pHal->stats.ttyParityErrors = count.parity - pHal->icountBase.parity;
+        pHal->stats.ttyBreaks = count.brk - pHal->icountBase.brk;
+    }
+#else
+    (void)pHal;
+#endif
+}
+
 static int ftdi_hal_open(sh2_Hal_t* self) {
     ftdi_hal_t* pHal = (ftdi_hal_t*)self;
 
@@ -313,10 +960,45 @@ static int ftdi_hal_open(sh2_Hal_t* self) {
     pHal->is_open = true;
 
     // reset de-framer
-    rfc1662_reset(pHal);
+    rx_buf_reset(pHal);
 
     pHal->lastBsn = 0;
-    pHal->rxFrameStartTime_us = time32_now_us();
+    pHal->bsqPending = false;
+    pHal->bsnMode = BSN_MODE_UNKNOWN;
+    pHal->bsnsQuery = 0;
+    pHal->bsnsFrame = 0;
+    pHal->bsnDueQuery = 0;
+    pHal->bsnDueFrame = 0;
+    pHal->rxBsn = 0;
+    pHal->txStallStart_us = 0;
+    memset(&pHal->stats, 0, sizeof(pHal->stats));
+    pHal->stats.ttyOverruns = -1;
+    pHal->stats.ttyBufOverruns = -1;
+    pHal->stats.ttyFramingErrors = -1;
+    pHal->stats.ttyParityErrors = -1;
+    pHal->stats.ttyBreaks = -1;
+#ifdef __linux__
+    pHal->icountValid = false;
+#endif
+    pHal->txQueueLen = 0;
+    pHal->txFrames = 0;
+    pHal->rxFrameStartTime_us = timing_now_us();
+    pHal->rxChunkTime_us = pHal->rxFrameStartTime_us;
+    pHal->rxIdleTime_us = pHal->rxFrameStartTime_us;
+    pHal->rxJitter_us = 0;
+    pHal->txMinGap_us = UINT32_MAX;
+    pHal->txGapTotal_us = 0;
+    pHal->txGaps = 0;
+    pHal->txFullSince_us = 0;
+
+    if (pHal->replayFilename != NULL) {
+        // No port to set up and no sensor hub to reset
+        int status = replay_open(pHal);
+        if (status != SH2_OK) {
+            pHal->is_open = false;
+        }
+        return status;
+    }
 
 #ifdef _WIN32
     // Windows-specific serial port setup
@@ -374,50 +1056,44 @@ static int ftdi_hal_open(sh2_Hal_t* self) {
 #else  // ifdef _WIN32
     // Non-Windows-specific serial port setup
 
-    struct termios tty;
-
-    // Open device file
-    if ((pHal->fd = open(pHal->device_filename, O_RDWR | O_NOCTTY | O_NONBLOCK)) == -1) {
-        uart_errno_printf("uart_connect: OPEN '%s':", pHal->device_filename);
-        pHal->is_open = false;
-        return SH2_ERR_IO;
+    pHal->softLink = soft_link_isSoftLink(pHal->device_filename);
+    if (pHal->softLink) {
+        // Simulated sensor hub, no serial port setup
+        if ((pHal->fd = soft_link_open(pHal->device_filename)) == -1) {
+            uart_errno_printf("uart_connect: OPEN '%s':", pHal->device_filename);
+            pHal->is_open = false;
+            return SH2_ERR_IO;
+        }
+    } else {
+        int status = open_serial(pHal);
+        if (status != SH2_OK) {
+            pHal->is_open = false;
+            return status;
+        }
     }
 
-    // Get attributes
-    if (tcgetattr(pHal->fd, &tty) < 0) {
-        uart_errno_printf("Unable to read port attributes: %s", pHal->device_filename);
+    // Create pipe used to wake up ftdi_hal_wait()
+    if (pipe(pHal->wakePipe) < 0) {
+        uart_errno_printf("Unable to create wake pipe for %s", pHal->device_filename);
         pHal->is_open = false;
         close(pHal->fd);
         return SH2_ERR_IO;
     }
-    tty.c_iflag &=
-            ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF); //| IGNPAR
-    tty.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
-    tty.c_oflag &= ~OPOST;
-    tty.c_cflag &= ~(CSIZE | PARENB);
-    tty.c_cflag |= CS8 | CREAD | CLOCAL;
-
-    tty.c_cflag &= ~CSTOPB;
-    tty.c_cflag &= ~CRTSCTS;
-
-    // Set speed
-    cfsetispeed(&tty, pHal->baud);
-    cfsetospeed(&tty, pHal->baud);
-
-    // VMIN and VTIME so data is returned ASAP
-    tty.c_cc[VMIN] = 0;
-    tty.c_cc[VTIME] = 0;
+    fcntl(pHal->wakePipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(pHal->wakePipe[1], F_SETFL, O_NONBLOCK);
 
-    // Set attributes
-    if (tcsetattr(pHal->fd, TCSANOW, &tty) < 0) {
-        uart_errno_printf("Unable to set port attributes for %s", pHal->device_filename);
-        pHal->is_open = false;
-        close(pHal->fd);
-        return SH2_ERR_IO;
+    if (pHal->softLink) {
+        pHal->origLatencyTimer = -1;
+        pHal->origSerialFlags = -1;
+    } else {
+        tune_latency(pHal);
     }
 
-    fsync(pHal->fd);
-    tcflush(pHal->fd, TCIOFLUSH);
+#ifdef __linux__
+    // Error counters are kept from when the driver loaded, count from here.
+    pHal->icountValid =
+            !pHal->softLink && (ioctl(pHal->fd, TIOCGICOUNT, &pHal->icountBase) == 0);
+#endif
 #endif // ifdef _WIN32
 
     // Reset into bootloader
@@ -429,17 +1105,17 @@ static int ftdi_hal_open(sh2_Hal_t* self) {
     }
 
     // Delay for RESET_DELAY_US to ensure reset takes effect
-    delay_us(RESET_DELAY_US);
+    timing_delay_us(RESET_DELAY_US);
 
     setResetN(pHal, true); // Deassert reset with BOOTN asserted
 
-    pHal->lastBsqTime_us = time32_now_us();
+    pHal->lastBsqTime_us = timing_now_us();
 
     // Wait until we know system is up
     if (pHal->dfu) {
-        delay_us(DFU_BOOT_DELAY_US);
+        timing_delay_us(DFU_BOOT_DELAY_US);
     } else {
-        delay_us(SH2_BOOT_DELAY_US);
+        timing_delay_us(SH2_BOOT_DELAY_US);
     }
 
     return SH2_OK;
@@ -448,12 +1124,26 @@ static int ftdi_hal_open(sh2_Hal_t* self) {
 static void ftdi_hal_close(sh2_Hal_t* self) {
     ftdi_hal_t* pHal = (ftdi_hal_t*)self;
 
+    if (pHal->captureFile != NULL) {
+        fclose(pHal->captureFile);
+        pHal->captureFile = NULL;
+    }
+
+    if (pHal->replayFilename != NULL) {
+        pHal->is_open = false;
+        replay_close(pHal);
+        return;
+    }
+
     // Reset into normal SHTP mode
     setResetN(pHal, false); // Assert reset
     setBootN(pHal, true);   // De-assert BOOTN
 
     // Delay for RESET_DELAY_US to ensure reset takes effect
-    delay_us(RESET_DELAY_US);
+    timing_delay_us(RESET_DELAY_US);
+
+    // Final error counts, the driver's are gone once the port is closed.
+    tty_stats(pHal);
 
     // Mark as not open
     pHal->is_open = false;
@@ -463,258 +1153,424 @@ static void ftdi_hal_close(sh2_Hal_t* self) {
     FT_Close(pHal->ftHandle);
 #else
     // Non-Windows close serial port
+    restore_latency(pHal);
     close(pHal->fd);
+    close(pHal->wakePipe[0]);
+    close(pHal->wakePipe[1]);
 #endif
 }
 
-static int ftdi_hal_read(sh2_Hal_t* self, uint8_t* pBuffer, unsigned len, uint32_t* t_us) {
-    int retval = 0;
-    uint8_t c;
+// Process a complete frame: the still-escaped bytes between its flags.
+// Fresh BSN control frames update lastBsn.  SHTP frames are decoded directly into
+// the client's buffer.  Returns value for ftdi_hal_read to return, 0 if the
+// frame was consumed by the HAL or discarded.
+static int rx_frame(ftdi_hal_t* pHal,
+                    const uint8_t* pFrame,
+                    uint32_t frameLen,
+                    uint8_t* pBuffer,
+                    unsigned len) {
+    // First byte is UART protocol id, it doesn't go to SHTP layer.
+    uint8_t protocol = pFrame[0];
+    uint32_t idLen = 1;
+    if ((protocol == RFC1662_ESCAPE) && (frameLen > 1)) {
+        protocol = pFrame[1] ^ 0x20;
+        idLen = 2;
+    }
+
+    if (protocol == PROTOCOL_CONTROL) {
+        // If it's a BSN sent after our latest run of frames, update lastBsn
+        uint8_t bsn[2];
+        if (rfc1662_unescape(bsn, sizeof(bsn), pFrame + idLen, frameLen - idLen) >= sizeof(bsn)) {
+            pHal->rxBsn = (bsn[1] << 8) + bsn[0];
+            pHal->stats.rxBsns++;
+
+            if (pHal->stats.rxBsns > pHal->bsnsQuery) {
+                if (pHal->stats.txFrames == 0) {
+                    // Unprompted, but nothing was sent yet that it could be stale for.
+                    pHal->bsnsQuery = pHal->stats.rxBsns;
+                    pHal->bsnsFrame = pHal->stats.rxBsns;
+                } else if (pHal->bsnMode == BSN_MODE_UNKNOWN) {
+                    // More BSNs than BSQs: the hub sends them after frames too.
+                    pHal->bsnMode = BSN_MODE_FRAME;
+                }
+            }
+
+            // Until the mode is known, only the stricter count will do.
+            uint32_t due = (pHal->bsnMode == BSN_MODE_QUERY) ? pHal->bsnDueQuery
+                                                             : pHal->bsnDueFrame;
+            if (pHal->stats.rxBsns >= due) {
+                pHal->lastBsn = pHal->rxBsn;
+                pHal->bsqPending = false;
+
+                // Send whatever was waiting for this.  An I/O error will show up
+                // on the next write.
+                tx_service(pHal);
+            }
+        }
+        return 0;
+    }
 
+    uint32_t payloadLen = rfc1662_unescape(pBuffer, len, pFrame + idLen, frameLen - idLen);
+    if (payloadLen + 1 > SH2_HAL_MAX_PAYLOAD_IN) {
+        // frame was too big for HAL to accept, discard
+        pHal->stats.rxTooBig++;
+        return 0;
+    }
+    if (payloadLen + 1 > len) {
+        // frame is too big for client to store, discard
+        pHal->stats.rxClientTooSmall++;
+        return 0;
+    }
+
+    // Each escaped byte took two on the wire.
+    pHal->stats.rxEscapes += (frameLen - idLen) - payloadLen;
+    pHal->stats.rxFrames++;
+
+    // Length reported to the client includes the protocol id byte.
+    return payloadLen + 1;
+}
+
+static int ftdi_hal_read(sh2_Hal_t* self, uint8_t* pBuffer, unsigned len, uint32_t* t_us) {
     ftdi_hal_t* pHal = (ftdi_hal_t*)self;
 
-    bool read_ok = read_char(pHal, &c);
-    while (read_ok) {
-        // incorporate c into frame under construction
-        rfc1662_decode(pHal, c);
-
-        // If a full frame is ready
-        if (pHal->rxFrameReady) {
-            // If it's a BSN, update lastBsn
-            if ((pHal->rxFrameLen > 0) && (pHal->rxFrame[0] == PROTOCOL_CONTROL)) {
-                pHal->lastBsn = (pHal->rxFrame[2] << 8) + pHal->rxFrame[1];
-                rfc1662_reset(pHal);
-            } else if (pHal->rxFrameLen > sizeof(pHal->rxFrame)) {
-                // frame was too big for HAL to store, discard
-                rfc1662_reset(pHal);
-            } else if (pHal->rxFrameLen > len) {
-                // frame is too big for client to store, discard
-                rfc1662_reset(pHal);
+    if (pHal->txFrames > 0) {
+        // Frames are waiting for buffer credit, re-query if a BSN seems lost.
+        tx_service(pHal);
+    }
+
+    while (true) {
+        if (!pHal->rxInFrame) {
+            // Look for start of frame
+            const uint8_t* pFlag = (const uint8_t*)memchr(pHal->rxBuf + pHal->rxBufIdx,
+                                                          RFC1662_FLAG,
+                                                          pHal->rxBufLen - pHal->rxBufIdx);
+            if (pFlag != NULL) {
+                pHal->rxBufIdx = (uint32_t)(pFlag - pHal->rxBuf);
+                pHal->rxScanIdx = pHal->rxBufIdx + 1;
+                pHal->rxInFrame = true;
+
+                // Only the last chunk is ever searched for a start flag, so
+                // the flag's arrival time follows from its offset in that chunk.
+                pHal->rxFrameStartTime_us = rx_byte_time(pHal, pHal->rxBufIdx);
             } else {
-                // Copy the frame into the user's buffer
-                // (First byte is UART protocol id, it doesn't go to SHTP layer.)
-                memcpy(pBuffer, pHal->rxFrame + 1, pHal->rxFrameLen - 1);
-                retval = pHal->rxFrameLen;
-                *t_us = pHal->rxFrameStartTime_us;
-                rfc1662_reset(pHal);
-                break;
+                pHal->rxBufIdx = pHal->rxBufLen;
             }
         }
 
-        // Read next char
-        read_ok = read_char(pHal, &c);
-    }
+        if (pHal->rxInFrame) {
+            // Look for end of frame
+            const uint8_t* pFlag = (const uint8_t*)memchr(pHal->rxBuf + pHal->rxScanIdx,
+                                                          RFC1662_FLAG,
+                                                          pHal->rxBufLen - pHal->rxScanIdx);
+            if (pFlag != NULL) {
+                uint32_t start = pHal->rxBufIdx + 1;
+                uint32_t end = (uint32_t)(pFlag - pHal->rxBuf);
+
+                if (end == start) {
+                    // Treat second consec flag as another start flag.
+                    pHal->rxBufIdx = end;
+                    pHal->rxScanIdx = end + 1;
+                    continue;
+                }
 
-    return retval;
+                // Frame is done.  Any bytes after it are kept for the next call.
+                pHal->rxBufIdx = end + 1;
+                pHal->rxInFrame = false;
+                int retval = rx_frame(pHal, pHal->rxBuf + start, end - start, pBuffer, len);
+                if (retval > 0) {
+                    // sh2 takes 32-bit time, it extends it across wraps itself.
+                    *t_us = (uint32_t)pHal->rxFrameStartTime_us;
+                    return retval;
+                }
+                continue;
+            }
+            pHal->rxScanIdx = pHal->rxBufLen;
+        }
+
+        // Everything buffered has been searched, get more data.
+        if (rx_buf_fill(pHal) <= 0) {
+            // No more data for now.
+            return 0;
+        }
+    }
 }
 
-static bool txEncode(uint8_t* pOut, uint32_t* outLen, uint8_t* pIn, uint32_t inLen) {
-    bool overflowed = false;
-    uint32_t outIndex = 0;
+static int ftdi_hal_write(sh2_Hal_t* self, uint8_t* pBuffer, unsigned len) {
+    ftdi_hal_t* pHal = (ftdi_hal_t*)self;
 
-    // start of frame
-    if (outIndex >= *outLen) {
-        return true; // overflowed
+    if (pHal->replayFilename != NULL) {
+        // Nothing to send to, the recording already holds the responses.
+        return len;
     }
-    pOut[outIndex++] = RFC1662_FLAG;
 
-    // protocol id
-    if (outIndex >= *outLen) {
-        return true; // overflowed
+    // encode pBuffer
+    uint8_t writeBuf[1024];
+    uint32_t encodedLen = sizeof(writeBuf);
+    bool overflow = rfc1662_encode(writeBuf, &encodedLen, PROTOCOL_SHTP, pBuffer, len);
+    if (overflow) {
+        return SH2_ERR_BAD_PARAM;
     }
-    pOut[outIndex++] = PROTOCOL_SHTP;
 
-    // RFC1662 encoded data
-    for (unsigned i = 0; i < inLen; i++) {
-        if ((pIn[i] == RFC1662_FLAG) || (pIn[i] == RFC1662_ESCAPE)) {
-            // escape this char
-            if (outIndex + 1 >= *outLen) {
-                return true; // overflowed
-            }
-            pOut[outIndex++] = RFC1662_ESCAPE;
-            pOut[outIndex++] = pIn[i] ^ 0x20;
-        } else {
-            if (outIndex >= *outLen) {
-                return true;
-            }
-            pOut[outIndex++] = pIn[i];
+    if ((pHal->txFrames == TX_QUEUE_FRAMES) ||
+        (pHal->txQueueLen + encodedLen > sizeof(pHal->txQueue))) {
+        // No room to queue it, the caller will have to retry.
+        if (tx_service(pHal) != SH2_OK) {
+            return SH2_ERR_IO;
         }
+        return 0;
     }
 
-    // end of frame
-    if (outIndex >= *outLen) {
-        return true; // overflowed
+    // Queue it, then send as much of the queue as the hub will take now.
+    // The rest goes out from ftdi_hal_read() as BSNs arrive.
+    memcpy(pHal->txQueue + pHal->txQueueLen, writeBuf, encodedLen);
+    pHal->txQueueLen += encodedLen;
+    pHal->txFrameLen[pHal->txFrames++] = (uint16_t)encodedLen;
+
+    if (tx_service(pHal) != SH2_OK) {
+        return SH2_ERR_IO;
     }
-    pOut[outIndex++] = RFC1662_FLAG;
 
-    // set outLen for return
-    *outLen = outIndex;
-    return false; // return, no overflow
+    // notify caller that data was accepted
+    return len;
 }
 
+static uint32_t ftdi_hal_getTimeUs(sh2_Hal_t* self) {
+    return (uint32_t)timing_now_us();
+}
 
-static const uint8_t BSQ[] = {RFC1662_FLAG, PROTOCOL_CONTROL, RFC1662_FLAG};
+// Create a HAL instance.  Each instance has its own port and state, so
+// several sensor hubs can be driven from one process.
+static sh2_Hal_t* new_hal(const char* device_filename, bool dfu) {
+    ftdi_hal_t* pHal = (ftdi_hal_t*)calloc(1, sizeof(ftdi_hal_t));
+    if (pHal == NULL) {
+        return NULL;
+    }
 
+    pHal->hal_fns.open = ftdi_hal_open;
+    pHal->hal_fns.close = ftdi_hal_close;
+    pHal->hal_fns.read = ftdi_hal_read;
+    pHal->hal_fns.write = ftdi_hal_write;
+    pHal->hal_fns.getTimeUs = ftdi_hal_getTimeUs;
 
-static int ftdi_hal_write(sh2_Hal_t* self, uint8_t* pBuffer, unsigned len) {
-    int retval = 0;
+    // Save reference to device file name, etc.
+    pHal->device_filename = device_filename;
+    pHal->dfu = dfu;
+    pHal->baud = DEFAULT_BAUD_RATE;
+    pHal->baud_bps = DEFAULT_BAUD_RATE_BPS;
+    pHal->txGap_us = DEFAULT_TX_GAP_US;
+    pHal->is_open = false;
 
+    // give caller the list of access functions.
+    return &(pHal->hal_fns);
+}
+
+// ---------------------------------------------------------
+// Public functions
+
+sh2_Hal_t* ftdi_hal_init(const char* device_filename) {
+    return new_hal(device_filename, false);
+}
+
+sh2_Hal_t* ftdi_hal_dfu_init(const char* device_filename) {
+    return new_hal(device_filename, true);
+}
+
+void ftdi_hal_free(sh2_Hal_t* self) {
     ftdi_hal_t* pHal = (ftdi_hal_t*)self;
 
-    // encode pBuffer
-    uint8_t writeBuf[1024];
-    uint32_t encodedLen = sizeof(writeBuf);
-    bool overflow = txEncode(writeBuf, &encodedLen, pBuffer, len);
-    if (overflow) {
-        return SH2_ERR_BAD_PARAM;
+    if (pHal == NULL) {
+        return;
     }
+    if (pHal->is_open) {
+        ftdi_hal_close(self);
+    }
+    if (pHal->captureFile != NULL) {
+        fclose(pHal->captureFile);
+    }
+    free(pHal);
+}
 
-    uint32_t now = time32_now_us();
+int ftdi_hal_wait(sh2_Hal_t* self, uint32_t timeout_us) {
+    ftdi_hal_t* pHal = (ftdi_hal_t*)self;
 
-    // if device is ready to receive this size transfer...
-    if (pHal->lastBsn >= encodedLen) {
-        // Reset lastBsn.  By sending, we're invalidating prior buffer status notification.
-        pHal->lastBsn = 0;
-        pHal->lastBsqTime_us = 0;
-
-        // write bytes one at a time.
-        // The sensor hub can't handle data too fast: nominal limit is 100 us
-        // between bytes.
-        unsigned written = 0;
-        while (written < encodedLen) {
-            // transmit c.
-#ifdef _WIN32
-            // Windows-specific write to serial port
-            DWORD bytes_written = 0;
-            FT_STATUS status = FT_Write(pHal->ftHandle, writeBuf + written, 1, &bytes_written);
-            if (status != FT_OK) {
-                // fail with I/O error
-                return SH2_ERR_IO;
+    if (!pHal->is_open) {
+        return SH2_ERR;
+    }
+
+    // Data already buffered in the HAL can be processed right away.
+    if (rx_buf_pending(pHal)) {
+        return 1;
+    }
+
+    if (pHal->replayFilename != NULL) {
+        return replay_wait(pHal, timeout_us);
+    }
+
+    if (pHal->rxSpin_us > 0) {
+        // More data tends to follow shortly after data, so busy-poll for a
+        // while rather than pay the wake-up latency of a blocking wait.
+        uint64_t now = timing_now_us();
+        uint64_t deadline = now + timeout_us;
+        uint64_t spinEnd = pHal->rxChunkTime_us + pHal->rxSpin_us;
+        if (spinEnd > deadline) {
+            spinEnd = deadline;
+        }
+        while (now < spinEnd) {
+            if (rx_buf_fill(pHal) > 0) {
+                return 1;
             }
-            written += bytes_written;
+            // Let other threads run if they share our CPU.
+#ifdef _WIN32
+            SwitchToThread();
 #else
-            // Non-Windows write to serial port
-            int status = write(pHal->fd, &writeBuf[written], 1);
-            if (status > 0) {
-                written += 1;
-            } else if ((status < 0) && (errno != EAGAIN)) {
-                // I/O error!
-                return SH2_ERR_IO;
-            }
+            sched_yield();
 #endif
-            delay_us(100);
+            now = timing_now_us();
         }
+        if (now >= deadline) {
+            return 0;
+        }
+        timeout_us = (uint32_t)(deadline - now);
+    }
 
-        // set retval to notify caller that data was sent
-        retval = len;
-    } else if ((pHal->lastBsqTime_us == 0) || ((now - pHal->lastBsqTime_us) > INTER_BSQ_DELAY_US)) {
-        // transmit a buffer status query to ensure we get a buffer
-        // status notification update.
-        int written = 0;
-        pHal->lastBsqTime_us = now;
-        while (written < sizeof(BSQ)) {
 #ifdef _WIN32
-            DWORD bytes_written = 0;
-            FT_STATUS status = FT_Write(pHal->ftHandle, (void*)(BSQ + written), 1, &bytes_written);
-            if (status != FT_OK) {
-                // fail with I/O error
-                return SH2_ERR_IO;
-            }
-            written += bytes_written;
+    DWORD rxBytes = 0;
+    if ((FT_GetQueueStatus(pHal->ftHandle, &rxBytes) == FT_OK) && (rxBytes > 0)) {
+        return 1;
+    }
+
+    // commEvent is signalled by the driver on RX and by ftdi_hal_wake().
+    DWORD timeout_ms = (timeout_us + 999) / 1000;
+    DWORD result = WaitForSingleObject(pHal->commEvent, timeout_ms);
+
+    // Any data that arrived did so just before we woke up.
+    pHal->rxIdleTime_us = timing_now_us();
+    return (result == WAIT_OBJECT_0) ? 1 : 0;
 #else
-            int status = write(pHal->fd, &BSQ[written], 1);
-            if (status > 0) {
-                written += 1;
-            } else if ((status < 0) && (errno != EAGAIN)) {
-                // I/O error!
-                return SH2_ERR_IO;
-            }
-#endif
-            delay_us(100);
+    struct pollfd fds[2];
+    fds[0].fd = pHal->fd;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    fds[1].fd = pHal->wakePipe[0];
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+
+    // Round up so we never wake before the caller's deadline.
+    int timeout_ms = (int)((timeout_us + 999) / 1000);
+    int status = poll(fds, 2, timeout_ms);
+    if (status < 0) {
+        if (errno == EINTR) {
+            // Interrupted by a signal (e.g. Ctrl-C), let the caller check its state.
+            return 1;
         }
-
-        // we did not write any of the user's data
-        retval = 0;
+        return SH2_ERR_IO;
     }
 
-    return retval;
-}
+    // Any data that arrived did so just before we woke up.
+    pHal->rxIdleTime_us = timing_now_us();
 
-static uint32_t ftdi_hal_getTimeUs(sh2_Hal_t* self) {
-    return time32_now_us();
-}
-
-// regular (non-dfu) hal instance data
-static ftdi_hal_t ftdi_hal = {
-        .hal_fns =
-                {
-                        .open = ftdi_hal_open,
-                        .close = ftdi_hal_close,
-                        .read = ftdi_hal_read,
-                        .write = ftdi_hal_write,
-                        .getTimeUs = ftdi_hal_getTimeUs,
-                },
-
-        .dfu = false,
-        .baud = DEFAULT_BAUD_RATE,
-        .is_open = false,
-        .device_filename = "",
-#ifdef _WIN32
-        .latencySet = false,
-        .ftHandle = 0,
-        .commEvent = 0,
-#else
-        .fd = 0,
+    if (fds[1].revents & POLLIN) {
+        // Drain wake-up notifications
+        uint8_t drain[64];
+        while (read(pHal->wakePipe[0], drain, sizeof(drain)) > 0) {
+        }
+    }
+    return (status > 0) ? 1 : 0;
 #endif
-};
+}
+
+void ftdi_hal_wake(sh2_Hal_t* self) {
+    ftdi_hal_t* pHal = (ftdi_hal_t*)self;
+
+    // A replay wait is never longer than the gap to the next recorded data.
+    if (!pHal->is_open || (pHal->replayFilename != NULL)) {
+        return;
+    }
 
-// dfu_hal instance data (used for FSP200 DFU)
-static ftdi_hal_t dfu_hal = {
-        .hal_fns =
-                {
-                        .open = ftdi_hal_open,
-                        .close = ftdi_hal_close,
-                        .read = ftdi_hal_read,
-                        .write = ftdi_hal_write,
-                        .getTimeUs = ftdi_hal_getTimeUs,
-                },
-
-        .dfu = true,
-        .baud = DEFAULT_BAUD_RATE,
-        .is_open = false,
-        .device_filename = "",
 #ifdef _WIN32
-        .latencySet = false,
-        .ftHandle = 0,
-        .commEvent = 0,
+    SetEvent(pHal->commEvent);
 #else
-        .fd = 0,
+    // If the pipe is full, a wake-up is already pending.
+    uint8_t c = 1;
+    ssize_t rc = write(pHal->wakePipe[1], &c, 1);
+    (void)rc;
 #endif
-};
+}
 
-// ---------------------------------------------------------
-// Public functions
+uint32_t ftdi_hal_getServiceTimeoutUs(sh2_Hal_t* self) {
+    ftdi_hal_t* pHal = (ftdi_hal_t*)self;
 
-sh2_Hal_t* ftdi_hal_init(const char* device_filename) {
+    if (pHal->txFrames == 0) {
+        return UINT32_MAX;
+    }
+    if (!pHal->bsqPending) {
+        return 0;
+    }
 
-    // Save reference to device file name, etc.
-    ftdi_hal.device_filename = device_filename;
-    ftdi_hal.dfu = false;
-    ftdi_hal.baud = DEFAULT_BAUD_RATE;
-    ftdi_hal.is_open = false;
+    // tx_service() asks again once INTER_BSQ_DELAY_US has passed.
+    uint64_t elapsed = timing_now_us() - pHal->lastBsqTime_us;
+    if (elapsed > INTER_BSQ_DELAY_US) {
+        return 0;
+    }
+    return (uint32_t)(INTER_BSQ_DELAY_US + 1 - elapsed);
+}
 
-    // give caller the list of access functions.
-    return &(ftdi_hal.hal_fns);
+uint32_t ftdi_hal_getRxJitterUs(sh2_Hal_t* self) {
+    ftdi_hal_t* pHal = (ftdi_hal_t*)self;
+
+    return pHal->rxJitter_us;
 }
 
-sh2_Hal_t* ftdi_hal_dfu_init(const char* device_filename) {
+void ftdi_hal_setTxGapUs(sh2_Hal_t* self, uint32_t gap_us) {
+    ftdi_hal_t* pHal = (ftdi_hal_t*)self;
 
-    // Save reference to device file name, etc.
-    dfu_hal.device_filename = device_filename;
-    dfu_hal.dfu = true;
-    dfu_hal.baud = DEFAULT_BAUD_RATE;
-    dfu_hal.is_open = false;
+    pHal->txGap_us = gap_us;
+}
 
-    // give caller the list of access functions.
-    return &(dfu_hal.hal_fns);
+void ftdi_hal_setRxSpinUs(sh2_Hal_t* self, uint32_t spin_us) {
+    ftdi_hal_t* pHal = (ftdi_hal_t*)self;
+
+    pHal->rxSpin_us = spin_us;
+}
+
+void ftdi_hal_getTxGapStats(sh2_Hal_t* self, uint32_t* pMin_us, uint32_t* pMean_us) {
+    ftdi_hal_t* pHal = (ftdi_hal_t*)self;
+
+    if (pHal->txGaps == 0) {
+        *pMin_us = 0;
+        *pMean_us = 0;
+        return;
+    }
+    *pMin_us = pHal->txMinGap_us;
+    *pMean_us = (uint32_t)(pHal->txGapTotal_us / pHal->txGaps);
+}
+
+bool ftdi_hal_setCapture(sh2_Hal_t* self, const char* filename) {
+    ftdi_hal_t* pHal = (ftdi_hal_t*)self;
+
+    if (pHal->captureFile != NULL) {
+        fclose(pHal->captureFile);
+    }
+    pHal->captureFile = capture_create(filename);
+    return pHal->captureFile != NULL;
+}
+
+void ftdi_hal_setReplay(sh2_Hal_t* self, const char* filename, bool fast) {
+    ftdi_hal_t* pHal = (ftdi_hal_t*)self;
+
+    pHal->replayFilename = filename;
+    pHal->replayFast = fast;
+}
+
+bool ftdi_hal_replayDone(sh2_Hal_t* self) {
+    ftdi_hal_t* pHal = (ftdi_hal_t*)self;
+
+    return (pHal->replayFilename != NULL) && pHal->replayEof && !rx_buf_pending(pHal);
+}
+
+void ftdi_hal_getStats(sh2_Hal_t* self, ftdi_hal_Stats_t* pStats) {
+    ftdi_hal_t* pHal = (ftdi_hal_t*)self;
+
+    tty_stats(pHal);
+    *pStats = pHal->stats;
 }
@@ -19,5 +19,91 @@
 
 #include "sh2_hal.h"
 
+#include <stdbool.h>
+#include <stdint.h>
+
+// I/O and framing statistics of a HAL, counted since it was opened.
+typedef struct ftdi_hal_Stats_s {
+    uint64_t rxBytes;           // Bytes read from the port
+    uint64_t rxEscapes;         // Escape bytes in delivered frames.  Over rxBytes, escape density.
+    uint32_t rxFrames;          // SHTP frames delivered to the client
+    uint32_t rxBsns;            // Buffer status notifications received
+    uint32_t rxTooLong;         // Frames discarded, longer than the HAL's receive buffer
+    uint32_t rxTooBig;          // Frames discarded, payload over SH2_HAL_MAX_PAYLOAD_IN
+    uint32_t rxClientTooSmall;  // Frames discarded, too big for the client's buffer
+    uint64_t txBytes;           // Bytes written to the port
+    uint32_t txWrites;          // Write calls that wrote to the port
+    uint32_t txFrames;          // SHTP frames sent
+    uint32_t txBsqs;            // Buffer status queries sent
+    uint32_t txStalls;          // Times a frame had to wait for the hub to have room
+    uint64_t txStall_us;        // Total time frames waited for the hub to have room
+
+    // Errors counted by the serial driver (Linux TIOCGICOUNT), -1 if not available.
+    int32_t ttyOverruns;      // UART receive FIFO overruns
+    int32_t ttyBufOverruns;   // Driver receive buffer overruns
+    int32_t ttyFramingErrors; // Characters received with framing errors
+    int32_t ttyParityErrors;  // Characters received with parity errors
+    int32_t ttyBreaks;        // Break conditions received
+} ftdi_hal_Stats_t;
+
+// Create a HAL for the sensor hub on device_filename.  Each call returns a
+// new instance; release it with ftdi_hal_free().  Returns NULL on failure.
 sh2_Hal_t* ftdi_hal_init(const char* device_filename);
 sh2_Hal_t* ftdi_hal_dfu_init(const char* device_filename);
+
+// Close (if open) and release a HAL created by ftdi_hal_init() or
+// ftdi_hal_dfu_init().
+void ftdi_hal_free(sh2_Hal_t* self);
+
+// Block until received data is available, ftdi_hal_wake() is called or
+// timeout_us elapses.  Returns 1 if data is available (or woken), 0 on
+// timeout, or an SH2_ERR code.  Call it from the thread that reads.  With
+// ftdi_hal_setRxSpinUs() at 0 it only checks the receive buffer and sleeps;
+// while spinning it reads the port, updating the statistics and capture
+// file like a read, so it must then be serialized with writes too.
+int ftdi_hal_wait(sh2_Hal_t* self, uint32_t timeout_us);
+
+// Cause a pending (or the next) ftdi_hal_wait() to return immediately.
+// May be called from any thread.
+void ftdi_hal_wake(sh2_Hal_t* self);
+
+// Time until the HAL has timed work of its own to do in its next read:
+// asking again for buffer status, for queued frames whose BSN seems lost.
+// UINT32_MAX if there is none.  A caller sleeping in ftdi_hal_wait()
+// between reads must not sleep longer than this.
+uint32_t ftdi_hal_getServiceTimeoutUs(sh2_Hal_t* self);
+
+// Estimated uncertainty, in microseconds, of the timestamps returned with
+// received frames.  This is the smoothed width of the window in which each
+// chunk of serial data could have arrived.
+uint32_t ftdi_hal_getRxJitterUs(sh2_Hal_t* self);
+
+// Set the minimum time between bytes sent to the sensor hub.  Default is 100us.
+void ftdi_hal_setTxGapUs(sh2_Hal_t* self, uint32_t gap_us);
+
+// Make ftdi_hal_wait() busy-poll the port for up to spin_us after data last
+// arrived, before falling back to a blocking wait.  Lowers receive latency
+// at the cost of a CPU spinning while data is flowing.  Default is 0, off.
+void ftdi_hal_setRxSpinUs(sh2_Hal_t* self, uint32_t spin_us);
+
+// Smallest and mean time between transmitted bytes, as measured since open.
+// Both are 0 if nothing has been sent yet.
+void ftdi_hal_getTxGapStats(sh2_Hal_t* self, uint32_t* pMin_us, uint32_t* pMean_us);
+
+// Record all raw traffic to and from the port in a capture file (see
+// capture.h) until the HAL is closed.  Returns false if the file can't be
+// created.
+bool ftdi_hal_setCapture(sh2_Hal_t* self, const char* filename);
+
+// Instead of opening the port, replay the data received in a capture file.
+// Writes are accepted and discarded.  Data is delivered at its recorded
+// pace, or if fast is set, as quickly as it's read, with the clock
+// (timing_now_us) following the recorded timestamps.  Call before open.
+void ftdi_hal_setReplay(sh2_Hal_t* self, const char* filename, bool fast);
+
+// True once all data of a replay has been read.
+bool ftdi_hal_replayDone(sh2_Hal_t* self);
+
+// Get the HAL's statistics.  Counts are kept after close, until the next open.
+// Not thread safe: call from the thread doing I/O, or with it held off.
+void ftdi_hal_getStats(sh2_Hal_t* self, ftdi_hal_Stats_t* pStats);
@@ -0,0 +1,445 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rfc1662.h"
+
+#include <string.h>
+
+// Select scan implementation
+#if defined(RFC1662_NO_SIMD)
+#define RFC1662_SCALAR
+#elif defined(__AVX2__)
+#define RFC1662_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define RFC1662_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define RFC1662_NEON
+#include <arm_neon.h>
+#else
+#define RFC1662_SCALAR
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+static unsigned ctz32(uint32_t x) {
+    unsigned long idx;
+    _BitScanForward(&idx, x);
+    return (unsigned)idx;
+}
+#if defined(_M_X64) || defined(_M_ARM64)
+static unsigned ctz64(uint64_t x) {
+    unsigned long idx;
+    _BitScanForward64(&idx, x);
+    return (unsigned)idx;
+}
+#endif
+#else
+#define ctz32(x) ((unsigned)__builtin_ctz(x))
+#define ctz64(x) ((unsigned)__builtin_ctzll(x))
+#endif
+
+static bool isSpecial(uint8_t c) {
+    return (c == RFC1662_FLAG) || (c == RFC1662_ESCAPE);
+}
+
+// ------------------------------------------------------------------------
+// Scanning
+
+size_t rfc1662_findSpecial_scalar(const uint8_t* p, size_t len) {
+    size_t i;
+    for (i = 0; i < len; i++) {
+        if (isSpecial(p[i])) {
+            break;
+        }
+    }
+    return i;
+}
+
+#if defined(RFC1662_AVX2)
+const char* rfc1662_implName(void) {
+    return "avx2";
+}
+
+size_t rfc1662_findSpecial(const uint8_t* p, size_t len) {
+    const __m256i flag = _mm256_set1_epi8((char)RFC1662_FLAG);
+    const __m256i esc = _mm256_set1_epi8((char)RFC1662_ESCAPE);
+    size_t i = 0;
+
+    while (i + 32 <= len) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, flag), _mm256_cmpeq_epi8(v, esc));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit);
+        if (mask != 0) {
+            return i + ctz32(mask);
+        }
+        i += 32;
+    }
+    return i + rfc1662_findSpecial_scalar(p + i, len - i);
+}
+
+#elif defined(RFC1662_SSE2)
+const char* rfc1662_implName(void) {
+    return "sse2";
+}
+
+size_t rfc1662_findSpecial(const uint8_t* p, size_t len) {
+    const __m128i flag = _mm_set1_epi8((char)RFC1662_FLAG);
+    const __m128i esc = _mm_set1_epi8((char)RFC1662_ESCAPE);
+    size_t i = 0;
+
+    while (i + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, flag), _mm_cmpeq_epi8(v, esc));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(hit);
+        if (mask != 0) {
+            return i + ctz32(mask);
+        }
+        i += 16;
+    }
+    return i + rfc1662_findSpecial_scalar(p + i, len - i);
+}
+
+#elif defined(RFC1662_NEON)
+const char* rfc1662_implName(void) {
+    return "neon";
+}
+
+size_t rfc1662_findSpecial(const uint8_t* p, size_t len) {
+    const uint8x16_t flag = vdupq_n_u8(RFC1662_FLAG);
+    const uint8x16_t esc = vdupq_n_u8(RFC1662_ESCAPE);
+    size_t i = 0;
+
+    while (i + 16 <= len) {
+        uint8x16_t v = vld1q_u8(p + i);
+        uint8x16_t hit = vorrq_u8(vceqq_u8(v, flag), vceqq_u8(v, esc));
+        // Narrow each byte of the compare result to a nibble of a 64-bit mask.
+        uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(hit), 4);
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+        if (mask != 0) {
+            return i + (ctz64(mask) >> 2);
+        }
+        i += 16;
+    }
+    return i + rfc1662_findSpecial_scalar(p + i, len - i);
+}
+
+#else
+const char* rfc1662_implName(void) {
+    return "scalar";
+}
+
+size_t rfc1662_findSpecial(const uint8_t* p, size_t len) {
+    return rfc1662_findSpecial_scalar(p, len);
+}
+#endif
+
+// ------------------------------------------------------------------------
+// Decoding
+
+void rfc1662_decoderInit(rfc1662_Decoder_t* d, uint8_t* pFrame, uint32_t frameMax) {
+    d->pFrame = pFrame;
+    d->frameMax = frameMax;
+    d->startPos = -1;
+    rfc1662_decoderReset(d);
+}
+
+void rfc1662_decoderReset(rfc1662_Decoder_t* d) {
+    d->frameLen = 0;
+    d->frameReady = false;
+    d->state = RFC1662_OUTSIDE_FRAME;
+}
+
+// Append one decoded byte to the frame in progress
+static void storeByte(rfc1662_Decoder_t* d, uint8_t c) {
+    if (d->frameLen < d->frameMax) {
+        d->pFrame[d->frameLen] = c;
+    }
+    // overflowing, don't store data beyond allocated buffer size.
+    d->frameLen++;
+}
+
+// Append a run of decoded bytes to the frame in progress
+static void storeRun(rfc1662_Decoder_t* d, const uint8_t* p, uint32_t n) {
+    if (d->frameLen < d->frameMax) {
+        uint32_t room = d->frameMax - d->frameLen;
+        memcpy(d->pFrame + d->frameLen, p, (n < room) ? n : room);
+    }
+    // overflowing, don't store data beyond allocated buffer size.
+    d->frameLen += n;
+}
+
+uint32_t rfc1662_decode_scalar(rfc1662_Decoder_t* d, const uint8_t* pIn, uint32_t len) {
+    d->frameReady = false;
+    d->startPos = -1;
+
+    // Use state machine to build up chars into frames for delivery.
+    for (uint32_t i = 0; i < len; i++) {
+        uint8_t c = pIn[i];
+        switch (d->state) {
+            case RFC1662_OUTSIDE_FRAME:
+                // Look for start of frame
+                if (c == RFC1662_FLAG) {
+                    // Init frame in progress
+                    d->startPos = (int32_t)i;
+                    d->frameLen = 0;
+                    d->state = RFC1662_INSIDE_FRAME;
+                }
+                break;
+            case RFC1662_INSIDE_FRAME:
+                // Look for end of frame
+                if (c == RFC1662_FLAG) {
+                    if (d->frameLen > 0) {
+                        // Frame is done
+                        d->frameReady = true;
+                        d->state = RFC1662_OUTSIDE_FRAME;
+                        return i + 1;
+                    }
+                    // Otherwise treat second consec flag as another start flag.
+                } else if (c == RFC1662_ESCAPE) {
+                    // Go to escaped state so next char can be a flag or escape
+                    d->state = RFC1662_ESCAPED;
+                } else {
+                    storeByte(d, c);
+                }
+                break;
+            case RFC1662_ESCAPED:
+                storeByte(d, c ^ 0x20);
+                d->state = RFC1662_INSIDE_FRAME;
+                break;
+            default:
+                // Bad state.  Recover by resetting to outside frame state
+                d->state = RFC1662_OUTSIDE_FRAME;
+                break;
+        }
+    }
+
+    return len;
+}
+
+uint32_t rfc1662_decode(rfc1662_Decoder_t* d, const uint8_t* pIn, uint32_t len) {
+    uint32_t i = 0;
+
+    d->frameReady = false;
+    d->startPos = -1;
+
+    while (i < len) {
+        switch (d->state) {
+            case RFC1662_OUTSIDE_FRAME: {
+                // Skip everything up to the next start of frame
+                const uint8_t* pFlag = (const uint8_t*)memchr(pIn + i, RFC1662_FLAG, len - i);
+                if (pFlag == NULL) {
+                    return len;
+                }
+                i = (uint32_t)(pFlag - pIn);
+                d->startPos = (int32_t)i;
+                d->frameLen = 0;
+                d->state = RFC1662_INSIDE_FRAME;
+                i++;
+                break;
+            }
+            case RFC1662_INSIDE_FRAME: {
+                // Copy the run of ordinary characters in one go
+                uint32_t run = (uint32_t)rfc1662_findSpecial(pIn + i, len - i);
+                storeRun(d, pIn + i, run);
+                i += run;
+                if (i == len) {
+                    return len;
+                }
+                if (pIn[i++] == RFC1662_FLAG) {
+                    if (d->frameLen > 0) {
+                        // Frame is done
+                        d->frameReady = true;
+                        d->state = RFC1662_OUTSIDE_FRAME;
+                        return i;
+                    }
+                    // Otherwise treat second consec flag as another start flag.
+                } else {
+                    d->state = RFC1662_ESCAPED;
+                }
+                break;
+            }
+            case RFC1662_ESCAPED:
+                storeByte(d, pIn[i++] ^ 0x20);
+                d->state = RFC1662_INSIDE_FRAME;
+                break;
+            default:
+                // Bad state.  Recover by resetting to outside frame state
+                d->state = RFC1662_OUTSIDE_FRAME;
+                break;
+        }
+    }
+
+    return len;
+}
+
+uint32_t rfc1662_unescape_scalar(uint8_t* pOut,
+                                 uint32_t outMax,
+                                 const uint8_t* pIn,
+                                 uint32_t inLen) {
+    uint32_t outLen = 0;
+
+    for (uint32_t i = 0; i < inLen; i++) {
+        uint8_t c = pIn[i];
+        if (c == RFC1662_ESCAPE) {
+            if (++i >= inLen) {
+                // Escape with nothing after it, drop it.
+                break;
+            }
+            c = pIn[i] ^ 0x20;
+        }
+        if (outLen < outMax) {
+            pOut[outLen] = c;
+        }
+        outLen++;
+    }
+
+    return outLen;
+}
+
+uint32_t rfc1662_unescape(uint8_t* pOut, uint32_t outMax, const uint8_t* pIn, uint32_t inLen) {
+    uint32_t outLen = 0;
+    uint32_t i = 0;
+
+    while (i < inLen) {
+        // Copy the run up to the next escape in one go
+        uint32_t run = (uint32_t)rfc1662_findSpecial(pIn + i, inLen - i);
+        if (outLen < outMax) {
+            uint32_t room = outMax - outLen;
+            memcpy(pOut + outLen, pIn + i, (run < room) ? run : room);
+        }
+        outLen += run;
+        i += run;
+
+        if (i < inLen) {
+            uint8_t c = pIn[i++];
+            if (c == RFC1662_ESCAPE) {
+                if (i >= inLen) {
+                    // Escape with nothing after it, drop it.
+                    break;
+                }
+                c = pIn[i++] ^ 0x20;
+            }
+            // (A flag can't appear inside a complete frame, it is passed through as is.)
+            if (outLen < outMax) {
+                pOut[outLen] = c;
+            }
+            outLen++;
+        }
+    }
+
+    return outLen;
+}
+
+// ------------------------------------------------------------------------
+// Encoding
+
+bool rfc1662_encode_scalar(uint8_t* pOut,
+                           uint32_t* outLen,
+                           uint8_t protocol,
+                           const uint8_t* pIn,
+                           uint32_t inLen) {
+    uint32_t outIndex = 0;
+
+    // start of frame
+    if (outIndex >= *outLen) {
+        return true; // overflowed
+    }
+    pOut[outIndex++] = RFC1662_FLAG;
+
+    // protocol id
+    if (outIndex >= *outLen) {
+        return true; // overflowed
+    }
+    pOut[outIndex++] = protocol;
+
+    // RFC1662 encoded data
+    for (uint32_t i = 0; i < inLen; i++) {
+        if (isSpecial(pIn[i])) {
+            // escape this char
+            if (outIndex + 1 >= *outLen) {
+                return true; // overflowed
+            }
+            pOut[outIndex++] = RFC1662_ESCAPE;
+            pOut[outIndex++] = pIn[i] ^ 0x20;
+        } else {
+            if (outIndex >= *outLen) {
+                return true; // overflowed
+            }
+            pOut[outIndex++] = pIn[i];
+        }
+    }
+
+    // end of frame
+    if (outIndex >= *outLen) {
+        return true; // overflowed
+    }
+    pOut[outIndex++] = RFC1662_FLAG;
+
+    // set outLen for return
+    *outLen = outIndex;
+    return false; // return, no overflow
+}
+
+bool rfc1662_encode(uint8_t* pOut,
+                    uint32_t* outLen,
+                    uint8_t protocol,
+                    const uint8_t* pIn,
+                    uint32_t inLen) {
+    uint32_t outMax = *outLen;
+    uint32_t outIndex = 0;
+    uint32_t i = 0;
+
+    // start of frame and protocol id
+    if (outMax < 2) {
+        return true; // overflowed
+    }
+    pOut[outIndex++] = RFC1662_FLAG;
+    pOut[outIndex++] = protocol;
+
+    // RFC1662 encoded data
+    while (i < inLen) {
+        // Copy the run of characters that need no escaping in one go
+        uint32_t run = (uint32_t)rfc1662_findSpecial(pIn + i, inLen - i);
+        if (run > outMax - outIndex) {
+            return true; // overflowed
+        }
+        memcpy(pOut + outIndex, pIn + i, run);
+        outIndex += run;
+        i += run;
+
+        if (i < inLen) {
+            // escape this char
+            if (outMax - outIndex < 2) {
+                return true; // overflowed
+            }
+            pOut[outIndex++] = RFC1662_ESCAPE;
+            pOut[outIndex++] = pIn[i++] ^ 0x20;
+        }
+    }
+
+    // end of frame
+    if (outIndex >= outMax) {
+        return true; // overflowed
+    }
+    pOut[outIndex++] = RFC1662_FLAG;
+
+    // set outLen for return
+    *outLen = outIndex;
+    return false; // return, no overflow
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * RFC1662 (HDLC-like) framing used on the SHTP UART interface.
+ *
+ * The block functions scan for flag/escape characters several bytes at a
+ * time (SSE2/AVX2 on x86, NEON on ARM, when enabled by the compiler) and
+ * copy escape-free runs with memcpy.  The *_scalar variants process one
+ * byte at a time and always produce identical results.  Define
+ * RFC1662_NO_SIMD to build only the scalar code paths.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RFC1662_FLAG (0x7E)
+#define RFC1662_ESCAPE (0x7D)
+
+typedef enum {
+    RFC1662_OUTSIDE_FRAME, // Waiting for start of frame
+    RFC1662_INSIDE_FRAME,  // Inside frame until end of frame
+    RFC1662_ESCAPED,       // Inside frame, after escape char
+} rfc1662_RxState_t;
+
+typedef struct rfc1662_Decoder_s {
+    rfc1662_RxState_t state;
+
+    uint8_t* pFrame;   // Storage for the frame being decoded
+    uint32_t frameMax; // Size of pFrame
+    uint32_t frameLen; // Length of decoded frame. May exceed frameMax, excess is not stored.
+
+    bool frameReady; // Set when a complete frame is in pFrame
+    int32_t startPos; // Input offset of start flag seen in the last decode call, or -1
+} rfc1662_Decoder_t;
+
+// Name of the scan implementation selected at build time ("avx2", "sse2", "neon" or "scalar")
+const char* rfc1662_implName(void);
+
+// Return the offset of the first RFC1662_FLAG or RFC1662_ESCAPE in p[0..len), or len if none.
+size_t rfc1662_findSpecial(const uint8_t* p, size_t len);
+size_t rfc1662_findSpecial_scalar(const uint8_t* p, size_t len);
+
+// Prepare decoder to assemble frames into pFrame.
+void rfc1662_decoderInit(rfc1662_Decoder_t* d, uint8_t* pFrame, uint32_t frameMax);
+
+// Discard any frame in progress and wait for the next start flag.
+void rfc1662_decoderReset(rfc1662_Decoder_t* d);
+
+// Decode bytes from pIn until a frame is complete or the input is used up.
+// Returns the number of bytes consumed.  On return, d->frameReady indicates
+// a complete frame of d->frameLen bytes.  The caller must call
+// rfc1662_decoderReset() after consuming it.
+uint32_t rfc1662_decode(rfc1662_Decoder_t* d, const uint8_t* pIn, uint32_t len);
+uint32_t rfc1662_decode_scalar(rfc1662_Decoder_t* d, const uint8_t* pIn, uint32_t len);
+
+// Remove escapes from the contents of a complete frame (the bytes between
+// its start and end flags), writing at most outMax bytes to pOut.  Returns
+// the decoded length, which may exceed outMax; excess is not stored.
+uint32_t rfc1662_unescape(uint8_t* pOut, uint32_t outMax, const uint8_t* pIn, uint32_t inLen);
+uint32_t rfc1662_unescape_scalar(uint8_t* pOut,
+                                 uint32_t outMax,
+                                 const uint8_t* pIn,
+                                 uint32_t inLen);
+
+// Encode pIn as a complete frame: flag, protocol id, escaped data, flag.
+// On entry *outLen is the size of pOut, on return it is the encoded length.
+// Returns true if pOut was too small.
+bool rfc1662_encode(uint8_t* pOut,
+                    uint32_t* outLen,
+                    uint8_t protocol,
+                    const uint8_t* pIn,
+                    uint32_t inLen);
+bool rfc1662_encode_scalar(uint8_t* pOut,
+                           uint32_t* outLen,
+                           uint8_t protocol,
+                           const uint8_t* pIn,
+                           uint32_t inLen);
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "soft_link.h"
+#include "rfc1662.h"
+#include "timing.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Give up on a line control frame the peer isn't reading after this long
+#define WRITE_TIMEOUT_US (100000)
+#define WRITE_RETRY_US (100)
+
+static bool has_prefix(const char* s, const char* prefix) {
+    return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+static int open_unix(const char* path) {
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    // If the simulator goes away, writes should fail with EPIPE rather
+    // than kill the process.
+    signal(SIGPIPE, SIG_IGN);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if ((connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) ||
+        (fcntl(fd, F_SETFL, O_NONBLOCK) < 0)) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    return fd;
+}
+
+static int open_pty(const char* path) {
+    struct termios tty;
+
+    int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // Raw mode, so bytes pass through the line discipline unchanged
+    if (tcgetattr(fd, &tty) == 0) {
+        cfmakeraw(&tty);
+        tty.c_cc[VMIN] = 0;
+        tty.c_cc[VTIME] = 0;
+        tcsetattr(fd, TCSANOW, &tty);
+    }
+    tcflush(fd, TCIOFLUSH);
+
+    return fd;
+}
+
+bool soft_link_isSoftLink(const char* device_filename) {
+    return has_prefix(device_filename, SOFT_LINK_UNIX_PREFIX) ||
+           has_prefix(device_filename, SOFT_LINK_PTY_PREFIX);
+}
+
+int soft_link_open(const char* device_filename) {
+    if (has_prefix(device_filename, SOFT_LINK_UNIX_PREFIX)) {
+        return open_unix(device_filename + strlen(SOFT_LINK_UNIX_PREFIX));
+    }
+    if (has_prefix(device_filename, SOFT_LINK_PTY_PREFIX)) {
+        return open_pty(device_filename + strlen(SOFT_LINK_PTY_PREFIX));
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+bool soft_link_setLine(int fd, int line, bool level) {
+    uint8_t frame[] = {
+            RFC1662_FLAG, SOFT_LINK_PROTOCOL_LINE, (uint8_t)line, level ? 1 : 0, RFC1662_FLAG};
+    uint32_t sent = 0;
+    uint64_t deadline_us = timing_now_us() + WRITE_TIMEOUT_US;
+
+    while (sent < sizeof(frame)) {
+        ssize_t status = write(fd, frame + sent, sizeof(frame) - sent);
+        if (status > 0) {
+            sent += status;
+        } else if ((status < 0) && (errno != EAGAIN)) {
+            return false;
+        } else if (timing_now_us() >= deadline_us) {
+            return false;
+        } else {
+            timing_sleepUntil_us(timing_now_us() + WRITE_RETRY_US, 0);
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Software transports, for running against a simulated sensor hub instead
+ * of a device on an FTDI cable.  (POSIX only.)
+ *
+ * A device name of the form
+ *   unix:<path>   connects to a Unix-domain stream socket at <path>
+ *   pty:<path>    opens the pseudo-terminal <path>, e.g. /dev/pts/3
+ * selects a software transport.  Data is exchanged exactly as on the UART,
+ * the HALs just skip serial port setup.
+ *
+ * A software transport has no DTR/RTS, so RESETN and BOOTN are sent in
+ * band as line control frames instead:
+ *
+ *   7E 10 <line> <level> 7E
+ *
+ * <line> is SOFT_LINK_RESETN or SOFT_LINK_BOOTN and <level> is the logic
+ * level of the pin (0: asserted, 1: de-asserted).  Neither byte is ever
+ * 7E or 7D so no escaping is needed.  Protocol 0x10 is not used by the
+ * sensor hub, so a simulator can pick these frames out of the same stream
+ * as SHTP and BSN/BSQ frames.  Line control frames are only sent while the
+ * HAL is opening or closing, so they don't interleave with DFU traffic.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+// Prefixes selecting a software transport
+#define SOFT_LINK_UNIX_PREFIX "unix:"
+#define SOFT_LINK_PTY_PREFIX "pty:"
+
+// RFC1662 protocol id of line control frames
+#define SOFT_LINK_PROTOCOL_LINE (0x10)
+
+// Line ids in line control frames
+#define SOFT_LINK_RESETN (0)
+#define SOFT_LINK_BOOTN (1)
+
+// True if device_filename names a software transport.
+bool soft_link_isSoftLink(const char* device_filename);
+
+// Open the transport named by device_filename in non-blocking mode.
+// Returns the file descriptor or -1 with errno set.
+int soft_link_open(const char* device_filename);
+
+// Send a line control frame setting line to level.  Returns true on success.
+bool soft_link_setLine(int fd, int line, bool level);
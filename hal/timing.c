@@ -0,0 +1,236 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "timing.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <time.h>
+#endif
+
+// Windows sleeps in scheduler ticks (nominally 15.6 ms).  Stop sleeping
+// this far before the spin tail and yield instead.
+#define WIN_SLEEP_MARGIN_US (16000)
+
+// Any thread may read the time or delay, so the state below is only
+// accessed through the atomic helpers that follow.
+static volatile uint64_t spinTail_us = TIMING_DEFAULT_SPIN_US;
+
+// Overshoot statistics, see timing_Overshoot_t
+static volatile uint64_t overshootCount = 0;
+static volatile uint64_t overshootLast_ns = 0;
+static volatile uint64_t overshootMax_ns = 0;
+static volatile uint64_t overshootTotal_ns = 0;
+
+static timing_Clock_t volatile clock_ = NULL;
+
+// System clock time corresponding to 0, or 0 until the first call
+static volatile uint64_t epoch_ns = 0;
+
+#ifdef _WIN32
+static uint64_t load64(volatile uint64_t* p) {
+    return (uint64_t)InterlockedCompareExchange64((volatile LONG64*)p, 0, 0);
+}
+
+static void store64(volatile uint64_t* p, uint64_t v) {
+    InterlockedExchange64((volatile LONG64*)p, (LONG64)v);
+}
+
+static void add64(volatile uint64_t* p, uint64_t v) {
+    InterlockedExchangeAdd64((volatile LONG64*)p, (LONG64)v);
+}
+
+// Set *p to desired if it is expected.  Returns true if it was.
+static bool cas64(volatile uint64_t* p, uint64_t expected, uint64_t desired) {
+    return (uint64_t)InterlockedCompareExchange64(
+                   (volatile LONG64*)p, (LONG64)desired, (LONG64)expected) == expected;
+}
+
+static timing_Clock_t loadClock(void) {
+    return (timing_Clock_t)InterlockedCompareExchangePointer((PVOID volatile*)&clock_, NULL, NULL);
+}
+
+static void storeClock(timing_Clock_t clock) {
+    InterlockedExchangePointer((PVOID volatile*)&clock_, (PVOID)clock);
+}
+#else
+static uint64_t load64(volatile uint64_t* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void store64(volatile uint64_t* p, uint64_t v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static void add64(volatile uint64_t* p, uint64_t v) {
+    __atomic_fetch_add(p, v, __ATOMIC_RELAXED);
+}
+
+// Set *p to desired if it is expected.  Returns true if it was.
+static bool cas64(volatile uint64_t* p, uint64_t expected, uint64_t desired) {
+    return __atomic_compare_exchange_n(
+            p, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static timing_Clock_t loadClock(void) {
+    return __atomic_load_n(&clock_, __ATOMIC_ACQUIRE);
+}
+
+static void storeClock(timing_Clock_t clock) {
+    __atomic_store_n(&clock_, clock, __ATOMIC_RELEASE);
+}
+#endif
+
+// OS monotonic clock in nanoseconds
+static uint64_t system_ns(void) {
+#ifdef _WIN32
+    static uint64_t freq = 0;
+    uint64_t counterTime;
+
+    QueryPerformanceCounter((LARGE_INTEGER*)&counterTime);
+
+    if (freq == 0) {
+        QueryPerformanceFrequency((LARGE_INTEGER*)&freq);
+    }
+
+    // Split to avoid overflowing counterTime * 1e9
+    return (counterTime / freq) * 1000000000ull + ((counterTime % freq) * 1000000000ull) / freq;
+#else
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return (uint64_t)tp.tv_sec * 1000000000ull + (uint64_t)tp.tv_nsec;
+#endif
+}
+
+// System clock time corresponding to 0, set by the first caller.
+static uint64_t epoch(void) {
+    uint64_t e = load64(&epoch_ns);
+    if (e == 0) {
+        // If another thread got there first, use its epoch.
+        cas64(&epoch_ns, 0, system_ns());
+        e = load64(&epoch_ns);
+    }
+    return e;
+}
+
+// System clock time in nanoseconds, starting from 0 at the first call.
+static uint64_t elapsed_ns(void) {
+    uint64_t e = epoch();
+    return system_ns() - e;
+}
+
+// Current time in nanoseconds: the injected clock if there is one,
+// otherwise the system clock.
+static uint64_t now_ns(void) {
+    timing_Clock_t clock = loadClock();
+    if (clock != NULL) {
+        return clock();
+    }
+    return elapsed_ns();
+}
+
+// Sleep (without spinning) until now_ns() reaches wake_ns.
+static void sleep_until_ns(uint64_t wake_ns) {
+    if (loadClock() != NULL) {
+        // The OS can't sleep on an injected clock, the caller spins instead.
+        return;
+    }
+
+#ifdef _WIN32
+    uint64_t now = now_ns();
+    if (wake_ns > now + WIN_SLEEP_MARGIN_US * 1000ull) {
+        Sleep((DWORD)((wake_ns - now) / 1000000ull - WIN_SLEEP_MARGIN_US / 1000));
+    }
+    while (now_ns() < wake_ns) {
+        SwitchToThread();
+    }
+#else
+    // Convert back to the system clock's timebase
+    uint64_t wake = wake_ns + epoch();
+
+    struct timespec ts;
+    ts.tv_sec = (time_t)(wake / 1000000000ull);
+    ts.tv_nsec = (long)(wake % 1000000000ull);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+#endif
+}
+
+uint64_t timing_now_us(void) {
+    return now_ns() / 1000;
+}
+
+uint64_t timing_systemNow_us(void) {
+    return elapsed_ns() / 1000;
+}
+
+// Sleep until spin_ns before deadline_ns, then busy-wait.  Returns the time
+// at which the deadline was seen to have passed.
+static uint64_t wait_until_ns(uint64_t deadline_ns, uint64_t spin_ns) {
+    if (deadline_ns > spin_ns) {
+        sleep_until_ns(deadline_ns - spin_ns);
+    }
+
+    uint64_t now = now_ns();
+    while (now < deadline_ns) {
+        now = now_ns();
+    }
+    return now;
+}
+
+void timing_sleepUntil_us(uint64_t deadline_us, uint32_t spin_us) {
+    wait_until_ns(deadline_us * 1000, (uint64_t)spin_us * 1000);
+}
+
+void timing_delay_us(uint32_t t_us) {
+    uint64_t deadline_ns = now_ns() + (uint64_t)t_us * 1000;
+    uint64_t done_ns = wait_until_ns(deadline_ns, load64(&spinTail_us) * 1000);
+
+    uint64_t over_ns = done_ns - deadline_ns;
+    if (over_ns > UINT32_MAX) {
+        over_ns = UINT32_MAX;
+    }
+    add64(&overshootCount, 1);
+    store64(&overshootLast_ns, over_ns);
+    uint64_t max_ns = load64(&overshootMax_ns);
+    while ((over_ns > max_ns) && !cas64(&overshootMax_ns, max_ns, over_ns)) {
+        max_ns = load64(&overshootMax_ns);
+    }
+    add64(&overshootTotal_ns, over_ns);
+}
+
+void timing_setSpinTail_us(uint32_t spin_us) {
+    store64(&spinTail_us, spin_us);
+}
+
+void timing_getOvershoot(timing_Overshoot_t* pOvershoot) {
+    // Each field is read atomically, though a delay finishing meanwhile
+    // may show in some fields and not others.
+    pOvershoot->count = (uint32_t)load64(&overshootCount);
+    pOvershoot->last_ns = (uint32_t)load64(&overshootLast_ns);
+    pOvershoot->max_ns = (uint32_t)load64(&overshootMax_ns);
+    pOvershoot->total_ns = load64(&overshootTotal_ns);
+}
+
+void timing_setClock(timing_Clock_t clock) {
+    storeClock(clock);
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Timebase and delays shared by the HALs, DFU and logger code.
+ *
+ * Time is kept as 64-bit microseconds from the first call to
+ * timing_now_us(), so it doesn't wrap in practice.  Interfaces that only
+ * carry 32-bit time (e.g. sh2_Hal_t getTimeUs) use the low 32 bits, which
+ * wrap cleanly every 2^32 us.
+ *
+ * A delay sleeps for most of its interval and busy-waits only for a
+ * short tail at the end, to make up for the OS waking the thread late.
+ * The overshoot actually achieved (time past the deadline when the
+ * delay returns) is recorded.
+ *
+ * All functions may be called from any thread.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Default length of the busy-wait tail
+#define TIMING_DEFAULT_SPIN_US (100)
+
+// Source of time in nanoseconds.  Must be monotonic.
+typedef uint64_t (*timing_Clock_t)(void);
+
+typedef struct timing_Overshoot_s {
+    uint32_t count;    // Number of delays measured
+    uint32_t last_ns;  // Overshoot of the most recent delay
+    uint32_t max_ns;   // Largest overshoot
+    uint64_t total_ns; // Sum of all overshoots, for the mean
+} timing_Overshoot_t;
+
+// Monotonic time in microseconds.
+uint64_t timing_now_us(void);
+
+// Monotonic system time in microseconds, ignoring any injected clock.
+uint64_t timing_systemNow_us(void);
+
+// Return when timing_now_us() reaches deadline_us.  Sleeps until spin_us
+// before the deadline, then busy-waits.  spin_us of 0 never busy-waits.
+void timing_sleepUntil_us(uint64_t deadline_us, uint32_t spin_us);
+
+// Delay for t_us microseconds, busy-waiting for the configured tail.
+void timing_delay_us(uint32_t t_us);
+
+// Set the busy-wait tail used by timing_delay_us().
+void timing_setSpinTail_us(uint32_t spin_us);
+
+// Get overshoot statistics of all timing_delay_us() calls so far.
+void timing_getOvershoot(timing_Overshoot_t* pOvershoot);
+
+// Replace the system clock with clock, e.g. to simulate long runs.  Its
+// value is used as is, without rebasing to 0.  Delays spin on an injected
+// clock, so it must advance by itself.  It is called from whichever thread
+// reads the time.  Pass NULL to restore the system clock.
+void timing_setClock(timing_Clock_t clock);
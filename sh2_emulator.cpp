@@ -0,0 +1,296 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Sensor hub emulator: serves sh2_logger over a Unix-domain socket or a
+// pseudo-terminal (sh2_logger -d unix:<path> or -d pty:<path>).
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "tclap/CmdLine.h"
+#include <iomanip>
+#include <iostream>
+#include <string.h>
+#include <string>
+
+#include "config.h"
+
+#include "Sh2Emulator.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <unistd.h>
+
+extern "C" {
+#include "timing.h"
+}
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define STATS_INTERVAL_US (1000000)
+
+// =================================================================================================
+// LOCAL VARIABLES
+// =================================================================================================
+
+// Is set to false in Break handler to stop application gracefully.
+volatile static bool runApp_ = true;
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+void breakHandler(int signo) {
+    if (signo == SIGINT) {
+        if (!runApp_) {
+            std::cerr << "force quit.\n";
+            exit(0);
+        }
+        runApp_ = false;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// reportStats
+// -------------------------------------------------------------------------------------------------
+static void reportStats(Sh2Emulator::Stats_s* pLast, Sh2Emulator::Stats_s* pNow, double dt_s) {
+    std::cout << "Reports: " << std::setw(10) << pNow->reports << " (" << std::fixed
+              << std::setprecision(0) << (pNow->reports - pLast->reports) / dt_s
+              << "/s) Dropped: " << pNow->dropped << " Packets: " << pNow->packets << " ("
+              << (pNow->packets - pLast->packets) / dt_s
+              << "/s) Bytes/s: " << (pNow->bytes - pLast->bytes) / dt_s << std::endl;
+}
+
+// -------------------------------------------------------------------------------------------------
+// serve
+// -------------------------------------------------------------------------------------------------
+// Run the emulator against one host until it hangs up or we're interrupted.
+static void serve(Sh2Emulator* pEmulator, int fd) {
+    pEmulator->connect(fd);
+
+    Sh2Emulator::Stats_s last = pEmulator->getStats();
+    uint64_t lastReport_us = timing_now_us();
+
+    while (runApp_) {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN | (pEmulator->txPending() ? POLLOUT : 0);
+        pfd.revents = 0;
+
+        // poll() works in ms, round up so we never wake before a report is due
+        int timeout_ms = (int)((pEmulator->getServiceTimeout_us() + 999) / 1000);
+        poll(&pfd, 1, timeout_ms);
+
+        if (!pEmulator->service()) {
+            std::cout << "INFO: Host disconnected." << std::endl;
+            break;
+        }
+
+        uint64_t now_us = timing_now_us();
+        if (now_us - lastReport_us >= STATS_INTERVAL_US) {
+            Sh2Emulator::Stats_s stats = pEmulator->getStats();
+            if (stats.reports != last.reports) {
+                reportStats(&last, &stats, (now_us - lastReport_us) * 1e-6);
+            }
+            last = stats;
+            lastReport_us = now_us;
+        }
+    }
+
+    pEmulator->disconnect();
+}
+
+// -------------------------------------------------------------------------------------------------
+// runSocket
+// -------------------------------------------------------------------------------------------------
+// Accept hosts on a Unix-domain socket, one at a time.
+static int runSocket(Sh2Emulator* pEmulator, const std::string& path) {
+    struct sockaddr_un addr;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "ERROR: Socket path too long: " << path << std::endl;
+        return -1;
+    }
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        std::cerr << "ERROR: socket: " << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+
+    unlink(path.c_str());
+    if ((bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) < 0) || (listen(listenFd, 1) < 0)) {
+        std::cerr << "ERROR: Unable to listen on " << path << ": " << strerror(errno) << std::endl;
+        close(listenFd);
+        return -1;
+    }
+
+    std::cout << "INFO: Listening on unix:" << path << std::endl;
+
+    while (runApp_) {
+        int fd = accept(listenFd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "ERROR: accept: " << strerror(errno) << std::endl;
+            break;
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+
+        std::cout << "INFO: Host connected." << std::endl;
+        serve(pEmulator, fd);
+        close(fd);
+    }
+
+    close(listenFd);
+    unlink(path.c_str());
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+// runPty
+// -------------------------------------------------------------------------------------------------
+// Serve on a new pseudo-terminal until interrupted.
+static int runPty(Sh2Emulator* pEmulator) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((master < 0) || (grantpt(master) < 0) || (unlockpt(master) < 0)) {
+        std::cerr << "ERROR: Unable to create a pty: " << strerror(errno) << std::endl;
+        return -1;
+    }
+    fcntl(master, F_SETFL, O_NONBLOCK);
+
+    const char* name = ptsname(master);
+
+    // Hold the slave side open ourselves, so the master doesn't see a hangup
+    // each time the logger closes it.  Raw mode passes frames through untouched.
+    int slave = open(name, O_RDWR | O_NOCTTY);
+    if (slave < 0) {
+        std::cerr << "ERROR: Unable to open " << name << ": " << strerror(errno) << std::endl;
+        close(master);
+        return -1;
+    }
+    struct termios tty;
+    if (tcgetattr(slave, &tty) == 0) {
+        cfmakeraw(&tty);
+        tcsetattr(slave, TCSANOW, &tty);
+    }
+
+    std::cout << "INFO: Serving on pty:" << name << std::endl;
+    serve(pEmulator, master);
+
+    close(slave);
+    close(master);
+    return 0;
+}
+
+// =================================================================================================
+// MAIN
+// =================================================================================================
+int main(int argc, const char* argv[]) {
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = breakHandler;
+    sigaction(SIGINT, &act, NULL);
+
+    // A host going away shows up as a write error, not a signal.
+    signal(SIGPIPE, SIG_IGN);
+
+    TCLAP::CmdLine cmd("SH2 sensor hub emulator", ' ', PROJECT_VERSION);
+
+    // --socket path
+    TCLAP::ValueArg<std::string> socketArg("s",
+                                           "socket",
+                                           "Listen for sh2_logger on a Unix-domain socket at this "
+                                           "path (sh2_logger -d unix:<path>).",
+                                           false,
+                                           "/tmp/sh2_emulator.sock",
+                                           "path");
+    cmd.add(socketArg);
+
+    // --pty
+    TCLAP::SwitchArg ptyArg("",
+                            "pty",
+                            "Serve on a new pseudo-terminal instead of a socket. Its name is "
+                            "printed at startup (sh2_logger -d pty:<name>).",
+                            false);
+    cmd.add(ptyArg);
+
+    // --cargo bytes
+    TCLAP::ValueArg<uint32_t> cargoArg("",
+                                       "cargo",
+                                       "Largest SHTP packet sent, in bytes including the 4 byte "
+                                       "header. Defaults to 256.",
+                                       false,
+                                       256,
+                                       "bytes");
+    cmd.add(cargoArg);
+
+    // --batch us
+    TCLAP::ValueArg<uint32_t> batchArg("",
+                                       "batch",
+                                       "Longest time sensor reports are held to be batched into "
+                                       "one packet, in microseconds. 0 sends each report in its "
+                                       "own packet. Defaults to 1000.",
+                                       false,
+                                       1000,
+                                       "microseconds");
+    cmd.add(batchArg);
+
+    // --bsqOnly
+    TCLAP::SwitchArg bsqOnlyArg("",
+                                "bsqOnly",
+                                "Send buffer status only when the host asks for it, not after "
+                                "every frame received.",
+                                false);
+    cmd.add(bsqOnlyArg);
+
+    cmd.parse(argc, argv);
+
+    // Leave room for the largest report (60 bytes) and base timestamp after the header.
+    // The host HAL accepts packets up to 1023 bytes.
+    uint32_t cargo = cargoArg.getValue();
+    if ((cargo < 69) || (cargo > 1023)) {
+        std::cerr << "ERROR: --cargo must be between 69 and 1023" << std::endl;
+        return -1;
+    }
+
+    Sh2Emulator emulator(cargo, batchArg.getValue(), !bsqOnlyArg.getValue());
+
+    int status;
+    if (ptyArg.getValue()) {
+        status = runPty(&emulator);
+    } else {
+        status = runSocket(&emulator, socketArg.getValue());
+    }
+
+    Sh2Emulator::Stats_s stats = emulator.getStats();
+    std::cout << "INFO: " << stats.reports << " reports generated, " << stats.dropped
+              << " dropped, " << stats.packets << " packets, " << stats.bytes << " bytes sent."
+              << std::endl;
+
+    return status;
+}
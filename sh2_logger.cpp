@@ -26,20 +26,25 @@
 // INCLUDE FILES
 // =================================================================================================
 #include "tclap/CmdLine.h"
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <nlohmann/json.hpp>
 #include <string.h>
 #include <string>
 
 #include "config.h"
 
+#include "BinLogger.h"
 #include "BnoDfu.h"
 #include "DsfLogger.h"
 #include "FileWheelSource.h"
 #include "FspDfu.h"
 #include "LoggerApp.h"
 #include "LoggerUtil.h"
+#include "RxThreadHal.h"
+#include "ThreadedLogger.h"
 #include "WheelSource.h"
 
 #include "HcBinFile.h"
@@ -53,6 +58,7 @@
 extern "C" {
 #include "bno_dfu_hal.h"
 #include "ftdi_hal.h"
+#include "timing.h"
 }
 
 // =================================================================================================
@@ -68,6 +74,13 @@ using json = nlohmann::json;
 // LOCAL FUNCTION PROTOTYPES
 // =================================================================================================
 bool ParseJsonBatchFile(std::string inFilename, LoggerApp::appConfig_s* pAppConfig);
+void reportDelayOvershoot();
+void reportHalStats(const ftdi_hal_Stats_t* pStats);
+void reportLatency(const LatencyHistogram& latency);
+void reportLogThread(const ThreadedLogger::Stats_s& stats);
+void reportFileWrites(const AsyncFileWriter::Stats_s& stats);
+void reportCompression(const AsyncFileWriter::Stats_s& stats);
+uint32_t timeUntil(uint64_t now_us, uint64_t last_us, uint64_t interval_us);
 
 
 // =================================================================================================
@@ -75,6 +88,12 @@ bool ParseJsonBatchFile(std::string inFilename, LoggerApp::appConfig_s* pAppConf
 // =================================================================================================
 static const uint32_t MaxPathLen = 260;
 
+// Interval between HAL statistics records in the log
+static const uint64_t HalStatsInterval_us = 1000000;
+
+// Interval between compression progress reports
+static const uint64_t CompressionReportInterval_us = 10000000;
+
 // =================================================================================================
 // LOCAL VARIABLES
 // =================================================================================================
@@ -94,8 +113,11 @@ public:
     int do_logging();
     int do_dfu_bno();
     int do_dfu_fsp();
+    int do_bin2dsf();
 
 private:
+    bool getWriteConfig(AsyncFileWriter::Config_s* pConfig);
+
     std::string m_cmd;
 
     bool m_outFilenameSet;
@@ -114,6 +136,26 @@ private:
     bool m_clearDcd;
     bool m_clearOfCalSet;
     bool m_clearOfCal;
+
+    bool m_waitForData;
+    bool m_rxThread;
+    bool m_logThread;
+    bool m_binary;
+    uint32_t m_flush_ms;
+    uint32_t m_sync_ms;
+    uint32_t m_syncMB;
+    AsyncFileWriter::Compression_e m_compression;
+    int m_compressLevel;
+    uint32_t m_rxSpin_us;
+    bool m_rxCpuSet;
+    int m_rxCpu;
+    uint32_t m_txGap_us;
+
+    bool m_captureSet;
+    std::string m_capture;
+    bool m_replaySet;
+    std::string m_replay;
+    bool m_replayFast;
 };
 
 void Sh2Logger::parseArgs(int argc, const char* argv[]) {
@@ -122,7 +164,7 @@ void Sh2Logger::parseArgs(int argc, const char* argv[]) {
     TCLAP::CmdLine cmd("SH2 Logging utility", ' ', PROJECT_VERSION);
 
     // Command: log (default), dfu,
-    std::vector<std::string> operations = {"log", "dfu-bno", "dfu-fsp200", "template"};
+    std::vector<std::string> operations = {"log", "dfu-bno", "dfu-fsp200", "template", "bin2dsf"};
     TCLAP::ValuesConstraint<std::string> opConstr(operations);
     TCLAP::UnlabeledValueArg<std::string> cmdArg("command",
                                                  "Operation to perform",
@@ -136,7 +178,8 @@ void Sh2Logger::parseArgs(int argc, const char* argv[]) {
     TCLAP::ValueArg<std::string>
             inFilenameArg("i",
                           "input",
-                          "Input filename (configuration for 'log' command, firmware file for DFU)",
+                          "Input filename (configuration for 'log' command, firmware file for "
+                          "DFU, binary log for 'bin2dsf' command)",
                           false,
                           "",
                           "filename");
@@ -147,8 +190,8 @@ void Sh2Logger::parseArgs(int argc, const char* argv[]) {
     TCLAP::ValueArg<std::string>
             outFilenameArg("o",
                            "output",
-                           "Output filename (sensor .dsf log for 'log' command, logger .json "
-                           "configuration for 'template' command)",
+                           "Output filename (sensor .dsf log for 'log' and 'bin2dsf' commands, "
+                           "logger .json configuration for 'template' command)",
                            false,
                            "",
                            "filename");
@@ -197,6 +240,153 @@ void Sh2Logger::parseArgs(int argc, const char* argv[]) {
                                                 "wheel_source");
     cmd.add(wheelSourceArg);
 
+    // --wait
+    TCLAP::SwitchArg waitArg("",
+                             "wait",
+                             "Sleep until serial data arrives instead of continuously polling the "
+                             "serial port. Reduces CPU load.",
+                             false);
+    cmd.add(waitArg);
+
+    // --rxThread
+    TCLAP::SwitchArg rxThreadArg("",
+                                 "rxThread",
+                                 "Receive serial data on a dedicated thread so that slow log "
+                                 "file writes can't cause received data to be lost.",
+                                 false);
+    cmd.add(rxThreadArg);
+
+    // --logThread
+    TCLAP::SwitchArg logThreadArg("",
+                                  "logThread",
+                                  "Format and write the log on a dedicated thread so that "
+                                  "receiving sensor reports never waits on it.",
+                                  false);
+    cmd.add(logThreadArg);
+
+    // --binary
+    TCLAP::SwitchArg binaryArg("",
+                               "binary",
+                               "Write the log in a compact binary format instead of .dsf text. "
+                               "Convert it to .dsf afterwards with the 'bin2dsf' command.",
+                               false);
+    cmd.add(binaryArg);
+
+    // --flush ms
+    TCLAP::ValueArg<uint32_t> flushArg("",
+                                       "flush",
+                                       "Longest time log data is held in memory before being "
+                                       "written to the file, in milliseconds. 0 writes only "
+                                       "when a 1 MiB buffer fills. Defaults to 1000.",
+                                       false,
+                                       1000,
+                                       "milliseconds");
+    cmd.add(flushArg);
+
+    // --sync ms
+    TCLAP::ValueArg<uint32_t> syncArg("",
+                                      "sync",
+                                      "Sync the log file to disk at least this often, in "
+                                      "milliseconds. Defaults to 0, only when logging stops.",
+                                      false,
+                                      0,
+                                      "milliseconds");
+    cmd.add(syncArg);
+
+    // --syncMB MB
+    TCLAP::ValueArg<uint32_t> syncMBArg("",
+                                        "syncMB",
+                                        "Sync the log file to disk after every this many MiB "
+                                        "written. Defaults to 0, only when logging stops.",
+                                        false,
+                                        0,
+                                        "MiB");
+    cmd.add(syncMBArg);
+
+    // --compress none|gzip|zstd
+    std::vector<std::string> compressions = {"none", "gzip", "zstd"};
+    TCLAP::ValuesConstraint<std::string> compressConstr(compressions);
+    TCLAP::ValueArg<std::string> compressArg("",
+                                             "compress",
+                                             "Compress the log file as it's written, in blocks "
+                                             "of up to 1 MiB or --flush milliseconds of data, "
+                                             "so a file cut short can be decompressed up to its "
+                                             "last whole block. Defaults to none.",
+                                             false,
+                                             "none",
+                                             &compressConstr);
+    cmd.add(compressArg);
+
+    // --compressLevel level
+    TCLAP::ValueArg<int> compressLevelArg("",
+                                          "compressLevel",
+                                          "Compression level for --compress. Defaults to the "
+                                          "compression library's default.",
+                                          false,
+                                          0,
+                                          "level");
+    cmd.add(compressLevelArg);
+
+    // --rxSpin us
+    TCLAP::ValueArg<uint32_t> rxSpinArg("",
+                                        "rxSpin",
+                                        "Busy-poll for received data for this long after data "
+                                        "arrives before sleeping, in microseconds. Lowers latency "
+                                        "at the cost of CPU load. Defaults to 0 (off).",
+                                        false,
+                                        0,
+                                        "microseconds");
+    cmd.add(rxSpinArg);
+
+    // --rxCpu cpu
+    TCLAP::ValueArg<int> rxCpuArg("",
+                                  "rxCpu",
+                                  "Run the --rxThread receive thread on this CPU only, e.g. an "
+                                  "isolated core.",
+                                  false,
+                                  -1,
+                                  "cpu");
+    cmd.add(rxCpuArg);
+
+    // --txGap us
+    TCLAP::ValueArg<uint32_t> txGapArg("",
+                                       "txGap",
+                                       "Minimum time between bytes sent to the sensor hub, in "
+                                       "microseconds. 0 writes queued frames in one go. "
+                                       "Defaults to 100.",
+                                       false,
+                                       100,
+                                       "microseconds");
+    cmd.add(txGapArg);
+
+    // --capture filename
+    TCLAP::ValueArg<std::string> captureArg("",
+                                            "capture",
+                                            "Record all raw serial traffic, with timestamps, to "
+                                            "this file for later use with --replay.",
+                                            false,
+                                            "",
+                                            "filename");
+    cmd.add(captureArg);
+
+    // --replay filename
+    TCLAP::ValueArg<std::string> replayArg("",
+                                           "replay",
+                                           "Replay data recorded with --capture instead of "
+                                           "using a sensor hub. Logging stops at the end of the "
+                                           "recording. Replaces -d.",
+                                           false,
+                                           "",
+                                           "filename");
+    cmd.add(replayArg);
+
+    // --replayFast
+    TCLAP::SwitchArg replayFastArg("",
+                                   "replayFast",
+                                   "Replay as fast as possible rather than in real time. "
+                                   "Timestamps are the recorded ones.",
+                                   false);
+    cmd.add(replayFastArg);
 
     // Parse them arguments
     cmd.parse(argc, argv);
@@ -215,6 +405,30 @@ void Sh2Logger::parseArgs(int argc, const char* argv[]) {
     m_clearOfCal = clearOfCalArg.getValue();
     m_wheelSourceSet = wheelSourceArg.isSet();
     m_wheelSource = wheelSourceArg.getValue();
+    m_waitForData = waitArg.getValue();
+    m_rxThread = rxThreadArg.getValue();
+    m_logThread = logThreadArg.getValue();
+    m_binary = binaryArg.getValue();
+    m_flush_ms = flushArg.getValue();
+    m_sync_ms = syncArg.getValue();
+    m_syncMB = syncMBArg.getValue();
+    if (compressArg.getValue() == "gzip") {
+        m_compression = AsyncFileWriter::COMPRESS_GZIP;
+    } else if (compressArg.getValue() == "zstd") {
+        m_compression = AsyncFileWriter::COMPRESS_ZSTD;
+    } else {
+        m_compression = AsyncFileWriter::COMPRESS_NONE;
+    }
+    m_compressLevel = compressLevelArg.getValue();
+    m_rxSpin_us = rxSpinArg.getValue();
+    m_rxCpuSet = rxCpuArg.isSet();
+    m_rxCpu = rxCpuArg.getValue();
+    m_txGap_us = txGapArg.getValue();
+    m_captureSet = captureArg.isSet();
+    m_capture = captureArg.getValue();
+    m_replaySet = replayArg.isSet();
+    m_replay = replayArg.getValue();
+    m_replayFast = replayFastArg.getValue();
 }
 
 int Sh2Logger::run() {
@@ -226,12 +440,32 @@ int Sh2Logger::run() {
         return do_dfu_fsp();
     } else if (m_cmd == "log") {
         return do_logging();
+    } else if (m_cmd == "bin2dsf") {
+        return do_bin2dsf();
     }
 
     std::cerr << "ERROR: Unrecognized command: " << m_cmd << std::endl;
     return -1;
 }
 
+// File buffering, sync and compression settings from the command line
+bool Sh2Logger::getWriteConfig(AsyncFileWriter::Config_s* pConfig) {
+    if (!AsyncFileWriter::canCompress(m_compression)) {
+        std::cerr << "ERROR: This sh2_logger was built without support for that --compress "
+                     "method."
+                  << std::endl;
+        return false;
+    }
+
+    *pConfig = AsyncFileWriter::defaultConfig();
+    pConfig->flush_ms = m_flush_ms;
+    pConfig->sync_ms = m_sync_ms;
+    pConfig->syncBytes = (uint64_t)m_syncMB * 1024 * 1024;
+    pConfig->compression = m_compression;
+    pConfig->level = m_compressLevel;
+    return true;
+}
+
 int Sh2Logger::do_template() {
     // JSON configuration file template
     static const json templateContents = {
@@ -312,10 +546,19 @@ int Sh2Logger::do_logging() {
         std::cerr << "ERROR: No output file specified, use -o or --output argument." << std::endl;
         return -1;
     }
-    if (!m_deviceArgSet) {
+    if (!m_deviceArgSet && !m_replaySet) {
         std::cerr << "ERROR: No device specified, use -d or --device argument." << std::endl;
         return -1;
     }
+    if (m_replaySet && m_rxThread) {
+        // Replay feeds data and time from one thread.
+        std::cerr << "ERROR: --rxThread can't be used with --replay." << std::endl;
+        return -1;
+    }
+    if (m_rxCpuSet && (!m_rxThread || (m_rxCpu < 0))) {
+        std::cerr << "ERROR: --rxCpu needs --rxThread and a CPU number of 0 or more." << std::endl;
+        return -1;
+    }
 
     // appConfig holds the requested configuration for this session, as read from
     // the input .JSON file.
@@ -325,8 +568,14 @@ int Sh2Logger::do_logging() {
     // module startup commands and manages the flow of data from the module.
     LoggerApp loggerApp;
 
-    // loggerApp uses dsfLogger to translate received data into DSF Format.
+    // loggerApp uses dsfLogger to translate received data into DSF Format,
+    // or binLogger to record it in binary.
     DsfLogger dsfLogger;
+    BinLogger binLogger;
+    Logger* pFileLogger = &dsfLogger;
+    if (m_binary) {
+        pFileLogger = &binLogger;
+    }
 
     // Parse input .json file
     if (!ParseJsonBatchFile(m_inFilename, &appConfig)) {
@@ -354,34 +603,91 @@ int Sh2Logger::do_logging() {
         return -1;
     }
 
+    // Optionally move log formatting and writing to its own thread.  Held so
+    // that it stops writing to the file logger on any return from here.
+    std::unique_ptr<ThreadedLogger> threadedLogger;
+    Logger* pLogger = pFileLogger;
+    if (m_logThread) {
+        threadedLogger.reset(new ThreadedLogger(pFileLogger));
+        pLogger = threadedLogger.get();
+    }
+
     // Initialize DSF Logger
-    bool rv = dsfLogger.init(m_outFilename.c_str(), appConfig.orientationNed);
+    AsyncFileWriter::Config_s writeConfig;
+    if (!getWriteConfig(&writeConfig)) {
+        return -1;
+    }
+    dsfLogger.setWriteConfig(writeConfig);
+    binLogger.setWriteConfig(writeConfig);
+
+    bool rv = pLogger->init(m_outFilename.c_str(), appConfig.orientationNed);
     if (!rv) {
-        std::cerr << "ERROR: Unable to open dsf file:  \"" << m_outFilename << "\"" << std::endl;
+        std::cerr << "ERROR: Unable to open log file:  \"" << m_outFilename << "\"" << std::endl;
         return -1;
     }
 
-    WheelSource* wheelSource = nullptr;
+    // The wheel source and HALs are held like threadedLogger, so that any
+    // return from here releases them, the RX thread before the HAL it reads.
+    std::unique_ptr<WheelSource> wheelSource;
     if (m_wheelSourceSet) {
-        wheelSource = new FileWheelSource(m_wheelSource.c_str());
+        wheelSource.reset(new FileWheelSource(m_wheelSource.c_str()));
     }
 
     // Initialze FTDI HAL
     int status;
-    sh2_Hal_t* pHal = ftdi_hal_init(m_deviceArg.c_str());
+    std::unique_ptr<sh2_Hal_t, void (*)(sh2_Hal_t*)> hal(ftdi_hal_init(m_deviceArg.c_str()),
+                                                         ftdi_hal_free);
+    sh2_Hal_t* pHal = hal.get();
 
     if (pHal == 0) {
         std::cerr << "ERROR: Initialize FTDI HAL failed!\n";
         return -1;
     }
+    ftdi_hal_setTxGapUs(pHal, m_txGap_us);
+    // The receive thread does its own spinning; ftdi_hal_wait() mustn't
+    // read the port from it (see RxThreadHal::WaitFn_t).
+    ftdi_hal_setRxSpinUs(pHal, m_rxThread ? 0 : m_rxSpin_us);
+
+    if (m_replaySet) {
+        ftdi_hal_setReplay(pHal, m_replay.c_str(), m_replayFast);
+        std::cout << "INFO: Replaying " << m_replay << (m_replayFast ? " (fast)" : "")
+                  << std::endl;
+    }
+    if (m_captureSet) {
+        if (!ftdi_hal_setCapture(pHal, m_capture.c_str())) {
+            std::cerr << "ERROR: Unable to create capture file: \"" << m_capture << "\""
+                      << std::endl;
+            return -1;
+        }
+        std::cout << "INFO: Capturing serial traffic to " << m_capture << std::endl;
+    }
+
+    // Optionally move serial reception to its own thread.
+    std::unique_ptr<RxThreadHal> rxThreadHalHolder;
+    RxThreadHal* rxThreadHal = nullptr;
+    sh2_Hal_t* pAppHal = pHal;
+    if (m_rxThread) {
+        rxThreadHalHolder.reset(new RxThreadHal(pHal, ftdi_hal_wait));
+        rxThreadHal = rxThreadHalHolder.get();
+        rxThreadHal->setSpinUs(m_rxSpin_us);
+        if (m_rxCpuSet) {
+            rxThreadHal->setCpu(m_rxCpu);
+        }
+        pAppHal = rxThreadHal->getHal();
+    }
 
     // Initialize the LoggerApp
-    status = loggerApp.init(&appConfig, pHal, &dsfLogger, wheelSource);
+    status = loggerApp.init(&appConfig, pAppHal, pLogger, wheelSource.get());
     if (status != 0) {
         std::cerr << "ERROR: Initialize LoggerApp failed!\n";
         return -1;
     }
 
+    uint32_t txGapMin_us, txGapMean_us;
+    ftdi_hal_getTxGapStats(pHal, &txGapMin_us, &txGapMean_us);
+    std::cout << "INFO: TX gap between bytes: min " << txGapMin_us << " us, mean " << txGapMean_us
+              << " us" << std::endl;
+
 #ifdef _WIN32
     HANDLE hstdin = GetStdHandle(STD_INPUT_HANDLE);
     DWORD mode;
@@ -397,13 +703,38 @@ int Sh2Logger::do_logging() {
 
     std::cout << "\nProcessing Sensor Reports . . ." << std::endl;
 
-    uint32_t currSysTime_us = pHal->getTimeUs(pHal);
-    uint32_t lastChecked_us = currSysTime_us;
+    if (m_waitForData && (wheelSource != nullptr)) {
+        // Wake the main loop as soon as wheel data is available.
+        if (rxThreadHal != nullptr) {
+            wheelSource->setNotify([rxThreadHal]() { rxThreadHal->wake(); });
+        } else {
+            wheelSource->setNotify([pHal]() { ftdi_hal_wake(pHal); });
+        }
+    }
+
+    // HAL statistics are logged periodically, to tell data lost on the wire
+    // from data lost on the host.  Not when replaying, they describe the replay
+    // rather than the recorded link.
+    // Read them from under the acquisition thread if there is one.
+    auto getHalStats = [pHal, rxThreadHal](ftdi_hal_Stats_t* pStats) {
+        if (rxThreadHal != nullptr) {
+            rxThreadHal->withInner(
+                    [pStats](sh2_Hal_t* pInner) { ftdi_hal_getStats(pInner, pStats); });
+        } else {
+            ftdi_hal_getStats(pHal, pStats);
+        }
+    };
+    ftdi_hal_Stats_t halStats;
+
+    uint64_t currSysTime_us = timing_now_us();
+    uint64_t lastChecked_us = currSysTime_us;
+    uint64_t lastHalStats_us = currSysTime_us;
+    uint64_t lastCompressionReport_us = currSysTime_us;
 
     while (runApp_) {
 
 #ifdef _WIN32
-        currSysTime_us = pHal->getTimeUs(pHal);
+        currSysTime_us = timing_now_us();
 
         if (currSysTime_us - lastChecked_us > 200000) {
             lastChecked_us = currSysTime_us;
@@ -423,14 +754,93 @@ int Sh2Logger::do_logging() {
 #endif
 
         loggerApp.service();
+
+        uint64_t now_us = timing_now_us();
+        if (!m_replaySet && (now_us - lastHalStats_us >= HalStatsInterval_us)) {
+            lastHalStats_us = now_us;
+            getHalStats(&halStats);
+            pLogger->logHalStats(&halStats, now_us * 1e-6);
+        }
+
+        if ((m_compression != AsyncFileWriter::COMPRESS_NONE) &&
+            (now_us - lastCompressionReport_us >= CompressionReportInterval_us)) {
+            lastCompressionReport_us = now_us;
+            reportCompression(m_binary ? binLogger.getWriteStats() : dsfLogger.getWriteStats());
+        }
+
+        if (m_replaySet && ftdi_hal_replayDone(pHal)) {
+            std::cout << "\nINFO: End of replay" << std::endl;
+            break;
+        }
+
+        if (m_waitForData) {
+            // Sleep until there is something to do, or the next periodic task is due.
+            uint32_t timeout_us = loggerApp.getServiceTimeout_us();
+            now_us = timing_now_us();
+            if (!m_replaySet) {
+                timeout_us = std::min(timeout_us,
+                                      timeUntil(now_us, lastHalStats_us, HalStatsInterval_us));
+            }
+            if (m_compression != AsyncFileWriter::COMPRESS_NONE) {
+                timeout_us = std::min(
+                        timeout_us,
+                        timeUntil(now_us, lastCompressionReport_us, CompressionReportInterval_us));
+            }
+            if (rxThreadHal == nullptr) {
+                // With an RX thread, that reads (and so retries BSQs) on its own.
+                timeout_us = std::min(timeout_us, ftdi_hal_getServiceTimeoutUs(pHal));
+            }
+#ifdef _WIN32
+            // Keep checking the console for a key press.
+            if (timeout_us > 200000) {
+                timeout_us = 200000;
+            }
+#endif
+            if (rxThreadHal != nullptr) {
+                rxThreadHal->wait(timeout_us);
+            } else {
+                ftdi_hal_wait(pHal, timeout_us);
+            }
+        }
     }
 
     std::cout << "\nINFO: Shutting down" << std::endl;
 
+    if (wheelSource != nullptr) {
+        wheelSource->setNotify(nullptr);
+    }
+
+    if (!m_replaySet) {
+        getHalStats(&halStats);
+        pLogger->logHalStats(&halStats, timing_now_us() * 1e-6);
+    }
+
     loggerApp.finish();
 
-    if (wheelSource != nullptr) {
-        delete wheelSource;
+    // Closed now, so the counts are final.
+    ftdi_hal_getStats(pHal, &halStats);
+    reportHalStats(&halStats);
+    reportLatency(loggerApp.getLatency());
+
+    if (threadedLogger) {
+        reportLogThread(threadedLogger->getStats());
+    }
+    AsyncFileWriter::Stats_s writeStats =
+            m_binary ? binLogger.getWriteStats() : dsfLogger.getWriteStats();
+    reportFileWrites(writeStats);
+    if (m_compression != AsyncFileWriter::COMPRESS_NONE) {
+        reportCompression(writeStats);
+    }
+
+    std::cout << "INFO: RX timestamp jitter estimate: " << ftdi_hal_getRxJitterUs(pHal) << " us"
+              << std::endl;
+    reportDelayOvershoot();
+
+    if (rxThreadHal != nullptr) {
+        RxThreadHal::Stats_s stats = rxThreadHal->getStats();
+        std::cout << "INFO: RX queue high water mark: " << stats.highWater << " of "
+                  << stats.capacity << " frames, " << stats.overflows << " frames dropped"
+                  << std::endl;
     }
 
 #ifdef _WIN32
@@ -475,6 +885,7 @@ int Sh2Logger::do_dfu_bno() {
 
         std::cout << "DFU completed successfully.\n";
     }
+    reportDelayOvershoot();
 
     return 0;
 }
@@ -499,18 +910,65 @@ int Sh2Logger::do_dfu_fsp() {
         std::cerr << "ERROR: Could not initialize DFU HAL.\n";
         return -1;
     }
+    ftdi_hal_setTxGapUs(pHal, m_txGap_us);
 
     // FSP200 DFU
     FspDfu fspDfu;
     Firmware* firmware = new HcBinFile(m_inFilename);
     std::cout << "Starting DFU for FSP200.\n";
-    if (!fspDfu.run(pHal, firmware)) {
+    bool ok = fspDfu.run(pHal, firmware);
+    ftdi_hal_free(pHal);
+    if (!ok) {
         // DFU Failed.
         std::cerr << "ERROR: DFU for FSP200 failed.\n";
         return -1;
     }
 
     std::cout << "DFU completed successfully.\n";
+    reportDelayOvershoot();
+    return 0;
+}
+
+int Sh2Logger::do_bin2dsf() {
+    if (!m_inFilenameSet) {
+        std::cerr << "ERROR: No binary log specified, use -i or --input argument." << std::endl;
+        return -1;
+    }
+    if (!m_outFilenameSet) {
+        std::cerr << "ERROR: No output file specified, use -o or --output argument." << std::endl;
+        return -1;
+    }
+
+    BinLogReader reader;
+    if (!reader.open(m_inFilename.c_str())) {
+        std::cerr << "ERROR: Not a binary log: \"" << m_inFilename << "\"" << std::endl;
+        return -1;
+    }
+
+    DsfLogger dsfLogger;
+    AsyncFileWriter::Config_s writeConfig;
+    if (!getWriteConfig(&writeConfig)) {
+        return -1;
+    }
+    dsfLogger.setWriteConfig(writeConfig);
+    if (!dsfLogger.init(m_outFilename.c_str(), reader.isNed())) {
+        std::cerr << "ERROR: Unable to open dsf file:  \"" << m_outFilename << "\"" << std::endl;
+        return -1;
+    }
+
+    bool ok = reader.replay(&dsfLogger);
+    dsfLogger.finish();
+
+    std::cout << "INFO: Converted " << reader.getRecords() << " records" << std::endl;
+    if (m_compression != AsyncFileWriter::COMPRESS_NONE) {
+        reportCompression(dsfLogger.getWriteStats());
+    }
+    if (!ok) {
+        // Everything up to the damage has been converted.
+        std::cerr << "WARNING: Binary log damaged or cut short at byte " << reader.getOffset()
+                  << std::endl;
+        return -1;
+    }
     return 0;
 }
 
@@ -522,6 +980,111 @@ static LoggerApp::sensorList_t sensorsToEnable_;
 // =================================================================================================
 // LOCAL FUNCTIONS
 // =================================================================================================
+// Time from now_us until a task run every interval_us, last at last_us, is due.
+uint32_t timeUntil(uint64_t now_us, uint64_t last_us, uint64_t interval_us) {
+    uint64_t elapsed_us = now_us - last_us;
+    return (elapsed_us >= interval_us) ? 0 : (uint32_t)(interval_us - elapsed_us);
+}
+
+// Report how late the HAL's reset and boot delays finished.
+void reportDelayOvershoot() {
+    timing_Overshoot_t overshoot;
+    timing_getOvershoot(&overshoot);
+    if (overshoot.count == 0) {
+        return;
+    }
+
+    std::cout << "INFO: Delay overshoot: mean " << overshoot.total_ns / overshoot.count / 1000
+              << " us, max " << overshoot.max_ns / 1000 << " us over " << overshoot.count
+              << " delays" << std::endl;
+}
+
+// Summarize the HAL's I/O statistics, to tell where data was lost.
+void reportHalStats(const ftdi_hal_Stats_t* pStats) {
+    std::cout << "INFO: HAL RX: " << pStats->rxBytes << " bytes, " << pStats->rxFrames
+              << " frames, " << pStats->rxEscapes << " escapes, dropped " << pStats->rxTooLong
+              << " too long, " << pStats->rxTooBig << " too big, " << pStats->rxClientTooSmall
+              << " client buffer too small" << std::endl;
+    std::cout << "INFO: HAL TX: " << pStats->txBytes << " bytes in " << pStats->txWrites
+              << " writes, " << pStats->txFrames << " frames, " << pStats->txBsqs << " BSQs, "
+              << pStats->txStalls << " stalls (" << pStats->txStall_us / 1000 << " ms)"
+              << std::endl;
+    if (pStats->ttyOverruns >= 0) {
+        std::cout << "INFO: Serial errors: " << pStats->ttyOverruns << " overruns, "
+                  << pStats->ttyBufOverruns << " buffer overruns, " << pStats->ttyFramingErrors
+                  << " framing, " << pStats->ttyParityErrors << " parity, " << pStats->ttyBreaks
+                  << " breaks" << std::endl;
+    }
+}
+
+// Summarize the time from sensor reports arriving to their callbacks.
+void reportLatency(const LatencyHistogram& latency) {
+    if (latency.count() == 0) {
+        return;
+    }
+
+    std::cout << "INFO: Sensor report latency (serial arrival to callback): mean "
+              << latency.mean_us() << " us, p50 " << latency.percentile_us(0.5) << " us, p90 "
+              << latency.percentile_us(0.9) << " us, p99 " << latency.percentile_us(0.99)
+              << " us, p99.9 " << latency.percentile_us(0.999) << " us, max "
+              << latency.max_us() << " us over " << latency.count() << " reports" << std::endl;
+}
+
+// Summarize how the log writer thread kept up.
+void reportLogThread(const ThreadedLogger::Stats_s& stats) {
+    std::cout << "INFO: Log queue high water mark: " << stats.highWater << " of " << stats.capacity
+              << " records, " << stats.drops << " records dropped" << std::endl;
+
+    const ThreadedLogger::StageTime_s* stages[] = {&stats.enqueue, &stats.queued, &stats.format};
+    const char* names[] = {"enqueue", "queued", "format"};
+    for (int i = 0; i < 3; i++) {
+        if (stages[i]->records > 0) {
+            std::cout << "INFO: Log " << names[i] << " time: mean "
+                      << stages[i]->total_ns / stages[i]->records / 1000 << " us, max "
+                      << stages[i]->max_ns / 1000 << " us" << std::endl;
+        }
+    }
+}
+
+// Summarize how long log file writes and syncs took.
+void reportFileWrites(const AsyncFileWriter::Stats_s& stats) {
+    std::cout << "INFO: Log file: " << stats.bytes << " bytes in " << stats.writes << " writes, "
+              << stats.syncs << " syncs, buffer high water mark " << stats.highWater << " of "
+              << stats.buffers << ", " << stats.drops << " records (" << stats.droppedBytes
+              << " bytes) dropped" << std::endl;
+
+    const LatencyHistogram* times[] = {&stats.write_us, &stats.sync_us};
+    const char* names[] = {"write", "sync"};
+    for (int i = 0; i < 2; i++) {
+        if (times[i]->count() > 0) {
+            std::cout << "INFO: Log file " << names[i] << " time: mean " << times[i]->mean_us()
+                      << " us, p50 " << times[i]->percentile_us(0.5) << " us, p99 "
+                      << times[i]->percentile_us(0.99) << " us, p99.9 "
+                      << times[i]->percentile_us(0.999) << " us, max " << times[i]->max_us()
+                      << " us" << std::endl;
+        }
+    }
+
+    if (stats.error != 0) {
+        std::cerr << "WARNING: Log file write failed: " << strerror(stats.error) << std::endl;
+    }
+}
+
+// Compression so far: ratio, and speed of compressing.
+void reportCompression(const AsyncFileWriter::Stats_s& stats) {
+    if ((stats.bytes == 0) || (stats.compress_us == 0)) {
+        return;
+    }
+
+    std::cout << "INFO: Log compression: " << std::fixed << std::setprecision(1)
+              << stats.dataBytes * 1e-6 << " MB to " << stats.bytes * 1e-6 << " MB, ratio "
+              << std::setprecision(2) << (double)stats.dataBytes / stats.bytes << ", "
+              << std::setprecision(1) << (double)stats.dataBytes / stats.compress_us << " MB/s"
+              << std::endl;
+    std::cout.unsetf(std::ios_base::floatfield);
+    std::cout << std::setprecision(6);
+}
+
 #ifndef _WIN32
 void breakHandler(int signo) {
     if (signo == SIGINT) {
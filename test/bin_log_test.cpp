@@ -0,0 +1,325 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Binary log round trip.  The same calls go to a DsfLogger, one report at
+// a time, and to a BinLogger, with most reports passed in batches of
+// varying size through logSensorValues().  The binary log is converted as
+// bin2dsf does, and must give the same .dsf, apart from the posix_offset
+// line, which records when each was written.  Both orientations.  A
+// record with a damaged sensor id must stop the conversion.
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "BinLogger.h"
+#include "DsfLogger.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define REPORTS (50000)
+#define MAX_BATCH (64)
+
+// =================================================================================================
+// LOCAL VARIABLES
+// =================================================================================================
+static uint32_t rngState_;
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+static uint32_t rng() {
+    rngState_ ^= rngState_ << 13;
+    rngState_ ^= rngState_ >> 17;
+    rngState_ ^= rngState_ << 5;
+    return rngState_;
+}
+
+// A report from every sensor in turn, with random fields.  Most are
+// plausible floats, some raw bit patterns (NaNs, huge and tiny values).
+static void makeSample(Logger::SensorSample_s* pSample, uint32_t i) {
+    sh2_SensorValue_t* pValue = &pSample->value;
+    memset(pValue, 0, sizeof(*pValue));
+    pValue->sensorId = (uint8_t)(i % (SH2_MAX_SENSOR_ID + 1));
+    pValue->sequence = (uint8_t)rng();
+    pValue->status = (uint8_t)rng();
+
+    uint8_t* pBytes = (uint8_t*)&pValue->un;
+    for (size_t b = 0; b < sizeof(pValue->un); b++) {
+        pBytes[b] = (uint8_t)rng();
+    }
+    if (i % 4 != 0) {
+        float* pFloats = (float*)&pValue->un;
+        for (size_t f = 0; f < sizeof(pValue->un) / sizeof(float); f++) {
+            pFloats[f] = ((int32_t)(rng() % 200001) - 100000) * 1e-3f;
+        }
+    }
+
+    pSample->timestamp = 1.0 + i * 1e-4 + (i % 13) * 1.37e-7;
+    pSample->delay_uS = (int64_t)(rng() % 100000) - 50000;
+}
+
+// Make the same calls on either logger.  If batched, reports mostly go
+// through logSensorValues().
+static void drive(Logger* pLogger, bool batched) {
+    rngState_ = 12345;
+
+    pLogger->logMessage("# bin_log_test");
+
+    sh2_ProductIds_t ids;
+    memset(&ids, 0, sizeof(ids));
+    ids.numEntries = 3;
+    for (uint8_t i = 0; i < ids.numEntries; i++) {
+        ids.entry[i].resetCause = i + 1;
+        ids.entry[i].swPartNumber = 10004563 + i;
+        ids.entry[i].swVersionMajor = 3;
+        ids.entry[i].swVersionMinor = i;
+        ids.entry[i].swVersionPatch = 700 + i;
+        ids.entry[i].swBuildNumber = 1234567 + i;
+    }
+    pLogger->logProductIds(ids);
+
+    uint32_t frs[17];
+    for (uint32_t& word : frs) {
+        word = rng();
+    }
+    pLogger->logFrsRecord(0x7979, "scd", frs, 17);
+
+    sh2_AsyncEvent_t event;
+    memset(&event, 0, sizeof(event));
+    event.eventId = SH2_RESET;
+    pLogger->logAsyncEvent(&event, 0.25);
+    event.eventId = SH2_GET_FEATURE_RESP;
+    for (uint8_t id = 1; id <= SH2_MAX_SENSOR_ID; id += 2) {
+        event.sh2SensorConfigResp.sensorId = id;
+        event.sh2SensorConfigResp.sensorConfig.reportInterval_us = 1000 * id + 7;
+        pLogger->logAsyncEvent(&event, 0.5);
+    }
+
+    std::vector<Logger::SensorSample_s> batch;
+    uint32_t batchSize = 1;
+    for (uint32_t i = 0; i < REPORTS; i++) {
+        Logger::SensorSample_s sample;
+        makeSample(&sample, i);
+
+        // Other records between batches
+        if (i % 1000 == 500) {
+            ftdi_hal_Stats_t stats;
+            uint8_t* pBytes = (uint8_t*)&stats;
+            for (size_t b = 0; b < sizeof(stats); b++) {
+                pBytes[b] = (uint8_t)rng();
+            }
+            if (!batch.empty()) {
+                pLogger->logSensorValues(batch.data(), batch.size());
+                batch.clear();
+            }
+            pLogger->logHalStats(&stats, sample.timestamp);
+        }
+
+        // Alternate stretches of batched and single reports
+        if (batched && ((i / 300) % 3 != 0)) {
+            batch.push_back(sample);
+            if (batch.size() >= batchSize) {
+                pLogger->logSensorValues(batch.data(), batch.size());
+                batch.clear();
+                // Not from rng(), so both loggers see the same reports
+                batchSize = 1 + (i * 7919) % MAX_BATCH;
+            }
+        } else {
+            if (!batch.empty()) {
+                pLogger->logSensorValues(batch.data(), batch.size());
+                batch.clear();
+            }
+            pLogger->logSensorValue(&sample.value, sample.timestamp, sample.delay_uS);
+        }
+    }
+    if (!batch.empty()) {
+        pLogger->logSensorValues(batch.data(), batch.size());
+    }
+}
+
+// Read a .dsf, leaving out the posix_offset line
+static bool readDsf(const char* path, std::string* pText) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::ostringstream text;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 14, "! posix_offset") != 0) {
+            text << line << "\n";
+        }
+    }
+    *pText = text.str();
+    return true;
+}
+
+static bool roundTrip(bool ned) {
+    const char* direct = "bin_log_test_direct.dsf";
+    const char* bin = "bin_log_test.bin";
+    const char* converted = "bin_log_test_converted.dsf";
+    const char* orientation = ned ? "NED" : "ENU";
+
+    DsfLogger dsf;
+    if (!dsf.init(direct, ned)) {
+        std::cerr << "ERROR: Unable to write " << direct << std::endl;
+        return false;
+    }
+    drive(&dsf, false);
+    dsf.finish();
+
+    BinLogger binLogger;
+    if (!binLogger.init(bin, ned)) {
+        std::cerr << "ERROR: Unable to write " << bin << std::endl;
+        return false;
+    }
+    drive(&binLogger, true);
+    binLogger.finish();
+
+    BinLogReader reader;
+    DsfLogger conv;
+    if (!reader.open(bin) || !conv.init(converted, reader.isNed())) {
+        std::cerr << "ERROR: Unable to convert " << bin << std::endl;
+        return false;
+    }
+    bool replayed = reader.replay(&conv);
+    conv.finish();
+    if (!replayed) {
+        std::cerr << "FAIL: " << orientation << ": " << bin << " damaged at byte "
+                  << reader.getOffset() << std::endl;
+        return false;
+    }
+
+    std::string expected;
+    std::string actual;
+    if (!readDsf(direct, &expected) || !readDsf(converted, &actual)) {
+        std::cerr << "ERROR: Unable to read back the .dsf files" << std::endl;
+        return false;
+    }
+    if (actual != expected) {
+        size_t at = 0;
+        while ((at < expected.size()) && (at < actual.size()) && (expected[at] == actual[at])) {
+            at++;
+        }
+        std::cerr << "FAIL: " << orientation << ": converted .dsf differs from direct one at byte "
+                  << at << " (" << actual.size() << " bytes, expected " << expected.size() << ")"
+                  << std::endl;
+        return false;
+    }
+
+    std::cout << orientation << ": " << reader.getRecords() << " records, .dsf identical"
+              << std::endl;
+    remove(direct);
+    remove(bin);
+    remove(converted);
+    return true;
+}
+
+// A period record whose sensor id has been damaged to one beyond the
+// sensor table must stop the conversion at that record, not be passed on.
+static bool badSensorId(void) {
+    const char* bin = "bin_log_test_bad.bin";
+    const char* converted = "bin_log_test_bad.dsf";
+    const uint32_t interval_us = 0x12345678;
+
+    BinLogger binLogger;
+    if (!binLogger.init(bin, true)) {
+        std::cerr << "ERROR: Unable to write " << bin << std::endl;
+        return false;
+    }
+    binLogger.logMessage("# before");
+    sh2_AsyncEvent_t event;
+    memset(&event, 0, sizeof(event));
+    event.eventId = SH2_GET_FEATURE_RESP;
+    event.sh2SensorConfigResp.sensorId = SH2_ACCELEROMETER;
+    event.sh2SensorConfigResp.sensorConfig.reportInterval_us = interval_us;
+    binLogger.logAsyncEvent(&event, 0.5);
+    binLogger.logMessage("# after");
+    binLogger.finish();
+
+    // The record ends with the sensor id and the little endian interval
+    std::vector<char> data;
+    {
+        std::ifstream in(bin, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    const char pattern[] = {SH2_ACCELEROMETER, 0x78, 0x56, 0x34, 0x12};
+    std::vector<char>::iterator at =
+            std::search(data.begin(), data.end(), pattern, pattern + sizeof(pattern));
+    if (at == data.end()) {
+        std::cerr << "FAIL: Bad sensor id: period record not found in " << bin << std::endl;
+        return false;
+    }
+    *at = (char)0xFF;
+    {
+        std::ofstream out(bin, std::ios::binary);
+        out.write(data.data(), data.size());
+    }
+    // Type, length and timestamp come before the sensor id
+    uint64_t recordStart = (uint64_t)(at - data.begin()) - (1 + 4 + 8);
+
+    BinLogReader reader;
+    DsfLogger conv;
+    if (!reader.open(bin) || !conv.init(converted, reader.isNed())) {
+        std::cerr << "ERROR: Unable to convert " << bin << std::endl;
+        return false;
+    }
+    bool replayed = reader.replay(&conv);
+    conv.finish();
+
+    std::string text;
+    bool ok = true;
+    if (replayed || (reader.getOffset() != recordStart)) {
+        std::cerr << "FAIL: Bad sensor id: replay " << (replayed ? "succeeded" : "failed")
+                  << " at byte " << reader.getOffset() << ", expected to fail at "
+                  << recordStart << std::endl;
+        ok = false;
+    } else if (!readDsf(converted, &text) || (text.find("# before") == std::string::npos) ||
+               (text.find("# after") != std::string::npos)) {
+        std::cerr << "FAIL: Bad sensor id: .dsf doesn't end before the damaged record"
+                  << std::endl;
+        ok = false;
+    }
+
+    if (ok) {
+        std::cout << "Bad sensor id: rejected at byte " << recordStart << std::endl;
+        remove(bin);
+        remove(converted);
+    }
+    return ok;
+}
+
+// =================================================================================================
+// MAIN
+// =================================================================================================
+int main() {
+    bool ok = roundTrip(true);
+    ok = roundTrip(false) && ok;
+    ok = badSensorId() && ok;
+    return ok ? 0 : 1;
+}
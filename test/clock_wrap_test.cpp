@@ -0,0 +1,475 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Multi-day run test.  An injected clock (timing_setClock) starts three
+// days into a run, just before timing_now_us() passes a multiple of
+// 2^32 us, where the 32-bit times of the sh2 HAL interface wrap.  Across
+// the wrap:
+//  - timing_now_us() keeps counting and getTimeUs() is its low 32 bits.
+//  - ftdi_hal frame timestamps, for a frame read over a pty that started
+//    before the wrap and ended after it, agree with getTimeUs().
+//  - LoggerApp's sample times, latency, progress reports and service
+//    timeout stay consistent.
+//  - WheelSource maps host time to hub time, whose own wrap falls
+//    elsewhere.
+// LoggerApp runs against a fake sh2 driver, defined here, which delivers
+// the sensor events the test queues.  The fake also checks that a
+// LoggerApp whose init() fails part way closes its session, so that
+// another can be started.
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "Logger.h"
+#include "LoggerApp.h"
+#include "WheelSource.h"
+
+extern "C" {
+#include "ftdi_hal.h"
+#include "rfc1662.h"
+#include "sh2.h"
+#include "sh2_SensorValue.h"
+#include "sh2_err.h"
+#include "timing.h"
+}
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define DAY_US (86400ull * 1000000ull)
+
+// Start this far before the wrap, run for twice as long
+#define LEAD_US (3000000ull)
+#define STEP_US (10000ull)
+#define REPORT_INTERVAL_US (1000000ull)
+
+// Hub time is host time plus this, so it wraps 1.5 s before host time
+#define HUB_OFFSET_US (1500000u)
+
+// Sensor report timestamp and delay, for a latency of 500 us
+#define REPORT_AGE_US (200)
+#define REPORT_DELAY_US (300)
+
+#define FRAME_PAYLOAD (256)
+
+// =================================================================================================
+// LOCAL VARIABLES
+// =================================================================================================
+static uint64_t clockNs_;
+static uint64_t clockStep_ns_;
+
+// Fake sh2 driver state
+static sh2_SensorCallback_t* sensorCallback_;
+static void* sensorCookie_;
+static std::vector<sh2_SensorEvent_t> pending_;
+static int sessions_;     // Opened and not closed
+static bool failProdIds_; // Make sh2_getProdIds() fail
+
+static uint32_t checks_;
+static uint32_t failures_;
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+// Injected clock.  It advances a little on every read so that delays,
+// which spin on an injected clock, finish.
+static uint64_t testClock(void) {
+    uint64_t t = clockNs_;
+    clockNs_ += clockStep_ns_;
+    return t;
+}
+
+static void setClock_us(uint64_t t_us) {
+    clockNs_ = t_us * 1000;
+}
+
+static void check(bool ok, const char* what, uint64_t value) {
+    checks_++;
+    if (!ok) {
+        failures_++;
+        std::cerr << "FAIL: " << what << " (" << value << ")" << std::endl;
+    }
+}
+
+// The first multiple of 2^32 us after three days
+static uint64_t wrapAfterThreeDays(void) {
+    return ((3 * DAY_US >> 32) + 1) << 32;
+}
+
+// -------------------------------------------------------------------------------------------------
+// Fake sh2 driver
+// -------------------------------------------------------------------------------------------------
+extern "C" {
+int sh2_open(sh2_Hal_t* pHal, sh2_EventCallback_t* eventCallback, void* eventCookie) {
+    sessions_++;
+    return SH2_OK;
+}
+
+void sh2_close(void) {
+    sessions_--;
+}
+
+void sh2_service(void) {
+    for (size_t i = 0; i < pending_.size(); i++) {
+        sensorCallback_(sensorCookie_, &pending_[i]);
+    }
+    pending_.clear();
+}
+
+int sh2_setSensorCallback(sh2_SensorCallback_t* callback, void* cookie) {
+    sensorCallback_ = callback;
+    sensorCookie_ = cookie;
+    return SH2_OK;
+}
+
+int sh2_getProdIds(sh2_ProductIds_t* prodIds) {
+    memset(prodIds, 0, sizeof(*prodIds));
+    return failProdIds_ ? SH2_ERR_IO : SH2_OK;
+}
+
+int sh2_setSensorConfig(sh2_SensorId_t sensorId, const sh2_SensorConfig_t* pConfig) {
+    return SH2_OK;
+}
+
+int sh2_getFrs(uint16_t recordId, uint32_t* pData, uint16_t* words) {
+    *words = 0;
+    return SH2_OK;
+}
+
+int sh2_setFrs(uint16_t recordId, uint32_t* pData, uint16_t words) {
+    return SH2_OK;
+}
+
+int sh2_setDcdAutoSave(bool enabled) {
+    return SH2_OK;
+}
+
+int sh2_setCalConfig(uint8_t sensors) {
+    return SH2_OK;
+}
+
+int sh2_saveDcdNow(void) {
+    return SH2_OK;
+}
+
+int sh2_clearDcdAndReset(void) {
+    return SH2_OK;
+}
+
+int sh2_reinitialize(void) {
+    return SH2_OK;
+}
+
+// Only what this test needs: ids, times and a raw accelerometer's hub
+// timestamp, which the fake events carry in report[4..7].
+int sh2_decodeSensorEvent(sh2_SensorValue_t* value, const sh2_SensorEvent_t* event) {
+    memset(value, 0, sizeof(*value));
+    value->sensorId = event->reportId;
+    value->sequence = event->report[1];
+    value->timestamp = event->timestamp_uS;
+    value->delay = (uint32_t)event->delay_uS;
+    if (event->reportId == SH2_RAW_ACCELEROMETER) {
+        memcpy(&value->un.rawAccelerometer.timestamp, &event->report[4], 4);
+    }
+    return SH2_OK;
+}
+}
+
+// -------------------------------------------------------------------------------------------------
+// Test Logger and WheelSource
+// -------------------------------------------------------------------------------------------------
+// Keeps the timestamps of accelerometer reports
+class RecordingLogger : public Logger {
+public:
+    virtual bool init(char const* filePath, bool ned) {
+        return true;
+    }
+    virtual void finish() {
+    }
+    virtual void logMessage(char const* msg) {
+    }
+    virtual void logAsyncEvent(sh2_AsyncEvent_t* pEvent, double timestamp) {
+    }
+    virtual void logProductIds(sh2_ProductIds_t ids) {
+    }
+    virtual void logFrsRecord(uint16_t recordId, char const* name, uint32_t* buffer, uint16_t words) {
+    }
+    virtual void logSensorValue(sh2_SensorValue_t* pValue, double timestamp, int64_t delay_uS) {
+        if (pValue->sensorId == SH2_ACCELEROMETER) {
+            timestamps.push_back(timestamp);
+        }
+    }
+    virtual void logHalStats(const ftdi_hal_Stats_t* pStats, double timestamp) {
+    }
+
+    std::vector<double> timestamps;
+};
+
+// Checks the hub time estimate at each service()
+class TestWheelSource : public WheelSource {
+public:
+    TestWheelSource() : estimates(0) {
+    }
+
+    virtual void service(void) {
+        if (ready()) {
+            uint64_t host_us = timing_now_us();
+            uint32_t hub_us = estimateHubTime(&host_us);
+            uint32_t error_us = hub_us - (uint32_t)(host_us + HUB_OFFSET_US);
+            check((error_us <= 1) || (error_us == UINT32_MAX), "WheelSource hub time", error_us);
+            estimates++;
+        }
+    }
+
+    uint32_t estimates;
+};
+
+// -------------------------------------------------------------------------------------------------
+// Tests
+// -------------------------------------------------------------------------------------------------
+// A frame that starts arriving before the wrap and is read after it
+static void testHalFrame(uint64_t wrap_us) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((master < 0) || (grantpt(master) != 0) || (unlockpt(master) != 0)) {
+        std::cerr << "ERROR: Unable to open a pty" << std::endl;
+        failures_++;
+        return;
+    }
+    struct termios tio;
+    tcgetattr(master, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(master, TCSANOW, &tio);
+
+    // Open and reset delays spin on the clock, 1 us per read
+    clockStep_ns_ = 1000;
+    setClock_us(wrap_us - LEAD_US);
+    sh2_Hal_t* pHal = ftdi_hal_init(ptsname(master));
+    if ((pHal == NULL) || (pHal->open(pHal) != SH2_OK)) {
+        std::cerr << "ERROR: Unable to open the HAL on " << ptsname(master) << std::endl;
+        failures_++;
+        close(master);
+        return;
+    }
+
+    uint8_t payload[FRAME_PAYLOAD];
+    for (uint32_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = (uint8_t)(i * 7);
+    }
+    uint8_t frame[2 * FRAME_PAYLOAD + 8];
+    uint32_t frameLen = sizeof(frame);
+    rfc1662_encode(frame, &frameLen, 0x01, payload, sizeof(payload));
+    if (write(master, frame, frameLen) != (ssize_t)frameLen) {
+        std::cerr << "ERROR: Unable to write to the pty" << std::endl;
+        failures_++;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    // At 3 Mbaud the frame took about 870 us to arrive, most of it before the wrap
+    setClock_us(wrap_us + 20);
+    uint8_t buffer[FRAME_PAYLOAD + 8];
+    uint32_t t_us = 0;
+    int got = 0;
+    for (int tries = 0; (tries < 100) && (got == 0); tries++) {
+        got = pHal->read(pHal, buffer, sizeof(buffer), &t_us);
+    }
+    // Each clock read takes 1 us
+    uint64_t now_us = timing_now_us();
+    uint32_t now32 = pHal->getTimeUs(pHal);
+    uint32_t frameTime_us = (uint32_t)((frameLen - 1) * 10ull * 1000000ull / 3000000ull);
+
+    // The length includes the protocol id
+    check(got == FRAME_PAYLOAD + 1, "HAL frame length", (uint64_t)got);
+    check(now_us > wrap_us, "timing_now_us() past the wrap", now_us - wrap_us);
+    check(now32 - (uint32_t)now_us <= 1, "getTimeUs() is timing_now_us() low bits", now32);
+    check(t_us > UINT32_MAX - 2 * frameTime_us, "HAL frame started before the wrap", t_us);
+    check((now32 - t_us >= frameTime_us) && (now32 - t_us < frameTime_us + 1000),
+          "HAL frame age",
+          now32 - t_us);
+
+    ftdi_hal_free(pHal);
+    close(master);
+}
+
+// Queue an accelerometer and a raw accelerometer report, as sh2 would give
+// them at host time now_us: sh2 extends the HAL's 32-bit time from when it
+// opened, so its 64-bit timestamps run from just under 2^32 here.
+static void queueReports(uint64_t now_us, uint64_t wrap_us, uint8_t seq) {
+    sh2_SensorEvent_t event;
+    memset(&event, 0, sizeof(event));
+    event.timestamp_uS = now_us - REPORT_AGE_US - (wrap_us - (1ull << 32));
+    event.delay_uS = REPORT_DELAY_US;
+    event.report[1] = seq;
+
+    event.reportId = SH2_ACCELEROMETER;
+    pending_.push_back(event);
+
+    event.reportId = SH2_RAW_ACCELEROMETER;
+    uint32_t hub_us = (uint32_t)(now_us + HUB_OFFSET_US);
+    memcpy(&event.report[4], &hub_us, 4);
+    pending_.push_back(event);
+}
+
+static void testLoggerApp(uint64_t wrap_us) {
+    RecordingLogger logger;
+    TestWheelSource wheel;
+    LoggerApp app;
+    LoggerApp::sensorList_t sensors(1);
+    sensors.front().sensorId = SH2_ACCELEROMETER;
+    sensors.front().reportInterval_us = STEP_US;
+    LoggerApp::appConfig_s config;
+    config.pSensorsToEnable = &sensors;
+
+    // LoggerApp reads the clock a few times per step, never spinning
+    clockStep_ns_ = 1;
+    uint64_t start_us = wrap_us - LEAD_US;
+    setClock_us(start_us);
+
+    std::ostringstream out;
+    std::streambuf* pCout = std::cout.rdbuf(out.rdbuf());
+    int status = app.init(&config, NULL, &logger, &wheel);
+
+    uint64_t lastReport_us = 0;
+    uint32_t reports = 0;
+    uint32_t steps = (uint32_t)(2 * LEAD_US / STEP_US);
+    for (uint32_t step = 0; step <= steps; step++) {
+        uint64_t now_us = start_us + step * STEP_US;
+        setClock_us(now_us);
+        queueReports(now_us, wrap_us, (uint8_t)step);
+
+        size_t outLen = out.str().size();
+        app.service();
+        if ((step == 0) || (out.str().size() != outLen)) {
+            lastReport_us = now_us;
+        }
+
+        // Reports after the first are dropped until LoggerApp has waited
+        // out its start-up flush, in real time.
+        if (step == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(150));
+        }
+
+        uint32_t timeout_us = app.getServiceTimeout_us();
+        uint64_t expected_us = REPORT_INTERVAL_US - (now_us - lastReport_us);
+        check((timeout_us + 1 >= expected_us) && (timeout_us <= expected_us),
+              "LoggerApp service timeout",
+              timeout_us);
+    }
+    app.finish();
+    std::cout.rdbuf(pCout);
+    check(status == 0, "LoggerApp init", (uint64_t)status);
+
+    // Progress lines: "... Rate: <overall> (<last second>) Samples per second"
+    std::istringstream lines(out.str());
+    std::string line;
+    while (std::getline(lines, line)) {
+        size_t at = line.find("Rate: ");
+        if (at == std::string::npos) {
+            continue;
+        }
+        double overall = 0;
+        double window = 0;
+        sscanf(line.c_str() + at, "Rate: %lf (%lf)", &overall, &window);
+        reports++;
+        if (reports > 1) {
+            // Two reports per 10 ms step
+            check((window > 199.0) && (window < 201.0), "LoggerApp progress rate", (uint64_t)window);
+            check((overall > 195.0) && (overall < 205.0), "LoggerApp mean rate", (uint64_t)overall);
+        }
+    }
+    check(reports == 2 * LEAD_US / REPORT_INTERVAL_US, "LoggerApp progress reports", reports);
+
+    // Sample times step by 10 ms through the wrap
+    const std::vector<double>& t = logger.timestamps;
+    check(t.size() == steps, "Accelerometer reports logged", t.size());
+    for (size_t i = 1; i < t.size(); i++) {
+        double step_us = (t[i] - t[i - 1]) * 1e6;
+        check((step_us > STEP_US - 0.01) && (step_us < STEP_US + 0.01),
+              "Sample timestamp step",
+              (uint64_t)step_us);
+    }
+    if (!t.empty()) {
+        check(t.back() * 1e6 > 4294967296.0, "Sample timestamps past 2^32 us", (uint64_t)t.back());
+    }
+
+    check(app.getLatency().max_us() <= REPORT_AGE_US + REPORT_DELAY_US + 1,
+          "LoggerApp latency",
+          app.getLatency().max_us());
+    check(wheel.estimates + 2 >= steps, "WheelSource estimates", wheel.estimates);
+}
+
+// A failed init() must close its session, and not block a later one.
+static void testInitError(void) {
+    RecordingLogger logger;
+    LoggerApp::sensorList_t sensors(1);
+    sensors.front().sensorId = SH2_ACCELEROMETER;
+    sensors.front().reportInterval_us = STEP_US;
+    LoggerApp::appConfig_s config;
+    config.pSensorsToEnable = &sensors;
+
+    std::ostringstream out;
+    std::streambuf* pCout = std::cout.rdbuf(out.rdbuf());
+    int failed;
+    {
+        LoggerApp app;
+        failProdIds_ = true;
+        failed = app.init(&config, NULL, &logger, NULL);
+        failProdIds_ = false;
+    }
+    int sessionsAfterFailure = sessions_;
+    LoggerApp app;
+    int status = app.init(&config, NULL, &logger, NULL);
+    if (status == 0) {
+        app.finish();
+    }
+    std::cout.rdbuf(pCout);
+
+    check(failed != 0, "LoggerApp init with failing product IDs", (uint64_t)failed);
+    check(sessionsAfterFailure == 0, "Sessions open after failed init", sessionsAfterFailure);
+    check(status == 0, "LoggerApp init after a failed one", (uint64_t)status);
+    check(sessions_ == 0, "Sessions open after finish", sessions_);
+}
+
+// =================================================================================================
+// MAIN
+// =================================================================================================
+int main() {
+    uint64_t wrap_us = wrapAfterThreeDays();
+    timing_setClock(testClock);
+
+    testHalFrame(wrap_us);
+    testLoggerApp(wrap_us);
+    testInitError();
+
+    timing_setClock(NULL);
+    std::cout << "clock_wrap_test: " << checks_ << " checks, " << failures_ << " failures"
+              << std::endl;
+    return (failures_ == 0) ? 0 : 1;
+}
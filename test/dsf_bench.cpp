@@ -0,0 +1,187 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// DSF sensor report rate, in thousands of records per second, for each
+// sensor type that is logged and for a mix of all of them.  Reports go
+// through logSensorValue() one at a time and through logSensorValues() in
+// batches, in NED and ENU.  Each run writes a whole log, from init() to
+// finish(), so file output is counted too; give /dev/null as the output
+// file to measure formatting alone.  The best of several runs is shown.
+//
+// Usage: dsf_bench [reports per run] [output file] [runs]
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "DsfLogger.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define BATCH (64)
+
+// =================================================================================================
+// LOCAL VARIABLES
+// =================================================================================================
+static uint32_t rngState_ = 12345;
+static uint32_t runs_ = 3;
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+static uint32_t rng() {
+    rngState_ ^= rngState_ << 13;
+    rngState_ ^= rngState_ >> 17;
+    rngState_ ^= rngState_ << 5;
+    return rngState_;
+}
+
+// count reports, from sensors taken from ids in turn, with plausible values
+static void makeSamples(std::vector<Logger::SensorSample_s>* pSamples,
+                        const std::vector<uint8_t>& ids,
+                        uint32_t count) {
+    pSamples->resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        Logger::SensorSample_s* pSample = &(*pSamples)[i];
+        sh2_SensorValue_t* pValue = &pSample->value;
+        memset(pValue, 0, sizeof(*pValue));
+        pValue->sensorId = ids[i % ids.size()];
+        pValue->sequence = (uint8_t)(i / ids.size());
+        pValue->status = (uint8_t)(rng() % 4);
+
+        float* pFloats = (float*)&pValue->un;
+        for (size_t f = 0; f < sizeof(pValue->un) / sizeof(float); f++) {
+            pFloats[f] = ((int32_t)(rng() % 2000001) - 1000000) * 1e-5f;
+        }
+
+        pSample->timestamp = 1.0 + i * 1e-4;
+        pSample->delay_uS = -1500 - (int64_t)(i % 300);
+    }
+}
+
+// Log samples, returning thousands of records per second
+static double runOnce(const char* path,
+                  bool ned,
+                  bool batched,
+                  const std::vector<Logger::SensorSample_s>& samples) {
+    // The log calls take non-const reports
+    std::vector<Logger::SensorSample_s> work(samples);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    DsfLogger logger;
+    if (!logger.init(path, ned)) {
+        fprintf(stderr, "ERROR: Unable to write %s\n", path);
+        exit(1);
+    }
+    if (batched) {
+        for (size_t i = 0; i < work.size(); i += BATCH) {
+            size_t n = (work.size() - i < BATCH) ? work.size() - i : BATCH;
+            logger.logSensorValues(&work[i], n);
+        }
+    } else {
+        for (size_t i = 0; i < work.size(); i++) {
+            logger.logSensorValue(&work[i].value, work[i].timestamp, work[i].delay_uS);
+        }
+    }
+    logger.finish();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+                             .count();
+
+    return (elapsed > 0) ? work.size() / elapsed / 1000.0 : 0.0;
+}
+
+static double run(const char* path,
+                  bool ned,
+                  bool batched,
+                  const std::vector<Logger::SensorSample_s>& samples) {
+    double best = 0.0;
+    for (uint32_t r = 0; r < runs_; r++) {
+        double rate = runOnce(path, ned, batched, samples);
+        best = (rate > best) ? rate : best;
+    }
+    return best;
+}
+
+static void report(const char* path,
+                   const char* name,
+                   const std::vector<uint8_t>& ids,
+                   uint32_t count) {
+    std::vector<Logger::SensorSample_s> samples;
+    makeSamples(&samples, ids, count);
+
+    printf("%-32s %9.0f %9.0f  %9.0f %9.0f\n",
+           name,
+           run(path, true, false, samples),
+           run(path, true, true, samples),
+           run(path, false, false, samples),
+           run(path, false, true, samples));
+}
+
+// =================================================================================================
+// MAIN
+// =================================================================================================
+int main(int argc, char* argv[]) {
+    uint32_t count = 100000;
+    std::string path = "dsf_bench.dsf";
+
+    if (argc > 1) {
+        count = (uint32_t)strtoul(argv[1], NULL, 0);
+    }
+    if (argc > 2) {
+        path = argv[2];
+    }
+    if (argc > 3) {
+        runs_ = (uint32_t)strtoul(argv[3], NULL, 0);
+    }
+    if (count < 1) {
+        count = 1;
+    }
+    if (runs_ < 1) {
+        runs_ = 1;
+    }
+
+    printf("dsf_bench: %u reports per run, batches of %d, best of %u runs, to %s\n",
+           count,
+           BATCH,
+           runs_,
+           path.c_str());
+    printf("%-32s %9s %9s  %9s %9s\n", "k records/s", "NED", "batched", "ENU", "batched");
+
+    std::vector<uint8_t> all;
+    for (int id = 0; id <= SH2_MAX_SENSOR_ID; id++) {
+        if (strcmp(DsfLogger::getSensorColumns((uint8_t)id), "") != 0) {
+            all.push_back((uint8_t)id);
+            report(path.c_str(),
+                   DsfLogger::getSensorName((uint8_t)id),
+                   std::vector<uint8_t>(1, (uint8_t)id),
+                   count);
+        }
+    }
+    report(path.c_str(), "All sensors, interleaved", all, count);
+
+    if (path != "/dev/null") {
+        remove(path.c_str());
+    }
+    return 0;
+}
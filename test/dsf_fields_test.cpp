@@ -0,0 +1,667 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// DSF sensor field golden test.  DsfLogger writes each sensor's fields
+// with a writer specialized for the sensor and orientation.  This logs
+// reports from every sensor ID, in NED and ENU, and checks the fields of
+// each line against the single switch statement the writers replaced,
+// kept below as the reference.  Sensor IDs that aren't logged must give
+// no lines, nor may IDs past the sensor table, logged singly or in
+// batches.  A logger re-initialised for another file must write its
+// posix_offset line again.
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "DsfLogger.h"
+
+#include <fstream>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define REPORTS_PER_SENSOR (2000)
+
+// =================================================================================================
+// LOCAL VARIABLES
+// =================================================================================================
+static uint32_t rngState_;
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+static uint32_t rng() {
+    rngState_ ^= rngState_ << 13;
+    rngState_ ^= rngState_ >> 17;
+    rngState_ ^= rngState_ << 5;
+    return rngState_;
+}
+
+static double radiansToDeg(float value) {
+    double const PI = 3.1415926535897932384626433832795;
+    return (value * 180.0) / PI;
+}
+
+// Report i of a sensor.  Most have plausible floats, some all zero
+// fields (so negated axes give -0) and some raw bit patterns (NaNs,
+// infinities, huge and tiny values, and every integer field value).
+static void makeValue(sh2_SensorValue_t* pValue, uint8_t sensorId, uint32_t i) {
+    memset(pValue, 0, sizeof(*pValue));
+    pValue->sensorId = sensorId;
+    pValue->sequence = (uint8_t)i;
+    pValue->status = (uint8_t)rng();
+
+    if (i % 8 == 1) {
+        return;
+    }
+    uint8_t* pBytes = (uint8_t*)&pValue->un;
+    for (size_t b = 0; b < sizeof(pValue->un); b++) {
+        pBytes[b] = (uint8_t)rng();
+    }
+    if (i % 4 != 0) {
+        float* pFloats = (float*)&pValue->un;
+        for (size_t f = 0; f < sizeof(pValue->un) / sizeof(float); f++) {
+            pFloats[f] = ((int32_t)(rng() % 2000001) - 1000000) * 1e-4f;
+        }
+    }
+}
+
+// The fields of a sensor report, as DsfLogger::WriteSensorValue() wrote
+// them before the per-sensor field writers.
+static void writeReference(DsfFormatter& out, const sh2_SensorValue_t* pValue, bool ned) {
+    uint32_t sensorId = pValue->sensorId;
+
+    switch (sensorId) {
+
+        case SH2_RAW_ACCELEROMETER: {
+            out << pValue->un.rawAccelerometer.x << "," << pValue->un.rawAccelerometer.y << ","
+                << pValue->un.rawAccelerometer.z << ","
+                << pValue->un.rawAccelerometer.timestamp << "\n";
+            break;
+        }
+        case SH2_ACCELEROMETER: {
+            if (ned) {
+                out << pValue->un.accelerometer.y << "," // ENU -> NED
+                    << pValue->un.accelerometer.x << "," << -pValue->un.accelerometer.z
+                    << "\n";
+            } else {
+                out << pValue->un.accelerometer.x << "," << pValue->un.accelerometer.y << ","
+                    << pValue->un.accelerometer.z << "\n";
+            }
+            break;
+        }
+        case SH2_LINEAR_ACCELERATION: {
+            if (ned) {
+                out << pValue->un.linearAcceleration.y << "," // ENU -> NED
+                    << pValue->un.linearAcceleration.x << ","
+                    << -pValue->un.linearAcceleration.z << "\n";
+            } else {
+                out << pValue->un.linearAcceleration.x << ","
+                    << pValue->un.linearAcceleration.y << ","
+                    << pValue->un.linearAcceleration.z << "\n";
+            }
+            break;
+        }
+        case SH2_GRAVITY: {
+            if (ned) {
+                out << pValue->un.gravity.y << "," // ENU -> NED
+                    << pValue->un.gravity.x << "," << -pValue->un.gravity.z << "\n";
+            } else {
+                out << pValue->un.gravity.x << "," << pValue->un.gravity.y << ","
+                    << pValue->un.gravity.z << "\n";
+            }
+            break;
+        }
+        case SH2_RAW_GYROSCOPE: {
+            out << pValue->un.rawGyroscope.x << "," << pValue->un.rawGyroscope.y << ","
+                << pValue->un.rawGyroscope.z << "," << pValue->un.rawGyroscope.temperature
+                << "," << pValue->un.rawGyroscope.timestamp << "\n";
+            break;
+        }
+        case SH2_GYROSCOPE_CALIBRATED: {
+            if (ned) {
+                out << pValue->un.gyroscope.y << "," // ENU -> NED
+                    << pValue->un.gyroscope.x << "," << -pValue->un.gyroscope.z << "\n";
+            } else {
+                out << pValue->un.gyroscope.x << "," << pValue->un.gyroscope.y << ","
+                    << pValue->un.gyroscope.z << "\n";
+            }
+            break;
+        }
+        case SH2_GYROSCOPE_UNCALIBRATED: {
+            if (ned) {
+                out << pValue->un.gyroscopeUncal.y << "," // ENU -> NED
+                    << pValue->un.gyroscopeUncal.x << "," << -pValue->un.gyroscopeUncal.z
+                    << "," << pValue->un.gyroscopeUncal.biasY << "," // ENU -> NED
+                    << pValue->un.gyroscopeUncal.biasX << ","
+                    << -pValue->un.gyroscopeUncal.biasZ << "\n";
+            } else {
+                out << pValue->un.gyroscopeUncal.x << "," << pValue->un.gyroscopeUncal.y << ","
+                    << pValue->un.gyroscopeUncal.z << "," << pValue->un.gyroscopeUncal.biasX
+                    << "," << pValue->un.gyroscopeUncal.biasY << ","
+                    << pValue->un.gyroscopeUncal.biasZ << "\n";
+            }
+            break;
+        }
+        case SH2_RAW_MAGNETOMETER: {
+            out << pValue->un.rawMagnetometer.x << "," << pValue->un.rawMagnetometer.y << ","
+                << pValue->un.rawMagnetometer.z << "," << pValue->un.rawMagnetometer.timestamp
+                << "\n";
+            break;
+        }
+        case SH2_MAGNETIC_FIELD_CALIBRATED: {
+            if (ned) {
+                out << pValue->un.magneticField.y << "," // ENU -> NED
+                    << pValue->un.magneticField.x << "," << -pValue->un.magneticField.z
+                    << "\n";
+            } else {
+                out << pValue->un.magneticField.x << "," << pValue->un.magneticField.y << ","
+                    << pValue->un.magneticField.z << "\n";
+            }
+            break;
+        }
+        case SH2_MAGNETIC_FIELD_UNCALIBRATED: {
+            if (ned) {
+                out << pValue->un.magneticFieldUncal.y << "," // ENU -> NED
+                    << pValue->un.magneticFieldUncal.x << ","
+                    << -pValue->un.magneticFieldUncal.z << ","
+                    << pValue->un.magneticFieldUncal.biasY << "," // ENU -> NED
+                    << pValue->un.magneticFieldUncal.biasX << ","
+                    << -pValue->un.magneticFieldUncal.biasZ << "\n";
+            } else {
+                out << pValue->un.magneticFieldUncal.x << ","
+                    << pValue->un.magneticFieldUncal.y << ","
+                    << pValue->un.magneticFieldUncal.z << ","
+                    << pValue->un.magneticFieldUncal.biasX << ","
+                    << pValue->un.magneticFieldUncal.biasY << ","
+                    << pValue->un.magneticFieldUncal.biasZ << "\n";
+            }
+            break;
+        }
+        case SH2_ROTATION_VECTOR: {
+            if (ned) {
+                out << pValue->un.rotationVector.real << "," << pValue->un.rotationVector.j
+                    << "," // Convert ENU -> NED
+                    << pValue->un.rotationVector.i << "," << -pValue->un.rotationVector.k
+                    << ",";
+            } else {
+                out << pValue->un.rotationVector.real << "," << pValue->un.rotationVector.i
+                    << "," << pValue->un.rotationVector.j << "," << pValue->un.rotationVector.k
+                    << ",";
+            }
+            out << radiansToDeg(pValue->un.rotationVector.accuracy) << "\n";
+            break;
+        }
+        case SH2_GAME_ROTATION_VECTOR: {
+            if (ned) {
+                out << pValue->un.gameRotationVector.real << ","
+                    << pValue->un.gameRotationVector.j << "," // Convert ENU -> NED
+                    << pValue->un.gameRotationVector.i << ","
+                    << -pValue->un.gameRotationVector.k << "\n";
+            } else {
+                out << pValue->un.gameRotationVector.real << ","
+                    << pValue->un.gameRotationVector.i << ","
+                    << pValue->un.gameRotationVector.j << ","
+                    << pValue->un.gameRotationVector.k << "\n";
+            }
+            break;
+        }
+        case SH2_GEOMAGNETIC_ROTATION_VECTOR: {
+            if (ned) {
+                out << pValue->un.geoMagRotationVector.real << ","
+                    << pValue->un.geoMagRotationVector.j << "," // Convert ENU -> NED
+                    << pValue->un.geoMagRotationVector.i << ","
+                    << -pValue->un.geoMagRotationVector.k << ",";
+            } else {
+                out << pValue->un.geoMagRotationVector.real << ","
+                    << pValue->un.geoMagRotationVector.i << ","
+                    << pValue->un.geoMagRotationVector.j << ","
+                    << pValue->un.geoMagRotationVector.k << ",";
+            }
+            out << radiansToDeg(pValue->un.geoMagRotationVector.accuracy) << "\n";
+            break;
+        }
+        case SH2_PRESSURE: {
+            out << pValue->un.pressure.value << "\n";
+            break;
+        }
+        case SH2_AMBIENT_LIGHT: {
+            out << pValue->un.ambientLight.value << "\n";
+            break;
+        }
+        case SH2_HUMIDITY: {
+            out << pValue->un.humidity.value << "\n";
+            break;
+        }
+        case SH2_PROXIMITY: {
+            out << pValue->un.proximity.value << "\n";
+            break;
+        }
+        case SH2_TEMPERATURE: {
+            out << pValue->un.temperature.value << "\n";
+            break;
+        }
+        case SH2_TAP_DETECTOR: {
+            out << static_cast<uint32_t>(pValue->un.tapDetector.flags) << "\n";
+            break;
+        }
+        case SH2_STEP_DETECTOR: {
+            out << pValue->un.stepDetector.latency << "\n";
+            break;
+        }
+        case SH2_STEP_COUNTER: {
+            out << pValue->un.stepCounter.steps << ",";
+            out << pValue->un.stepCounter.latency << "\n";
+            break;
+        }
+        case SH2_SIGNIFICANT_MOTION: {
+            out << pValue->un.sigMotion.motion << "\n";
+            break;
+        }
+        case SH2_STABILITY_CLASSIFIER: {
+            out << static_cast<uint32_t>(pValue->un.stabilityClassifier.classification)
+                << "\n";
+            break;
+        }
+        case SH2_SHAKE_DETECTOR: {
+            out << pValue->un.shakeDetector.shake << "\n";
+            break;
+        }
+        case SH2_FLIP_DETECTOR: {
+            out << pValue->un.flipDetector.flip << "\n";
+            break;
+        }
+        case SH2_PICKUP_DETECTOR: {
+            out << pValue->un.pickupDetector.pickup << "\n";
+            break;
+        }
+        case SH2_STABILITY_DETECTOR: {
+            out << pValue->un.stabilityDetector.stability << "\n";
+            break;
+        }
+        case SH2_PERSONAL_ACTIVITY_CLASSIFIER: {
+            out << static_cast<uint32_t>(pValue->un.personalActivityClassifier.mostLikelyState)
+                << ",";
+            for (int i = 0; i < 10; i++) {
+                out << static_cast<uint32_t>(pValue->un.personalActivityClassifier.confidence[i])
+                    << ",";
+            }
+            out << "\n";
+            break;
+        }
+        case SH2_SLEEP_DETECTOR: {
+            out << static_cast<uint32_t>(pValue->un.sleepDetector.sleepState) << "\n";
+            break;
+        }
+        case SH2_TILT_DETECTOR: {
+            out << pValue->un.tiltDetector.tilt << "\n";
+            break;
+        }
+        case SH2_POCKET_DETECTOR: {
+            out << pValue->un.pocketDetector.pocket << "\n";
+            break;
+        }
+        case SH2_CIRCLE_DETECTOR: {
+            out << pValue->un.circleDetector.circle << "\n";
+            break;
+        }
+        case SH2_HEART_RATE_MONITOR: {
+            out << pValue->un.heartRateMonitor.heartRate << "\n";
+            break;
+        }
+        case SH2_ARVR_STABILIZED_RV: {
+            if (ned) {
+                out << pValue->un.arvrStabilizedRV.real << "," << pValue->un.arvrStabilizedRV.j
+                    << "," // Convert ENU -> NED
+                    << pValue->un.arvrStabilizedRV.i << "," << -pValue->un.arvrStabilizedRV.k
+                    << ",";
+            } else {
+                out << pValue->un.arvrStabilizedRV.real << "," << pValue->un.arvrStabilizedRV.i
+                    << "," << pValue->un.arvrStabilizedRV.j << ","
+                    << pValue->un.arvrStabilizedRV.k << ",";
+            }
+            out << radiansToDeg(pValue->un.arvrStabilizedRV.accuracy) << "\n";
+            break;
+        }
+        case SH2_ARVR_STABILIZED_GRV: {
+            if (ned) {
+                out << pValue->un.arvrStabilizedGRV.real << ","
+                    << pValue->un.arvrStabilizedGRV.j << "," // Convert ENU -> NED
+                    << pValue->un.arvrStabilizedGRV.i << "," << -pValue->un.arvrStabilizedGRV.k
+                    << "\n";
+            } else {
+                out << pValue->un.arvrStabilizedGRV.real << ","
+                    << pValue->un.arvrStabilizedGRV.i << "," << pValue->un.arvrStabilizedGRV.j
+                    << "," << pValue->un.arvrStabilizedGRV.k << "\n";
+            }
+            break;
+        }
+        case SH2_GYRO_INTEGRATED_RV: {
+            if (ned) {
+                out << pValue->un.gyroIntegratedRV.real << "," << pValue->un.gyroIntegratedRV.j
+                    << "," // Convert ENU -> NED
+                    << pValue->un.gyroIntegratedRV.i << "," << -pValue->un.gyroIntegratedRV.k
+                    << "," << pValue->un.gyroIntegratedRV.angVelY << ","
+                    << pValue->un.gyroIntegratedRV.angVelX << ","
+                    << -pValue->un.gyroIntegratedRV.angVelZ << "\n";
+            } else {
+                out << pValue->un.gyroIntegratedRV.real << "," << pValue->un.gyroIntegratedRV.i
+                    << "," << pValue->un.gyroIntegratedRV.j << ","
+                    << pValue->un.gyroIntegratedRV.k << ","
+                    << pValue->un.gyroIntegratedRV.angVelX << ","
+                    << pValue->un.gyroIntegratedRV.angVelY << ","
+                    << pValue->un.gyroIntegratedRV.angVelZ << "\n";
+            }
+            break;
+        }
+        case SH2_IZRO_MOTION_REQUEST: {
+            out << static_cast<uint32_t>(pValue->un.izroRequest.intent) << ","
+                << static_cast<uint32_t>(pValue->un.izroRequest.request) << "\n";
+            break;
+        }
+        case SH2_RAW_OPTICAL_FLOW: {
+            out << static_cast<uint32_t>(pValue->un.rawOptFlow.dx != 0 ||
+                                         pValue->un.rawOptFlow.dy != 0)
+                << ",";
+            out << static_cast<uint32_t>(pValue->un.rawOptFlow.laserOn) << ",";
+            out << static_cast<int16_t>(pValue->un.rawOptFlow.dx) << ",";
+            out << static_cast<int16_t>(pValue->un.rawOptFlow.dy) << ",";
+            out << static_cast<uint32_t>(pValue->un.rawOptFlow.iq) << ",";
+            out << static_cast<uint32_t>(pValue->un.rawOptFlow.resX) << ",";
+            out << static_cast<uint32_t>(pValue->un.rawOptFlow.resY) << ",";
+            out << static_cast<uint32_t>(pValue->un.rawOptFlow.shutter) << ",";
+            out << static_cast<uint32_t>(pValue->un.rawOptFlow.frameMax) << ",";
+            out << static_cast<uint32_t>(pValue->un.rawOptFlow.frameAvg) << ",";
+            out << static_cast<uint32_t>(pValue->un.rawOptFlow.frameMin) << ",";
+            out << static_cast<uint32_t>(pValue->un.rawOptFlow.dt) << ",";
+            out << static_cast<uint32_t>(pValue->un.rawOptFlow.timestamp) << "\n";
+            break;
+        }
+        case SH2_DEAD_RECKONING_POSE: {
+            // Output is ENU: rearrange if desired
+            if (ned) {
+                out << pValue->un.deadReckoningPose.linPosY << ",";
+                out << pValue->un.deadReckoningPose.linPosX << ",";
+                out << -pValue->un.deadReckoningPose.linPosZ << ",";
+
+                out << pValue->un.deadReckoningPose.real << ",";
+                out << pValue->un.deadReckoningPose.j << ",";
+                out << pValue->un.deadReckoningPose.i << ",";
+                out << -pValue->un.deadReckoningPose.k << ",";
+
+                out << pValue->un.deadReckoningPose.linVelY << ",";
+                out << pValue->un.deadReckoningPose.linVelX << ",";
+                out << -pValue->un.deadReckoningPose.linVelZ << ",";
+
+                out << pValue->un.deadReckoningPose.angVelY << ",";
+                out << pValue->un.deadReckoningPose.angVelX << ",";
+                out << -pValue->un.deadReckoningPose.angVelZ << ",";
+            } else {
+                out << pValue->un.deadReckoningPose.linPosX << ",";
+                out << pValue->un.deadReckoningPose.linPosY << ",";
+                out << pValue->un.deadReckoningPose.linPosZ << ",";
+
+                out << pValue->un.deadReckoningPose.real << ",";
+                out << pValue->un.deadReckoningPose.i << ",";
+                out << pValue->un.deadReckoningPose.j << ",";
+                out << pValue->un.deadReckoningPose.k << ",";
+
+                out << pValue->un.deadReckoningPose.linVelX << ",";
+                out << pValue->un.deadReckoningPose.linVelY << ",";
+                out << pValue->un.deadReckoningPose.linVelZ << ",";
+
+                out << pValue->un.deadReckoningPose.angVelX << ",";
+                out << pValue->un.deadReckoningPose.angVelY << ",";
+                out << pValue->un.deadReckoningPose.angVelZ << ",";
+            }
+            out << pValue->un.deadReckoningPose.timestamp << "\n";
+            break;
+        }
+        case SH2_WHEEL_ENCODER: {
+            out << static_cast<uint16_t>(pValue->un.wheelEncoder.dataType) << ",";
+            out << static_cast<uint16_t>(pValue->un.wheelEncoder.wheelIndex) << ",";
+            out << static_cast<uint16_t>(pValue->un.wheelEncoder.data) << ",";
+            out << static_cast<uint32_t>(pValue->un.wheelEncoder.timestamp) << "\n";
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Fields of a DSF sensor report line: the text after TIME, SYSTEM_TIME,
+// SAMPLE_ID and STATUS, with the newline.
+static bool fieldsOf(const std::string& line, std::string* pFields) {
+    size_t at = 0;
+    for (int commas = 0; commas < 4; commas++) {
+        at = line.find(',', at);
+        if (at == std::string::npos) {
+            return false;
+        }
+        at++;
+    }
+    *pFields = line.substr(at) + "\n";
+    return true;
+}
+
+static bool check(bool ned) {
+    const char* path = "dsf_fields_test.dsf";
+    const char* orientation = ned ? "NED" : "ENU";
+
+    DsfLogger logger;
+    if (!logger.init(path, ned)) {
+        std::cerr << "ERROR: Unable to write " << path << std::endl;
+        return false;
+    }
+    rngState_ = 12345;
+    for (int id = 0; id <= SH2_MAX_SENSOR_ID; id++) {
+        for (uint32_t i = 0; i < REPORTS_PER_SENSOR; i++) {
+            sh2_SensorValue_t value;
+            makeValue(&value, (uint8_t)id, i);
+            logger.logSensorValue(&value, 1.0 + i * 1e-3, -1500);
+        }
+    }
+    logger.finish();
+
+    // Fields of each sensor's lines, in order
+    std::vector<std::vector<std::string> > actual(SH2_MAX_SENSOR_ID + 1);
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || (line[0] != '.')) {
+            continue;
+        }
+        int id = atoi(line.c_str() + 1);
+        std::string fields;
+        if ((id < 0) || (id > SH2_MAX_SENSOR_ID) || !fieldsOf(line, &fields)) {
+            std::cerr << "FAIL: " << orientation << ": bad report line: " << line << std::endl;
+            return false;
+        }
+        actual[id].push_back(fields);
+    }
+    in.close();
+
+    bool ok = true;
+    uint32_t sensors = 0;
+    rngState_ = 12345;
+    for (int id = 0; id <= SH2_MAX_SENSOR_ID; id++) {
+        bool logged = (strcmp(DsfLogger::getSensorColumns((uint8_t)id), "") != 0);
+        size_t expectedLines = logged ? REPORTS_PER_SENSOR : 0;
+        if (actual[id].size() != expectedLines) {
+            std::cerr << "FAIL: " << orientation << ": sensor " << id << " gave "
+                      << actual[id].size() << " lines, expected " << expectedLines << std::endl;
+            ok = false;
+        }
+        sensors += logged ? 1 : 0;
+
+        uint32_t mismatches = 0;
+        for (uint32_t i = 0; i < REPORTS_PER_SENSOR; i++) {
+            sh2_SensorValue_t value;
+            makeValue(&value, (uint8_t)id, i);
+            if (i >= actual[id].size()) {
+                continue;
+            }
+            DsfFormatter out;
+            writeReference(out, &value, ned);
+            std::string expected(out.data(), out.size());
+            if (actual[id][i] != expected) {
+                if (mismatches++ == 0) {
+                    std::cerr << "FAIL: " << orientation << ": " << DsfLogger::getSensorName(id)
+                              << " report " << i << ":\n  got      " << actual[id][i]
+                              << "  expected " << expected;
+                }
+                ok = false;
+            }
+        }
+        if (mismatches > 1) {
+            std::cerr << "  and " << (mismatches - 1) << " more" << std::endl;
+        }
+    }
+
+    if (ok) {
+        std::cout << orientation << ": " << sensors << " sensors, " << REPORTS_PER_SENSOR
+                  << " reports each, fields match" << std::endl;
+        remove(path);
+    }
+    return ok;
+}
+
+// Lines of a .dsf, leaving out the posix_offset line
+static std::string readLines(const char* path) {
+    std::ifstream in(path);
+    std::string text;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 14, "! posix_offset") != 0) {
+            text += line + "\n";
+        }
+    }
+    return text;
+}
+
+// Reports from sensor ids past SH2_MAX_SENSOR_ID, alone and in batches,
+// must be dropped without disturbing the other reports.
+static bool checkUnknownIds(void) {
+    const char* withPath = "dsf_fields_test_unknown.dsf";
+    const char* withoutPath = "dsf_fields_test_known.dsf";
+    const uint8_t unknownIds[] = {SH2_MAX_SENSOR_ID + 1, 0x80, 0xFF};
+
+    DsfLogger with;
+    DsfLogger without;
+    if (!with.init(withPath, true) || !without.init(withoutPath, true)) {
+        std::cerr << "ERROR: Unable to write " << withPath << std::endl;
+        return false;
+    }
+    rngState_ = 54321;
+    for (uint32_t b = 0; b < 100; b++) {
+        std::vector<Logger::SensorSample_s> all;
+        std::vector<Logger::SensorSample_s> known;
+        for (uint32_t i = 0; i < 64; i++) {
+            Logger::SensorSample_s sample;
+            uint8_t sensorId = (uint8_t)(rng() % (SH2_MAX_SENSOR_ID + 1));
+            bool unknown = (i % 5 == b % 5);
+            if (unknown) {
+                sensorId = unknownIds[rng() % sizeof(unknownIds)];
+            }
+            makeValue(&sample.value, sensorId, i);
+            sample.timestamp = 1.0 + (b * 64 + i) * 1e-3;
+            sample.delay_uS = -1500;
+            all.push_back(sample);
+            if (!unknown) {
+                known.push_back(sample);
+            }
+        }
+        with.logSensorValues(all.data(), all.size());
+        with.logSensorValue(&all[b % 5].value, 1.0, 0);
+        without.logSensorValues(known.data(), known.size());
+    }
+    with.finish();
+    without.finish();
+
+    if (readLines(withPath) != readLines(withoutPath)) {
+        std::cerr << "FAIL: Unknown sensor ids: .dsf differs from one without them" << std::endl;
+        return false;
+    }
+    std::cout << "Unknown sensor ids: dropped" << std::endl;
+    remove(withPath);
+    remove(withoutPath);
+    return true;
+}
+
+// The posix_offset line of a .dsf, or "" if it has none
+static std::string posixOffsetLine(const char* path) {
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 14, "! posix_offset") == 0) {
+            return line;
+        }
+    }
+    return "";
+}
+
+// Each file a logger is init()ed for gets its own posix_offset line, read
+// from the clock unless setPosixOffset() gave it.
+static bool checkReinit(void) {
+    const char* path = "dsf_fields_test_reinit.dsf";
+    const char* given = "! posix_offset=1234.500000000";
+
+    DsfLogger logger;
+    bool ok = true;
+    for (int file = 0; file < 3; file++) {
+        if (file == 2) {
+            logger.setPosixOffset(1234.5);
+        }
+        if (!logger.init(path, true)) {
+            std::cerr << "ERROR: Unable to write " << path << std::endl;
+            return false;
+        }
+        sh2_SensorValue_t value;
+        makeValue(&value, SH2_ACCELEROMETER, 0);
+        logger.logSensorValue(&value, 1.0, 0);
+        logger.finish();
+
+        std::string line = posixOffsetLine(path);
+        if (line.empty() || ((file == 2) && (line != given))) {
+            std::cerr << "FAIL: Reinit: file " << file << " posix_offset line \"" << line << "\""
+                      << std::endl;
+            ok = false;
+        }
+    }
+    if (ok) {
+        std::cout << "Reinit: posix_offset in every file" << std::endl;
+        remove(path);
+    }
+    return ok;
+}
+
+// =================================================================================================
+// MAIN
+// =================================================================================================
+int main() {
+    bool ok = check(true);
+    ok = check(false) && ok;
+    ok = checkUnknownIds() && ok;
+    ok = checkReinit() && ok;
+    return ok ? 0 : 1;
+}
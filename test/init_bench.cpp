@@ -0,0 +1,559 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Start-up command benchmark.  Issues the same request/response sequence
+// as LoggerApp::init (product ids, every FRS record LoggerApp logs, then
+// one set feature command per sensor) through ftdi_hal, one command at a
+// time, polling for each response the way the sh2 driver does.  Run it
+// against sh2_emulator (see init_bench.sh).
+//
+// For each run it reports, per phase, the command count, elapsed time and
+// time per command (the command round-trip time) and process CPU time,
+// like LoggerApp::init does, plus the time spent in HAL write calls,
+// writes refused for lack of credit, and BSQs and BSNs exchanged.
+//
+// --latency delays every byte by the given time in each direction,
+// through a proxy thread between the HAL and the emulator, standing in
+// for USB-serial latency.  Process CPU time then includes the proxy's.
+//
+// Usage: init_bench [-d unix:<path>] [-n runs] [--txGap us] [--latency us]
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "LoggerUtil.h"
+
+extern "C" {
+#include "ftdi_hal.h"
+#include "timing.h"
+}
+
+#include <atomic>
+#include <ctime>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define CHAN_EXECUTABLE (1)
+#define CHAN_CONTROL (2)
+
+#define EXECUTABLE_RESET_COMPLETE (1)
+#define SET_FEATURE_CMD (0xFD)
+#define GET_FEATURE_RESP (0xFC)
+#define PROD_ID_REQ (0xF9)
+#define PROD_ID_RESP (0xF8)
+#define FRS_READ_REQ (0xF4)
+#define FRS_READ_RESP (0xF3)
+
+#define RESPONSE_TIMEOUT_US (1000000)
+
+// =================================================================================================
+// DATA TYPES
+// =================================================================================================
+// Measurements of one phase of the start-up sequence
+struct Phase_s {
+    int commands = 0;
+    double wall_ms = 0.0;
+    double cpu_ms = 0.0;
+};
+
+// Measurements of one run
+struct Run_s {
+    Phase_s prodIds;
+    Phase_s frs;
+    Phase_s sensors;
+    Phase_s total;
+    double writeWall_ms = 0.0; // Time spent in HAL write calls
+    double writeCpu_ms = 0.0;  // CPU time spent in HAL write calls
+    uint32_t writeRetries = 0; // Writes refused for lack of credit (or queue space)
+    ftdi_hal_Stats_t stats;
+    uint32_t txGapMin_us = 0;
+    uint32_t txGapMean_us = 0;
+};
+
+// =================================================================================================
+// LOCAL VARIABLES
+// =================================================================================================
+// Sensors enabled in the last phase, as in a typical dead reckoning configuration
+static const uint8_t Sensors[] = {
+        SH2_ACCELEROMETER,
+        SH2_GYROSCOPE_CALIBRATED,
+        SH2_MAGNETIC_FIELD_CALIBRATED,
+        SH2_ROTATION_VECTOR,
+        SH2_RAW_ACCELEROMETER,
+        SH2_RAW_GYROSCOPE,
+        SH2_RAW_MAGNETOMETER,
+};
+
+static sh2_Hal_t* pHal_ = nullptr;
+static uint8_t txSeq_[8];
+static Run_s* pRun_ = nullptr;
+
+// Last response seen, for the command waiting on it
+static uint8_t resp_[SH2_HAL_MAX_TRANSFER_IN];
+static int respLen_ = 0;
+static bool resetSeen_ = false;
+
+static std::atomic<bool> proxyRun_(false);
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+static double cpuNow_ms() {
+    return 1000.0 * std::clock() / CLOCKS_PER_SEC;
+}
+
+static double wallNow_ms() {
+    return timing_now_us() * 1e-3;
+}
+
+static void put16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)(v & 0xFF);
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t* p, uint32_t v) {
+    put16(p, (uint16_t)(v & 0xFFFF));
+    put16(p + 2, (uint16_t)(v >> 16));
+}
+
+// -------------------------------------------------------------------------------------------------
+// pollHal
+// -------------------------------------------------------------------------------------------------
+// Read frames until one arrives on the control channel, leaving it in resp_,
+// or none are waiting.  Notes the reset complete message on the way.
+static void pollHal() {
+    uint8_t packet[SH2_HAL_MAX_TRANSFER_IN];
+    uint32_t t_us;
+    int len;
+
+    while ((len = pHal_->read(pHal_, packet, sizeof(packet), &t_us)) > 0) {
+        if (len < 5) {
+            continue;
+        }
+        uint8_t channel = packet[2];
+        if ((channel == CHAN_EXECUTABLE) && (packet[4] == EXECUTABLE_RESET_COMPLETE)) {
+            resetSeen_ = true;
+        } else if (channel == CHAN_CONTROL) {
+            respLen_ = len - 4;
+            memcpy(resp_, packet + 4, respLen_);
+            return;
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// send
+// -------------------------------------------------------------------------------------------------
+static void send(uint8_t channel, const uint8_t* pCargo, uint16_t len) {
+    uint8_t packet[64];
+    put16(packet, (uint16_t)(len + 4));
+    packet[2] = channel;
+    packet[3] = txSeq_[channel]++;
+    memcpy(packet + 4, pCargo, len);
+
+    for (;;) {
+        double wall0 = wallNow_ms();
+        double cpu0 = cpuNow_ms();
+        int status = pHal_->write(pHal_, packet, len + 4);
+        pRun_->writeWall_ms += wallNow_ms() - wall0;
+        pRun_->writeCpu_ms += cpuNow_ms() - cpu0;
+        if (status != 0) {
+            break;
+        }
+        // Like sh2: no room, service the HAL and try again.
+        pRun_->writeRetries++;
+        pollHal();
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// command
+// -------------------------------------------------------------------------------------------------
+// Send a control channel command and poll until done(resp_) says its last
+// response has arrived.  Returns false on timeout.
+static bool command(const uint8_t* pCargo, uint16_t len, bool (*done)(const uint8_t*, uint8_t),
+                    uint8_t key) {
+    respLen_ = 0;
+    send(CHAN_CONTROL, pCargo, len);
+
+    uint64_t start_us = timing_now_us();
+    for (;;) {
+        pollHal();
+        if ((respLen_ > 0) && done(resp_, key)) {
+            respLen_ = 0;
+            return true;
+        }
+        respLen_ = 0;
+        if (timing_now_us() - start_us > RESPONSE_TIMEOUT_US) {
+            std::cerr << "ERROR: No response to command 0x" << std::hex << (int)pCargo[0]
+                      << std::dec << std::endl;
+            return false;
+        }
+    }
+}
+
+static bool prodIdDone(const uint8_t* pResp, uint8_t key) {
+    (void)key;
+    return pResp[0] == PROD_ID_RESP;
+}
+
+// An FRS read is done with its last response: any status but "no error, more to come"
+static bool frsReadDone(const uint8_t* pResp, uint8_t key) {
+    (void)key;
+    return (pResp[0] == FRS_READ_RESP) && ((pResp[1] & 0x0F) != 0);
+}
+
+static bool featureDone(const uint8_t* pResp, uint8_t sensorId) {
+    return (pResp[0] == GET_FEATURE_RESP) && (pResp[1] == sensorId);
+}
+
+static bool readFrs(uint16_t recordId) {
+    uint8_t req[8] = {FRS_READ_REQ, 0};
+    put16(req + 2, 0); // offset
+    put16(req + 4, recordId);
+    put16(req + 6, 0); // whole record
+    return command(req, sizeof(req), frsReadDone, 0);
+}
+
+static void startPhase(Phase_s* pPhase) {
+    pPhase->wall_ms = -wallNow_ms();
+    pPhase->cpu_ms = -cpuNow_ms();
+}
+
+static void endPhase(Phase_s* pPhase, int commands) {
+    pPhase->wall_ms += wallNow_ms();
+    pPhase->cpu_ms += cpuNow_ms();
+    pPhase->commands = commands;
+}
+
+// -------------------------------------------------------------------------------------------------
+// runOnce
+// -------------------------------------------------------------------------------------------------
+static bool runOnce(const std::string& device, uint32_t txGap_us, Run_s* pRun) {
+    pRun_ = pRun;
+    pHal_ = ftdi_hal_init(device.c_str());
+    if (pHal_ == nullptr) {
+        std::cerr << "ERROR: Unable to create a HAL for " << device << std::endl;
+        return false;
+    }
+    if (txGap_us != UINT32_MAX) {
+        ftdi_hal_setTxGapUs(pHal_, txGap_us);
+    }
+    memset(txSeq_, 0, sizeof(txSeq_));
+    resetSeen_ = false;
+
+    if (pHal_->open(pHal_) != 0) {
+        std::cerr << "ERROR: Unable to open " << device << std::endl;
+        ftdi_hal_free(pHal_);
+        return false;
+    }
+
+    // Wait for the hub to come out of reset, as sh2_open does.
+    uint64_t start_us = timing_now_us();
+    while (!resetSeen_ && (timing_now_us() - start_us < RESPONSE_TIMEOUT_US)) {
+        pollHal();
+    }
+    bool ok = resetSeen_;
+
+    startPhase(&pRun->total);
+
+    startPhase(&pRun->prodIds);
+    uint8_t prodIdReq[2] = {PROD_ID_REQ, 0};
+    ok = ok && command(prodIdReq, sizeof(prodIdReq), prodIdDone, 0);
+    endPhase(&pRun->prodIds, 1);
+
+    startPhase(&pRun->frs);
+    int frsReads = 1;
+    ok = ok && readFrs(STATIC_CALIBRATION_AGM);
+    for (int i = 0; ok && (i < LoggerUtil::NumSh2FrsRecords); i++) {
+        ok = readFrs(LoggerUtil::Sh2FrsRecords[i].recordId);
+        frsReads++;
+    }
+    endPhase(&pRun->frs, frsReads);
+
+    startPhase(&pRun->sensors);
+    for (size_t i = 0; ok && (i < sizeof(Sensors)); i++) {
+        uint8_t req[17] = {SET_FEATURE_CMD, Sensors[i], 0};
+        put32(req + 5, 10000); // 100 Hz
+        ok = command(req, sizeof(req), featureDone, Sensors[i]);
+    }
+    endPhase(&pRun->sensors, (int)sizeof(Sensors));
+
+    endPhase(&pRun->total,
+             pRun->prodIds.commands + pRun->frs.commands + pRun->sensors.commands);
+
+    ftdi_hal_getStats(pHal_, &pRun->stats);
+    ftdi_hal_getTxGapStats(pHal_, &pRun->txGapMin_us, &pRun->txGapMean_us);
+
+    pHal_->close(pHal_);
+    ftdi_hal_free(pHal_);
+    pHal_ = nullptr;
+    return ok;
+}
+
+// -------------------------------------------------------------------------------------------------
+// Latency proxy
+// -------------------------------------------------------------------------------------------------
+// Bytes read from one side, held until they are due on the other
+struct Delayed_s {
+    uint64_t due_us;
+    std::vector<uint8_t> data;
+};
+
+static int listenUnix(const std::string& path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str());
+    if ((fd < 0) || (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) || (listen(fd, 1) < 0)) {
+        std::cerr << "ERROR: Unable to listen on " << path << ": " << strerror(errno) << std::endl;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+static int connectUnix(const std::string& path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((fd >= 0) && (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// Forward between the HAL (host) and the emulator until either hangs up.
+static void proxyConnection(int hostFd, int hubFd, uint32_t latency_us) {
+    int fds[2] = {hostFd, hubFd};
+    std::deque<Delayed_s> pending[2]; // pending[i]: read from fds[i], for fds[1-i]
+    uint8_t buf[4096];
+
+    while (proxyRun_) {
+        uint64_t now_us = timing_now_us();
+        int timeout_ms = 100;
+        for (int i = 0; i < 2; i++) {
+            while (!pending[i].empty() && (pending[i].front().due_us <= now_us)) {
+                const std::vector<uint8_t>& data = pending[i].front().data;
+                if (write(fds[1 - i], data.data(), data.size()) != (ssize_t)data.size()) {
+                    return;
+                }
+                pending[i].pop_front();
+            }
+            if (!pending[i].empty()) {
+                int wait_ms = (int)((pending[i].front().due_us - now_us + 999) / 1000);
+                timeout_ms = (wait_ms < timeout_ms) ? wait_ms : timeout_ms;
+            }
+        }
+
+        struct pollfd pfd[2];
+        for (int i = 0; i < 2; i++) {
+            pfd[i].fd = fds[i];
+            pfd[i].events = POLLIN;
+            pfd[i].revents = 0;
+        }
+        poll(pfd, 2, timeout_ms);
+
+        now_us = timing_now_us();
+        for (int i = 0; i < 2; i++) {
+            if (pfd[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                ssize_t n = read(fds[i], buf, sizeof(buf));
+                if (n <= 0) {
+                    return;
+                }
+                pending[i].push_back(Delayed_s{now_us + latency_us,
+                                               std::vector<uint8_t>(buf, buf + n)});
+            }
+        }
+    }
+}
+
+static void proxyThread(int listenFd, std::string hubPath, uint32_t latency_us) {
+    while (proxyRun_) {
+        struct pollfd pfd;
+        pfd.fd = listenFd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+        int hostFd = accept(listenFd, NULL, NULL);
+        if (hostFd < 0) {
+            continue;
+        }
+        int hubFd = connectUnix(hubPath);
+        if (hubFd < 0) {
+            std::cerr << "ERROR: Unable to connect to unix:" << hubPath << std::endl;
+        } else {
+            proxyConnection(hostFd, hubFd, latency_us);
+            close(hubFd);
+        }
+        close(hostFd);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// report
+// -------------------------------------------------------------------------------------------------
+static void reportPhase(const char* name, const Phase_s& phase) {
+    std::cout << "  " << std::left << std::setw(22) << name << std::right << std::setw(3)
+              << phase.commands << " commands in " << std::setw(7) << phase.wall_ms << " ms ("
+              << std::setw(6) << phase.wall_ms / phase.commands << " ms each), CPU "
+              << std::setw(7) << phase.cpu_ms << " ms" << std::endl;
+}
+
+static void reportRun(const Run_s& run) {
+    reportPhase("Product ids", run.prodIds);
+    reportPhase("FRS records", run.frs);
+    reportPhase("Sensor configuration", run.sensors);
+    reportPhase("Startup", run.total);
+    std::cout << "  HAL writes: " << run.writeWall_ms << " ms, CPU " << run.writeCpu_ms
+              << " ms, " << run.writeRetries << " retries; TX gap min " << run.txGapMin_us
+              << " us, mean " << run.txGapMean_us << " us; BSQs " << run.stats.txBsqs
+              << ", BSNs " << run.stats.rxBsns << std::endl;
+}
+
+// =================================================================================================
+// MAIN
+// =================================================================================================
+int main(int argc, const char* argv[]) {
+    std::string device = "unix:/tmp/sh2_emulator.sock";
+    int runs = 5;
+    uint32_t txGap_us = UINT32_MAX;
+    uint32_t latency_us = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if ((arg == "-d") && hasValue) {
+            device = argv[++i];
+        } else if ((arg == "-n") && hasValue) {
+            runs = atoi(argv[++i]);
+        } else if ((arg == "--txGap") && hasValue) {
+            txGap_us = (uint32_t)strtoul(argv[++i], NULL, 0);
+        } else if ((arg == "--latency") && hasValue) {
+            latency_us = (uint32_t)strtoul(argv[++i], NULL, 0);
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [-d unix:<path>] [-n runs] [--txGap us] [--latency us]" << std::endl;
+            return 1;
+        }
+    }
+
+    // A hub going away shows up as a write error, not a signal.
+    signal(SIGPIPE, SIG_IGN);
+
+    std::string halDevice = device;
+    std::string proxyPath;
+    int listenFd = -1;
+    std::thread proxy;
+    if (latency_us > 0) {
+        if (device.compare(0, 5, "unix:") != 0) {
+            std::cerr << "ERROR: --latency needs a unix:<path> device" << std::endl;
+            return 1;
+        }
+        proxyPath = "/tmp/init_bench." + std::to_string(getpid()) + ".sock";
+        listenFd = listenUnix(proxyPath);
+        if (listenFd < 0) {
+            return 1;
+        }
+        proxyRun_ = true;
+        proxy = std::thread(proxyThread, listenFd, device.substr(5), latency_us);
+        halDevice = "unix:" + proxyPath;
+    }
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "INFO: " << device << ", " << latency_us << " us added latency each way"
+              << std::endl;
+
+    std::vector<Run_s> results;
+    int status = 0;
+    for (int r = 0; r < runs; r++) {
+        Run_s run;
+        if (!runOnce(halDevice, txGap_us, &run)) {
+            status = 1;
+            break;
+        }
+        std::cout << "Run " << r + 1 << ":" << std::endl;
+        reportRun(run);
+        results.push_back(run);
+    }
+
+    if (!results.empty()) {
+        Run_s mean;
+        memset(&mean.stats, 0, sizeof(mean.stats));
+        for (const Run_s& run : results) {
+            mean.prodIds.wall_ms += run.prodIds.wall_ms / results.size();
+            mean.prodIds.cpu_ms += run.prodIds.cpu_ms / results.size();
+            mean.frs.wall_ms += run.frs.wall_ms / results.size();
+            mean.frs.cpu_ms += run.frs.cpu_ms / results.size();
+            mean.sensors.wall_ms += run.sensors.wall_ms / results.size();
+            mean.sensors.cpu_ms += run.sensors.cpu_ms / results.size();
+            mean.total.wall_ms += run.total.wall_ms / results.size();
+            mean.total.cpu_ms += run.total.cpu_ms / results.size();
+            mean.writeWall_ms += run.writeWall_ms / results.size();
+            mean.writeCpu_ms += run.writeCpu_ms / results.size();
+            mean.writeRetries += run.writeRetries;
+            mean.stats.txBsqs += run.stats.txBsqs;
+            mean.stats.rxBsns += run.stats.rxBsns;
+            mean.txGapMin_us = run.txGapMin_us;
+            mean.txGapMean_us = run.txGapMean_us;
+        }
+        mean.prodIds.commands = results[0].prodIds.commands;
+        mean.frs.commands = results[0].frs.commands;
+        mean.sensors.commands = results[0].sensors.commands;
+        mean.total.commands = results[0].total.commands;
+        mean.writeRetries /= results.size();
+        mean.stats.txBsqs /= results.size();
+        mean.stats.rxBsns /= results.size();
+        std::cout << "Mean of " << results.size() << " runs:" << std::endl;
+        reportRun(mean);
+    }
+
+    if (latency_us > 0) {
+        proxyRun_ = false;
+        proxy.join();
+        close(listenFd);
+        unlink(proxyPath.c_str());
+    }
+    return status;
+}
@@ -0,0 +1,39 @@
+#!/usr/bin/env bash
+if [ $# -lt 1 ]
+then
+    cat <<USAGE 1>&2
+Usage: $0 <build_dir> [init_bench options]
+
+Start sh2_emulator from <build_dir> on a private socket and run
+init_bench against it, which times LoggerApp::init's start-up commands
+(round-trip time per command and CPU time).  It runs twice: against a
+hub that sends a BSN after every frame, then with --bsqOnly against one
+that only answers BSQs.  Options such as -n, --txGap and --latency are
+passed on to init_bench.
+
+USAGE
+    exit 1
+fi
+build=$1
+shift
+sock=/tmp/init_bench_emulator.$$.sock
+
+run() {
+    echo "=== sh2_emulator $*"
+    "${build}/sh2_emulator" --socket "${sock}" "$@" > /dev/null &
+    emulator=$!
+    for i in $(seq 50)
+    do
+        [ -S "${sock}" ] && break
+        sleep 0.1
+    done
+    "${build}/init_bench" -d "unix:${sock}" "${benchArgs[@]}"
+    status=$?
+    kill -INT ${emulator}
+    wait ${emulator}
+    rm -f "${sock}"
+    return ${status}
+}
+
+benchArgs=("$@")
+run && run --bsqOnly
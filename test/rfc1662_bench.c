@@ -0,0 +1,207 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures RFC1662 decode, unescape and encode throughput in MB/s, for
+ * the block functions and their *_scalar counterparts.  The input is a
+ * stream of encoded frames, read in USB sized chunks the way ftdi_hal
+ * does, with payload bytes needing escapes at several rates.
+ *
+ * Usage: rfc1662_bench [MB per case]
+ */
+
+#include "rfc1662.h"
+#include "timing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------------------------------------------------------------
+// Defines and data types
+
+#define STREAM_LEN (1024 * 1024)
+#define READ_LEN (4096)
+#define FRAME_MAX (1024)
+
+typedef uint32_t (*Decode_t)(rfc1662_Decoder_t* d, const uint8_t* pIn, uint32_t len);
+typedef uint32_t (*Unescape_t)(uint8_t* pOut, uint32_t outMax, const uint8_t* pIn, uint32_t inLen);
+typedef bool (*Encode_t)(uint8_t* pOut,
+                         uint32_t* outLen,
+                         uint8_t protocol,
+                         const uint8_t* pIn,
+                         uint32_t inLen);
+
+// ------------------------------------------------------------------------
+// Local variables
+
+static uint32_t rngState = 12345;
+
+static uint8_t stream[STREAM_LEN];
+static uint32_t streamLen;
+
+static uint8_t payload[STREAM_LEN];
+static uint8_t scratch[2 * STREAM_LEN];
+
+// Keeps results live so the compiler can't drop the work
+static volatile uint32_t sink;
+
+// ------------------------------------------------------------------------
+// Local functions
+
+static uint32_t rng(void) {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+// Build a stream of encoded frames with payloadLen byte payloads, about one
+// in specialEvery of whose bytes is a flag or escape (0 for chance only).
+static void buildStream(uint32_t payloadLen, uint32_t specialEvery) {
+    for (uint32_t i = 0; i < STREAM_LEN; i++) {
+        uint8_t c = (uint8_t)rng();
+        if ((specialEvery != 0) && (rng() % specialEvery == 0)) {
+            c = (rng() & 1) ? RFC1662_FLAG : RFC1662_ESCAPE;
+        }
+        payload[i] = c;
+    }
+
+    streamLen = 0;
+    for (uint32_t p = 0; p + payloadLen <= STREAM_LEN; p += payloadLen) {
+        uint32_t len = STREAM_LEN - streamLen;
+        if (rfc1662_encode_scalar(stream + streamLen, &len, 0x01, payload + p, payloadLen)) {
+            break;
+        }
+        streamLen += len;
+    }
+}
+
+static double mbPerSec(uint64_t bytes, uint64_t elapsed_us) {
+    return (elapsed_us == 0) ? 0.0 : (double)bytes / (double)elapsed_us;
+}
+
+static double benchDecode(Decode_t decode, uint32_t passes) {
+    static uint8_t frame[FRAME_MAX];
+    rfc1662_Decoder_t d;
+    uint32_t frames = 0;
+
+    rfc1662_decoderInit(&d, frame, sizeof(frame));
+    uint64_t start_us = timing_now_us();
+    for (uint32_t pass = 0; pass < passes; pass++) {
+        for (uint32_t pos = 0; pos < streamLen; pos += READ_LEN) {
+            uint32_t n = (streamLen - pos < READ_LEN) ? streamLen - pos : READ_LEN;
+            uint32_t off = 0;
+            while (off < n) {
+                off += decode(&d, stream + pos + off, n - off);
+                if (d.frameReady) {
+                    frames++;
+                    rfc1662_decoderReset(&d);
+                }
+            }
+        }
+    }
+    uint64_t elapsed_us = timing_now_us() - start_us;
+    sink = frames;
+    return mbPerSec((uint64_t)passes * streamLen, elapsed_us);
+}
+
+static double benchUnescape(Unescape_t unescape, uint32_t passes) {
+    uint32_t total = 0;
+
+    // One large frame body: the stream less its first and last flags
+    uint64_t start_us = timing_now_us();
+    for (uint32_t pass = 0; pass < passes; pass++) {
+        total += unescape(scratch, sizeof(scratch), stream + 1, streamLen - 2);
+    }
+    uint64_t elapsed_us = timing_now_us() - start_us;
+    sink = total;
+    return mbPerSec((uint64_t)passes * streamLen, elapsed_us);
+}
+
+static double benchEncode(Encode_t encode, uint32_t payloadLen, uint32_t passes) {
+    uint32_t total = 0;
+    uint32_t count = STREAM_LEN / payloadLen;
+
+    uint64_t start_us = timing_now_us();
+    for (uint32_t pass = 0; pass < passes; pass++) {
+        for (uint32_t p = 0; p < count; p++) {
+            uint32_t len = sizeof(scratch);
+            encode(scratch, &len, 0x01, payload + p * payloadLen, payloadLen);
+            total += len;
+        }
+    }
+    uint64_t elapsed_us = timing_now_us() - start_us;
+    sink = total;
+    return mbPerSec((uint64_t)passes * count * payloadLen, elapsed_us);
+}
+
+// ------------------------------------------------------------------------
+// Public functions
+
+int main(int argc, char* argv[]) {
+    static const struct {
+        uint32_t payloadLen;
+        uint32_t specialEvery;
+        const char* name;
+    } cases[] = {
+        {20, 0, "20B frames, random"},
+        {64, 0, "64B frames, random"},
+        {256, 0, "256B frames, random"},
+        {256, 1000, "256B frames, 0.1% specials"},
+        {256, 20, "256B frames, 5% specials"},
+        {256, 2, "256B frames, 50% specials"},
+    };
+    uint32_t mb = 64;
+
+    if (argc > 1) {
+        mb = (uint32_t)strtoul(argv[1], NULL, 0);
+    }
+    uint32_t passes = (mb < 1) ? 1 : mb;
+
+    printf("rfc1662_bench: block functions use %s, %u MB per case\n", rfc1662_implName(), passes);
+    printf("%-28s %9s %9s  %9s %9s  %9s %9s\n",
+           "MB/s",
+           "decode",
+           "scalar",
+           "unescape",
+           "scalar",
+           "encode",
+           "scalar");
+
+    for (uint32_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        buildStream(cases[c].payloadLen, cases[c].specialEvery);
+
+        double dec = benchDecode(rfc1662_decode, passes);
+        double decScalar = benchDecode(rfc1662_decode_scalar, passes);
+        double unesc = benchUnescape(rfc1662_unescape, passes);
+        double unescScalar = benchUnescape(rfc1662_unescape_scalar, passes);
+        double enc = benchEncode(rfc1662_encode, cases[c].payloadLen, passes);
+        double encScalar = benchEncode(rfc1662_encode_scalar, cases[c].payloadLen, passes);
+
+        printf("%-28s %9.1f %9.1f  %9.1f %9.1f  %9.1f %9.1f\n",
+               cases[c].name,
+               dec,
+               decScalar,
+               unesc,
+               unescScalar,
+               enc,
+               encScalar);
+    }
+
+    return 0;
+}
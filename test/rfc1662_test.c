@@ -0,0 +1,304 @@
+/*
+ * Copyright 2022 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks that the block RFC1662 functions give exactly the same results
+ * as their *_scalar counterparts, on random streams and on streams built
+ * to put flags and escapes where the block code changes over: at and
+ * around 16 and 32 byte boundaries, at the ends of input chunks (so an
+ * escape or frame spans calls), and in long runs.
+ */
+
+#include "rfc1662.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// ------------------------------------------------------------------------
+// Defines and data types
+
+#define STREAM_LEN (8192)
+#define FRAME_MAX (300)
+#define ENCODE_MAX (2 * STREAM_LEN + 4)
+
+// ------------------------------------------------------------------------
+// Local variables
+
+static uint32_t rngState = 12345;
+
+static uint32_t checks;
+static uint32_t failures;
+
+static uint8_t stream[STREAM_LEN];
+
+// ------------------------------------------------------------------------
+// Local functions
+
+static uint32_t rng(void) {
+    // xorshift32, so every platform sees the same streams
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+static void check(bool ok, const char* what, const char* name, uint32_t detail) {
+    checks++;
+    if (!ok) {
+        failures++;
+        if (failures <= 20) {
+            printf("FAIL: %s, %s stream, at %u\n", what, name, detail);
+        }
+    }
+}
+
+// Fill stream with random bytes, of which about one in specialEvery is a
+// flag or escape (0 for none beyond chance).
+static void fillRandom(uint32_t len, uint32_t specialEvery) {
+    for (uint32_t i = 0; i < len; i++) {
+        uint8_t c = (uint8_t)rng();
+        if ((specialEvery != 0) && (rng() % specialEvery == 0)) {
+            c = (rng() & 1) ? RFC1662_FLAG : RFC1662_ESCAPE;
+        }
+        stream[i] = c;
+    }
+}
+
+// Fill stream with ordinary bytes, then put specials at and either side
+// of every 16 byte boundary.
+static void fillBoundaries(uint32_t len, uint8_t special, int offset) {
+    for (uint32_t i = 0; i < len; i++) {
+        stream[i] = (uint8_t)(0x30 + i % 0x40);
+    }
+    for (uint32_t b = 16; b < len; b += 16) {
+        uint32_t pos = (uint32_t)((int)b + offset);
+        if (pos < len) {
+            stream[pos] = special;
+        }
+    }
+    stream[0] = RFC1662_FLAG;
+}
+
+// Frames with payloads of every length up to 70, each byte position in
+// turn needing an escape, so escapes land at every offset.
+static uint32_t fillFrames(void) {
+    uint32_t len = 0;
+    for (uint32_t n = 1; n <= 70; n++) {
+        for (uint32_t e = 0; (e < n) && (len + 2 * n + 2 < STREAM_LEN); e += 7) {
+            stream[len++] = RFC1662_FLAG;
+            for (uint32_t i = 0; i < n; i++) {
+                if (i == e) {
+                    stream[len++] = RFC1662_ESCAPE;
+                    stream[len++] = RFC1662_FLAG ^ 0x20;
+                } else {
+                    stream[len++] = (uint8_t)(i + n);
+                }
+            }
+            stream[len++] = RFC1662_FLAG;
+        }
+    }
+    return len;
+}
+
+// findSpecial from every start offset (alignment) and for every length
+static void testFindSpecial(uint32_t len, const char* name) {
+    for (uint32_t start = 0; start < 64 && start < len; start++) {
+        for (uint32_t n = 0; start + n <= len && n < 200; n++) {
+            size_t a = rfc1662_findSpecial(stream + start, n);
+            size_t b = rfc1662_findSpecial_scalar(stream + start, n);
+            check(a == b, "findSpecial", name, start * 1000 + n);
+        }
+    }
+}
+
+// Decode the stream with both decoders, fed in chunks from chunkSize()
+static void testDecode(uint32_t len, const char* name, uint32_t (*chunkSize)(uint32_t)) {
+    uint8_t frameA[FRAME_MAX];
+    uint8_t frameB[FRAME_MAX];
+    rfc1662_Decoder_t a;
+    rfc1662_Decoder_t b;
+    // Small frame buffers, so long frames also exercise overflow.
+    uint32_t frameMax = 1 + rng() % FRAME_MAX;
+
+    rfc1662_decoderInit(&a, frameA, frameMax);
+    rfc1662_decoderInit(&b, frameB, frameMax);
+
+    uint32_t pos = 0;
+    uint32_t call = 0;
+    while (pos < len) {
+        uint32_t n = chunkSize(call++);
+        if (n > len - pos) {
+            n = len - pos;
+        }
+
+        // Each call may return early at the end of a frame.
+        uint32_t off = 0;
+        while (off < n) {
+            uint32_t usedA = rfc1662_decode(&a, stream + pos + off, n - off);
+            uint32_t usedB = rfc1662_decode_scalar(&b, stream + pos + off, n - off);
+
+            check(usedA == usedB, "decode consumed", name, pos + off);
+            check(a.state == b.state, "decode state", name, pos + off);
+            check(a.frameReady == b.frameReady, "decode frameReady", name, pos + off);
+            check(a.frameLen == b.frameLen, "decode frameLen", name, pos + off);
+            check(a.startPos == b.startPos, "decode startPos", name, pos + off);
+            uint32_t stored = (a.frameLen < frameMax) ? a.frameLen : frameMax;
+            check(memcmp(frameA, frameB, stored) == 0, "decode frame", name, pos + off);
+            if (usedA != usedB) {
+                return;
+            }
+
+            if (a.frameReady) {
+                rfc1662_decoderReset(&a);
+                rfc1662_decoderReset(&b);
+            }
+            off += usedA;
+        }
+        pos += n;
+    }
+}
+
+// Unescape frames cut from the stream at random, with output buffers too
+// small as well as large enough
+static void testUnescape(uint32_t len, const char* name) {
+    uint8_t outA[STREAM_LEN];
+    uint8_t outB[STREAM_LEN];
+
+    for (uint32_t k = 0; k < 400; k++) {
+        uint32_t start = rng() % len;
+        uint32_t n = rng() % (len - start + 1);
+        if (k % 4 == 0) {
+            n = (n < 80) ? n : rng() % 80;
+        }
+        uint32_t outMax = (k % 3 == 0) ? rng() % (n + 1) : n;
+
+        memset(outA, 0xAA, sizeof(outA));
+        memset(outB, 0xAA, sizeof(outB));
+        uint32_t lenA = rfc1662_unescape(outA, outMax, stream + start, n);
+        uint32_t lenB = rfc1662_unescape_scalar(outB, outMax, stream + start, n);
+        check(lenA == lenB, "unescape length", name, start);
+        check(memcmp(outA, outB, n) == 0, "unescape data", name, start);
+    }
+}
+
+// Encode pieces of the stream, with output buffers too small as well as
+// large enough
+static void testEncode(uint32_t len, const char* name) {
+    static uint8_t outA[ENCODE_MAX];
+    static uint8_t outB[ENCODE_MAX];
+
+    for (uint32_t k = 0; k < 400; k++) {
+        uint32_t start = rng() % len;
+        uint32_t n = rng() % (len - start + 1);
+        if (k % 4 == 0) {
+            n = (n < 80) ? n : rng() % 80;
+        }
+        uint32_t outMax = 2 * n + 4;
+        if (k % 3 == 0) {
+            outMax = rng() % (outMax + 1);
+        }
+
+        uint32_t lenA = outMax;
+        uint32_t lenB = outMax;
+        memset(outA, 0xAA, sizeof(outA));
+        memset(outB, 0xAA, sizeof(outB));
+        bool overA = rfc1662_encode(outA, &lenA, 0x01, stream + start, n);
+        bool overB = rfc1662_encode_scalar(outB, &lenB, 0x01, stream + start, n);
+        check(overA == overB, "encode overflow", name, start);
+        if (!overA && !overB) {
+            check(lenA == lenB, "encode length", name, start);
+            check(memcmp(outA, outB, lenA) == 0, "encode data", name, start);
+        }
+    }
+}
+
+// Chunk sizes: random, or around the SIMD block sizes
+static uint32_t chunkRandom(uint32_t call) {
+    (void)call;
+    return 1 + rng() % 100;
+}
+static uint32_t chunkOne(uint32_t call) {
+    (void)call;
+    return 1;
+}
+static uint32_t chunk16(uint32_t call) {
+    return 15 + call % 3;
+}
+static uint32_t chunk32(uint32_t call) {
+    return 31 + call % 3;
+}
+static uint32_t chunkLarge(uint32_t call) {
+    (void)call;
+    return STREAM_LEN;
+}
+
+static void testAll(uint32_t len, const char* name) {
+    testFindSpecial(len, name);
+    testDecode(len, name, chunkRandom);
+    testDecode(len, name, chunkOne);
+    testDecode(len, name, chunk16);
+    testDecode(len, name, chunk32);
+    testDecode(len, name, chunkLarge);
+    testUnescape(len, name);
+    testEncode(len, name);
+}
+
+// ------------------------------------------------------------------------
+// Public functions
+
+int main(void) {
+    static const uint32_t densities[] = {0, 2, 5, 20, 100, 1000};
+    char name[64];
+
+    // Random streams, from all specials to almost none
+    for (uint32_t d = 0; d < sizeof(densities) / sizeof(densities[0]); d++) {
+        for (uint32_t r = 0; r < 4; r++) {
+            fillRandom(STREAM_LEN, densities[d]);
+            snprintf(name, sizeof(name), "random 1/%u", densities[d]);
+            testAll(STREAM_LEN, name);
+        }
+    }
+
+    // Only specials: runs of flags, runs of escapes, and both mixed
+    memset(stream, RFC1662_FLAG, STREAM_LEN);
+    testAll(STREAM_LEN, "all flags");
+    memset(stream, RFC1662_ESCAPE, STREAM_LEN);
+    stream[0] = RFC1662_FLAG;
+    testAll(STREAM_LEN, "all escapes");
+    for (uint32_t i = 0; i < STREAM_LEN; i++) {
+        stream[i] = (i % 3 == 0) ? RFC1662_FLAG : RFC1662_ESCAPE;
+    }
+    testAll(STREAM_LEN, "flag escape escape");
+
+    // A flag or escape at, just before and just after each 16 byte boundary
+    // (and so each 32 byte one)
+    for (int offset = -1; offset <= 1; offset++) {
+        fillBoundaries(STREAM_LEN, RFC1662_FLAG, offset);
+        snprintf(name, sizeof(name), "flags at 16n%+d", offset);
+        testAll(STREAM_LEN, name);
+        fillBoundaries(STREAM_LEN, RFC1662_ESCAPE, offset);
+        snprintf(name, sizeof(name), "escapes at 16n%+d", offset);
+        testAll(STREAM_LEN, name);
+    }
+
+    // Well formed frames of every length, with an escape at every offset
+    uint32_t len = fillFrames();
+    testAll(len, "frames");
+
+    printf("rfc1662_test (%s): %u checks, %u failures\n", rfc1662_implName(), checks, failures);
+    return (failures == 0) ? 0 : 1;
+}